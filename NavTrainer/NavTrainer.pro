@@ -1,4 +1,4 @@
-QT       += core gui svg svgwidgets
+QT       += core gui svg svgwidgets concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -9,34 +9,70 @@ CONFIG += c++17
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    annotationcodec.cpp \
+    annotationgeometrystore.cpp \
+    annotationhistory.cpp \
+    annotationpersistence.cpp \
+    annotationrasterlayer.cpp \
+    annotationregistry.cpp \
+    annotationsnapindex.cpp \
+    annotationspatialindex.cpp \
     carta.cpp \
+    chartcatalogpanel.cpp \
+    chartexporter.cpp \
+    chartpyramiditem.cpp \
+    charttilecache.cpp \
+    framestats.cpp \
     help.cpp \
     imageutils.cpp \
+    livestrokeitem.cpp \
     login.cpp \
     main.cpp \
     mainwindow.cpp \
     mapoverlaypanel.cpp \
+    pngstreamwriter.cpp \
     problem.cpp \
     selecpro.cpp \
     stats.cpp \
+    strokeprocessing.cpp \
     toastnotification.cpp \
+    toolrendercache.cpp \
+    toolspatialindex.cpp \
     usermanagement.cpp \
     navlib/navigation.cpp \
     navlib/navigationdao.cpp \
     user.cpp
 
 HEADERS += \
+    annotationcodec.h \
+    annotationgeometrystore.h \
+    annotationhistory.h \
+    annotationpersistence.h \
+    annotationrasterlayer.h \
+    annotationregistry.h \
+    annotationsnapindex.h \
+    annotationspatialindex.h \
     carta.h \
+    chartcatalogpanel.h \
+    chartexporter.h \
+    chartpyramiditem.h \
+    charttilecache.h \
+    framestats.h \
     help.h \
     imageutils.h \
+    livestrokeitem.h \
     login.h \
     mainwindow.h \
     mapoverlaypanel.h \
     maptooltypes.h \
+    pngstreamwriter.h \
     problem.h \
     selecpro.h \
     stats.h \
+    strokeprocessing.h \
     toastnotification.h \
+    toolrendercache.h \
+    toolspatialindex.h \
     usermanagement.h \
     navlib/navigation.h \
     navlib/navigationdao.h \
@@ -72,3 +108,6 @@ INCLUDEPATH += $$PWD/navlib
 
 # Agregar SQL para usar la base de datos de navegación
 QT += sql
+
+# zlib para escribir PNG por bandas (en Windows se usa la copia incluida en Qt)
+unix: LIBS += -lz
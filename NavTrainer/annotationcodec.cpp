@@ -0,0 +1,243 @@
+#include "annotationcodec.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    constexpr quint8 kFormatVersion = 1;
+    constexpr qreal kFixedPointScale = 16.0;
+    constexpr quint8 kCurvedFlag = 0x10;
+    constexpr int kKindCount = AnnotationRegistry::kKindCount;
+
+    void writeVarint(QByteArray &out, quint64 value)
+    {
+        while (value >= 0x80)
+        {
+            out.append(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        out.append(static_cast<char>(value));
+    }
+
+    void writeSigned(QByteArray &out, qint64 value)
+    {
+        writeVarint(out, (static_cast<quint64>(value) << 1) ^ static_cast<quint64>(value >> 63));
+    }
+
+    qint64 toFixed(qreal value)
+    {
+        return static_cast<qint64>(std::llround(value * kFixedPointScale));
+    }
+
+    class Reader
+    {
+    public:
+        explicit Reader(const QByteArray &bytes) : m_bytes(bytes) {}
+
+        bool readByte(quint8 *value)
+        {
+            if (m_position >= m_bytes.size())
+            {
+                return false;
+            }
+            *value = static_cast<quint8>(m_bytes.at(m_position++));
+            return true;
+        }
+
+        bool readVarint(quint64 *value)
+        {
+            quint64 result = 0;
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                quint8 byte = 0;
+                if (!readByte(&byte))
+                {
+                    return false;
+                }
+                result |= static_cast<quint64>(byte & 0x7f) << shift;
+                if (!(byte & 0x80))
+                {
+                    *value = result;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool readSigned(qint64 *value)
+        {
+            quint64 raw = 0;
+            if (!readVarint(&raw))
+            {
+                return false;
+            }
+            *value = static_cast<qint64>(raw >> 1) ^ -static_cast<qint64>(raw & 1);
+            return true;
+        }
+
+        bool readBytes(qsizetype count, QByteArray *value)
+        {
+            if (count < 0 || m_position + count > m_bytes.size())
+            {
+                return false;
+            }
+            *value = m_bytes.mid(m_position, count);
+            m_position += count;
+            return true;
+        }
+
+        qsizetype remaining() const { return m_bytes.size() - m_position; }
+
+    private:
+        const QByteArray &m_bytes;
+        qsizetype m_position = 0;
+    };
+}
+
+QByteArray AnnotationCodec::encode(const AnnotationData &data)
+{
+    QByteArray out;
+    out.reserve(16 + data.points.size() * 2 + data.text.size());
+    out.append(static_cast<char>(kFormatVersion));
+    out.append(static_cast<char>(static_cast<quint8>(data.kind) | (data.curved ? kCurvedFlag : 0)));
+    writeVarint(out, data.color);
+    writeVarint(out, static_cast<quint64>(std::max<qint64>(0, toFixed(data.width))));
+
+    writeVarint(out, static_cast<quint64>(data.points.size()));
+    qint64 previousX = 0;
+    qint64 previousY = 0;
+    for (const QPointF &point : data.points)
+    {
+        const qint64 x = toFixed(point.x());
+        const qint64 y = toFixed(point.y());
+        writeSigned(out, x - previousX);
+        writeSigned(out, y - previousY);
+        previousX = x;
+        previousY = y;
+    }
+
+    const QByteArray text = data.text.toUtf8();
+    writeVarint(out, static_cast<quint64>(text.size()));
+    out.append(text);
+    return out;
+}
+
+bool AnnotationCodec::decode(const QByteArray &bytes, AnnotationData *data)
+{
+    Reader reader(bytes);
+    quint8 version = 0;
+    quint8 header = 0;
+    if (!reader.readByte(&version) || version != kFormatVersion || !reader.readByte(&header))
+    {
+        return false;
+    }
+
+    const int kind = header & 0x0f;
+    if (kind >= kKindCount)
+    {
+        return false;
+    }
+
+    AnnotationData decoded;
+    decoded.kind = static_cast<AnnotationKind>(kind);
+    decoded.curved = header & kCurvedFlag;
+
+    quint64 color = 0;
+    quint64 width = 0;
+    quint64 count = 0;
+    if (!reader.readVarint(&color) || !reader.readVarint(&width) || !reader.readVarint(&count))
+    {
+        return false;
+    }
+    // Every vertex takes at least two bytes, which also bounds the allocation below
+    if (count > static_cast<quint64>(reader.remaining()) / 2)
+    {
+        return false;
+    }
+    decoded.color = static_cast<QRgb>(color);
+    decoded.width = width / kFixedPointScale;
+
+    decoded.points.reserve(static_cast<qsizetype>(count));
+    qint64 x = 0;
+    qint64 y = 0;
+    for (quint64 i = 0; i < count; ++i)
+    {
+        qint64 dx = 0;
+        qint64 dy = 0;
+        if (!reader.readSigned(&dx) || !reader.readSigned(&dy))
+        {
+            return false;
+        }
+        x += dx;
+        y += dy;
+        decoded.points.append(QPointF(x / kFixedPointScale, y / kFixedPointScale));
+    }
+
+    quint64 textLength = 0;
+    QByteArray text;
+    if (!reader.readVarint(&textLength) || !reader.readBytes(static_cast<qsizetype>(textLength), &text))
+    {
+        return false;
+    }
+    decoded.text = QString::fromUtf8(text);
+
+    *data = decoded;
+    return true;
+}
+
+QPainterPath AnnotationCodec::path(const AnnotationData &data)
+{
+    if (data.points.isEmpty())
+    {
+        return QPainterPath();
+    }
+
+    QPainterPath path(data.points.constFirst());
+    if (!data.curved)
+    {
+        if (data.points.size() == 1)
+        {
+            path.lineTo(data.points.constFirst());
+        }
+        for (qsizetype i = 1; i < data.points.size(); ++i)
+        {
+            path.lineTo(data.points.at(i));
+        }
+        return path;
+    }
+
+    for (qsizetype i = 1; i + 2 < data.points.size(); i += 3)
+    {
+        path.cubicTo(data.points.at(i), data.points.at(i + 1), data.points.at(i + 2));
+    }
+    return path;
+}
+
+void AnnotationCodec::setPath(AnnotationData *data, const QPainterPath &path)
+{
+    data->points.clear();
+    data->curved = false;
+    for (int i = 0; i < path.elementCount(); ++i)
+    {
+        if (path.elementAt(i).isCurveTo())
+        {
+            data->curved = true;
+            break;
+        }
+    }
+
+    data->points.reserve(path.elementCount());
+    for (int i = 0; i < path.elementCount(); ++i)
+    {
+        const QPainterPath::Element element = path.elementAt(i);
+        if (i > 0 && data->curved && (element.isLineTo() || element.isMoveTo()))
+        {
+            // Straight piece inside a curved path becomes a flat cubic
+            const QPointF previous = data->points.constLast();
+            data->points.append(previous);
+            data->points.append(QPointF(element.x, element.y));
+        }
+        data->points.append(QPointF(element.x, element.y));
+    }
+}
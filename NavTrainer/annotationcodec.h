@@ -0,0 +1,38 @@
+#ifndef ANNOTATIONCODEC_H
+#define ANNOTATIONCODEC_H
+
+#include "annotationregistry.h"
+
+#include <QByteArray>
+#include <QPainterPath>
+#include <QPolygonF>
+#include <QRgb>
+#include <QString>
+
+// Style and geometry of one annotation, independent of the graphics item that shows it
+struct AnnotationData
+{
+    AnnotationKind kind = AnnotationKind::Stroke;
+    QRgb color = 0;
+    qreal width = 1.0;   // pen width; radius for points, font point size for text
+    bool curved = false; // stroke or arc made of cubic runs: start point, then control, control, end
+    QPolygonF points;    // path vertices, line ends, point center or text position
+    QString text;
+};
+
+// Compact binary form of AnnotationData for the database. Coordinates are
+// fixed point (1/16 scene unit), delta-encoded against the previous vertex
+// and written as zigzag varints, so a typical freehand vertex takes two bytes.
+class AnnotationCodec
+{
+public:
+    static QByteArray encode(const AnnotationData &data);
+    // False (and data untouched) when bytes are truncated or of an unknown version
+    static bool decode(const QByteArray &bytes, AnnotationData *data);
+
+    static QPainterPath path(const AnnotationData &data);
+    // Fills points and curved from a single-subpath QPainterPath
+    static void setPath(AnnotationData *data, const QPainterPath &path);
+};
+
+#endif // ANNOTATIONCODEC_H
@@ -0,0 +1,659 @@
+#include "annotationgeometrystore.h"
+#include "strokeprocessing.h"
+
+#include <QPainter>
+#include <QPainterPathStroker>
+#include <QVarLengthArray>
+#include <QStyleOptionGraphicsItem>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+namespace
+{
+    // Freed coordinates tolerated before the buffer is compacted
+    constexpr qsizetype kCompactionThreshold = 8192;
+    // Paths shorter than this are cheap enough at any zoom
+    constexpr int kMinLodVertices = 16;
+    // Simplification tolerance of the first level, in scene units
+    constexpr qreal kLodBaseTolerance = 2.0;
+}
+
+AnnotationGeometryStore::Handle AnnotationGeometryStore::add(const QPainterPath &path, const QPen &pen)
+{
+    Handle handle;
+    if (!m_freeHandles.isEmpty())
+    {
+        handle = m_freeHandles.takeLast();
+        m_records[handle] = Record();
+    }
+    else
+    {
+        handle = static_cast<Handle>(m_records.size());
+        m_records.append(Record());
+    }
+
+    Record &record = m_records[handle];
+    record.live = true;
+    record.color = pen.color().rgba();
+    record.width = static_cast<float>(pen.widthF());
+    store(record, path);
+    return handle;
+}
+
+void AnnotationGeometryStore::remove(Handle handle)
+{
+    if (handle >= static_cast<Handle>(m_records.size()) || !m_records.at(handle).live)
+    {
+        return;
+    }
+
+    Record &record = m_records[handle];
+    releaseRange(record);
+    record.live = false;
+    m_freeHandles.append(handle);
+
+    if ((m_deadCoordinates > kCompactionThreshold && m_deadCoordinates * 2 > m_coordinates.size())
+        || (m_deadLodIndices > kCompactionThreshold && m_deadLodIndices * 2 > m_lodIndices.size()))
+    {
+        compact();
+    }
+}
+
+void AnnotationGeometryStore::clear()
+{
+    // Assigning empty lists also gives the reserved capacity back
+    m_coordinates = QList<float>();
+    m_lodIndices = QList<quint32>();
+    m_records = QList<Record>();
+    m_freeHandles = QList<Handle>();
+    m_deadCoordinates = 0;
+    m_deadLodIndices = 0;
+}
+
+void AnnotationGeometryStore::setPath(Handle handle, const QPainterPath &path)
+{
+    store(m_records[handle], path);
+}
+
+QPainterPath AnnotationGeometryStore::path(Handle handle) const
+{
+    const Record &record = m_records.at(handle);
+    if (record.count == 0)
+    {
+        return QPainterPath();
+    }
+
+    QPainterPath path(vertex(record, 0));
+    if (record.segments == Segments::Polyline)
+    {
+        if (record.count == 1)
+        {
+            // A click without movement still leaves a dot
+            path.lineTo(vertex(record, 0));
+        }
+        for (quint32 i = 1; i < record.count; ++i)
+        {
+            path.lineTo(vertex(record, i));
+        }
+        return path;
+    }
+
+    for (quint32 i = 1; i + 2 < record.count; i += 3)
+    {
+        path.cubicTo(vertex(record, i), vertex(record, i + 1), vertex(record, i + 2));
+    }
+    return path;
+}
+
+QPen AnnotationGeometryStore::pen(Handle handle) const
+{
+    const Record &record = m_records.at(handle);
+    QPen pen(QColor::fromRgba(record.color));
+    pen.setWidthF(record.width);
+    pen.setCapStyle(Qt::RoundCap);
+    pen.setJoinStyle(Qt::RoundJoin);
+    return pen;
+}
+
+void AnnotationGeometryStore::setPen(Handle handle, const QPen &pen)
+{
+    Record &record = m_records[handle];
+    record.color = pen.color().rgba();
+    record.width = static_cast<float>(pen.widthF());
+}
+
+QRectF AnnotationGeometryStore::bounds(Handle handle) const
+{
+    const Record &record = m_records.at(handle);
+    return QRectF(QPointF(record.left, record.top), QPointF(record.right, record.bottom));
+}
+
+qreal AnnotationGeometryStore::penWidth(Handle handle) const
+{
+    return m_records.at(handle).width;
+}
+
+int AnnotationGeometryStore::vertexCount(Handle handle) const
+{
+    return static_cast<int>(m_records.at(handle).count);
+}
+
+void AnnotationGeometryStore::draw(Handle handle, QPainter *painter, qreal levelOfDetail) const
+{
+    const Record &record = m_records.at(handle);
+    if (record.count == 0)
+    {
+        return;
+    }
+
+    if (levelOfDetail > 0.0)
+    {
+        const qreal pixel = 1.0 / levelOfDetail;
+        // Whole path inside one device pixel: the pen cap is all that shows
+        if (record.right - record.left < pixel && record.bottom - record.top < pixel)
+        {
+            painter->drawPoint(QPointF((record.left + record.right) / 2.0, (record.top + record.bottom) / 2.0));
+            return;
+        }
+
+        // Coarsest level whose error stays under half a device pixel. Polyline levels are
+        // counted in m_lodIndices, curve levels in vertices after the full geometry
+        const bool indexed = record.segments == Segments::Polyline;
+        int first = -1;
+        int count = 0;
+        int offset = indexed ? 0 : static_cast<int>(record.count);
+        for (int level = 0; level < kLodLevels; ++level)
+        {
+            if (record.lodCount[level] > 0 && lodTolerance(level) <= pixel / 2.0)
+            {
+                first = offset;
+                count = static_cast<int>(record.lodCount[level]);
+            }
+            offset += static_cast<int>(record.lodCount[level]);
+        }
+        if (first >= 0)
+        {
+            QVarLengthArray<QPointF, 256> points(count);
+            for (int i = 0; i < count; ++i)
+            {
+                points[i] = vertex(record, indexed ? static_cast<int>(m_lodIndices.at(record.lodFirst + first + i)) : first + i);
+            }
+            painter->drawPolyline(points.constData(), count);
+            return;
+        }
+    }
+
+    if (record.segments == Segments::Bezier)
+    {
+        painter->drawPath(path(handle));
+        return;
+    }
+
+    if (record.count == 1)
+    {
+        painter->drawPoint(vertex(record, 0));
+        return;
+    }
+
+    // Widened to doubles only for the duration of the call
+    QVarLengthArray<QPointF, 256> points(record.count);
+    for (quint32 i = 0; i < record.count; ++i)
+    {
+        points[i] = vertex(record, i);
+    }
+    painter->drawPolyline(points.constData(), static_cast<int>(points.size()));
+}
+
+qint64 AnnotationGeometryStore::storedBytes(Handle handle) const
+{
+    const Record &record = m_records.at(handle);
+    return static_cast<qint64>(record.stored) * 2 * sizeof(float) + static_cast<qint64>(lodIndexCount(record)) * sizeof(quint32);
+}
+
+bool AnnotationGeometryStore::isPolyline(Handle handle) const
+{
+    return m_records.at(handle).segments == Segments::Polyline;
+}
+
+qreal AnnotationGeometryStore::squaredDistanceToPolyline(Handle handle, const QPointF &point) const
+{
+    const Record &record = m_records.at(handle);
+    if (record.count == 0)
+    {
+        return std::numeric_limits<qreal>::max();
+    }
+
+    QPointF previous = vertex(record, 0);
+    qreal nearest = StrokeProcessing::squaredDistanceToSegment(point, previous, previous);
+    for (quint32 i = 1; i < record.count; ++i)
+    {
+        const QPointF current = vertex(record, i);
+        nearest = std::min(nearest, StrokeProcessing::squaredDistanceToSegment(point, previous, current));
+        previous = current;
+    }
+    return nearest;
+}
+
+int AnnotationGeometryStore::segmentCount(Handle handle) const
+{
+    const Record &record = m_records.at(handle);
+    if (record.count == 0)
+    {
+        return 0;
+    }
+    if (record.segments == Segments::Bezier)
+    {
+        return static_cast<int>(record.count - 1) / 3;
+    }
+    return std::max(1, static_cast<int>(record.count) - 1);
+}
+
+QRectF AnnotationGeometryStore::segmentBounds(Handle handle, int segment) const
+{
+    const Record &record = m_records.at(handle);
+    const int stride = record.segments == Segments::Bezier ? 3 : 1;
+    const int first = segment * stride;
+    const int last = std::min(first + stride, static_cast<int>(record.count) - 1);
+
+    QPointF point = vertex(record, first);
+    qreal left = point.x();
+    qreal right = point.x();
+    qreal top = point.y();
+    qreal bottom = point.y();
+    for (int i = first + 1; i <= last; ++i)
+    {
+        point = vertex(record, i);
+        left = std::min(left, point.x());
+        right = std::max(right, point.x());
+        top = std::min(top, point.y());
+        bottom = std::max(bottom, point.y());
+    }
+    return QRectF(QPointF(left, top), QPointF(right, bottom));
+}
+
+QPointF AnnotationGeometryStore::segmentStart(Handle handle, int segment) const
+{
+    const Record &record = m_records.at(handle);
+    const int stride = record.segments == Segments::Bezier ? 3 : 1;
+    return vertex(record, std::min(segment * stride, static_cast<int>(record.count) - 1));
+}
+
+qreal AnnotationGeometryStore::squaredDistanceToSegment(Handle handle, int segment, const QPointF &start, const QPointF &end) const
+{
+    const Record &record = m_records.at(handle);
+    if (record.segments == Segments::Polyline)
+    {
+        const int last = static_cast<int>(record.count) - 1;
+        return StrokeProcessing::squaredDistanceBetweenSegments(vertex(record, std::min(segment, last)),
+                                                                vertex(record, std::min(segment + 1, last)),
+                                                                start, end);
+    }
+
+    // Flattened on the fly; only candidates from the spatial index get here
+    constexpr int kCubicSteps = 8;
+    const QPointF p0 = vertex(record, segment * 3);
+    const QPointF p1 = vertex(record, segment * 3 + 1);
+    const QPointF p2 = vertex(record, segment * 3 + 2);
+    const QPointF p3 = vertex(record, segment * 3 + 3);
+    QPointF previous = p0;
+    qreal nearest = std::numeric_limits<qreal>::max();
+    for (int step = 1; step <= kCubicSteps; ++step)
+    {
+        const qreal t = static_cast<qreal>(step) / kCubicSteps;
+        const qreal u = 1.0 - t;
+        const QPointF current = p0 * (u * u * u) + p1 * (3.0 * u * u * t) + p2 * (3.0 * u * t * t) + p3 * (t * t * t);
+        nearest = std::min(nearest, StrokeProcessing::squaredDistanceBetweenSegments(previous, current, start, end));
+        previous = current;
+    }
+    return nearest;
+}
+
+qint64 AnnotationGeometryStore::memoryUsage() const
+{
+    return static_cast<qint64>(m_coordinates.capacity()) * sizeof(float)
+         + static_cast<qint64>(m_lodIndices.capacity()) * sizeof(quint32)
+         + static_cast<qint64>(m_records.capacity()) * sizeof(Record)
+         + static_cast<qint64>(m_freeHandles.capacity()) * sizeof(Handle);
+}
+
+void AnnotationGeometryStore::store(Record &record, const QPainterPath &path)
+{
+    // Flatten the element list into x/y pairs first, so the record ranges can be reused in place
+    const qsizetype indicesAvailable = lodIndexCount(record);
+    QVarLengthArray<float, 512> coordinates;
+    bool curved = false;
+    for (int i = 0; i < path.elementCount(); ++i)
+    {
+        if (path.elementAt(i).isCurveTo())
+        {
+            curved = true;
+            break;
+        }
+    }
+
+    auto push = [&coordinates](qreal x, qreal y)
+    {
+        coordinates.append(static_cast<float>(x));
+        coordinates.append(static_cast<float>(y));
+    };
+
+    for (int i = 0; i < path.elementCount(); ++i)
+    {
+        const QPainterPath::Element element = path.elementAt(i);
+        if (i == 0 || !curved)
+        {
+            push(element.x, element.y);
+            continue;
+        }
+
+        if (element.isCurveTo() && i + 2 < path.elementCount())
+        {
+            const QPainterPath::Element control = path.elementAt(i + 1);
+            const QPainterPath::Element end = path.elementAt(i + 2);
+            push(element.x, element.y);
+            push(control.x, control.y);
+            push(end.x, end.y);
+            i += 2;
+            continue;
+        }
+
+        // Straight piece of a curved path (or a further subpath): a flat cubic keeps the layout uniform
+        const float previousX = coordinates.at(coordinates.size() - 2);
+        const float previousY = coordinates.at(coordinates.size() - 1);
+        push(previousX, previousY);
+        push(element.x, element.y);
+        push(element.x, element.y);
+    }
+
+    const qsizetype fullSize = coordinates.size();
+    const int vertexCount = static_cast<int>(fullSize / 2);
+
+    // Simplified levels are polylines, each derived from the previous one. Curves are flattened
+    // first: simplifying only the on-curve vertices would leave the bulge of each cubic out of
+    // the error bound
+    QVarLengthArray<quint32, 256> lodIndices;
+    record.lodCount.fill(0);
+    if (vertexCount >= kMinLodVertices)
+    {
+        QPolygonF outline;
+        // Index in the full geometry of each outline vertex; polylines only
+        QList<quint32> outlineIndices;
+        if (curved)
+        {
+            // Subpaths are joined the same way the full geometry joins them
+            const QList<QPolygonF> subpaths = path.toSubpathPolygons();
+            for (const QPolygonF &subpath : subpaths)
+            {
+                outline += subpath;
+            }
+        }
+        else
+        {
+            outline.reserve(vertexCount);
+            outlineIndices.reserve(vertexCount);
+            for (int i = 0; i < vertexCount; ++i)
+            {
+                outline.append(QPointF(coordinates.at(i * 2), coordinates.at(i * 2 + 1)));
+                outlineIndices.append(static_cast<quint32>(i));
+            }
+        }
+
+        qsizetype previousSize = vertexCount;
+        for (int level = 0; level < kLodLevels; ++level)
+        {
+            const QList<int> kept = StrokeProcessing::simplifiedIndices(outline, lodTolerance(level));
+            // A level that keeps most vertices is not worth the memory
+            if (kept.size() * 4 > previousSize * 3)
+            {
+                continue;
+            }
+            QPolygonF simplified;
+            QList<quint32> simplifiedIndices;
+            simplified.reserve(kept.size());
+            for (int index : kept)
+            {
+                const QPointF point = outline.at(index);
+                simplified.append(point);
+                if (curved)
+                {
+                    push(point.x(), point.y());
+                }
+                else
+                {
+                    simplifiedIndices.append(outlineIndices.at(index));
+                    lodIndices.append(outlineIndices.at(index));
+                }
+            }
+            record.lodCount[level] = static_cast<quint32>(kept.size());
+            previousSize = kept.size();
+            outline = std::move(simplified);
+            outlineIndices = std::move(simplifiedIndices);
+        }
+    }
+
+    // Level indices go to their own buffer, reusing the record's range when they fit
+    if (lodIndices.size() <= indicesAvailable && indicesAvailable > 0)
+    {
+        m_deadLodIndices += indicesAvailable - lodIndices.size();
+    }
+    else
+    {
+        m_deadLodIndices += indicesAvailable;
+        record.lodFirst = static_cast<quint32>(m_lodIndices.size());
+        m_lodIndices.resize(m_lodIndices.size() + lodIndices.size());
+    }
+    std::copy(lodIndices.cbegin(), lodIndices.cend(), m_lodIndices.begin() + record.lodFirst);
+
+    const qsizetype needed = coordinates.size();
+    const qsizetype available = static_cast<qsizetype>(record.stored) * 2;
+    if (needed <= available && record.stored > 0)
+    {
+        m_deadCoordinates += available - needed;
+    }
+    else
+    {
+        m_deadCoordinates += available;
+        record.first = static_cast<quint32>(m_coordinates.size());
+        m_coordinates.resize(m_coordinates.size() + needed);
+    }
+    std::copy(coordinates.cbegin(), coordinates.cend(), m_coordinates.begin() + record.first);
+    record.count = static_cast<quint32>(vertexCount);
+    record.stored = static_cast<quint32>(needed / 2);
+    record.segments = curved ? Segments::Bezier : Segments::Polyline;
+
+    // Control points included: a Bezier never leaves the hull of its control polygon
+    record.left = record.top = std::numeric_limits<float>::max();
+    record.right = record.bottom = std::numeric_limits<float>::lowest();
+    for (qsizetype i = 0; i < fullSize; i += 2)
+    {
+        record.left = std::min(record.left, coordinates.at(i));
+        record.right = std::max(record.right, coordinates.at(i));
+        record.top = std::min(record.top, coordinates.at(i + 1));
+        record.bottom = std::max(record.bottom, coordinates.at(i + 1));
+    }
+    if (fullSize == 0)
+    {
+        record.left = record.top = record.right = record.bottom = 0.0f;
+    }
+}
+
+qreal AnnotationGeometryStore::lodTolerance(int level)
+{
+    return kLodBaseTolerance * std::pow(4.0, level);
+}
+
+quint32 AnnotationGeometryStore::lodIndexCount(const Record &record)
+{
+    if (record.segments != Segments::Polyline)
+    {
+        return 0;
+    }
+    quint32 count = 0;
+    for (quint32 levelCount : record.lodCount)
+    {
+        count += levelCount;
+    }
+    return count;
+}
+
+QPointF AnnotationGeometryStore::vertex(const Record &record, int index) const
+{
+    const qsizetype offset = record.first + static_cast<qsizetype>(index) * 2;
+    return QPointF(m_coordinates.at(offset), m_coordinates.at(offset + 1));
+}
+
+void AnnotationGeometryStore::releaseRange(Record &record)
+{
+    m_deadCoordinates += static_cast<qsizetype>(record.stored) * 2;
+    m_deadLodIndices += lodIndexCount(record);
+    record.count = 0;
+    record.stored = 0;
+    record.lodCount.fill(0);
+}
+
+void AnnotationGeometryStore::compact()
+{
+    // Records keep their handles; only their ranges move
+    QList<float> compacted;
+    QList<quint32> compactedIndices;
+    compacted.reserve(m_coordinates.size() - m_deadCoordinates);
+    compactedIndices.reserve(m_lodIndices.size() - m_deadLodIndices);
+    for (Record &record : m_records)
+    {
+        if (!record.live || record.stored == 0)
+        {
+            continue;
+        }
+        const qsizetype first = record.first;
+        record.first = static_cast<quint32>(compacted.size());
+        compacted.append(m_coordinates.mid(first, static_cast<qsizetype>(record.stored) * 2));
+
+        const qsizetype lodFirst = record.lodFirst;
+        record.lodFirst = static_cast<quint32>(compactedIndices.size());
+        compactedIndices.append(m_lodIndices.mid(lodFirst, lodIndexCount(record)));
+    }
+    m_coordinates = std::move(compacted);
+    m_lodIndices = std::move(compactedIndices);
+    m_deadCoordinates = 0;
+    m_deadLodIndices = 0;
+}
+
+CompactPathItem::CompactPathItem(AnnotationGeometryStore *store, const QPainterPath &path, const QPen &pen, QGraphicsItem *parent)
+    : QGraphicsItem(parent),
+      m_store(store)
+{
+    m_handle = m_store->add(path, pen);
+}
+
+CompactPathItem::~CompactPathItem()
+{
+    m_store->remove(m_handle);
+}
+
+QPen CompactPathItem::pen() const
+{
+    return m_store->pen(m_handle);
+}
+
+void CompactPathItem::setPen(const QPen &pen)
+{
+    if (pen.widthF() != m_store->penWidth(m_handle))
+    {
+        prepareGeometryChange();
+    }
+    m_store->setPen(m_handle, pen);
+    update();
+}
+
+qreal CompactPathItem::penWidth() const
+{
+    return m_store->penWidth(m_handle);
+}
+
+QPainterPath CompactPathItem::path() const
+{
+    return m_store->path(m_handle);
+}
+
+void CompactPathItem::setPath(const QPainterPath &path)
+{
+    prepareGeometryChange();
+    m_store->setPath(m_handle, path);
+    update();
+}
+
+int CompactPathItem::vertexCount() const
+{
+    return m_store->vertexCount(m_handle);
+}
+
+qint64 CompactPathItem::storedBytes() const
+{
+    return m_store->storedBytes(m_handle);
+}
+
+bool CompactPathItem::isPolyline() const
+{
+    return m_store->isPolyline(m_handle);
+}
+
+int CompactPathItem::segmentCount() const
+{
+    return m_store->segmentCount(m_handle);
+}
+
+QRectF CompactPathItem::segmentBounds(int segment) const
+{
+    return m_store->segmentBounds(m_handle, segment);
+}
+
+QPointF CompactPathItem::segmentStart(int segment) const
+{
+    return m_store->segmentStart(m_handle, segment);
+}
+
+qreal CompactPathItem::squaredDistanceToSegment(int segment, const QPointF &start, const QPointF &end) const
+{
+    return m_store->squaredDistanceToSegment(m_handle, segment, start, end);
+}
+
+QRectF CompactPathItem::boundingRect() const
+{
+    const qreal margin = m_store->penWidth(m_handle) / 2.0 + 1.0;
+    return m_store->bounds(m_handle).adjusted(-margin, -margin, margin, margin);
+}
+
+QPainterPath CompactPathItem::shape() const
+{
+    // Built on demand instead of being cached per item
+    QPainterPathStroker stroker(pen());
+    return stroker.createStroke(path());
+}
+
+bool CompactPathItem::contains(const QPointF &point) const
+{
+    if (!boundingRect().contains(point))
+    {
+        return false;
+    }
+
+    if (m_store->isPolyline(m_handle))
+    {
+        const qreal radius = m_store->penWidth(m_handle) / 2.0;
+        return m_store->squaredDistanceToPolyline(m_handle, point) <= radius * radius;
+    }
+    return shape().contains(point);
+}
+
+void CompactPathItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    Q_UNUSED(option);
+    Q_UNUSED(widget);
+
+    painter->setPen(pen());
+    painter->setBrush(Qt::NoBrush);
+    // Taken from the painter so tiles baked by the raster layer get the detail of their own scale
+    m_store->draw(m_handle, painter, QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform()));
+}
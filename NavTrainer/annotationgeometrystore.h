@@ -0,0 +1,152 @@
+#ifndef ANNOTATIONGEOMETRYSTORE_H
+#define ANNOTATIONGEOMETRYSTORE_H
+
+#include <QGraphicsItem>
+#include <QList>
+#include <QPainterPath>
+#include <QPen>
+#include <QRectF>
+#include <QRgb>
+#include <array>
+
+// Packed geometry of the stroke and arc annotations of a chart. Vertices of
+// every path live as float32 x/y pairs in one contiguous buffer, and each path
+// has a fixed-size style record (range, bounds, color, width) in another, so a
+// vertex costs 8 bytes instead of a 24-byte QPainterPath element. Freed
+// ranges are reclaimed by compacting the buffers once they make up half of
+// them.
+//
+// Paths are single subpaths made of either straight segments or cubic
+// Beziers; line segments inside a curved path are stored as flat cubics.
+// Longer paths also keep a few simplified polylines, so zoomed-out paints
+// draw about one vertex per device pixel. A simplified polyline keeps a
+// subset of its vertices, so its levels are 32-bit indices into the full
+// geometry in a third buffer; for hand-drawn strokes they hold about three
+// quarters as many entries as the stroke has vertices, some 3 bytes per
+// drawn vertex. Curves are simplified from their flattened outline, whose
+// points are not stored, so their levels follow the full geometry as
+// vertices.
+class AnnotationGeometryStore
+{
+public:
+    using Handle = quint32;
+    static constexpr Handle kInvalidHandle = 0xffffffffu;
+    // Simplified versions per path, each with four times the tolerance of the previous one
+    static constexpr int kLodLevels = 3;
+
+    Handle add(const QPainterPath &path, const QPen &pen);
+    void remove(Handle handle);
+    void clear();
+
+    void setPath(Handle handle, const QPainterPath &path);
+    QPainterPath path(Handle handle) const;
+    QPen pen(Handle handle) const;
+    void setPen(Handle handle, const QPen &pen);
+    // Geometry bounds, without the pen
+    QRectF bounds(Handle handle) const;
+    qreal penWidth(Handle handle) const;
+    int vertexCount(Handle handle) const;
+    // Bytes the path holds in the buffers: full geometry and simplified levels
+    qint64 storedBytes(Handle handle) const;
+
+    // levelOfDetail is device pixels per scene unit (QStyleOptionGraphicsItem::levelOfDetailFromTransform)
+    void draw(Handle handle, QPainter *painter, qreal levelOfDetail) const;
+    bool isPolyline(Handle handle) const;
+    // Squared distance from point to the nearest segment of a straight-segment path
+    qreal squaredDistanceToPolyline(Handle handle, const QPointF &point) const;
+    // Straight segments of a polyline (one for a single-vertex dot) or cubic pieces of a curve
+    int segmentCount(Handle handle) const;
+    // Geometry bounds of one segment; the control hull for a cubic piece
+    QRectF segmentBounds(Handle handle, int segment) const;
+    // First vertex of one segment, which lies on the path
+    QPointF segmentStart(Handle handle, int segment) const;
+    // Squared distance between one segment of the path and the segment start-end
+    qreal squaredDistanceToSegment(Handle handle, int segment, const QPointF &start, const QPointF &end) const;
+
+    int pathCount() const { return m_records.size() - m_freeHandles.size(); }
+    int totalVertexCount() const { return (m_coordinates.size() - m_deadCoordinates) / 2; }
+    int totalLodIndexCount() const { return m_lodIndices.size() - m_deadLodIndices; }
+    // Bytes reserved by the three buffers
+    qint64 memoryUsage() const;
+
+private:
+    enum class Segments : quint8
+    {
+        Polyline,
+        Bezier
+    };
+
+    struct Record
+    {
+        quint32 first = 0; // index of the first x in m_coordinates
+        quint32 count = 0;  // vertices of the full path, including Bezier control points
+        quint32 stored = 0; // count, plus the vertices of every simplified level of a curve
+        quint32 lodFirst = 0; // index of the first level index in m_lodIndices, for polylines
+        std::array<quint32, kLodLevels> lodCount = {}; // 0 when a level would not save enough
+        float left = 0.0f;
+        float top = 0.0f;
+        float right = 0.0f;
+        float bottom = 0.0f;
+        QRgb color = 0;
+        float width = 1.0f;
+        Segments segments = Segments::Polyline;
+        bool live = false;
+    };
+
+    void store(Record &record, const QPainterPath &path);
+    static qreal lodTolerance(int level);
+    // Entries the record holds in m_lodIndices
+    static quint32 lodIndexCount(const Record &record);
+    QPointF vertex(const Record &record, int index) const;
+    void releaseRange(Record &record);
+    void compact();
+
+    QList<float> m_coordinates;
+    QList<quint32> m_lodIndices; // simplified levels of polylines, as vertex indices
+    QList<Record> m_records; // indexed by handle
+    QList<Handle> m_freeHandles;
+    qsizetype m_deadCoordinates = 0;
+    qsizetype m_deadLodIndices = 0;
+};
+
+// Scene item for a stroke or arc whose geometry lives in an
+// AnnotationGeometryStore. It caches nothing: bounds come from the style
+// record and the shape is only built when Qt asks for it.
+class CompactPathItem : public QGraphicsItem
+{
+public:
+    enum
+    {
+        Type = UserType + 13
+    };
+
+    CompactPathItem(AnnotationGeometryStore *store, const QPainterPath &path, const QPen &pen, QGraphicsItem *parent = nullptr);
+    ~CompactPathItem() override;
+
+    int type() const override { return Type; }
+
+    QPen pen() const;
+    void setPen(const QPen &pen);
+    qreal penWidth() const;
+    QPainterPath path() const;
+    void setPath(const QPainterPath &path);
+    int vertexCount() const;
+    qint64 storedBytes() const;
+    // Segment queries in item coordinates, see AnnotationGeometryStore
+    bool isPolyline() const;
+    int segmentCount() const;
+    QRectF segmentBounds(int segment) const;
+    QPointF segmentStart(int segment) const;
+    qreal squaredDistanceToSegment(int segment, const QPointF &start, const QPointF &end) const;
+
+    QRectF boundingRect() const override;
+    QPainterPath shape() const override;
+    bool contains(const QPointF &point) const override;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override;
+
+private:
+    AnnotationGeometryStore *m_store = nullptr;
+    AnnotationGeometryStore::Handle m_handle = AnnotationGeometryStore::kInvalidHandle;
+};
+
+#endif // ANNOTATIONGEOMETRYSTORE_H
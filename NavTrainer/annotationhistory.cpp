@@ -0,0 +1,220 @@
+#include "annotationhistory.h"
+#include "annotationgeometrystore.h"
+
+#include <QGraphicsItem>
+#include <algorithm>
+#include <utility>
+
+namespace
+{
+    // Rough footprint of a parked Qt item with its style, besides any packed geometry
+    constexpr qint64 kParkedItemBytes = 256;
+}
+
+AnnotationHistory::~AnnotationHistory()
+{
+    clear();
+}
+
+void AnnotationHistory::push(Command command)
+{
+    if (command.items.isEmpty())
+    {
+        return;
+    }
+
+    discardRedo();
+
+    if (command.mergeId != 0 && !m_undo.isEmpty())
+    {
+        Entry &last = m_undo.last();
+        if (last.command.mergeId == command.mergeId)
+        {
+            // Costed before merging, which may delete eraser pieces; incremental so a long drag stays linear
+            const qint64 extra = cost(command) - qint64(sizeof(Entry));
+            if (merge(last.command, command))
+            {
+                last.cost += extra;
+                m_undoBytes += extra;
+                trim();
+                return;
+            }
+        }
+    }
+
+    Entry entry;
+    entry.cost = cost(command);
+    entry.command = std::move(command);
+    m_undoBytes += entry.cost;
+    m_undo.append(std::move(entry));
+    trim();
+}
+
+const AnnotationHistory::Command *AnnotationHistory::undo()
+{
+    if (m_undo.isEmpty())
+    {
+        return nullptr;
+    }
+
+    Entry entry = m_undo.takeLast();
+    m_undoBytes -= entry.cost;
+    m_redo.append(std::move(entry));
+    return &m_redo.constLast().command;
+}
+
+const AnnotationHistory::Command *AnnotationHistory::redo()
+{
+    if (m_redo.isEmpty())
+    {
+        return nullptr;
+    }
+
+    Entry entry = m_redo.takeLast();
+    // Parked items swap sides on redo, so the cost is not the one it had before undo
+    entry.cost = cost(entry.command);
+    m_undoBytes += entry.cost;
+    m_undo.append(std::move(entry));
+    trim();
+    return &m_undo.constLast().command;
+}
+
+void AnnotationHistory::clear()
+{
+    discardRedo();
+    for (const Entry &entry : std::as_const(m_undo))
+    {
+        if (entry.command.type == CommandType::Remove)
+        {
+            deleteItems(entry.command.items);
+        }
+    }
+    m_undo.clear();
+    m_undoBytes = 0;
+}
+
+void AnnotationHistory::setBudget(qint64 bytes)
+{
+    m_budget = std::max<qint64>(0, bytes);
+    trim();
+}
+
+bool AnnotationHistory::merge(Command &target, const Command &next)
+{
+    if (target.type != next.type)
+    {
+        return false;
+    }
+
+    switch (target.type)
+    {
+    case CommandType::Add:
+        target.items += next.items;
+        target.kinds += next.kinds;
+        return true;
+    case CommandType::Remove:
+        mergeRemoval(target, next);
+        return true;
+    case CommandType::Restyle:
+        if (target.items != next.items)
+        {
+            return false;
+        }
+        target.newStyles = next.newStyles;
+        return true;
+    case CommandType::Move:
+        if (target.items != next.items)
+        {
+            return false;
+        }
+        target.offset += next.offset;
+        return true;
+    }
+    return false;
+}
+
+void AnnotationHistory::mergeRemoval(Command &target, const Command &next)
+{
+    for (qsizetype i = 0; i < next.items.size(); ++i)
+    {
+        QGraphicsItem *item = next.items.at(i);
+        const qsizetype added = target.added.indexOf(item);
+        if (added < 0)
+        {
+            target.items.append(item);
+            target.kinds.append(next.kinds.at(i));
+            continue;
+        }
+
+        // A piece created and erased within the same step never existed outside it
+        target.added.removeAt(added);
+        target.addedKinds.removeAt(added);
+        delete item;
+    }
+    target.added += next.added;
+    target.addedKinds += next.addedKinds;
+}
+
+qint64 AnnotationHistory::cost(const Command &command)
+{
+    qint64 bytes = sizeof(Entry)
+                   + (command.items.size() + command.added.size()) * qint64(sizeof(QGraphicsItem *) + sizeof(AnnotationKind))
+                   + (command.oldStyles.size() + command.newStyles.size()) * qint64(sizeof(Style));
+    // On the undo side only removed items are parked; added ones are still on the chart
+    if (command.type == CommandType::Remove)
+    {
+        for (const QGraphicsItem *item : command.items)
+        {
+            bytes += itemCost(item);
+        }
+    }
+    return bytes;
+}
+
+qint64 AnnotationHistory::itemCost(const QGraphicsItem *item)
+{
+    if (const auto *pathItem = qgraphicsitem_cast<const CompactPathItem *>(item))
+    {
+        // What the store really holds for it, simplified levels included
+        return kParkedItemBytes + pathItem->storedBytes();
+    }
+    return kParkedItemBytes;
+}
+
+void AnnotationHistory::deleteItems(const QList<QGraphicsItem *> &items)
+{
+    for (QGraphicsItem *item : items)
+    {
+        delete item;
+    }
+}
+
+void AnnotationHistory::discardRedo()
+{
+    // On the redo side the parked items are the undone additions, including eraser pieces
+    for (const Entry &entry : std::as_const(m_redo))
+    {
+        if (entry.command.type == CommandType::Add)
+        {
+            deleteItems(entry.command.items);
+        }
+        else if (entry.command.type == CommandType::Remove)
+        {
+            deleteItems(entry.command.added);
+        }
+    }
+    m_redo.clear();
+}
+
+void AnnotationHistory::trim()
+{
+    while (m_undoBytes > m_budget && m_undo.size() > 1)
+    {
+        const Entry entry = m_undo.takeFirst();
+        m_undoBytes -= entry.cost;
+        if (entry.command.type == CommandType::Remove)
+        {
+            deleteItems(entry.command.items);
+        }
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef ANNOTATIONHISTORY_H
+#define ANNOTATIONHISTORY_H
+
+#include "annotationregistry.h"
+
+#include <QColor>
+#include <QList>
+#include <QPointF>
+
+class QGraphicsItem;
+
+// Undo/redo history of annotation edits. Commands only reference items: an
+// item that an edit takes off the chart is parked here, out of the scene
+// but alive, so undoing an erase or redoing an add puts the same item back
+// without rebuilding it. Parked items belong to the history, which deletes
+// them when their command can no longer be undone or redone.
+//
+// The undo side is bounded by a memory budget (parked geometry included);
+// the oldest commands are dropped first, but the latest one is always kept.
+class AnnotationHistory
+{
+public:
+    static constexpr qint64 kDefaultBudget = 8ll * 1024 * 1024;
+
+    enum class CommandType
+    {
+        Add,
+        Remove,
+        Restyle,
+        Move
+    };
+
+    // Color and size of one annotation: pen width of strokes, arcs and lines, radius of
+    // points, point size of texts
+    struct Style
+    {
+        QColor color;
+        qreal width = 0.0;
+    };
+
+    struct Command
+    {
+        CommandType type = CommandType::Add;
+        QList<QGraphicsItem *> items;
+        QList<AnnotationKind> kinds;  // Add and Remove, to register the items again
+        // Remove: pieces left on the chart in place of the removed items, e.g. by splitting eraser
+        QList<QGraphicsItem *> added;
+        QList<AnnotationKind> addedKinds;
+        QList<Style> oldStyles;       // Restyle
+        QList<Style> newStyles;       // Restyle
+        QPointF offset;               // Move
+        // Consecutive commands of the same type and non-zero id become one, e.g. a whole eraser drag
+        quint64 mergeId = 0;
+    };
+
+    AnnotationHistory() = default;
+    ~AnnotationHistory();
+    AnnotationHistory(const AnnotationHistory &) = delete;
+    AnnotationHistory &operator=(const AnnotationHistory &) = delete;
+
+    // Records an edit that was already applied and discards everything that could be redone
+    void push(Command command);
+    // Moves the latest command to the redo side and returns it for reverting; nullptr when empty
+    const Command *undo();
+    // Moves the next redoable command back to the undo side and returns it for reapplying
+    const Command *redo();
+    // Forgets every command and deletes the parked items
+    void clear();
+
+    bool canUndo() const { return !m_undo.isEmpty(); }
+    bool canRedo() const { return !m_redo.isEmpty(); }
+    int undoCount() const { return m_undo.size(); }
+    int redoCount() const { return m_redo.size(); }
+
+    void setBudget(qint64 bytes);
+    qint64 budget() const { return m_budget; }
+    // Estimated bytes held by the undo side
+    qint64 memoryUsage() const { return m_undoBytes; }
+
+private:
+    struct Entry
+    {
+        Command command;
+        qint64 cost = 0;
+    };
+
+    static bool merge(Command &target, const Command &next);
+    static void mergeRemoval(Command &target, const Command &next);
+    static qint64 cost(const Command &command);
+    static qint64 itemCost(const QGraphicsItem *item);
+    static void deleteItems(const QList<QGraphicsItem *> &items);
+    void discardRedo();
+    void trim();
+
+    QList<Entry> m_undo; // oldest first
+    QList<Entry> m_redo; // next to redo last
+    qint64 m_undoBytes = 0;
+    qint64 m_budget = kDefaultBudget;
+};
+
+#endif // ANNOTATIONHISTORY_H
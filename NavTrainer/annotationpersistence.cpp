@@ -0,0 +1,293 @@
+#include "annotationpersistence.h"
+#include "annotationcodec.h"
+#include "carta.h"
+#include "navlib/navdaoexception.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QFutureWatcher>
+#include <QTimer>
+#include <QtConcurrent/QtConcurrentRun>
+#include <algorithm>
+
+namespace
+{
+    // Pausa sin cambios antes de escribir el lote pendiente
+    constexpr int kFlushDelayMs = 1500;
+}
+
+struct AnnotationPersistence::LoadedAnnotation
+{
+    qint64 seq = 0;
+    AnnotationData data;
+};
+
+AnnotationPersistence::AnnotationPersistence(Carta *carta, NavigationDAO *dao, QObject *parent)
+    : QObject(parent),
+      m_carta(carta),
+      m_dao(dao)
+{
+    m_flushTimer = new QTimer(this);
+    m_flushTimer->setSingleShot(true);
+    m_flushTimer->setInterval(kFlushDelayMs);
+    connect(m_flushTimer, &QTimer::timeout, this, &AnnotationPersistence::flush);
+
+    connect(m_carta, &Carta::chartHashChanged, this, &AnnotationPersistence::chartHashChanged);
+    connect(m_carta, &Carta::annotationAdded, this, &AnnotationPersistence::annotationAdded);
+    connect(m_carta, &Carta::annotationChanged, this, &AnnotationPersistence::annotationChanged);
+    connect(m_carta, &Carta::annotationRemoved, this, &AnnotationPersistence::annotationRemoved);
+    connect(m_carta, &Carta::annotationsCleared, this, &AnnotationPersistence::annotationsCleared);
+
+    m_chartKey = QString::fromLatin1(m_carta->chartHash().toHex());
+}
+
+AnnotationPersistence::~AnnotationPersistence()
+{
+    flush();
+}
+
+void AnnotationPersistence::setUser(const QString &nickName)
+{
+    if (nickName == m_user)
+    {
+        return;
+    }
+
+    flush();
+    const QString previous = m_user;
+    m_user = nickName;
+    ++m_loadGeneration;
+    m_seqs.clear();
+    discardPending();
+
+    if (!previous.isEmpty())
+    {
+        // Las anotaciones del usuario anterior ya están guardadas; no deben quedar a la vista ni en el historial
+        m_carta->discardAnnotations();
+    }
+    else if (!m_user.isEmpty())
+    {
+        // Lo dibujado sin sesión pasa a ser del usuario que acaba de entrar
+        const QList<QGraphicsItem *> items = m_carta->annotationItems();
+        for (QGraphicsItem *item : items)
+        {
+            trackItem(item);
+        }
+        scheduleFlush();
+    }
+
+    startLoad();
+}
+
+void AnnotationPersistence::renameUser(const QString &nickName)
+{
+    m_user = nickName;
+}
+
+void AnnotationPersistence::flush()
+{
+    m_flushTimer->stop();
+    if (m_user.isEmpty() || m_chartKey.isEmpty())
+    {
+        return;
+    }
+    if (!m_pendingClear && m_pendingWrites.isEmpty() && m_pendingRemovals.isEmpty())
+    {
+        return;
+    }
+
+    QVector<AnnotationRecord> records;
+    records.reserve(m_pendingWrites.size());
+    for (auto it = m_pendingWrites.cbegin(); it != m_pendingWrites.cend(); ++it)
+    {
+        records.append({it.key(), it.value()});
+    }
+    const QVector<qint64> removed(m_pendingRemovals.cbegin(), m_pendingRemovals.cend());
+
+    try
+    {
+        // El borrado total va en la misma transacción: si falla la escritura no se pierde lo guardado
+        m_dao->storeAnnotations(m_user, m_chartKey, records, removed, m_pendingClear);
+    }
+    catch (const NavDAOException &e)
+    {
+        qWarning() << "No se pudieron guardar las anotaciones:" << e.what();
+    }
+    discardPending();
+}
+
+void AnnotationPersistence::chartHashChanged(const QByteArray &hash)
+{
+    const QString key = QString::fromLatin1(hash.toHex());
+    if (key == m_chartKey)
+    {
+        return;
+    }
+
+    if (!m_chartKey.isEmpty())
+    {
+        // La carta anterior ya quitó sus anotaciones de la escena: solo quedan los bytes pendientes
+        flush();
+        m_seqs.clear();
+        discardPending();
+    }
+    // Lo dibujado mientras la carta nueva se estaba leyendo sigue pendiente y se guarda con su hash
+
+    m_chartKey = key;
+    ++m_loadGeneration;
+    startLoad();
+}
+
+void AnnotationPersistence::startLoad()
+{
+    if (m_user.isEmpty() || m_chartKey.isEmpty())
+    {
+        return;
+    }
+
+    const quint64 generation = m_loadGeneration;
+    const QString databasePath = m_dao->databasePath();
+    const QString user = m_user;
+    const QString chartKey = m_chartKey;
+
+    auto *watcher = new QFutureWatcher<QList<LoadedAnnotation>>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, generation]()
+            {
+        watcher->deleteLater();
+        // Otra carta, otro usuario o un borrado total mientras se leía
+        if (generation != m_loadGeneration)
+        {
+            return;
+        }
+        applyLoaded(watcher->result()); });
+
+    watcher->setFuture(QtConcurrent::run([databasePath, user, chartKey]()
+                                         {
+        QList<LoadedAnnotation> loaded;
+        try
+        {
+            // Conexión propia: una QSqlDatabase no se comparte entre hilos
+            NavigationDAO dao(databasePath);
+            const QVector<AnnotationRecord> records = dao.loadAnnotations(user, chartKey);
+            loaded.reserve(records.size());
+            for (const AnnotationRecord &record : records)
+            {
+                LoadedAnnotation annotation;
+                annotation.seq = record.seq;
+                if (AnnotationCodec::decode(record.data, &annotation.data))
+                {
+                    loaded.append(annotation);
+                }
+            }
+        }
+        catch (const NavDAOException &e)
+        {
+            qWarning() << "No se pudieron cargar las anotaciones:" << e.what();
+        }
+        return loaded; }));
+}
+
+void AnnotationPersistence::applyLoaded(const QList<LoadedAnnotation> &annotations)
+{
+    m_restoring = true;
+    for (const LoadedAnnotation &annotation : annotations)
+    {
+        m_lastSeq = std::max(m_lastSeq, annotation.seq);
+        if (QGraphicsItem *item = m_carta->restoreAnnotation(annotation.data))
+        {
+            m_seqs.insert(item, annotation.seq);
+        }
+    }
+    m_restoring = false;
+}
+
+void AnnotationPersistence::trackItem(QGraphicsItem *item)
+{
+    AnnotationData data;
+    if (!m_carta->annotationData(item, &data))
+    {
+        return;
+    }
+
+    const qint64 seq = nextSeq();
+    m_seqs.insert(item, seq);
+    m_pendingWrites.insert(seq, AnnotationCodec::encode(data));
+}
+
+void AnnotationPersistence::annotationAdded(QGraphicsItem *item)
+{
+    if (m_restoring || m_user.isEmpty())
+    {
+        return;
+    }
+    trackItem(item);
+    scheduleFlush();
+}
+
+void AnnotationPersistence::annotationChanged(QGraphicsItem *item)
+{
+    if (m_restoring || m_user.isEmpty())
+    {
+        return;
+    }
+
+    const auto it = m_seqs.constFind(item);
+    if (it == m_seqs.constEnd())
+    {
+        trackItem(item);
+        scheduleFlush();
+        return;
+    }
+
+    AnnotationData data;
+    if (m_carta->annotationData(item, &data))
+    {
+        // Misma fila, contenido nuevo
+        m_pendingWrites.insert(it.value(), AnnotationCodec::encode(data));
+        scheduleFlush();
+    }
+}
+
+void AnnotationPersistence::annotationRemoved(QGraphicsItem *item)
+{
+    const auto it = m_seqs.constFind(item);
+    if (it == m_seqs.constEnd())
+    {
+        return;
+    }
+
+    const qint64 seq = it.value();
+    m_seqs.erase(it);
+    m_pendingWrites.remove(seq);
+    m_pendingRemovals.insert(seq);
+    scheduleFlush();
+}
+
+void AnnotationPersistence::annotationsCleared()
+{
+    m_seqs.clear();
+    discardPending();
+    // Una carga en curso devolvería lo que se acaba de borrar
+    ++m_loadGeneration;
+    m_pendingClear = !m_user.isEmpty();
+    scheduleFlush();
+}
+
+void AnnotationPersistence::scheduleFlush()
+{
+    m_flushTimer->start();
+}
+
+void AnnotationPersistence::discardPending()
+{
+    m_pendingWrites.clear();
+    m_pendingRemovals.clear();
+    m_pendingClear = false;
+}
+
+qint64 AnnotationPersistence::nextSeq()
+{
+    // Basado en la hora: las filas mantienen el orden de creación entre sesiones sin consultar el máximo
+    m_lastSeq = std::max(m_lastSeq + 1, QDateTime::currentMSecsSinceEpoch() * 1000);
+    return m_lastSeq;
+}
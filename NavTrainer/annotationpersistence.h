@@ -0,0 +1,64 @@
+#ifndef ANNOTATIONPERSISTENCE_H
+#define ANNOTATIONPERSISTENCE_H
+
+#include "navlib/navigationdao.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QMap>
+#include <QObject>
+#include <QSet>
+#include <QString>
+
+class Carta;
+class QGraphicsItem;
+class QTimer;
+
+// Guarda las anotaciones de la carta por usuario y carta (hash del contenido).
+// Cada anotación es una fila: los cambios se acumulan y se escriben en lote,
+// y la carga se hace en segundo plano al abrir la carta.
+class AnnotationPersistence : public QObject
+{
+    Q_OBJECT
+
+public:
+    AnnotationPersistence(Carta *carta, NavigationDAO *dao, QObject *parent = nullptr);
+    ~AnnotationPersistence() override;
+
+    // Vacío para trabajar sin guardar. Al pasar de sin usuario a un usuario se conservan las anotaciones actuales.
+    void setUser(const QString &nickName);
+    // Cambio de nickname: la base de datos ya propaga el nombre por cascada
+    void renameUser(const QString &nickName);
+    // Escribe los cambios pendientes ahora
+    void flush();
+
+private:
+    struct LoadedAnnotation;
+
+    void chartHashChanged(const QByteArray &hash);
+    void startLoad();
+    void applyLoaded(const QList<LoadedAnnotation> &annotations);
+    void trackItem(QGraphicsItem *item);
+    void annotationAdded(QGraphicsItem *item);
+    void annotationChanged(QGraphicsItem *item);
+    void annotationRemoved(QGraphicsItem *item);
+    void annotationsCleared();
+    void scheduleFlush();
+    void discardPending();
+    qint64 nextSeq();
+
+    Carta *m_carta = nullptr;
+    NavigationDAO *m_dao = nullptr;
+    QString m_user;
+    QString m_chartKey; // SHA-256 del fichero de la carta, en hexadecimal
+    QHash<QGraphicsItem *, qint64> m_seqs;
+    QMap<qint64, QByteArray> m_pendingWrites;
+    QSet<qint64> m_pendingRemovals;
+    bool m_pendingClear = false;
+    bool m_restoring = false;
+    quint64 m_loadGeneration = 0;
+    qint64 m_lastSeq = 0;
+    QTimer *m_flushTimer = nullptr;
+};
+
+#endif // ANNOTATIONPERSISTENCE_H
@@ -0,0 +1,445 @@
+#include "annotationrasterlayer.h"
+
+#include <QGraphicsScene>
+#include <QPaintDevice>
+#include <QPainter>
+#include <QPainterPath>
+#include <QStyleOptionGraphicsItem>
+#include <algorithm>
+#include <cmath>
+
+bool RasterizedAnnotation::paintsItself()
+{
+    return !m_layer || annotationItem()->isSelected();
+}
+
+void RasterizedAnnotation::annotationSelectionChanged()
+{
+    // Selected items paint their own highlight, so their pixels leave the baked tiles
+    if (m_layer)
+    {
+        m_layer->invalidate(annotationItem()->sceneBoundingRect());
+    }
+}
+
+void RasterizedAnnotation::detachFromRasterLayer()
+{
+    if (m_layer)
+    {
+        m_layer->removeAnnotation(annotationItem());
+    }
+}
+
+AnnotationRasterLayer::AnnotationRasterLayer(qreal zValue, QGraphicsItem *parent)
+    : QGraphicsItem(parent)
+{
+    setZValue(zValue);
+    setAcceptedMouseButtons(Qt::NoButton);
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption, true);
+    setCacheBudget(kDefaultCacheBudget);
+}
+
+AnnotationRasterLayer::~AnnotationRasterLayer()
+{
+    // Scene teardown deletes items in any order; make sure none points back here
+    for (RasterizedAnnotation *annotation : std::as_const(m_items))
+    {
+        annotation->m_layer = nullptr;
+    }
+}
+
+QRectF AnnotationRasterLayer::boundingRect() const
+{
+    return m_bounds;
+}
+
+QPainterPath AnnotationRasterLayer::shape() const
+{
+    return QPainterPath();
+}
+
+bool AnnotationRasterLayer::contains(const QPointF &point) const
+{
+    Q_UNUSED(point);
+    return false;
+}
+
+bool AnnotationRasterLayer::addAnnotation(QGraphicsItem *item)
+{
+    auto *annotation = dynamic_cast<RasterizedAnnotation *>(item);
+    if (!annotation)
+    {
+        return false;
+    }
+    if (annotation->m_layer == this)
+    {
+        return true;
+    }
+    if (annotation->m_layer)
+    {
+        annotation->m_layer->removeAnnotation(item);
+    }
+
+    const QRectF itemRect = item->sceneBoundingRect();
+    if (!m_bounds.contains(itemRect))
+    {
+        prepareGeometryChange();
+        m_bounds = m_bounds.isNull() ? itemRect : m_bounds.united(itemRect);
+    }
+
+    m_items.insert(item, annotation);
+    annotation->m_layer = this;
+    item->update();
+    invalidate(itemRect);
+    return true;
+}
+
+void AnnotationRasterLayer::removeAnnotation(QGraphicsItem *item)
+{
+    RasterizedAnnotation *annotation = m_items.take(item);
+    if (!annotation)
+    {
+        return;
+    }
+
+    annotation->m_layer = nullptr;
+    invalidate(item->sceneBoundingRect());
+    item->update();
+
+    if (m_items.isEmpty())
+    {
+        prepareGeometryChange();
+        m_bounds = QRectF();
+        m_tiles.clear();
+    }
+}
+
+void AnnotationRasterLayer::addAnnotations(const QList<QGraphicsItem *> &items)
+{
+    QList<QRectF> dirty;
+    dirty.reserve(items.size());
+    for (QGraphicsItem *item : items)
+    {
+        auto *annotation = dynamic_cast<RasterizedAnnotation *>(item);
+        if (!annotation || annotation->m_layer == this)
+        {
+            continue;
+        }
+        if (annotation->m_layer)
+        {
+            annotation->m_layer->removeAnnotation(item);
+        }
+
+        m_items.insert(item, annotation);
+        annotation->m_layer = this;
+        dirty.append(item->sceneBoundingRect());
+    }
+    invalidate(dirty);
+}
+
+void AnnotationRasterLayer::removeAnnotations(const QList<QGraphicsItem *> &items)
+{
+    QRectF dirty;
+    for (QGraphicsItem *item : items)
+    {
+        RasterizedAnnotation *annotation = m_items.take(item);
+        if (!annotation)
+        {
+            continue;
+        }
+
+        annotation->m_layer = nullptr;
+        const QRectF itemRect = item->sceneBoundingRect();
+        dropTiles(itemRect);
+        dirty = dirty.united(itemRect);
+    }
+
+    if (m_items.isEmpty() && !m_bounds.isNull())
+    {
+        prepareGeometryChange();
+        m_bounds = QRectF();
+        m_tiles.clear();
+    }
+    if (!dirty.isEmpty())
+    {
+        update(dirty);
+    }
+}
+
+void AnnotationRasterLayer::clear()
+{
+    for (RasterizedAnnotation *annotation : std::as_const(m_items))
+    {
+        annotation->m_layer = nullptr;
+    }
+    m_items.clear();
+    m_tiles.clear();
+    prepareGeometryChange();
+    m_bounds = QRectF();
+}
+
+void AnnotationRasterLayer::invalidate(const QRectF &sceneRect)
+{
+    if (sceneRect.isEmpty())
+    {
+        return;
+    }
+
+    dropTiles(sceneRect);
+    update(sceneRect);
+}
+
+void AnnotationRasterLayer::invalidate(const QList<QRectF> &sceneRects)
+{
+    QRectF dirty;
+    for (const QRectF &rect : sceneRects)
+    {
+        if (!rect.isEmpty())
+        {
+            dropTiles(rect);
+            dirty = dirty.united(rect);
+        }
+    }
+    if (dirty.isEmpty())
+    {
+        return;
+    }
+
+    // Restyled annotations may now reach past the layer
+    if (!m_bounds.contains(dirty))
+    {
+        prepareGeometryChange();
+        m_bounds = m_bounds.isNull() ? dirty : m_bounds.united(dirty);
+    }
+    update(dirty);
+}
+
+void AnnotationRasterLayer::dropTiles(const QRectF &sceneRect)
+{
+    if (m_cacheScale > 0.0)
+    {
+        const qreal span = kTileSize / m_cacheScale;
+        const int firstColumn = static_cast<int>(std::floor(sceneRect.left() / span));
+        const int lastColumn = static_cast<int>(std::floor(sceneRect.right() / span));
+        const int firstRow = static_cast<int>(std::floor(sceneRect.top() / span));
+        const int lastRow = static_cast<int>(std::floor(sceneRect.bottom() / span));
+        const qint64 tileCount = (static_cast<qint64>(lastColumn) - firstColumn + 1) * (static_cast<qint64>(lastRow) - firstRow + 1);
+
+        if (tileCount > m_tiles.count())
+        {
+            // Cheaper to walk what is cached than every tile the rect spans
+            const QList<quint64> keys = m_tiles.keys();
+            for (quint64 key : keys)
+            {
+                const int column = static_cast<int>(static_cast<qint32>(key >> 32));
+                const int row = static_cast<int>(static_cast<qint32>(key & 0xFFFFFFFF));
+                if (column >= firstColumn && column <= lastColumn && row >= firstRow && row <= lastRow)
+                {
+                    m_tiles.remove(key);
+                }
+            }
+        }
+        else
+        {
+            for (int row = firstRow; row <= lastRow; ++row)
+            {
+                for (int column = firstColumn; column <= lastColumn; ++column)
+                {
+                    m_tiles.remove(tileKey(column, row));
+                }
+            }
+        }
+    }
+}
+
+void AnnotationRasterLayer::setCacheBudget(qint64 bytes)
+{
+    m_tiles.setMaxCost(std::max<qint64>(1, bytes / 1024));
+}
+
+qint64 AnnotationRasterLayer::cacheBudget() const
+{
+    return static_cast<qint64>(m_tiles.maxCost()) * 1024;
+}
+
+void AnnotationRasterLayer::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    Q_UNUSED(widget);
+
+    if (m_items.isEmpty())
+    {
+        return;
+    }
+
+    const QRectF exposed = option->exposedRect.intersected(m_bounds);
+    if (exposed.isEmpty())
+    {
+        return;
+    }
+
+    const QTransform world = painter->worldTransform();
+    if (world.type() > QTransform::TxScale || !qFuzzyCompare(world.m11(), world.m22()) || world.m11() <= 0.0)
+    {
+        // Tiles are only kept for the axis-aligned uniform scale the chart view uses
+        paintDirect(painter, exposed);
+        return;
+    }
+
+    const qreal scale = world.m11();
+    const qreal dpr = painter->device() ? painter->device()->devicePixelRatioF() : 1.0;
+    const qreal ratio = m_cacheScale > 0.0 ? scale / m_cacheScale : 0.0;
+    const bool reuseTiles = m_interactive && qFuzzyCompare(dpr, m_cacheDpr) && ratio >= 0.5 && ratio <= 2.0;
+    if (!reuseTiles && (!qFuzzyCompare(scale, m_cacheScale) || !qFuzzyCompare(dpr, m_cacheDpr)))
+    {
+        m_tiles.clear();
+        m_cacheScale = scale;
+        m_cacheDpr = dpr;
+    }
+
+    const qreal tileScale = m_cacheScale;
+    const bool exactScale = qFuzzyCompare(scale, tileScale);
+    const qreal span = kTileSize / tileScale; // scene units covered by one tile
+    const int firstColumn = static_cast<int>(std::floor(exposed.left() / span));
+    const int lastColumn = static_cast<int>(std::ceil(exposed.right() / span)) - 1;
+    const int firstRow = static_cast<int>(std::floor(exposed.top() / span));
+    const int lastRow = static_cast<int>(std::ceil(exposed.bottom() / span)) - 1;
+
+    painter->save();
+    if (exactScale)
+    {
+        painter->resetTransform();
+    }
+    for (int row = firstRow; row <= lastRow; ++row)
+    {
+        for (int column = firstColumn; column <= lastColumn; ++column)
+        {
+            const quint64 key = tileKey(column, row);
+            QImage tile;
+            if (QImage *cached = m_tiles.object(key))
+            {
+                ++m_tileHits;
+                tile = *cached;
+            }
+            else
+            {
+                ++m_tileMisses;
+                tile = renderTile(column, row, span, tileScale, dpr, painter->renderHints());
+                const qint64 cost = tile.isNull() ? 1 : std::max<qint64>(1, tile.sizeInBytes() / 1024);
+                m_tiles.insert(key, new QImage(tile), cost);
+            }
+
+            if (tile.isNull())
+            {
+                continue;
+            }
+
+            if (!exactScale)
+            {
+                // Mid-zoom: stretch the tile baked at the previous scale, refined once the view settles
+                painter->drawImage(QRectF(column * span, row * span, span, span), tile);
+                continue;
+            }
+
+            // Tiles are laid out on whole device pixels so neighbours never leave seams
+            const QPointF origin = world.map(QPointF(column * span, row * span));
+            painter->drawImage(QPointF(std::round(origin.x()), std::round(origin.y())), tile);
+        }
+    }
+    painter->restore();
+}
+
+void AnnotationRasterLayer::setInteractive(bool interactive)
+{
+    if (m_interactive == interactive)
+    {
+        return;
+    }
+    m_interactive = interactive;
+    if (!interactive)
+    {
+        update();
+    }
+}
+
+QImage AnnotationRasterLayer::renderTile(int column, int row, qreal span, qreal scale, qreal dpr,
+                                         QPainter::RenderHints hints)
+{
+    const QRectF tileRect(column * span, row * span, span, span);
+    const QList<QGraphicsItem *> candidates = scene() ? scene()->items(tileRect, Qt::IntersectsItemBoundingRect, Qt::AscendingOrder)
+                                                      : QList<QGraphicsItem *>();
+
+    QImage tile;
+    QPainter tilePainter;
+    for (QGraphicsItem *item : candidates)
+    {
+        RasterizedAnnotation *annotation = m_items.value(item);
+        if (!annotation || !item->isVisible() || item->isSelected())
+        {
+            continue;
+        }
+
+        if (tile.isNull())
+        {
+            const int pixels = static_cast<int>(std::ceil(kTileSize * dpr));
+            tile = QImage(pixels, pixels, QImage::Format_ARGB32_Premultiplied);
+            tile.setDevicePixelRatio(dpr);
+            tile.fill(Qt::transparent);
+            tilePainter.begin(&tile);
+            tilePainter.setRenderHints(hints);
+            tilePainter.scale(scale, scale);
+            tilePainter.translate(-tileRect.topLeft());
+        }
+
+        QStyleOptionGraphicsItem option;
+        option.exposedRect = item->boundingRect();
+        tilePainter.save();
+        tilePainter.setTransform(item->sceneTransform(), true);
+        tilePainter.setOpacity(item->effectiveOpacity());
+        annotation->paintAnnotation(&tilePainter, &option);
+        tilePainter.restore();
+    }
+    return tile;
+}
+
+void AnnotationRasterLayer::paintDirect(QPainter *painter, const QRectF &exposed)
+{
+    const QList<QGraphicsItem *> candidates = scene() ? scene()->items(exposed, Qt::IntersectsItemBoundingRect, Qt::AscendingOrder)
+                                                      : QList<QGraphicsItem *>();
+    const QTransform world = painter->worldTransform();
+    for (QGraphicsItem *item : candidates)
+    {
+        RasterizedAnnotation *annotation = m_items.value(item);
+        if (!annotation || !item->isVisible() || item->isSelected())
+        {
+            continue;
+        }
+
+        QStyleOptionGraphicsItem option;
+        option.exposedRect = item->boundingRect();
+        painter->save();
+        painter->setWorldTransform(item->sceneTransform() * world);
+        painter->setOpacity(item->effectiveOpacity());
+        annotation->paintAnnotation(painter, &option);
+        painter->restore();
+    }
+}
+
+void AnnotationRasterLayer::paintAnnotation(QGraphicsItem *item, QPainter *painter) const
+{
+    QStyleOptionGraphicsItem option;
+    option.exposedRect = item->boundingRect();
+    if (RasterizedAnnotation *annotation = m_items.value(item))
+    {
+        annotation->paintAnnotation(painter, &option);
+    }
+    else
+    {
+        // Not baked, so the item paints itself anyway
+        item->paint(painter, &option, nullptr);
+    }
+}
+
+quint64 AnnotationRasterLayer::tileKey(int column, int row)
+{
+    return (static_cast<quint64>(static_cast<quint32>(column)) << 32) | static_cast<quint32>(row);
+}
@@ -0,0 +1,143 @@
+#ifndef ANNOTATIONRASTERLAYER_H
+#define ANNOTATIONRASTERLAYER_H
+
+#include <QCache>
+#include <QGraphicsItem>
+#include <QHash>
+#include <QImage>
+#include <QList>
+#include <QPainter>
+#include <QRectF>
+
+class AnnotationRasterLayer;
+
+// Mixin for committed annotation items whose pixels can be baked into an
+// AnnotationRasterLayer. While attached, the item stays in the scene for hit
+// testing, selection and context menus but stops painting itself, unless it is
+// selected and has to show its highlight.
+class RasterizedAnnotation
+{
+public:
+    virtual ~RasterizedAnnotation() = default;
+
+    bool isRasterized() const { return m_layer != nullptr; }
+
+protected:
+    virtual QGraphicsItem *annotationItem() = 0;
+    // Paints the item the way the plain Qt item would
+    virtual void paintAnnotation(QPainter *painter, const QStyleOptionGraphicsItem *option) = 0;
+
+    bool paintsItself();
+    void annotationSelectionChanged();
+    void detachFromRasterLayer();
+
+private:
+    friend class AnnotationRasterLayer;
+    AnnotationRasterLayer *m_layer = nullptr;
+};
+
+// Keeps the Qt item type (and therefore qgraphicsitem_cast) of Base
+template <typename Base>
+class RasterizedAnnotationItem : public Base, public RasterizedAnnotation
+{
+public:
+    using Base::Base;
+
+    ~RasterizedAnnotationItem() override { detachFromRasterLayer(); }
+
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override
+    {
+        if (paintsItself())
+        {
+            Base::paint(painter, option, widget);
+        }
+    }
+
+protected:
+    QGraphicsItem *annotationItem() override { return this; }
+
+    void paintAnnotation(QPainter *painter, const QStyleOptionGraphicsItem *option) override
+    {
+        Base::paint(painter, option, nullptr);
+    }
+
+    QVariant itemChange(QGraphicsItem::GraphicsItemChange change, const QVariant &value) override
+    {
+        if (change == QGraphicsItem::ItemSelectedHasChanged)
+        {
+            annotationSelectionChanged();
+        }
+        return Base::itemChange(change, value);
+    }
+};
+
+// Scene item that draws every attached annotation from device-resolution
+// raster tiles instead of re-stroking the vector items on each paint. Tiles
+// live in an LRU cache bounded by a memory budget and are rebuilt only when
+// the zoom level settles on a new value or a dirty rect reported through
+// invalidate() touches them. The layer has an empty shape, so it never takes part in hit
+// testing.
+class AnnotationRasterLayer : public QGraphicsItem
+{
+public:
+    static constexpr int kTileSize = 256;
+    static constexpr qint64 kDefaultCacheBudget = 32ll * 1024 * 1024;
+    // Baked annotations keep their z order among themselves, but every other scene item stacks
+    // against a layer as a whole. Strokes (90) go into a layer just below them and the rest
+    // (arcs 91, points and lines 93, text 95) into one just above, so a stroke being drawn (90)
+    // still shows over committed strokes and under everything else, and the line and arc
+    // previews (89, 88) stay beneath every annotation.
+    static constexpr qreal kStrokeZValue = 89.9;
+    static constexpr qreal kZValue = 90.5;
+
+    explicit AnnotationRasterLayer(qreal zValue = kZValue, QGraphicsItem *parent = nullptr);
+    ~AnnotationRasterLayer() override;
+
+    QRectF boundingRect() const override;
+    QPainterPath shape() const override;
+    bool contains(const QPointF &point) const override;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override;
+
+    // Returns false when the item does not derive from RasterizedAnnotation
+    bool addAnnotation(QGraphicsItem *item);
+    void removeAnnotation(QGraphicsItem *item);
+    // Batched versions for bulk edits: one pass over the tiles and a single scene update
+    void addAnnotations(const QList<QGraphicsItem *> &items);
+    void removeAnnotations(const QList<QGraphicsItem *> &items);
+    // Detaches every annotation at once, without per-item invalidation
+    void clear();
+    // Drops the tiles intersecting a scene rect, e.g. after an annotation was recolored
+    void invalidate(const QRectF &sceneRect);
+    // Same for many rects at once, e.g. the old and new bounds of moved or restyled annotations;
+    // the layer grows to cover them
+    void invalidate(const QList<QRectF> &sceneRects);
+    int annotationCount() const { return m_items.size(); }
+    // Paints one annotation as the tiles would, through the painter's current transform; used to
+    // draw a copy of it somewhere else, e.g. while it is being dragged
+    void paintAnnotation(QGraphicsItem *item, QPainter *painter) const;
+    void setCacheBudget(qint64 bytes);
+    qint64 cacheBudget() const;
+    // While interactive, tiles baked at a nearby zoom are stretched instead of re-rasterized
+    void setInteractive(bool interactive);
+    bool isInteractive() const { return m_interactive; }
+    quint64 tileHits() const { return m_tileHits; }
+    quint64 tileMisses() const { return m_tileMisses; }
+
+private:
+    QImage renderTile(int column, int row, qreal span, qreal scale, qreal dpr, QPainter::RenderHints hints);
+    void paintDirect(QPainter *painter, const QRectF &exposed);
+    void dropTiles(const QRectF &sceneRect);
+    static quint64 tileKey(int column, int row);
+
+    QHash<QGraphicsItem *, RasterizedAnnotation *> m_items;
+    QRectF m_bounds;
+    qreal m_cacheScale = 0.0;
+    qreal m_cacheDpr = 0.0;
+    bool m_interactive = false;
+    // Cost unit is KiB; a null image marks a tile without annotations
+    QCache<quint64, QImage> m_tiles;
+    quint64 m_tileHits = 0;
+    quint64 m_tileMisses = 0;
+};
+
+#endif // ANNOTATIONRASTERLAYER_H
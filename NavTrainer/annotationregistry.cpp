@@ -0,0 +1,115 @@
+#include "annotationregistry.h"
+
+void AnnotationRegistry::add(QGraphicsItem *item, AnnotationKind kind)
+{
+    if (!item)
+    {
+        return;
+    }
+
+    const auto existing = m_nodes.constFind(item);
+    if (existing != m_nodes.constEnd())
+    {
+        const Node previous = *existing;
+        unlink(previous);
+        --m_counts[static_cast<int>(previous.kind)];
+    }
+
+    Node node;
+    node.kind = kind;
+    node.previous = m_tail;
+    if (m_tail)
+    {
+        m_nodes[m_tail].next = item;
+    }
+    else
+    {
+        m_head = item;
+    }
+    m_tail = item;
+    m_nodes.insert(item, node);
+    ++m_counts[static_cast<int>(kind)];
+}
+
+bool AnnotationRegistry::remove(QGraphicsItem *item)
+{
+    const auto it = m_nodes.constFind(item);
+    if (it == m_nodes.constEnd())
+    {
+        return false;
+    }
+
+    const Node node = *it;
+    unlink(node);
+    --m_counts[static_cast<int>(node.kind)];
+    m_nodes.remove(item);
+    return true;
+}
+
+void AnnotationRegistry::clear()
+{
+    m_nodes.clear();
+    m_head = nullptr;
+    m_tail = nullptr;
+    m_counts.fill(0);
+}
+
+bool AnnotationRegistry::contains(QGraphicsItem *item, AnnotationKind kind) const
+{
+    const auto it = m_nodes.constFind(item);
+    return it != m_nodes.constEnd() && it->kind == kind;
+}
+
+AnnotationKind AnnotationRegistry::kind(QGraphicsItem *item) const
+{
+    return m_nodes.value(item).kind;
+}
+
+QList<QGraphicsItem *> AnnotationRegistry::items() const
+{
+    QList<QGraphicsItem *> ordered;
+    ordered.reserve(m_nodes.size());
+    for (QGraphicsItem *item = m_head; item; item = m_nodes.value(item).next)
+    {
+        ordered.append(item);
+    }
+    return ordered;
+}
+
+QList<QGraphicsItem *> AnnotationRegistry::items(AnnotationKind kind) const
+{
+    QList<QGraphicsItem *> ordered;
+    ordered.reserve(count(kind));
+    for (QGraphicsItem *item = m_head; item;)
+    {
+        const Node &node = *m_nodes.constFind(item);
+        if (node.kind == kind)
+        {
+            ordered.append(item);
+        }
+        item = node.next;
+    }
+    return ordered;
+}
+
+void AnnotationRegistry::unlink(const Node &node)
+{
+    // Callers hand in a copy: the neighbour updates below may touch the node it came from
+    if (node.previous)
+    {
+        m_nodes[node.previous].next = node.next;
+    }
+    else
+    {
+        m_head = node.next;
+    }
+
+    if (node.next)
+    {
+        m_nodes[node.next].previous = node.previous;
+    }
+    else
+    {
+        m_tail = node.previous;
+    }
+}
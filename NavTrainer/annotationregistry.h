@@ -0,0 +1,63 @@
+#ifndef ANNOTATIONREGISTRY_H
+#define ANNOTATIONREGISTRY_H
+
+#include <QHash>
+#include <QList>
+#include <array>
+
+class QGraphicsItem;
+
+enum class AnnotationKind
+{
+    Stroke,
+    Arc,
+    Line,
+    Point,
+    Text
+};
+
+// Every committed annotation of a chart, tagged with its kind. Items are
+// linked in registration order through a hash, so membership, removal and
+// lookup of the most recent item are O(1) while iteration keeps the order
+// undo needs.
+class AnnotationRegistry
+{
+public:
+    static constexpr int kKindCount = 5;
+
+    // Appends the item, or moves it to the end when it is already registered
+    void add(QGraphicsItem *item, AnnotationKind kind);
+    bool remove(QGraphicsItem *item);
+    void clear();
+
+    bool contains(QGraphicsItem *item) const { return m_nodes.contains(item); }
+    bool contains(QGraphicsItem *item, AnnotationKind kind) const;
+    // Kind of a registered item; the result is unspecified for unknown items
+    AnnotationKind kind(QGraphicsItem *item) const;
+
+    bool isEmpty() const { return m_nodes.isEmpty(); }
+    int size() const { return m_nodes.size(); }
+    int count(AnnotationKind kind) const { return m_counts[static_cast<int>(kind)]; }
+    QGraphicsItem *last() const { return m_tail; }
+
+    // Registration order, oldest first
+    QList<QGraphicsItem *> items() const;
+    QList<QGraphicsItem *> items(AnnotationKind kind) const;
+
+private:
+    struct Node
+    {
+        AnnotationKind kind;
+        QGraphicsItem *previous = nullptr;
+        QGraphicsItem *next = nullptr;
+    };
+
+    void unlink(const Node &node);
+
+    QHash<QGraphicsItem *, Node> m_nodes;
+    QGraphicsItem *m_head = nullptr;
+    QGraphicsItem *m_tail = nullptr;
+    std::array<int, kKindCount> m_counts = {};
+};
+
+#endif // ANNOTATIONREGISTRY_H
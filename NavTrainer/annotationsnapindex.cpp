@@ -0,0 +1,449 @@
+#include "annotationsnapindex.h"
+#include "annotationgeometrystore.h"
+#include "strokeprocessing.h"
+
+#include <QGraphicsEllipseItem>
+#include <QGraphicsLineItem>
+#include <QPainterPath>
+#include <QPolygonF>
+#include <QSet>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    // A cell is crossed by a curve only if its center lies within this distance of it
+    constexpr qreal kCellHalfDiagonal = AnnotationSnapIndex::kCellSize * 0.70710678118654752;
+    // Slack on the angular range of an arc, so crossings right at its ends are kept
+    constexpr qreal kArcAngleTolerance = 1e-6;
+
+    qreal dot(const QPointF &a, const QPointF &b)
+    {
+        return a.x() * b.x() + a.y() * b.y();
+    }
+
+    // Degrees in [0, 360)
+    qreal normalizedAngle(qreal degrees)
+    {
+        const qreal wrapped = std::fmod(degrees, 360.0);
+        return wrapped < 0.0 ? wrapped + 360.0 : wrapped;
+    }
+
+    // Vertices that lie on the path, i.e. every element except the control points of cubics
+    QPolygonF onPathVertices(const QPainterPath &path)
+    {
+        QPolygonF vertices;
+        vertices.reserve(path.elementCount());
+        for (int i = 0; i < path.elementCount(); ++i)
+        {
+            const QPainterPath::Element element = path.elementAt(i);
+            if (element.isCurveTo())
+            {
+                // The end point comes after the two control points
+                i += 2;
+                if (i < path.elementCount())
+                {
+                    vertices.append(path.elementAt(i));
+                }
+                continue;
+            }
+            vertices.append(element);
+        }
+        return vertices;
+    }
+
+    // Calls visit(column, row) for every cell of bounds whose center is close enough to the
+    // curve, given as a squared-distance function of a scene point
+    template <typename Distance, typename Visit>
+    void forEachCrossedCell(const QRectF &bounds, Distance &&distance, Visit &&visit)
+    {
+        constexpr qreal cellSize = AnnotationSnapIndex::kCellSize;
+        const int firstColumn = static_cast<int>(std::floor(bounds.left() / cellSize));
+        const int lastColumn = static_cast<int>(std::floor(bounds.right() / cellSize));
+        const int firstRow = static_cast<int>(std::floor(bounds.top() / cellSize));
+        const int lastRow = static_cast<int>(std::floor(bounds.bottom() / cellSize));
+        for (int row = firstRow; row <= lastRow; ++row)
+        {
+            for (int column = firstColumn; column <= lastColumn; ++column)
+            {
+                const QPointF center((column + 0.5) * cellSize, (row + 0.5) * cellSize);
+                if (distance(center) <= kCellHalfDiagonal * kCellHalfDiagonal)
+                {
+                    visit(column, row);
+                }
+            }
+        }
+    }
+}
+
+quint64 AnnotationSnapIndex::cellKey(int column, int row)
+{
+    return (static_cast<quint64>(static_cast<quint32>(column)) << 32) | static_cast<quint32>(row);
+}
+
+quint64 AnnotationSnapIndex::cellKeyAt(const QPointF &pos)
+{
+    return cellKey(static_cast<int>(std::floor(pos.x() / kCellSize)), static_cast<int>(std::floor(pos.y() / kCellSize)));
+}
+
+void AnnotationSnapIndex::insert(QGraphicsItem *item, AnnotationKind kind)
+{
+    if (!item || m_itemCells.contains(item))
+    {
+        return;
+    }
+    m_itemCells.insert(item, {});
+
+    if (const auto *pathItem = qgraphicsitem_cast<const CompactPathItem *>(item))
+    {
+        const QPainterPath path = pathItem->path().translated(item->scenePos());
+        const QPolygonF vertices = onPathVertices(path);
+        if (!vertices.isEmpty())
+        {
+            addFeature(item, vertices.constFirst(), Feature::Endpoint);
+        }
+        if (vertices.size() > 1)
+        {
+            addFeature(item, vertices.constLast(), Feature::Endpoint);
+        }
+
+        // Inner stroke vertices are not copied here: they are read from the geometry store around the
+        // segments the annotation spatial index finds. The joins between the cubic pieces of an arc
+        // are not meaningful places
+        if (kind == AnnotationKind::Arc)
+        {
+            Curve curve;
+            if (arcCurve(path, &curve))
+            {
+                addFeature(item, curve.center, Feature::Center);
+                addCurve(item, std::move(curve));
+            }
+        }
+    }
+    else if (const auto *lineItem = qgraphicsitem_cast<const QGraphicsLineItem *>(item))
+    {
+        Curve curve;
+        curve.line = QLineF(lineItem->mapToScene(lineItem->line().p1()), lineItem->mapToScene(lineItem->line().p2()));
+        addFeature(item, curve.line.p1(), Feature::Endpoint);
+        addFeature(item, curve.line.p2(), Feature::Endpoint);
+        addCurve(item, std::move(curve));
+    }
+    else if (const auto *ellipseItem = qgraphicsitem_cast<const QGraphicsEllipseItem *>(item))
+    {
+        addFeature(item, ellipseItem->mapToScene(ellipseItem->rect().center()), Feature::Point);
+    }
+    // Text has nothing to snap to
+
+    QList<quint64> &cells = m_itemCells[item];
+    std::sort(cells.begin(), cells.end());
+    cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+}
+
+void AnnotationSnapIndex::remove(QGraphicsItem *item)
+{
+    const auto it = m_itemCells.constFind(item);
+    if (it == m_itemCells.constEnd())
+    {
+        return;
+    }
+
+    // Crossings are filed under both annotations, so this also drops the ones owned by the other side
+    for (quint64 key : it.value())
+    {
+        const auto cell = m_cells.find(key);
+        if (cell == m_cells.end())
+        {
+            continue;
+        }
+        m_featureCount -= static_cast<int>(cell->removeIf([item](const Entry &entry)
+                                                          { return entry.item == item || entry.other == item; }));
+        if (cell->isEmpty())
+        {
+            m_cells.erase(cell);
+        }
+    }
+    m_itemCells.erase(it);
+
+    const auto curve = m_curves.constFind(item);
+    if (curve == m_curves.constEnd())
+    {
+        return;
+    }
+    for (quint64 key : curve->cells)
+    {
+        const auto cell = m_curveCells.find(key);
+        if (cell == m_curveCells.end())
+        {
+            continue;
+        }
+        cell->removeOne(item);
+        if (cell->isEmpty())
+        {
+            m_curveCells.erase(cell);
+        }
+    }
+    m_curves.erase(curve);
+}
+
+void AnnotationSnapIndex::clear()
+{
+    m_cells.clear();
+    m_itemCells.clear();
+    m_curveCells.clear();
+    m_curves.clear();
+    m_featureCount = 0;
+}
+
+bool AnnotationSnapIndex::snap(const QPointF &pos, qreal radius, Match *match) const
+{
+    if (!match || radius <= 0.0 || m_cells.isEmpty())
+    {
+        return false;
+    }
+
+    const qreal radiusSquared = radius * radius;
+    const Entry *best = nullptr;
+    qreal bestDistance = 0.0;
+    const auto visitCell = [&](const QList<Entry> &entries)
+    {
+        for (const Entry &entry : entries)
+        {
+            const QPointF offset = entry.pos - pos;
+            const qreal distance = dot(offset, offset);
+            if (distance > radiusSquared)
+            {
+                continue;
+            }
+            // Only ranked kinds are filed, so distance alone decides
+            if (!best || distance < bestDistance)
+            {
+                best = &entry;
+                bestDistance = distance;
+            }
+        }
+    };
+
+    const int firstColumn = static_cast<int>(std::floor((pos.x() - radius) / kCellSize));
+    const int lastColumn = static_cast<int>(std::floor((pos.x() + radius) / kCellSize));
+    const int firstRow = static_cast<int>(std::floor((pos.y() - radius) / kCellSize));
+    const int lastRow = static_cast<int>(std::floor((pos.y() + radius) / kCellSize));
+    const qint64 spanned = (static_cast<qint64>(lastColumn) - firstColumn + 1) * (static_cast<qint64>(lastRow) - firstRow + 1);
+
+    if (spanned > m_cells.size())
+    {
+        // Zoomed far out, the reach covers more cells than are occupied
+        for (auto it = m_cells.constBegin(); it != m_cells.constEnd(); ++it)
+        {
+            const int column = static_cast<int>(static_cast<qint32>(it.key() >> 32));
+            const int row = static_cast<int>(static_cast<qint32>(it.key() & 0xFFFFFFFF));
+            if (column >= firstColumn && column <= lastColumn && row >= firstRow && row <= lastRow)
+            {
+                visitCell(it.value());
+            }
+        }
+    }
+    else
+    {
+        for (int row = firstRow; row <= lastRow; ++row)
+        {
+            for (int column = firstColumn; column <= lastColumn; ++column)
+            {
+                const auto cell = m_cells.constFind(cellKey(column, row));
+                if (cell != m_cells.constEnd())
+                {
+                    visitCell(cell.value());
+                }
+            }
+        }
+    }
+
+    if (!best)
+    {
+        return false;
+    }
+    match->pos = best->pos;
+    match->feature = best->feature;
+    match->item = best->item;
+    return true;
+}
+
+void AnnotationSnapIndex::addFeature(QGraphicsItem *item, const QPointF &pos, Feature feature, QGraphicsItem *other)
+{
+    const quint64 key = cellKeyAt(pos);
+    m_cells[key].append({pos, feature, item, other});
+    ++m_featureCount;
+    m_itemCells[item].append(key);
+    if (other)
+    {
+        // The other annotation's list is already sorted and unique; keep it free of repeats
+        QList<quint64> &otherCells = m_itemCells[other];
+        if (!otherCells.contains(key))
+        {
+            otherCells.append(key);
+        }
+    }
+}
+
+void AnnotationSnapIndex::addCurve(QGraphicsItem *item, Curve curve)
+{
+    const auto fileCell = [&curve](int column, int row)
+    {
+        curve.cells.append(cellKey(column, row));
+    };
+    if (curve.arc)
+    {
+        const QPointF center = curve.center;
+        const qreal radius = curve.radius;
+        forEachCrossedCell(curve.bounds, [center, radius](const QPointF &point)
+                           {
+                               const qreal fromRing = std::abs(QLineF(center, point).length() - radius);
+                               return fromRing * fromRing;
+                           },
+                           fileCell);
+    }
+    else
+    {
+        const QPointF start = curve.line.p1();
+        const QPointF end = curve.line.p2();
+        forEachCrossedCell(QRectF(start, end).normalized(), [start, end](const QPointF &point)
+                           { return StrokeProcessing::squaredDistanceToSegment(point, start, end); },
+                           fileCell);
+    }
+
+    // Each neighbour is tested once, however many cells the two share
+    QSet<QGraphicsItem *> neighbours;
+    for (quint64 key : std::as_const(curve.cells))
+    {
+        const auto cell = m_curveCells.constFind(key);
+        if (cell != m_curveCells.constEnd())
+        {
+            for (QGraphicsItem *other : cell.value())
+            {
+                neighbours.insert(other);
+            }
+        }
+    }
+    for (QGraphicsItem *other : std::as_const(neighbours))
+    {
+        const QList<QPointF> points = crossings(curve, *m_curves.constFind(other));
+        for (const QPointF &point : points)
+        {
+            addFeature(item, point, Feature::Intersection, other);
+        }
+    }
+
+    for (quint64 key : std::as_const(curve.cells))
+    {
+        m_curveCells[key].append(item);
+    }
+    m_curves.insert(item, std::move(curve));
+}
+
+bool AnnotationSnapIndex::arcCurve(const QPainterPath &path, Curve *curve)
+{
+    // A move and at least one cubic
+    if (path.elementCount() < 4)
+    {
+        return false;
+    }
+
+    // Circle through three distinct points of the arc, taken relative to its start
+    const QPointF start = path.pointAtPercent(0.0);
+    const QPointF first = path.pointAtPercent(1.0 / 3.0) - start;
+    const QPointF second = path.pointAtPercent(2.0 / 3.0) - start;
+    const qreal determinant = 2.0 * (first.x() * second.y() - first.y() * second.x());
+    if (qFuzzyIsNull(determinant))
+    {
+        return false;
+    }
+    const qreal firstSquared = dot(first, first);
+    const qreal secondSquared = dot(second, second);
+    const QPointF center = start + QPointF((second.y() * firstSquared - first.y() * secondSquared) / determinant,
+                                           (first.x() * secondSquared - second.x() * firstSquared) / determinant);
+
+    // The arc runs counterclockwise from one end to the other; the middle tells which
+    const qreal startAngle = QLineF(center, start).angle();
+    const qreal endAngle = QLineF(center, path.pointAtPercent(1.0)).angle();
+    const qreal middleAngle = QLineF(center, path.pointAtPercent(0.5)).angle();
+    const qreal sweep = normalizedAngle(endAngle - startAngle);
+    curve->arc = true;
+    curve->center = center;
+    curve->radius = QLineF(center, start).length();
+    curve->bounds = path.boundingRect();
+    if (normalizedAngle(middleAngle - startAngle) <= sweep)
+    {
+        curve->startAngle = startAngle;
+        curve->spanAngle = sweep;
+    }
+    else
+    {
+        curve->startAngle = endAngle;
+        curve->spanAngle = 360.0 - sweep;
+    }
+    return curve->radius > 0.0 && curve->spanAngle > 0.0;
+}
+
+bool AnnotationSnapIndex::onArc(const Curve &arc, const QPointF &point)
+{
+    return normalizedAngle(QLineF(arc.center, point).angle() - arc.startAngle) <= arc.spanAngle + kArcAngleTolerance;
+}
+
+QList<QPointF> AnnotationSnapIndex::crossings(const Curve &a, const Curve &b)
+{
+    QList<QPointF> points;
+    // Circle-circle crossings are not snap targets
+    if (a.arc && b.arc)
+    {
+        return points;
+    }
+
+    if (!a.arc && !b.arc)
+    {
+        QPointF point;
+        if (a.line.intersects(b.line, &point) == QLineF::BoundedIntersection)
+        {
+            points.append(point);
+        }
+        return points;
+    }
+
+    // Line against circle: |p1 + t (p2 - p1) - center| = radius for t in [0, 1], then kept if on the arc
+    const Curve &line = a.arc ? b : a;
+    const Curve &arc = a.arc ? a : b;
+    const QPointF direction = line.line.p2() - line.line.p1();
+    const QPointF fromCenter = line.line.p1() - arc.center;
+    const qreal quadratic = dot(direction, direction);
+    if (qFuzzyIsNull(quadratic))
+    {
+        return points;
+    }
+    const qreal linear = 2.0 * dot(fromCenter, direction);
+    const qreal constant = dot(fromCenter, fromCenter) - arc.radius * arc.radius;
+    const qreal discriminant = linear * linear - 4.0 * quadratic * constant;
+    if (discriminant < 0.0)
+    {
+        return points;
+    }
+
+    const qreal root = std::sqrt(discriminant);
+    const qreal entering = (-linear - root) / (2.0 * quadratic);
+    const qreal leaving = (-linear + root) / (2.0 * quadratic);
+    for (const qreal t : {entering, leaving})
+    {
+        if (t < 0.0 || t > 1.0)
+        {
+            continue;
+        }
+        const QPointF point = line.line.p1() + direction * t;
+        if (onArc(arc, point))
+        {
+            points.append(point);
+        }
+        // A tangent line touches once
+        if (qFuzzyIsNull(root))
+        {
+            break;
+        }
+    }
+    return points;
+}
@@ -0,0 +1,102 @@
+#ifndef ANNOTATIONSNAPINDEX_H
+#define ANNOTATIONSNAPINDEX_H
+
+#include "annotationregistry.h"
+
+#include <QHash>
+#include <QLineF>
+#include <QList>
+#include <QPointF>
+#include <QRectF>
+
+class QGraphicsItem;
+class QPainterPath;
+
+// Snap targets on the committed annotations: line, stroke and arc ends,
+// point markers, arc centers, and the crossings of lines with lines and with
+// arcs. Every target is a plain point filed in a uniform grid, so a query only
+// looks at the handful of cells around the cursor no matter how many
+// annotations the chart holds. Inner stroke vertices would outnumber all of
+// that, so they stay in the geometry store and Carta finds them through the
+// annotation spatial index instead.
+//
+// Crossings are worked out when an annotation is inserted, against the lines
+// and arcs already indexed (kept in a second grid by the cells they pass
+// through), and go away with either of the two annotations. Like
+// AnnotationSpatialIndex, the index assumes annotations are only translated;
+// moving one is a remove followed by an insert.
+class AnnotationSnapIndex
+{
+public:
+    static constexpr qreal kCellSize = 64.0;
+
+    // The nearest target within reach wins whatever its kind, except that a stroke vertex only
+    // counts when nothing else is in reach
+    enum class Feature : quint8
+    {
+        Intersection,
+        Endpoint,
+        Point,
+        Center,
+        Vertex // inner vertex of a stroke; found by Carta, never filed here
+    };
+
+    struct Match
+    {
+        QPointF pos;
+        Feature feature = Feature::Vertex;
+        QGraphicsItem *item = nullptr;
+    };
+
+    void insert(QGraphicsItem *item, AnnotationKind kind);
+    void remove(QGraphicsItem *item);
+    void clear();
+
+    bool contains(QGraphicsItem *item) const { return m_itemCells.contains(item); }
+    int featureCount() const { return m_featureCount; }
+    int cellCount() const { return m_cells.size(); }
+
+    // Nearest target within radius of pos; false when there is none
+    bool snap(const QPointF &pos, qreal radius, Match *match) const;
+
+private:
+    struct Entry
+    {
+        QPointF pos;
+        Feature feature = Feature::Vertex;
+        QGraphicsItem *item = nullptr;
+        QGraphicsItem *other = nullptr; // second annotation of a crossing
+    };
+
+    // A line or circular arc that takes part in crossings, in scene coordinates
+    struct Curve
+    {
+        bool arc = false;
+        QLineF line;
+        QPointF center;
+        qreal radius = 0.0;
+        qreal startAngle = 0.0; // degrees, counterclockwise as QLineF::angle()
+        qreal spanAngle = 0.0;  // counterclockwise from startAngle, in (0, 360]
+        QRectF bounds;          // of the arc's path
+        QList<quint64> cells;
+    };
+
+    static quint64 cellKey(int column, int row);
+    static quint64 cellKeyAt(const QPointF &pos);
+    // Circle and angular range of an arc annotation's path; false for a degenerate path
+    static bool arcCurve(const QPainterPath &path, Curve *curve);
+    static bool onArc(const Curve &arc, const QPointF &point);
+    static QList<QPointF> crossings(const Curve &a, const Curve &b);
+
+    void addFeature(QGraphicsItem *item, const QPointF &pos, Feature feature, QGraphicsItem *other = nullptr);
+    void addCurve(QGraphicsItem *item, Curve curve);
+
+    QHash<quint64, QList<Entry>> m_cells;
+    // Cells holding targets of each item, crossings included
+    QHash<QGraphicsItem *, QList<quint64>> m_itemCells;
+    QHash<quint64, QList<QGraphicsItem *>> m_curveCells;
+    QHash<QGraphicsItem *, Curve> m_curves;
+    int m_featureCount = 0;
+};
+
+#endif // ANNOTATIONSNAPINDEX_H
@@ -0,0 +1,362 @@
+#include "annotationspatialindex.h"
+#include "annotationgeometrystore.h"
+#include "strokeprocessing.h"
+
+#include <QGraphicsEllipseItem>
+#include <QGraphicsLineItem>
+#include <QPen>
+#include <QSet>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+    // Distance from a cell center to its corners
+    constexpr qreal kCellHalfDiagonal = AnnotationSpatialIndex::kCellSize * 0.70710678118654752;
+
+    qreal squaredDistanceToRect(const QPointF &point, const QRectF &rect)
+    {
+        const qreal dx = std::max({rect.left() - point.x(), 0.0, point.x() - rect.right()});
+        const qreal dy = std::max({rect.top() - point.y(), 0.0, point.y() - rect.bottom()});
+        return dx * dx + dy * dy;
+    }
+}
+
+quint64 AnnotationSpatialIndex::cellKey(int column, int row)
+{
+    return (static_cast<quint64>(static_cast<quint32>(column)) << 32) | static_cast<quint32>(row);
+}
+
+template <typename Distance, typename Visit>
+void AnnotationSpatialIndex::forEachCell(const QRectF &bounds, qreal reach, Distance &&distance, Visit &&visit)
+{
+    const int firstColumn = static_cast<int>(std::floor((bounds.left() - reach) / kCellSize));
+    const int lastColumn = static_cast<int>(std::floor((bounds.right() + reach) / kCellSize));
+    const int firstRow = static_cast<int>(std::floor((bounds.top() - reach) / kCellSize));
+    const int lastRow = static_cast<int>(std::floor((bounds.bottom() + reach) / kCellSize));
+
+    // Cells of the bounding box that the geometry only passes diagonally are skipped
+    const qreal limit = reach + kCellHalfDiagonal;
+    const qreal limitSquared = limit * limit;
+    for (int row = firstRow; row <= lastRow; ++row)
+    {
+        for (int column = firstColumn; column <= lastColumn; ++column)
+        {
+            const QPointF center((column + 0.5) * kCellSize, (row + 0.5) * kCellSize);
+            if (distance(center) <= limitSquared)
+            {
+                visit(cellKey(column, row));
+            }
+        }
+    }
+}
+
+void AnnotationSpatialIndex::insert(QGraphicsItem *item)
+{
+    if (!item || m_itemCells.contains(item))
+    {
+        return;
+    }
+
+    QList<quint64> &cells = m_itemCells[item];
+    const auto addEntry = [this, &cells, item](int segment)
+    {
+        return [this, &cells, item, segment](quint64 key)
+        {
+            m_cells[key].append({item, segment});
+            cells.append(key);
+        };
+    };
+
+    const qreal margin = halfExtent(item);
+    if (const auto *pathItem = qgraphicsitem_cast<const CompactPathItem *>(item))
+    {
+        const QPointF offset = item->scenePos();
+        const int segments = pathItem->segmentCount();
+        for (int segment = 0; segment < segments; ++segment)
+        {
+            forEachCell(pathItem->segmentBounds(segment).translated(offset), margin, [pathItem, segment, offset](const QPointF &center)
+                        { return pathItem->squaredDistanceToSegment(segment, center - offset, center - offset); },
+                        addEntry(segment));
+        }
+    }
+    else if (const auto *lineItem = qgraphicsitem_cast<const QGraphicsLineItem *>(item))
+    {
+        const QPointF start = lineItem->mapToScene(lineItem->line().p1());
+        const QPointF end = lineItem->mapToScene(lineItem->line().p2());
+        forEachCell(QRectF(start, end).normalized(), margin, [start, end](const QPointF &center)
+                    { return StrokeProcessing::squaredDistanceToSegment(center, start, end); },
+                    addEntry(-1));
+    }
+    else if (const auto *ellipseItem = qgraphicsitem_cast<const QGraphicsEllipseItem *>(item))
+    {
+        const QPointF point = ellipseItem->mapToScene(ellipseItem->rect().center());
+        forEachCell(QRectF(point, point), margin, [point](const QPointF &center)
+                    { return StrokeProcessing::squaredDistanceToSegment(center, point, point); },
+                    addEntry(-1));
+    }
+    else
+    {
+        const QRectF rect = item->sceneBoundingRect();
+        forEachCell(rect, margin, [rect](const QPointF &center)
+                    { return squaredDistanceToRect(center, rect); },
+                    addEntry(-1));
+    }
+
+    // Neighbouring segments share cells; removal only needs each cell once
+    std::sort(cells.begin(), cells.end());
+    cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+}
+
+void AnnotationSpatialIndex::remove(QGraphicsItem *item)
+{
+    const auto it = m_itemCells.constFind(item);
+    if (it == m_itemCells.constEnd())
+    {
+        return;
+    }
+
+    for (quint64 key : it.value())
+    {
+        const auto cell = m_cells.find(key);
+        if (cell == m_cells.end())
+        {
+            continue;
+        }
+        cell->removeIf([item](const Entry &entry)
+                       { return entry.item == item; });
+        if (cell->isEmpty())
+        {
+            m_cells.erase(cell);
+        }
+    }
+    m_itemCells.erase(it);
+}
+
+void AnnotationSpatialIndex::clear()
+{
+    m_cells.clear();
+    m_itemCells.clear();
+}
+
+QList<AnnotationSpatialIndex::Hit> AnnotationSpatialIndex::sweep(const QPointF &from, const QPointF &to, qreal radius) const
+{
+    QList<Hit> hits;
+    QHash<QGraphicsItem *, qsizetype> hitIndex;
+
+    forEachCell(QRectF(from, to).normalized(), radius, [from, to](const QPointF &center)
+                { return StrokeProcessing::squaredDistanceToSegment(center, from, to); },
+                [&](quint64 key)
+                {
+        const auto cell = m_cells.constFind(key);
+        if (cell == m_cells.constEnd())
+        {
+            return;
+        }
+
+        for (const Entry &entry : cell.value())
+        {
+            const auto known = hitIndex.constFind(entry.item);
+            if (known != hitIndex.constEnd() && entry.segment < 0)
+            {
+                continue;
+            }
+
+            const qreal reach = radius + halfExtent(entry.item);
+            if (squaredDistance(entry.item, entry.segment, from, to) > reach * reach)
+            {
+                continue;
+            }
+
+            if (known == hitIndex.constEnd())
+            {
+                hitIndex.insert(entry.item, hits.size());
+                hits.append({entry.item, {}});
+            }
+            if (entry.segment >= 0)
+            {
+                hits[hitIndex.value(entry.item)].segments.append(entry.segment);
+            }
+        } });
+
+    // A segment spanning several swept cells is reported once
+    for (Hit &hit : hits)
+    {
+        std::sort(hit.segments.begin(), hit.segments.end());
+        hit.segments.erase(std::unique(hit.segments.begin(), hit.segments.end()), hit.segments.end());
+    }
+    return hits;
+}
+
+QList<QGraphicsItem *> AnnotationSpatialIndex::intersecting(const QPolygonF &region) const
+{
+    QList<QGraphicsItem *> found;
+    if (region.size() < 3 || m_cells.isEmpty())
+    {
+        return found;
+    }
+
+    QList<QLineF> edges;
+    edges.reserve(region.size());
+    for (qsizetype i = 0; i < region.size(); ++i)
+    {
+        edges.append(QLineF(region.at(i), region.at((i + 1) % region.size())));
+    }
+    const auto boundaryDistance = [&edges](const QPointF &point)
+    {
+        qreal nearest = std::numeric_limits<qreal>::max();
+        for (const QLineF &edge : edges)
+        {
+            nearest = std::min(nearest, StrokeProcessing::squaredDistanceToSegment(point, edge.p1(), edge.p2()));
+        }
+        return nearest;
+    };
+
+    QSet<QGraphicsItem *> seen;
+    const qreal halfDiagonalSquared = kCellHalfDiagonal * kCellHalfDiagonal;
+    const auto visitCell = [&](quint64 key, const QList<Entry> &entries)
+    {
+        const int column = static_cast<int>(static_cast<qint32>(key >> 32));
+        const int row = static_cast<int>(static_cast<qint32>(key & 0xFFFFFFFF));
+        const QPointF center((column + 0.5) * kCellSize, (row + 0.5) * kCellSize);
+        const bool centerInside = region.containsPoint(center, Qt::OddEvenFill);
+        const bool farFromBoundary = boundaryDistance(center) > halfDiagonalSquared;
+        if (!centerInside && farFromBoundary)
+        {
+            return;
+        }
+
+        for (const Entry &entry : entries)
+        {
+            if (seen.contains(entry.item))
+            {
+                continue;
+            }
+
+            // Every entry of a cell reaches into the disc around its center, so a cell
+            // whose disc lies inside the region needs no per-entry test
+            bool hit = centerInside && farFromBoundary;
+            if (!hit)
+            {
+                hit = region.containsPoint(anchor(entry.item, entry.segment), Qt::OddEvenFill);
+            }
+            if (!hit)
+            {
+                const qreal reach = halfExtent(entry.item);
+                for (const QLineF &edge : std::as_const(edges))
+                {
+                    if (squaredDistance(entry.item, entry.segment, edge.p1(), edge.p2()) <= reach * reach)
+                    {
+                        hit = true;
+                        break;
+                    }
+                }
+            }
+            if (hit)
+            {
+                seen.insert(entry.item);
+                found.append(entry.item);
+            }
+        }
+    };
+
+    const QRectF bounds = region.boundingRect();
+    const int firstColumn = static_cast<int>(std::floor(bounds.left() / kCellSize)) - 1;
+    const int lastColumn = static_cast<int>(std::floor(bounds.right() / kCellSize)) + 1;
+    const int firstRow = static_cast<int>(std::floor(bounds.top() / kCellSize)) - 1;
+    const int lastRow = static_cast<int>(std::floor(bounds.bottom() / kCellSize)) + 1;
+    const qint64 spanned = (static_cast<qint64>(lastColumn) - firstColumn + 1) * (static_cast<qint64>(lastRow) - firstRow + 1);
+
+    if (spanned > m_cells.size())
+    {
+        // A band over most of the chart: cheaper to walk the occupied cells
+        for (auto it = m_cells.constBegin(); it != m_cells.constEnd(); ++it)
+        {
+            const int column = static_cast<int>(static_cast<qint32>(it.key() >> 32));
+            const int row = static_cast<int>(static_cast<qint32>(it.key() & 0xFFFFFFFF));
+            if (column >= firstColumn && column <= lastColumn && row >= firstRow && row <= lastRow)
+            {
+                visitCell(it.key(), it.value());
+            }
+        }
+    }
+    else
+    {
+        for (int row = firstRow; row <= lastRow; ++row)
+        {
+            for (int column = firstColumn; column <= lastColumn; ++column)
+            {
+                const auto cell = m_cells.constFind(cellKey(column, row));
+                if (cell != m_cells.constEnd())
+                {
+                    visitCell(cell.key(), cell.value());
+                }
+            }
+        }
+    }
+    return found;
+}
+
+qreal AnnotationSpatialIndex::halfExtent(const QGraphicsItem *item)
+{
+    if (const auto *pathItem = qgraphicsitem_cast<const CompactPathItem *>(item))
+    {
+        return pathItem->penWidth() / 2.0;
+    }
+    if (const auto *lineItem = qgraphicsitem_cast<const QGraphicsLineItem *>(item))
+    {
+        return lineItem->pen().widthF() / 2.0;
+    }
+    if (const auto *ellipseItem = qgraphicsitem_cast<const QGraphicsEllipseItem *>(item))
+    {
+        return ellipseItem->rect().width() / 2.0 + ellipseItem->pen().widthF() / 2.0;
+    }
+    return 0.0;
+}
+
+qreal AnnotationSpatialIndex::squaredDistance(const QGraphicsItem *item, int segment, const QPointF &from, const QPointF &to)
+{
+    if (const auto *pathItem = qgraphicsitem_cast<const CompactPathItem *>(item))
+    {
+        const QPointF offset = item->scenePos();
+        return pathItem->squaredDistanceToSegment(segment, from - offset, to - offset);
+    }
+    if (const auto *lineItem = qgraphicsitem_cast<const QGraphicsLineItem *>(item))
+    {
+        return StrokeProcessing::squaredDistanceBetweenSegments(lineItem->mapToScene(lineItem->line().p1()),
+                                                                lineItem->mapToScene(lineItem->line().p2()),
+                                                                from, to);
+    }
+    if (const auto *ellipseItem = qgraphicsitem_cast<const QGraphicsEllipseItem *>(item))
+    {
+        return StrokeProcessing::squaredDistanceToSegment(ellipseItem->mapToScene(ellipseItem->rect().center()), from, to);
+    }
+
+    const QRectF rect = item->sceneBoundingRect();
+    if (rect.contains(from) || rect.contains(to))
+    {
+        return 0.0;
+    }
+    return std::min({StrokeProcessing::squaredDistanceBetweenSegments(rect.topLeft(), rect.topRight(), from, to),
+                     StrokeProcessing::squaredDistanceBetweenSegments(rect.topRight(), rect.bottomRight(), from, to),
+                     StrokeProcessing::squaredDistanceBetweenSegments(rect.bottomRight(), rect.bottomLeft(), from, to),
+                     StrokeProcessing::squaredDistanceBetweenSegments(rect.bottomLeft(), rect.topLeft(), from, to)});
+}
+
+QPointF AnnotationSpatialIndex::anchor(const QGraphicsItem *item, int segment)
+{
+    if (const auto *pathItem = qgraphicsitem_cast<const CompactPathItem *>(item))
+    {
+        return pathItem->segmentStart(segment) + item->scenePos();
+    }
+    if (const auto *lineItem = qgraphicsitem_cast<const QGraphicsLineItem *>(item))
+    {
+        return lineItem->mapToScene(lineItem->line().p1());
+    }
+    if (const auto *ellipseItem = qgraphicsitem_cast<const QGraphicsEllipseItem *>(item))
+    {
+        return ellipseItem->mapToScene(ellipseItem->rect().center());
+    }
+    return item->sceneBoundingRect().center();
+}
@@ -0,0 +1,65 @@
+#ifndef ANNOTATIONSPATIALINDEX_H
+#define ANNOTATIONSPATIALINDEX_H
+
+#include <QHash>
+#include <QLineF>
+#include <QList>
+#include <QPointF>
+#include <QPolygonF>
+#include <QRectF>
+
+class QGraphicsItem;
+
+// Uniform-grid spatial hash of the committed annotations, used by the
+// eraser and by rubber-band selection. Strokes and arcs are indexed segment by segment, so a query only
+// looks at the few segments near the cursor and tests them analytically
+// instead of stroking whole paths into shapes. Other annotations are
+// indexed as a single entry (a line segment, a disc or a rectangle).
+//
+// Annotations are assumed to be only translated, never rotated or scaled.
+class AnnotationSpatialIndex
+{
+public:
+    static constexpr qreal kCellSize = 64.0;
+
+    struct Hit
+    {
+        QGraphicsItem *item = nullptr;
+        // Segments of a packed stroke or arc that were touched, ascending; empty for other annotations
+        QList<int> segments;
+    };
+
+    void insert(QGraphicsItem *item);
+    void remove(QGraphicsItem *item);
+    void clear();
+
+    bool contains(QGraphicsItem *item) const { return m_itemCells.contains(item); }
+    int cellCount() const { return m_cells.size(); }
+
+    // Annotations within radius of the segment from-to, i.e. swept by a round eraser
+    QList<Hit> sweep(const QPointF &from, const QPointF &to, qreal radius) const;
+    // Annotations with any part (pen width included) inside a closed polygon, e.g. a rubber band or lasso
+    QList<QGraphicsItem *> intersecting(const QPolygonF &region) const;
+
+private:
+    struct Entry
+    {
+        QGraphicsItem *item = nullptr;
+        int segment = -1; // -1: the whole item
+    };
+
+    static quint64 cellKey(int column, int row);
+    // Calls visit(key) for every cell whose center is within reach of the geometry, given as
+    // its bounds and a squared-distance function of a scene point
+    template <typename Distance, typename Visit>
+    static void forEachCell(const QRectF &bounds, qreal reach, Distance &&distance, Visit &&visit);
+    static qreal halfExtent(const QGraphicsItem *item);
+    static qreal squaredDistance(const QGraphicsItem *item, int segment, const QPointF &from, const QPointF &to);
+    // A point on the geometry of an entry
+    static QPointF anchor(const QGraphicsItem *item, int segment);
+
+    QHash<quint64, QList<Entry>> m_cells;
+    QHash<QGraphicsItem *, QList<quint64>> m_itemCells;
+};
+
+#endif // ANNOTATIONSPATIALINDEX_H
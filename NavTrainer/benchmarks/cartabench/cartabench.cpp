@@ -0,0 +1,435 @@
+#include "annotationgeometrystore.h"
+#include "carta.h"
+
+#include <QApplication>
+#include <QGraphicsPathItem>
+#include <QGraphicsScene>
+#include <QImage>
+#include <QLinearGradient>
+#include <QPainter>
+#include <QPainterPath>
+#include <QRandomGenerator>
+#include <QScrollBar>
+#include <QWheelEvent>
+#include <QtTest>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    constexpr quint32 kSeed = 20240611;
+    // Zoom steps above the minimum scale every case starts from; 9 lands close to the fit-to-height view
+    constexpr int kStartZoomSteps = 9;
+    // Steps above the minimum for panPaint, enough for the chart to overflow the viewport both ways
+    constexpr int kPanZoomSteps = 16;
+
+    int envInt(const char *name, int fallback)
+    {
+        bool ok = false;
+        const int value = qEnvironmentVariableIntValue(name, &ok);
+        return ok && value > 0 ? value : fallback;
+    }
+
+    // Deterministic chart-like image: gradient sea, a coastline and a graticule
+    QImage syntheticChart(int side)
+    {
+        QImage image(side, side, QImage::Format_RGB32);
+        QPainter painter(&image);
+        QLinearGradient sea(0, 0, side, side);
+        sea.setColorAt(0.0, QColor(190, 220, 240));
+        sea.setColorAt(1.0, QColor(120, 170, 210));
+        painter.fillRect(image.rect(), sea);
+
+        QRandomGenerator random(kSeed);
+        QPainterPath coast(QPointF(0, side * 0.3));
+        for (int x = 0; x <= side; x += std::max(1, side / 64))
+        {
+            coast.lineTo(x, side * 0.3 + random.bounded(side / 10));
+        }
+        coast.lineTo(side, 0);
+        coast.lineTo(0, 0);
+        painter.fillPath(coast, QColor(235, 220, 170));
+
+        painter.setPen(QPen(QColor(60, 60, 60), 1));
+        for (int step = 0; step < side; step += std::max(1, side / 32))
+        {
+            painter.drawLine(step, 0, step, side);
+            painter.drawLine(0, step, side, step);
+        }
+        return image;
+    }
+}
+
+// Paint cost of the chart view under the interactions trainees actually use.
+// Every annotation is created through Carta's public API with a fixed seed, so
+// two builds measure exactly the same scene.
+class CartaBenchmark : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void init();
+    void cleanupTestCase();
+
+    void fullRepaint();
+    void panPaint();
+    void zoomPaint();
+    void erasePaint();
+    void undoPaint();
+    void clearUserAnnotationsPaint();
+    void eraseScaling_data();
+    void eraseScaling();
+    void undoScaling_data();
+    void undoScaling();
+    void snapScaling_data();
+    void snapScaling();
+    void strokeGeometryMemory_data();
+    void strokeGeometryMemory();
+
+private:
+    void populateAnnotations();
+    void populatePoints(int count);
+    void scalingRows();
+    void sendZoomStep(bool zoomIn);
+    void zoomTo(int stepsAboveMinimum);
+    void repaint();
+
+    Carta *m_carta = nullptr;
+    int m_chartSide = 0;
+    int m_annotationsPerType = 0;
+};
+
+void CartaBenchmark::initTestCase()
+{
+    m_chartSide = envInt("CARTABENCH_CHART_SIZE", 8192);
+    m_annotationsPerType = envInt("CARTABENCH_ANNOTATIONS", 200);
+    qInfo("Chart %dx%d px, %d annotations of each type", m_chartSide, m_chartSide, m_annotationsPerType);
+
+    m_carta = new Carta();
+    m_carta->resize(1280, 800);
+    m_carta->setSmoothZoomEnabled(false);
+    m_carta->show();
+    QVERIFY(QTest::qWaitForWindowExposed(m_carta));
+    QVERIFY(m_carta->setMapImage(syntheticChart(m_chartSide)));
+}
+
+void CartaBenchmark::init()
+{
+    m_carta->clearUserAnnotations();
+    populateAnnotations();
+    zoomTo(kStartZoomSteps);
+    repaint();
+}
+
+void CartaBenchmark::cleanupTestCase()
+{
+    delete m_carta;
+    m_carta = nullptr;
+}
+
+void CartaBenchmark::populateAnnotations()
+{
+    QRandomGenerator random(kSeed);
+    auto randomPoint = [&random, this]()
+    {
+        return QPointF(random.bounded(m_chartSide), random.bounded(m_chartSide));
+    };
+
+    m_carta->setStrokeWidth(4);
+    m_carta->setStrokeOpacity(85);
+    for (int i = 0; i < m_annotationsPerType; ++i)
+    {
+        QPainterPath stroke(randomPoint());
+        for (int segment = 0; segment < 40; ++segment)
+        {
+            stroke.lineTo(stroke.currentPosition() + QPointF(random.bounded(-30, 31), random.bounded(-30, 31)));
+        }
+        m_carta->addStrokeAnnotation(stroke);
+        m_carta->addPointAnnotation(randomPoint());
+        m_carta->addLineAnnotation(QLineF(randomPoint(), randomPoint()));
+        m_carta->addArcAnnotation(randomPoint(), 50 + random.bounded(400), 0.0, random.bounded(360));
+        m_carta->addTextAnnotation(randomPoint(), QStringLiteral("WP%1").arg(i));
+    }
+}
+
+void CartaBenchmark::populatePoints(int count)
+{
+    // Dense grid over the whole chart so every eraser step has candidates under it
+    m_carta->clearUserAnnotations();
+    const int perRow = std::max(1, static_cast<int>(std::ceil(std::sqrt(count))));
+    const qreal spacing = static_cast<qreal>(m_chartSide) / perRow;
+    for (int i = 0; i < count; ++i)
+    {
+        m_carta->addPointAnnotation(QPointF((i % perRow + 0.5) * spacing, (i / perRow + 0.5) * spacing));
+    }
+}
+
+void CartaBenchmark::scalingRows()
+{
+    QTest::addColumn<int>("annotations");
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+    QTest::newRow("40k") << 40000;
+}
+
+void CartaBenchmark::repaint()
+{
+    // Synchronous paint so the measured time includes the whole frame
+    m_carta->viewport()->repaint();
+}
+
+void CartaBenchmark::sendZoomStep(bool zoomIn)
+{
+    const QPointF center = QRectF(m_carta->viewport()->rect()).center();
+    QWheelEvent event(center, m_carta->viewport()->mapToGlobal(center), QPoint(), QPoint(0, zoomIn ? 120 : -120),
+                      Qt::NoButton, Qt::ShiftModifier, Qt::NoScrollPhase, false);
+    QApplication::sendEvent(m_carta->viewport(), &event);
+}
+
+void CartaBenchmark::zoomTo(int stepsAboveMinimum)
+{
+    // Zooming out saturates at the minimum scale, so the same steps always reach the same level
+    for (int step = 0; step < 40; ++step)
+    {
+        sendZoomStep(false);
+    }
+    for (int step = 0; step < stepsAboveMinimum; ++step)
+    {
+        sendZoomStep(true);
+    }
+}
+
+void CartaBenchmark::fullRepaint()
+{
+    QBENCHMARK
+    {
+        m_carta->viewport()->update();
+        repaint();
+    }
+}
+
+void CartaBenchmark::panPaint()
+{
+    // At the fitted zoom the chart does not overflow the viewport and there is nothing to scroll
+    zoomTo(kPanZoomSteps);
+    QScrollBar *horizontal = m_carta->horizontalScrollBar();
+    QScrollBar *vertical = m_carta->verticalScrollBar();
+    QVERIFY(horizontal->maximum() > 0 && vertical->maximum() > 0);
+    horizontal->setValue((horizontal->minimum() + horizontal->maximum()) / 2);
+    vertical->setValue((vertical->minimum() + vertical->maximum()) / 2);
+    repaint();
+    int direction = 1;
+    QBENCHMARK
+    {
+        horizontal->setValue(horizontal->value() + direction * 37);
+        vertical->setValue(vertical->value() + direction * 23);
+        direction = -direction;
+        repaint();
+    }
+}
+
+void CartaBenchmark::zoomPaint()
+{
+    // In and back out within each iteration, so every run starts and ends at the init() zoom
+    QBENCHMARK
+    {
+        sendZoomStep(true);
+        repaint();
+        sendZoomStep(false);
+        repaint();
+    }
+}
+
+void CartaBenchmark::erasePaint()
+{
+    m_carta->setInteractionMode(Carta::InteractionMode::Erase);
+    QWidget *viewport = m_carta->viewport();
+    const QRect area = viewport->rect().adjusted(20, 20, -20, -20);
+
+    // Sweeps the eraser across the viewport in rows, repainting after every step
+    QBENCHMARK_ONCE
+    {
+        for (int y = area.top(); y <= area.bottom(); y += 40)
+        {
+            QTest::mousePress(viewport, Qt::LeftButton, Qt::NoModifier, QPoint(area.left(), y));
+            for (int x = area.left(); x <= area.right(); x += 20)
+            {
+                QTest::mouseMove(viewport, QPoint(x, y));
+                repaint();
+            }
+            QTest::mouseRelease(viewport, Qt::LeftButton, Qt::NoModifier, QPoint(area.right(), y));
+        }
+    }
+    m_carta->setInteractionMode(Carta::InteractionMode::Drag);
+}
+
+void CartaBenchmark::undoPaint()
+{
+    const int steps = m_annotationsPerType * 5;
+    QBENCHMARK_ONCE
+    {
+        for (int i = 0; i < steps; ++i)
+        {
+            m_carta->undoLastAnnotation();
+            repaint();
+        }
+    }
+}
+
+void CartaBenchmark::clearUserAnnotationsPaint()
+{
+    QBENCHMARK_ONCE
+    {
+        m_carta->clearUserAnnotations();
+        repaint();
+    }
+}
+
+// Bookkeeping cost only (no repaint): should stay flat as the annotation count grows
+void CartaBenchmark::eraseScaling_data()
+{
+    scalingRows();
+}
+
+void CartaBenchmark::eraseScaling()
+{
+    QFETCH(int, annotations);
+    populatePoints(annotations);
+    m_carta->setInteractionMode(Carta::InteractionMode::Erase);
+    QWidget *viewport = m_carta->viewport();
+    const QRect area = viewport->rect().adjusted(20, 20, -20, -20);
+
+    QBENCHMARK_ONCE
+    {
+        QTest::mousePress(viewport, Qt::LeftButton, Qt::NoModifier, area.topLeft());
+        for (int step = 0; step <= 200; ++step)
+        {
+            QTest::mouseMove(viewport, area.topLeft() + (area.bottomRight() - area.topLeft()) * step / 200);
+        }
+        QTest::mouseRelease(viewport, Qt::LeftButton, Qt::NoModifier, area.bottomRight());
+    }
+    m_carta->setInteractionMode(Carta::InteractionMode::Drag);
+}
+
+void CartaBenchmark::undoScaling_data()
+{
+    scalingRows();
+}
+
+void CartaBenchmark::undoScaling()
+{
+    QFETCH(int, annotations);
+    populatePoints(annotations);
+
+    QBENCHMARK_ONCE
+    {
+        for (int i = 0; i < 1000; ++i)
+        {
+            m_carta->undoLastAnnotation();
+        }
+    }
+}
+
+void CartaBenchmark::snapScaling_data()
+{
+    scalingRows();
+}
+
+// 1000 snap queries along the viewport diagonal, as a line preview would issue them
+void CartaBenchmark::snapScaling()
+{
+    QFETCH(int, annotations);
+    populatePoints(annotations);
+    const QRect area = m_carta->viewport()->rect();
+    const QPointF from = m_carta->mapToScene(area.topLeft());
+    const QPointF to = m_carta->mapToScene(area.bottomRight());
+
+    QBENCHMARK
+    {
+        for (int step = 0; step < 1000; ++step)
+        {
+            m_carta->snapScenePoint(from + (to - from) * (step / 1000.0));
+        }
+    }
+}
+
+// Bytes held by the packed geometry for 10k stroke vertices (100 strokes of 100)
+void CartaBenchmark::strokeGeometryMemory_data()
+{
+    QTest::addColumn<bool>("pathItems");
+    QTest::newRow("packed") << false;
+    QTest::newRow("QGraphicsPathItem") << true;
+}
+
+void CartaBenchmark::strokeGeometryMemory()
+{
+    QFETCH(bool, pathItems);
+    constexpr int kStrokes = 100;
+    constexpr int kVerticesPerStroke = 100;
+
+    QRandomGenerator random(kSeed);
+    QList<QPainterPath> strokes;
+    for (int i = 0; i < kStrokes; ++i)
+    {
+        QPainterPath stroke(QPointF(random.bounded(m_chartSide), random.bounded(m_chartSide)));
+        for (int segment = 1; segment < kVerticesPerStroke; ++segment)
+        {
+            stroke.lineTo(stroke.currentPosition() + QPointF(random.bounded(-30, 31), random.bounded(-30, 31)));
+        }
+        strokes.append(stroke);
+    }
+    const QPen pen(Qt::red, 4);
+    const int inputVertices = kStrokes * kVerticesPerStroke;
+
+    qint64 bytes = 0;
+    if (pathItems)
+    {
+        // What the strokes cost before the store: the elements each path reserves plus the cached
+        // bounding rect. Reserved rather than used, like the store's buffers; the item objects
+        // themselves are left out here as they are for the packed row
+        QGraphicsScene scene;
+        for (const QPainterPath &stroke : strokes)
+        {
+            QGraphicsPathItem *item = scene.addPath(stroke, pen);
+            item->boundingRect();
+            bytes += static_cast<qint64>(item->path().capacity()) * sizeof(QPainterPath::Element) + sizeof(QRectF);
+        }
+    }
+    else
+    {
+        // Same store Carta uses, so the simplified levels are counted along with the full geometry
+        AnnotationGeometryStore store;
+        for (const QPainterPath &stroke : strokes)
+        {
+            store.add(stroke, pen);
+        }
+        bytes = store.memoryUsage();
+        qInfo("%d input vertices stored as %d, plus %d simplified-level indices (%.2f per vertex)", inputVertices,
+              store.totalVertexCount(), store.totalLodIndexCount(),
+              static_cast<double>(store.totalLodIndexCount()) / inputVertices);
+    }
+    qInfo("%.1f bytes per input vertex", static_cast<double>(bytes) / inputVertices);
+    QTest::setBenchmarkResult(bytes, QTest::BytesAllocated);
+}
+
+int main(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+    {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app(argc, argv);
+    CartaBenchmark benchmark;
+
+    // Machine-readable results by default so runs can be diffed between releases
+    QStringList arguments = app.arguments();
+    if (!arguments.contains(QStringLiteral("-o")))
+    {
+        arguments << QStringLiteral("-o") << QStringLiteral("cartabench.xml,xml")
+                  << QStringLiteral("-o") << QStringLiteral("-,txt");
+    }
+    return QTest::qExec(&benchmark, arguments);
+}
+
+#include "cartabench.moc"
@@ -0,0 +1,56 @@
+# Benchmark headless del dibujado de la carta.
+# Ejecutar con: QT_QPA_PLATFORM=offscreen ./cartabench
+# Variables: CARTABENCH_CHART_SIZE (lado de la carta en píxeles, 8192 por defecto)
+#            CARTABENCH_ANNOTATIONS (anotaciones de cada tipo, 200 por defecto)
+
+QT += core gui widgets svg svgwidgets concurrent testlib
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = cartabench
+
+NAVTRAINER_DIR = $$PWD/../..
+INCLUDEPATH += $$NAVTRAINER_DIR
+
+SOURCES += \
+    cartabench.cpp \
+    $$NAVTRAINER_DIR/annotationcodec.cpp \
+    $$NAVTRAINER_DIR/annotationgeometrystore.cpp \
+    $$NAVTRAINER_DIR/annotationhistory.cpp \
+    $$NAVTRAINER_DIR/annotationrasterlayer.cpp \
+    $$NAVTRAINER_DIR/annotationregistry.cpp \
+    $$NAVTRAINER_DIR/annotationsnapindex.cpp \
+    $$NAVTRAINER_DIR/annotationspatialindex.cpp \
+    $$NAVTRAINER_DIR/carta.cpp \
+    $$NAVTRAINER_DIR/chartpyramiditem.cpp \
+    $$NAVTRAINER_DIR/charttilecache.cpp \
+    $$NAVTRAINER_DIR/framestats.cpp \
+    $$NAVTRAINER_DIR/livestrokeitem.cpp \
+    $$NAVTRAINER_DIR/mapoverlaypanel.cpp \
+    $$NAVTRAINER_DIR/strokeprocessing.cpp \
+    $$NAVTRAINER_DIR/toolrendercache.cpp \
+    $$NAVTRAINER_DIR/toolspatialindex.cpp
+
+HEADERS += \
+    $$NAVTRAINER_DIR/annotationcodec.h \
+    $$NAVTRAINER_DIR/annotationgeometrystore.h \
+    $$NAVTRAINER_DIR/annotationhistory.h \
+    $$NAVTRAINER_DIR/annotationrasterlayer.h \
+    $$NAVTRAINER_DIR/annotationregistry.h \
+    $$NAVTRAINER_DIR/annotationsnapindex.h \
+    $$NAVTRAINER_DIR/annotationspatialindex.h \
+    $$NAVTRAINER_DIR/carta.h \
+    $$NAVTRAINER_DIR/chartexporter.h \
+    $$NAVTRAINER_DIR/chartpyramiditem.h \
+    $$NAVTRAINER_DIR/charttilecache.h \
+    $$NAVTRAINER_DIR/framestats.h \
+    $$NAVTRAINER_DIR/livestrokeitem.h \
+    $$NAVTRAINER_DIR/mapoverlaypanel.h \
+    $$NAVTRAINER_DIR/maptooltypes.h \
+    $$NAVTRAINER_DIR/strokeprocessing.h \
+    $$NAVTRAINER_DIR/toolrendercache.h \
+    $$NAVTRAINER_DIR/toolspatialindex.h
+
+RESOURCES += \
+    $$NAVTRAINER_DIR/Assets.qrc
@@ -1,20 +1,31 @@
 #include "carta.h"
+#include "annotationcodec.h"
+#include "annotationrasterlayer.h"
+#include "chartpyramiditem.h"
+#include "charttilecache.h"
+#include "livestrokeitem.h"
+#include "strokeprocessing.h"
 #include "mapoverlaypanel.h"
 #include "maptooltypes.h"
+#include "toolrendercache.h"
 
 #include <QDragEnterEvent>
 #include <QDragMoveEvent>
 #include <QDropEvent>
+#include <QFileInfo>
 #include <QFrame>
 #include <QGraphicsEllipseItem>
 #include <QGraphicsItem>
 #include <QGraphicsLineItem>
 #include <QGraphicsPathItem>
-#include <QGraphicsPixmapItem>
 #include <QGraphicsRectItem>
 #include <QGraphicsSceneMouseEvent>
 #include <QGraphicsSceneWheelEvent>
 #include <QGraphicsSimpleTextItem>
+#include <QImage>
+#include <QImageReader>
+#include <QFutureWatcher>
+#include <QtConcurrent/QtConcurrentRun>
 #include <QtSvgWidgets/qgraphicssvgitem.h>
 #include <QMouseEvent>
 #include <QMimeData>
@@ -22,9 +33,13 @@
 #include <QPointer>
 #include <QPainter>
 #include <QPixmap>
+#include <QPaintEvent>
+#include <QRegion>
 #include <QResizeEvent>
+#include <QScreen>
 #include <QScrollBar>
 #include <QSizePolicy>
+#include <QStyleOptionGraphicsItem>
 #include <QTransform>
 #include <QtSvg/qsvgrenderer.h>
 #include <QPen>
@@ -32,6 +47,10 @@
 #include <QWidget>
 #include <QtMath>
 #include <QTimer>
+#include <QVariantAnimation>
+#include <QElapsedTimer>
+#include <QFontMetrics>
+#include <QStringList>
 #include <QLineEdit>
 #include <QLineF>
 #include <QInputDialog>
@@ -40,8 +59,48 @@
 #include <QMenu>
 #include <QColorDialog>
 #include <QApplication>
+#include <QVarLengthArray>
 #include <algorithm>
 #include <cmath>
+#include <utility>
+
+// Paints a set of Carta's procedural guides inside the scene pass, so they stack between scene
+// items instead of over the finished scene layer. Covers the chart and is never hit.
+class GuideLayerItem : public QGraphicsItem
+{
+public:
+    using Painter = std::function<void(QPainter *)>;
+
+    GuideLayerItem(qreal zValue, Painter paintGuides)
+        : m_paintGuides(std::move(paintGuides))
+    {
+        setZValue(zValue);
+        setAcceptedMouseButtons(Qt::NoButton);
+    }
+
+    void setBounds(const QRectF &bounds)
+    {
+        if (bounds != m_bounds)
+        {
+            prepareGeometryChange();
+            m_bounds = bounds;
+        }
+    }
+
+    QRectF boundingRect() const override { return m_bounds; }
+    QPainterPath shape() const override { return QPainterPath(); }
+
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override
+    {
+        Q_UNUSED(option);
+        Q_UNUSED(widget);
+        m_paintGuides(painter);
+    }
+
+private:
+    Painter m_paintGuides;
+    QRectF m_bounds;
+};
 
 class MapToolItem : public QGraphicsSvgItem
 {
@@ -49,8 +108,10 @@ public:
     static constexpr qreal kToolSceneScale = 1.0 / 6.0 * 1.5;
 
     MapToolItem(const QString &toolId, const QString &resourcePath, Carta *view)
-        : QGraphicsSvgItem(resourcePath), m_toolId(toolId), m_view(view)
+        : m_toolId(toolId), m_resourcePath(resourcePath), m_view(view)
     {
+        // Every instance of a tool shares one parsed document
+        setSharedRenderer(ToolRenderCache::instance().renderer(resourcePath));
         setFlags(QGraphicsItem::ItemIsMovable | QGraphicsItem::ItemIsSelectable |
                  QGraphicsItem::ItemSendsGeometryChanges);
         if (toolId == QLatin1String("tool_ruler") || toolId == QLatin1String("tool_compass")) {
@@ -104,6 +165,43 @@ public:
         return m_toolId;
     }
 
+    // Hit test in tool scene (viewport) coordinates
+    virtual bool containsToolScenePoint(const QPointF &toolScenePos) const
+    {
+        return contains(mapFromScene(toolScenePos));
+    }
+
+    QVariant itemChange(GraphicsItemChange change, const QVariant &value) override
+    {
+        // Keeps the view's tool index and any cached scene geometry in step with moves, rotations and rescales
+        if (change == ItemPositionHasChanged || change == ItemRotationHasChanged || change == ItemScaleHasChanged
+            || change == ItemTransformOriginPointHasChanged || change == ItemTransformHasChanged)
+        {
+            sceneTransformChanged();
+            if (m_view)
+            {
+                m_view->toolGeometryChanged(this);
+            }
+        }
+        return QGraphicsSvgItem::itemChange(change, value);
+    }
+
+    // Same output as QGraphicsSvgItem::paint, blitted from the shared raster cache
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override
+    {
+        Q_UNUSED(widget);
+        const QRectF documentRect = QGraphicsSvgItem::boundingRect();
+        ToolRenderCache::instance().paint(painter, m_resourcePath, documentRect);
+        if (option && (option->state & QStyle::State_Selected))
+        {
+            painter->save();
+            painter->setPen(QPen(option->palette.windowText(), 0, Qt::DashLine));
+            painter->setBrush(Qt::NoBrush);
+            painter->drawRect(documentRect);
+            painter->restore();
+        }
+    }
+
 protected:
     void mousePressEvent(QGraphicsSceneMouseEvent *event) override
     {
@@ -162,6 +260,8 @@ protected:
     bool m_dragging = false;
     QPointF m_pressPos;
 
+    virtual void sceneTransformChanged() {}
+
     void wheelEvent(QGraphicsSceneWheelEvent *event) override
     {
         if (!event)
@@ -233,6 +333,7 @@ protected:
     }
 
     QString m_toolId;
+    QString m_resourcePath;
     QPointer<Carta> m_view;
     qreal m_rotationDeg = 0.0;
     QGraphicsSimpleTextItem *m_angleLabel = nullptr;
@@ -287,30 +388,29 @@ protected:
 
     QPainterPath shape() const override
     {
-        QPainterPath path;
-        // Hinge area
-        path.addEllipse(QPointF(0, 0), m_hingeRadius + 5, m_hingeRadius + 5);
-        
-        // Pivot leg
-        QTransform pivotRot;
-        pivotRot.rotate(m_pivotRotationDeg);
-        QPolygonF pivotPoly;
-        pivotPoly << QPointF(0, -m_legWidth/2) << QPointF(m_legLength, -2) 
-                  << QPointF(m_legLength + 8, 0) << QPointF(m_legLength, 2) 
-                  << QPointF(0, m_legWidth/2);
-        path.addPolygon(pivotRot.map(pivotPoly));
-        
-        // Pencil leg
-        QTransform pencilRot;
-        pencilRot.rotate(m_pencilRotationDeg);
-        QPolygonF pencilPoly;
-        pencilPoly << QPointF(0, -m_legWidth/2) << QPointF(m_legLength - 10, -m_legWidth/2)
-                   << QPointF(m_legLength - 10, -m_legWidth) << QPointF(m_legLength + 5, 0)
-                   << QPointF(m_legLength - 10, m_legWidth) << QPointF(m_legLength - 10, m_legWidth/2)
-                   << QPointF(0, m_legWidth/2);
-        path.addPolygon(pencilRot.map(pencilPoly));
-        
-        return path;
+        const Geometry &geometry = legGeometry();
+        if (geometry.shape.isEmpty())
+        {
+            QPainterPath path;
+            path.addEllipse(QPointF(0, 0), geometry.hingeReach, geometry.hingeReach);
+            path.addPolygon(geometry.pivotLeg);
+            path.addPolygon(geometry.pencilLeg);
+            geometry.shape = path;
+        }
+        return geometry.shape;
+    }
+
+    // Analytic version of the shape test: a disc and two leg polygons, with no path built
+    bool contains(const QPointF &point) const override
+    {
+        const Geometry &geometry = legGeometry();
+        if (!geometry.bounds.contains(point))
+        {
+            return false;
+        }
+        return QPointF::dotProduct(point, point) <= geometry.hingeReach * geometry.hingeReach
+               || geometry.pivotLeg.containsPoint(point, Qt::OddEvenFill)
+               || geometry.pencilLeg.containsPoint(point, Qt::OddEvenFill);
     }
 
     void paint(QPainter *painter, const QStyleOptionGraphicsItem *, QWidget *) override
@@ -473,7 +573,7 @@ protected:
         const qreal step = static_cast<qreal>(deltaValue) / 120.0 * 3.0;
         qreal currentSpread = m_pivotRotationDeg - m_pencilRotationDeg;
         currentSpread = std::clamp(currentSpread + step, kMinSpreadDeg, kMaxSpreadDeg);
-        m_pencilRotationDeg = m_pivotRotationDeg - currentSpread;
+        setPencilRotation(m_pivotRotationDeg - currentSpread);
         
         update();
         if (scene()) scene()->update();
@@ -675,16 +775,74 @@ private:
     qreal m_arcRadius = 0.0;
     QGraphicsPathItem *m_arcPreview = nullptr;
 
+    // Leg outlines in item coordinates. Item rotation and scale are applied by the hit tests
+    // mapping into item coordinates, so only a change of leg angle rebuilds them.
+    struct Geometry
+    {
+        QPolygonF pivotLeg;
+        QPolygonF pencilLeg;
+        QPointF pivotTip;
+        QPointF pencilTip;
+        QRectF bounds;
+        qreal hingeReach = 0.0;
+        mutable QPainterPath shape; // built on the first shape() call
+    };
+    mutable Geometry m_geometry;
+    mutable bool m_geometryValid = false;
+
+    void setPencilRotation(qreal degrees)
+    {
+        if (m_pencilRotationDeg == degrees)
+        {
+            return;
+        }
+        m_pencilRotationDeg = degrees;
+        m_geometryValid = false;
+    }
+
+    const Geometry &legGeometry() const
+    {
+        if (m_geometryValid)
+        {
+            return m_geometry;
+        }
+
+        Geometry geometry;
+        geometry.hingeReach = m_hingeRadius + 5;
+
+        const QTransform pivotRot = QTransform().rotate(m_pivotRotationDeg);
+        QPolygonF pivotPoly;
+        pivotPoly << QPointF(0, -m_legWidth/2) << QPointF(m_legLength, -2)
+                  << QPointF(m_legLength + 8, 0) << QPointF(m_legLength, 2)
+                  << QPointF(0, m_legWidth/2);
+        geometry.pivotLeg = pivotRot.map(pivotPoly);
+        geometry.pivotTip = pivotRot.map(QPointF(m_legLength + 10, 0));
+
+        const QTransform pencilRot = QTransform().rotate(m_pencilRotationDeg);
+        QPolygonF pencilPoly;
+        pencilPoly << QPointF(0, -m_legWidth/2) << QPointF(m_legLength - 10, -m_legWidth/2)
+                   << QPointF(m_legLength - 10, -m_legWidth) << QPointF(m_legLength + 5, 0)
+                   << QPointF(m_legLength - 10, m_legWidth) << QPointF(m_legLength - 10, m_legWidth/2)
+                   << QPointF(0, m_legWidth/2);
+        geometry.pencilLeg = pencilRot.map(pencilPoly);
+        geometry.pencilTip = pencilRot.map(QPointF(m_legLength + 5, 0));
+
+        const QRectF hinge(-geometry.hingeReach, -geometry.hingeReach, geometry.hingeReach * 2, geometry.hingeReach * 2);
+        geometry.bounds = hinge.united(geometry.pivotLeg.boundingRect()).united(geometry.pencilLeg.boundingRect());
+
+        m_geometry = geometry;
+        m_geometryValid = true;
+        return m_geometry;
+    }
+
     QPointF pivotTipLocal() const
     {
-        const QTransform rot = QTransform().rotate(m_pivotRotationDeg);
-        return rot.map(QPointF(m_legLength + 10, 0));
+        return legGeometry().pivotTip;
     }
 
     QPointF pencilTipLocal() const
     {
-        const QTransform rot = QTransform().rotate(m_pencilRotationDeg);
-        return rot.map(QPointF(m_legLength + 5, 0));
+        return legGeometry().pencilTip;
     }
 
     void beginMove(QGraphicsSceneMouseEvent *event)
@@ -699,6 +857,14 @@ private:
     {
         if (!event) return;
         setPos(event->scenePos() - m_moveSceneOffset);
+
+        // Drop the pivot tip onto a nearby mark, line end or crossing
+        QPointF snappedPivot;
+        const QPointF pivotScene = mapToScene(pivotTipLocal());
+        if (m_view && m_view->snapToolScenePoint(pivotScene, &snappedPivot))
+        {
+            setPos(pos() + snappedPivot - pivotScene);
+        }
     }
 
     void beginRotateWhole(QGraphicsSceneMouseEvent *event)
@@ -826,7 +992,7 @@ private:
         // Clamp spread between legs
         qreal spread = m_pivotRotationDeg - newPencilRot;
         spread = std::clamp(spread, kMinSpreadDeg, kMaxSpreadDeg);
-        m_pencilRotationDeg = m_pivotRotationDeg - spread;
+        setPencilRotation(m_pivotRotationDeg - spread);
         
         // Get new pencil tip in map scene
         QPointF pencilToolScene = mapToScene(pencilTipLocal());
@@ -970,6 +1136,35 @@ protected:
     // Handlebar dimensions (in local SVG coordinates)
     static constexpr qreal kHandleRadius = 80.0;  // Radius of circular handles
     static constexpr qreal kHandleOffset = 50.0;  // Distance from edge
+
+    // Bounds in tool scene coordinates: a corner and the two edge vectors leaving it
+    struct Frame
+    {
+        QPointF origin;
+        QPointF along;
+        QPointF across;
+        qreal alongLengthSquared = 0.0;
+        qreal acrossLengthSquared = 0.0;
+    };
+    mutable Frame m_frame;
+    mutable bool m_frameValid = false;
+    mutable QPainterPath m_shape;
+
+    const Frame &sceneFrame() const
+    {
+        if (!m_frameValid)
+        {
+            const QRectF bounds = boundingRect();
+            const QTransform transform = sceneTransform();
+            m_frame.origin = transform.map(bounds.topLeft());
+            m_frame.along = transform.map(bounds.topRight()) - m_frame.origin;
+            m_frame.across = transform.map(bounds.bottomLeft()) - m_frame.origin;
+            m_frame.alongLengthSquared = QPointF::dotProduct(m_frame.along, m_frame.along);
+            m_frame.acrossLengthSquared = QPointF::dotProduct(m_frame.across, m_frame.across);
+            m_frameValid = true;
+        }
+        return m_frame;
+    }
     
     // Get the bounding rect of the SVG
     QRectF svgRect() const
@@ -1005,6 +1200,38 @@ protected:
         return base.adjusted(-kHandleRadius, -kHandleRadius, kHandleRadius, kHandleRadius);
     }
 
+    // The ruler is hit anywhere within its bounds, handles included
+    QPainterPath shape() const override
+    {
+        if (m_shape.isEmpty())
+        {
+            m_shape.addRect(boundingRect());
+        }
+        return m_shape;
+    }
+
+    bool contains(const QPointF &point) const override
+    {
+        return boundingRect().contains(point);
+    }
+
+public:
+    // Projects the point on the ruler's two edge directions, with no inverse transform per call
+    bool containsToolScenePoint(const QPointF &toolScenePos) const override
+    {
+        const Frame &frame = sceneFrame();
+        const QPointF offset = toolScenePos - frame.origin;
+        const qreal along = QPointF::dotProduct(offset, frame.along);
+        const qreal across = QPointF::dotProduct(offset, frame.across);
+        return along >= 0.0 && along <= frame.alongLengthSquared && across >= 0.0 && across <= frame.acrossLengthSquared;
+    }
+
+protected:
+    void sceneTransformChanged() override
+    {
+        m_frameValid = false;
+    }
+
     void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override
     {
         // Draw the SVG ruler first
@@ -1192,11 +1419,44 @@ private:
     }
 };
 
+namespace
+{
+    // Idle time after the last zoom or pan event before the view is refined to full quality
+    constexpr int kRefineDelayMs = 180;
+    constexpr int kZoomAnimationMs = 140;
+    constexpr qreal kZoomStep = 1.15;
+    // Decoded charts kept around after switching away from them
+    constexpr qint64 kDefaultChartCacheBudget = 384ll * 1024 * 1024;
+    constexpr qreal kStrokeZValue = 90.0;
+    // Freehand samples closer than this on screen are dropped while drawing
+    constexpr qreal kStrokeSampleTolerancePx = 1.5;
+    // Douglas-Peucker tolerance applied when the stroke is finished
+    constexpr qreal kStrokeSimplifyTolerancePx = 0.6;
+    // Strokes with more vertices than this are smoothed on a worker thread
+    constexpr int kSyncSmoothingVertices = 200;
+    // Radius of the eraser tip on screen
+    constexpr qreal kEraserRadiusPx = 5.0;
+    // Pick tolerance of a click in Select mode
+    constexpr qreal kSelectionPickRadiusPx = 4.0;
+    // Lasso vertices closer than this on screen are dropped
+    constexpr qreal kLassoSpacingPx = 3.0;
+    // Rubber bands smaller than this on screen are a click on empty chart
+    constexpr qreal kMinimumBandPx = 3.0;
+    // Offset between instances of a tool placed on the same spot, in viewport pixels
+    constexpr qreal kToolCascadeStep = 24.0;
+    // Used when the screen does not report its refresh rate
+    constexpr qreal kFallbackRefreshRate = 60.0;
+    // Reach of geometry snapping on screen
+    constexpr qreal kSnapRadiusPx = 10.0;
+}
+
 Carta::Carta(QWidget *parent)
     : QGraphicsView(parent)
 {
     setScene(&m_scene);
     m_toolScene.setSceneRect(-5000, -5000, 10000, 10000);
+    // Tools move constantly and are looked up through m_toolIndex, so the scene keeps no BSP tree
+    m_toolScene.setItemIndexMethod(QGraphicsScene::NoIndex);
     setRenderHint(QPainter::SmoothPixmapTransform, true);
     setRenderHint(QPainter::Antialiasing, false);
     setTransformationAnchor(QGraphicsView::AnchorUnderMouse);
@@ -1216,7 +1476,58 @@ Carta::Carta(QWidget *parent)
         viewport()->setAttribute(Qt::WA_AcceptDrops, true);
     }
     m_scene.setBackgroundBrush(Qt::black);
+    m_strokeLayer = new AnnotationRasterLayer(AnnotationRasterLayer::kStrokeZValue);
+    m_annotationLayer = new AnnotationRasterLayer(AnnotationRasterLayer::kZValue);
+    // The two layers share what a single one used to be allowed
+    m_strokeLayer->setCacheBudget(AnnotationRasterLayer::kDefaultCacheBudget / 2);
+    m_annotationLayer->setCacheBudget(AnnotationRasterLayer::kDefaultCacheBudget / 2);
+    m_scene.addItem(m_strokeLayer);
+    m_scene.addItem(m_annotationLayer);
+    // Same z values the guide line items had
+    m_guideItem = new GuideLayerItem(85.0, [this](QPainter *painter)
+                                     { drawGuides(painter, Guides::ChartLines); });
+    m_crosshairItem = new GuideLayerItem(90.0, [this](QPainter *painter)
+                                         { drawGuides(painter, Guides::Crosshair); });
+    m_scene.addItem(m_guideItem);
+    m_scene.addItem(m_crosshairItem);
+
+    // Track what changed in each scene so the cached layers are only re-rendered where needed
+    connect(&m_scene, &QGraphicsScene::changed, this, [this](const QList<QRectF> &region)
+            { m_pendingSceneDirty.append(region); });
+    connect(&m_toolScene, &QGraphicsScene::changed, this, [this](const QList<QRectF> &)
+            { markToolLayerDirty(); });
     
+    setChartCacheBudget(kDefaultChartCacheBudget);
+
+    m_refineTimer = new QTimer(this);
+    m_refineTimer->setSingleShot(true);
+    m_refineTimer->setInterval(kRefineDelayMs);
+    connect(m_refineTimer, &QTimer::timeout, this, [this]()
+            { setRenderQuality(RenderQuality::Full); });
+
+    m_diagnosticsTimer = new QTimer(this);
+    m_diagnosticsTimer->setInterval(250);
+    connect(m_diagnosticsTimer, &QTimer::timeout, viewport(), qOverload<>(&QWidget::update));
+
+    m_moveFlushTimer = new QTimer(this);
+    m_moveFlushTimer->setSingleShot(true);
+    m_moveFlushTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_moveFlushTimer, &QTimer::timeout, this, &Carta::flushPendingMove);
+
+    m_zoomAnimation = new QVariantAnimation(this);
+    m_zoomAnimation->setDuration(kZoomAnimationMs);
+    m_zoomAnimation->setEasingCurve(QEasingCurve::OutCubic);
+    connect(m_zoomAnimation, &QVariantAnimation::valueChanged, this, [this](const QVariant &value)
+            {
+        if (!m_mapItem || m_currentScale <= 0.0)
+        {
+            m_zoomAnimation->stop();
+            return;
+        }
+        noteInteraction();
+        applyScale(value.toReal() / m_currentScale);
+        syncOverlayToScene(); });
+
     // Ensure the view is ready for tool drops
     QTimer::singleShot(0, this, [this]() {
         viewport()->update();
@@ -1299,12 +1610,19 @@ void Carta::setInteractionMode(InteractionMode mode)
     {
         cancelLinePreview();
     }
+    clearSnapIndicator();
 
     if (mode != InteractionMode::Erase)
     {
         m_erasing = false;
     }
 
+    if (m_interactionMode == InteractionMode::Select)
+    {
+        cancelSelectionGesture();
+        clearSelection();
+    }
+
     if (mode != InteractionMode::Drag && m_panning)
     {
         m_panning = false;
@@ -1364,250 +1682,712 @@ void Carta::clearUserAnnotations()
 {
     abortCurrentStroke();
     cancelLinePreview();
-    removeTextItems();
-    removeStrokeItems();
-    removePointItems();
-    removeLineItems();
-    removeArcItems();
-    m_annotationStack.clear();
     m_erasing = false;
-}
+    if (m_annotations.isEmpty())
+    {
+        return;
+    }
 
-void Carta::undoLastAnnotation()
-{
-    while (!m_annotationStack.isEmpty())
+    // Parked as one command, so a clear can be undone like any other edit
+    AnnotationHistory::Command command;
+    command.type = AnnotationHistory::CommandType::Remove;
+    command.items = m_annotations.items();
+    command.kinds.reserve(command.items.size());
+    for (QGraphicsItem *item : std::as_const(command.items))
     {
-        QGraphicsItem *item = m_annotationStack.takeLast();
-        if (!item)
-        {
-            continue;
-        }
+        command.kinds.append(m_annotations.kind(item));
+    }
 
-        if (removeAnnotationItem(item))
-        {
-            break;
-        }
+    cancelSelectionGesture();
+    clearSelection();
+    m_strokeLayer->clear();
+    m_annotationLayer->clear();
+    m_strokeSmoothingJobs.clear();
+    m_annotations.clear();
+    m_spatialIndex.clear();
+    m_snapIndex.clear();
+    clearSnapIndicator();
+    projectionPointsChanged();
+    for (QGraphicsItem *item : std::as_const(command.items))
+    {
+        m_scene.removeItem(item);
     }
+    m_history.push(std::move(command));
+    emit annotationsCleared();
 }
 
-bool Carta::loadMap(const QString &filePath)
+void Carta::discardAnnotations()
 {
-    QPixmap pixmap(filePath);
-    return setMapPixmap(pixmap);
+    abortCurrentStroke();
+    cancelLinePreview();
+    removeAllAnnotations();
+    m_erasing = false;
 }
 
-bool Carta::setMapPixmap(const QPixmap &pixmap)
+void Carta::undoLastAnnotation()
 {
-    if (pixmap.isNull())
+    abortCurrentStroke();
+    cancelLinePreview();
+    const AnnotationHistory::Command *command = m_history.undo();
+    if (!command)
     {
-        return false;
+        return;
     }
 
-    clearMap();
-
-    m_mapItem = m_scene.addPixmap(pixmap);
-    m_mapItem->setTransformationMode(Qt::SmoothTransformation);
-    m_scene.setSceneRect(pixmap.rect());
-    m_userHasZoomed = false;
-    m_pendingFitToHeight = true;
-    fitMapToViewportHeight();
-    syncOverlayToScene();
-    return true;
+    switch (command->type)
+    {
+    case AnnotationHistory::CommandType::Add:
+        parkAnnotations(command->items);
+        break;
+    case AnnotationHistory::CommandType::Remove:
+        parkAnnotations(command->added);
+        unparkAnnotations(command->items, command->kinds);
+        break;
+    case AnnotationHistory::CommandType::Restyle:
+        applyAnnotationStyles(command->items, command->oldStyles);
+        break;
+    case AnnotationHistory::CommandType::Move:
+        translateAnnotations(command->items, -command->offset);
+        break;
+    }
 }
 
-void Carta::clearMap()
+void Carta::redoLastAnnotation()
 {
     abortCurrentStroke();
     cancelLinePreview();
-    clearToolInstances();
-    removeTextItems();
-    removeStrokeItems();
-    removePointItems();
-    removeLineItems();
-    removeArcItems();
-    m_annotationStack.clear();
-    m_erasing = false;
+    const AnnotationHistory::Command *command = m_history.redo();
+    if (!command)
+    {
+        return;
+    }
 
-    if (m_mapItem)
+    switch (command->type)
     {
-        m_scene.removeItem(m_mapItem);
-        delete m_mapItem;
-        m_mapItem = nullptr;
+    case AnnotationHistory::CommandType::Add:
+        unparkAnnotations(command->items, command->kinds);
+        break;
+    case AnnotationHistory::CommandType::Remove:
+        parkAnnotations(command->items);
+        unparkAnnotations(command->added, command->addedKinds);
+        break;
+    case AnnotationHistory::CommandType::Restyle:
+        applyAnnotationStyles(command->items, command->newStyles);
+        break;
+    case AnnotationHistory::CommandType::Move:
+        translateAnnotations(command->items, command->offset);
+        break;
     }
+}
 
-    m_scene.setSceneRect({});
-    resetTransform();
-    m_baseScale = 1.0;
-    m_currentScale = 1.0;
-    setOverlayDefaultScenePos();
-    syncOverlayToScene(true);
+void Carta::setHistoryBudget(qint64 bytes)
+{
+    m_history.setBudget(bytes);
 }
 
-void Carta::setZoomRange(qreal minFactor, qreal maxFactor)
+void Carta::moveAnnotations(const QList<QGraphicsItem *> &items, const QPointF &offset, quint64 mergeId)
 {
-    if (minFactor <= 0 || maxFactor <= 0 || minFactor >= maxFactor)
+    AnnotationHistory::Command command;
+    command.type = AnnotationHistory::CommandType::Move;
+    command.offset = offset;
+    command.mergeId = mergeId;
+    for (QGraphicsItem *item : items)
+    {
+        if (m_annotations.contains(item))
+        {
+            command.items.append(item);
+        }
+    }
+    if (command.items.isEmpty() || offset.isNull())
     {
         return;
     }
 
-    m_minZoomRatio = minFactor;
-    m_maxZoomRatio = maxFactor;
+    translateAnnotations(command.items, offset);
+    m_history.push(std::move(command));
 }
 
-void Carta::wheelEvent(QWheelEvent *event)
+QList<QGraphicsItem *> Carta::selectedAnnotations() const
 {
-    // Check if wheel event is over a tool
-    const QPoint viewPos = wheelEventViewportPos(event);
-    const QPointF toolScenePos = QPointF(viewPos);
-    QGraphicsItem *toolItem = m_toolScene.itemAt(toolScenePos, QTransform());
-    
-    if (toolItem)
+    QList<QGraphicsItem *> items;
+    if (m_selection.isEmpty())
     {
-        // Find top-level MapToolItem
-        while (toolItem && !qgraphicsitem_cast<MapToolItem*>(toolItem))
-        {
-            toolItem = toolItem->parentItem();
-        }
-        
-        if (MapToolItem *mapTool = qgraphicsitem_cast<MapToolItem*>(toolItem))
+        return items;
+    }
+
+    items.reserve(m_selection.size());
+    const QList<QGraphicsItem *> annotations = m_annotations.items();
+    for (QGraphicsItem *item : annotations)
+    {
+        if (m_selection.contains(item))
         {
-            QGraphicsSceneWheelEvent sceneEvent(QEvent::GraphicsSceneWheel);
-            sceneEvent.setScenePos(toolScenePos);
-            sceneEvent.setPos(mapTool->mapFromScene(toolScenePos));
-            sceneEvent.setDelta(event->angleDelta().y());
-            sceneEvent.setButtons(event->buttons());
-            sceneEvent.setModifiers(event->modifiers());
-            m_toolScene.sendEvent(mapTool, &sceneEvent);
-            if (sceneEvent.isAccepted())
-            {
-                viewport()->update();
-                event->accept();
-                return;
-            }
+            items.append(item);
         }
     }
+    return items;
+}
 
-    if (!m_mapItem)
+void Carta::clearSelection()
+{
+    if (m_selection.isEmpty())
     {
-        event->ignore();
         return;
     }
+    setSelection({});
+}
 
-    // Only allow zoom if Shift is held
-    if (!(event->modifiers() & Qt::ShiftModifier)) {
-        event->ignore();
+void Carta::deleteSelectedAnnotations()
+{
+    cancelSelectionGesture();
+    if (m_selection.isEmpty())
+    {
         return;
     }
 
-    QPointF delta = event->angleDelta();
-    if (delta.isNull())
+    AnnotationHistory::Command command;
+    command.type = AnnotationHistory::CommandType::Remove;
+    command.items = selectedAnnotations();
+    command.kinds.reserve(command.items.size());
+    for (QGraphicsItem *item : std::as_const(command.items))
     {
-        delta = event->pixelDelta();
+        command.kinds.append(m_annotations.kind(item));
     }
+    parkAnnotations(command.items);
+    m_history.push(std::move(command));
+}
 
-    if (delta.y() == 0)
+void Carta::recolorSelection(const QColor &color)
+{
+    if (!color.isValid())
     {
-        event->ignore();
         return;
     }
 
-    constexpr qreal zoomStep = 1.15;
-    const qreal factor = delta.y() > 0 ? zoomStep : (1.0 / zoomStep);
-    applyScale(factor);
-    event->accept();
-    syncOverlayToScene();
+    const auto recolor = [color](QGraphicsItem *, AnnotationHistory::Style style)
+    {
+        const int alpha = style.color.alpha();
+        style.color = color;
+        style.color.setAlpha(alpha);
+        return style;
+    };
+    restyleSelection(recolor, 0);
 }
 
-void Carta::mousePressEvent(QMouseEvent *event)
+void Carta::setSelectionStrokeWidth(int width)
 {
-    setFocus();
-
-    // FIRST: Check if clicking on overlay (toolbox) - this takes priority
-    if (m_overlayWidget && !m_overlayMouseTransparent)
+    if (width <= 0)
     {
-        const QPoint overlayPos = m_overlayWidget->mapFromParent(event->pos());
-        if (m_overlayWidget->rect().contains(overlayPos))
-        {
-            // Pass to base class which will let the child widget handle it
-            QGraphicsView::mousePressEvent(event);
-            return;
-        }
+        return;
     }
 
-    // SECOND: Check if clicking on a tool in tool scene (only if NOT over overlay)
-    const QPointF toolScenePos = QPointF(event->pos());
-    QGraphicsItem *toolItem = m_toolScene.itemAt(toolScenePos, QTransform());
-    
-    if (toolItem)
+    // Same mapping as new annotations drawn with this width; texts keep their size
+    const auto resize = [width](QGraphicsItem *item, AnnotationHistory::Style style)
     {
-        // Find top-level MapToolItem
-        while (toolItem && !qgraphicsitem_cast<MapToolItem*>(toolItem))
+        if (qgraphicsitem_cast<QGraphicsEllipseItem *>(item))
         {
-            toolItem = toolItem->parentItem();
+            style.width = std::max<qreal>(4.0, width * 1.2);
         }
-        
-        if (MapToolItem *mapTool = qgraphicsitem_cast<MapToolItem*>(toolItem))
+        else if (!qgraphicsitem_cast<QGraphicsSimpleTextItem *>(item))
         {
-            // Check if this is a RulerToolItem - let it handle its own events
-            if (RulerToolItem *ruler = dynamic_cast<RulerToolItem*>(mapTool))
-            {
-                // Forward mouse event to the ruler's scene event handler
-                QPointF localPos = ruler->mapFromScene(toolScenePos);
-                QGraphicsSceneMouseEvent sceneEvent(QEvent::GraphicsSceneMousePress);
-                sceneEvent.setPos(localPos);
-                sceneEvent.setScenePos(toolScenePos);
-                sceneEvent.setScreenPos(event->globalPosition().toPoint());
-                sceneEvent.setButton(event->button());
-                sceneEvent.setButtons(event->buttons());
-                sceneEvent.setModifiers(event->modifiers());
-                
-                // Store reference for move/release events
-                m_draggedToolItem = ruler;
-                m_activeRuler = ruler;
-                
-                // Send to ruler
-                ruler->handleMousePress(&sceneEvent);
-                event->accept();
-                return;
-            }
-            
-            // If this is the compass, forward the event to let it handle rotate/paint
-            if (CompassToolItem *compass = dynamic_cast<CompassToolItem*>(mapTool))
-            {
-                QPointF localPos = compass->mapFromScene(toolScenePos);
-                QGraphicsSceneMouseEvent sceneEvent(QEvent::GraphicsSceneMousePress);
-                sceneEvent.setPos(localPos);
-                sceneEvent.setScenePos(toolScenePos);
-                sceneEvent.setScreenPos(event->globalPosition().toPoint());
-                sceneEvent.setButton(event->button());
-                sceneEvent.setButtons(event->buttons());
-                sceneEvent.setModifiers(event->modifiers());
-
-                // Store reference for move/release events
-                m_draggedToolItem = compass;
-                m_activeCompass = compass;
-
-                // Forward to compass via public wrapper
-                compass->handleMousePress(&sceneEvent);
-                event->accept();
-                return;
-            }
-
-            // Other tools use default dragging
-            m_draggedToolItem = mapTool;
-            m_toolDragOffset = toolScenePos - mapTool->pos();
-            event->accept();
-            return;
+            style.width = width;
         }
-    }
+        return style;
+    };
+    restyleSelection(resize, (m_selectionId << 2) | 1);
+}
 
-    if (event->button() == Qt::LeftButton && m_mapItem)
+void Carta::setSelectionOpacity(int opacityPercent)
+{
+    const qreal opacity = std::clamp(opacityPercent, 1, 100) / 100.0;
+    const auto fade = [opacity](QGraphicsItem *, AnnotationHistory::Style style)
     {
-        if (m_crosshairPlacementMode)
-        {
-            const QPointF scenePos = mapToScene(event->pos());
-            placeCrosshairAt(scenePos);
-            event->accept();
+        style.color.setAlphaF(opacity);
+        return style;
+    };
+    restyleSelection(fade, (m_selectionId << 2) | 2);
+}
+
+void Carta::moveSelection(const QPointF &offset)
+{
+    moveAnnotations(selectedAnnotations(), offset);
+    viewport()->update();
+}
+
+namespace
+{
+    // Longest side of the preview decoded on the GUI thread before the full chart arrives
+    constexpr int kMapPreviewMaxSide = 2048;
+}
+
+Carta::CachedChart::~CachedChart()
+{
+    delete item;
+}
+
+QString Carta::chartCacheKey(const QString &filePath)
+{
+    if (filePath.startsWith(QLatin1Char(':')))
+    {
+        return filePath;
+    }
+    const QFileInfo info(filePath);
+    const QString canonical = info.canonicalFilePath();
+    return canonical.isEmpty() ? info.absoluteFilePath() : canonical;
+}
+
+bool Carta::isChartCached(const QString &filePath) const
+{
+    return m_chartCache.contains(chartCacheKey(filePath));
+}
+
+void Carta::setChartCacheBudget(qint64 bytes)
+{
+    m_chartCache.setMaxCost(std::max<qint64>(1, bytes / 1024));
+}
+
+bool Carta::loadMap(const QString &filePath)
+{
+    cancelPendingMapLoad();
+
+    // A recently viewed chart comes back as it was left, without decoding anything
+    const QString key = chartCacheKey(filePath);
+    if (CachedChart *cached = m_chartCache.take(key))
+    {
+        ChartPyramidItem *item = std::exchange(cached->item, nullptr);
+        const CachedChart state = *cached;
+        delete cached;
+
+        installMapItem(item);
+        m_mapPath = key;
+        setChartHash(state.hash);
+        if (state.userHasZoomed)
+        {
+            applyScale(state.scale / m_currentScale);
+            centerOn(state.center);
+            syncOverlayToScene();
+        }
+        return true;
+    }
+
+    QImageReader reader(filePath);
+    reader.setAutoTransform(true);
+    const QSize fullSize = reader.size();
+
+    int previewLevel = 0;
+    if (fullSize.isValid())
+    {
+        while ((std::max(fullSize.width(), fullSize.height()) >> previewLevel) > kMapPreviewMaxSide)
+        {
+            ++previewLevel;
+        }
+    }
+
+    // Small charts (or formats that cannot report their size) are cheap enough to decode in place
+    if (previewLevel == 0)
+    {
+        if (!setMapImage(reader.read()))
+        {
+            return false;
+        }
+        m_mapPath = key;
+        setChartHash(ChartTileCache::hashFile(filePath));
+        return true;
+    }
+
+    // Scaled reads let the JPEG decoder skip most of the work for the preview
+    const int divisor = 1 << previewLevel;
+    reader.setScaledSize(QSize((fullSize.width() + divisor - 1) / divisor,
+                               (fullSize.height() + divisor - 1) / divisor));
+    const QImage preview = reader.read();
+    if (preview.isNull())
+    {
+        return false;
+    }
+
+    if (!installMapItem(new ChartPyramidItem(preview, fullSize)))
+    {
+        return false;
+    }
+
+    m_mapPath = key;
+    startFullResolutionLoad(filePath);
+    return true;
+}
+
+bool Carta::setMapPixmap(const QPixmap &pixmap)
+{
+    return setMapImage(pixmap.toImage());
+}
+
+bool Carta::setMapImage(const QImage &image)
+{
+    if (image.isNull())
+    {
+        return false;
+    }
+
+    return installMapItem(new ChartPyramidItem(image));
+}
+
+bool Carta::installMapItem(ChartPyramidItem *item)
+{
+    if (!item)
+    {
+        return false;
+    }
+
+    clearMap();
+
+    m_mapItem = item;
+    if (m_tileCacheBudget > 0)
+    {
+        m_mapItem->setCacheBudget(m_tileCacheBudget);
+    }
+    m_mapItem->setLevelBias(m_renderQuality == RenderQuality::Draft ? 1 : 0);
+    m_scene.addItem(m_mapItem);
+    m_scene.setSceneRect(m_mapItem->boundingRect());
+    updateGuideBounds();
+    m_userHasZoomed = false;
+    m_pendingFitToHeight = true;
+    fitMapToViewportHeight();
+    syncOverlayToScene();
+    return true;
+}
+
+void Carta::setChartHash(const QByteArray &hash)
+{
+    if (hash == m_chartHash)
+    {
+        return;
+    }
+    m_chartHash = hash;
+    emit chartHashChanged(m_chartHash);
+}
+
+void Carta::parkMapItem()
+{
+    const QPointF center = mapToScene(viewport()->rect().center());
+    m_scene.removeItem(m_mapItem);
+    ChartPyramidItem *item = std::exchange(m_mapItem, nullptr);
+
+    // Only finished charts loaded from a file are worth keeping; a half-loaded preview is dropped
+    if (m_mapPath.isEmpty() || item->isPreview())
+    {
+        delete item;
+        return;
+    }
+
+    item->releaseCaches();
+    auto *cached = new CachedChart;
+    cached->item = item;
+    cached->hash = m_chartHash;
+    cached->scale = m_currentScale;
+    cached->center = center;
+    cached->userHasZoomed = m_userHasZoomed;
+    const qint64 cost = std::max<qint64>(1, item->memoryFootprint() / 1024);
+    m_chartCache.insert(m_mapPath, cached, cost);
+}
+
+struct Carta::MapLoadResult
+{
+    QImage image;
+    std::shared_ptr<ChartTileCache> tileCache;
+    QByteArray hash;
+};
+
+void Carta::startFullResolutionLoad(const QString &filePath)
+{
+    const quint64 generation = ++m_mapLoadGeneration;
+
+    auto *watcher = new QFutureWatcher<MapLoadResult>(this);
+    m_mapLoadWatcher = watcher;
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, generation]()
+            {
+        watcher->deleteLater();
+        if (m_mapLoadWatcher == watcher)
+        {
+            m_mapLoadWatcher = nullptr;
+        }
+
+        // A newer chart was requested (or the map cleared) while this one was decoding
+        if (generation != m_mapLoadGeneration || watcher->isCanceled() || !m_mapItem)
+        {
+            return;
+        }
+
+        const MapLoadResult result = watcher->future().resultCount() > 0 ? watcher->result() : MapLoadResult();
+        setChartHash(result.hash);
+
+        // Same chart geometry either way, so zoom, pan and annotations stay untouched
+        if (m_mapItem->setTileCache(result.tileCache))
+        {
+            emit mapLoadFinished(true);
+            return;
+        }
+
+        if (result.image.isNull())
+        {
+            emit mapLoadFinished(false);
+            return;
+        }
+
+        m_mapItem->setImage(result.image);
+        emit mapLoadFinished(true);
+        startTileCacheBuild(result.hash, result.image); });
+
+    watcher->setFuture(QtConcurrent::run([filePath](QPromise<MapLoadResult> &promise)
+                                         {
+        MapLoadResult result;
+        result.hash = ChartTileCache::hashFile(filePath);
+        if (promise.isCanceled())
+        {
+            return;
+        }
+
+        // A valid on-disk pyramid makes the full decode unnecessary
+        result.tileCache = ChartTileCache::open(result.hash, ChartPyramidItem::kTileSize);
+        if (result.tileCache)
+        {
+            promise.addResult(result);
+            return;
+        }
+
+        QImageReader reader(filePath);
+        reader.setAutoTransform(true);
+        const QImage image = reader.read();
+        if (promise.isCanceled() || image.isNull())
+        {
+            return;
+        }
+
+        result.image = ChartPyramidItem::prepareImage(image);
+        promise.addResult(result); }));
+}
+
+void Carta::startTileCacheBuild(const QByteArray &hash, const QImage &image)
+{
+    if (hash.isEmpty() || image.isNull())
+    {
+        return;
+    }
+
+    // Missing or stale cache: rebuild it in the background and switch over to the mapped tiles
+    const quint64 generation = m_mapLoadGeneration;
+    auto *watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, generation, hash]()
+            {
+        watcher->deleteLater();
+        if (generation != m_mapLoadGeneration || !m_mapItem || !watcher->result())
+        {
+            return;
+        }
+
+        m_mapItem->setTileCache(ChartTileCache::open(hash, ChartPyramidItem::kTileSize)); });
+
+    watcher->setFuture(QtConcurrent::run([hash, image]()
+                                         { return ChartTileCache::build(hash, image, ChartPyramidItem::kTileSize); }));
+}
+
+void Carta::cancelPendingMapLoad()
+{
+    ++m_mapLoadGeneration;
+    if (!m_mapLoadWatcher)
+    {
+        return;
+    }
+
+    m_mapLoadWatcher->cancel();
+    m_mapLoadWatcher = nullptr;
+}
+
+void Carta::clearMap()
+{
+    cancelPendingMapLoad();
+    abortCurrentStroke();
+    cancelLinePreview();
+    clearToolInstances();
+    removeAllAnnotations();
+    clearGuides();
+    m_erasing = false;
+
+    if (m_mapItem)
+    {
+        parkMapItem();
+    }
+    setChartHash(QByteArray());
+    m_mapPath.clear();
+
+    m_scene.setSceneRect({});
+    updateGuideBounds();
+    m_zoomAnimation->stop();
+    resetTransform();
+    m_baseScale = 1.0;
+    m_currentScale = 1.0;
+    setOverlayDefaultScenePos();
+    syncOverlayToScene(true);
+}
+
+void Carta::setZoomRange(qreal minFactor, qreal maxFactor)
+{
+    if (minFactor <= 0 || maxFactor <= 0 || minFactor >= maxFactor)
+    {
+        return;
+    }
+
+    m_minZoomRatio = minFactor;
+    m_maxZoomRatio = maxFactor;
+}
+
+void Carta::setTileCacheBudget(qint64 bytes)
+{
+    if (bytes <= 0)
+    {
+        return;
+    }
+
+    m_tileCacheBudget = bytes;
+    if (m_mapItem)
+    {
+        m_mapItem->setCacheBudget(bytes);
+    }
+}
+
+void Carta::wheelEvent(QWheelEvent *event)
+{
+    // Zoom anchors under the last handled mouse position
+    flushPendingMove();
+
+    // Check if wheel event is over a tool
+    const QPoint viewPos = wheelEventViewportPos(event);
+    const QPointF toolScenePos = QPointF(viewPos);
+    if (MapToolItem *mapTool = toolAt(toolScenePos))
+    {
+        QGraphicsSceneWheelEvent sceneEvent(QEvent::GraphicsSceneWheel);
+        sceneEvent.setScenePos(toolScenePos);
+        sceneEvent.setPos(mapTool->mapFromScene(toolScenePos));
+        sceneEvent.setDelta(event->angleDelta().y());
+        sceneEvent.setButtons(event->buttons());
+        sceneEvent.setModifiers(event->modifiers());
+        m_toolScene.sendEvent(mapTool, &sceneEvent);
+        if (sceneEvent.isAccepted())
+        {
+            markToolLayerDirty();
+            event->accept();
+            return;
+        }
+    }
+
+    if (!m_mapItem)
+    {
+        event->ignore();
+        return;
+    }
+
+    // Only allow zoom if Shift is held
+    if (!(event->modifiers() & Qt::ShiftModifier)) {
+        event->ignore();
+        return;
+    }
+
+    QPointF delta = event->angleDelta();
+    if (delta.isNull())
+    {
+        delta = event->pixelDelta();
+    }
+
+    if (delta.y() == 0)
+    {
+        event->ignore();
+        return;
+    }
+
+    const qreal factor = delta.y() > 0 ? kZoomStep : (1.0 / kZoomStep);
+    animateZoom(factor);
+    event->accept();
+    syncOverlayToScene();
+}
+
+void Carta::mousePressEvent(QMouseEvent *event)
+{
+    // A held-back move belongs before the click
+    flushPendingMove();
+    setFocus();
+
+    // FIRST: Check if clicking on overlay (toolbox) - this takes priority
+    if (m_overlayWidget && !m_overlayMouseTransparent)
+    {
+        const QPoint overlayPos = m_overlayWidget->mapFromParent(event->pos());
+        if (m_overlayWidget->rect().contains(overlayPos))
+        {
+            // Pass to base class which will let the child widget handle it
+            QGraphicsView::mousePressEvent(event);
+            return;
+        }
+    }
+
+    // SECOND: Check if clicking on a tool in tool scene (only if NOT over overlay)
+    const QPointF toolScenePos = QPointF(event->pos());
+    if (MapToolItem *mapTool = toolAt(toolScenePos))
+    {
+        // Check if this is a RulerToolItem - let it handle its own events
+        if (RulerToolItem *ruler = dynamic_cast<RulerToolItem*>(mapTool))
+        {
+            // Forward mouse event to the ruler's scene event handler
+            QPointF localPos = ruler->mapFromScene(toolScenePos);
+            QGraphicsSceneMouseEvent sceneEvent(QEvent::GraphicsSceneMousePress);
+            sceneEvent.setPos(localPos);
+            sceneEvent.setScenePos(toolScenePos);
+            sceneEvent.setScreenPos(event->globalPosition().toPoint());
+            sceneEvent.setButton(event->button());
+            sceneEvent.setButtons(event->buttons());
+            sceneEvent.setModifiers(event->modifiers());
+            
+            // Store reference for move/release events
+            m_draggedToolItem = ruler;
+            m_activeRuler = ruler;
+            
+            // Send to ruler
+            ruler->handleMousePress(&sceneEvent);
+            event->accept();
+            return;
+        }
+        
+        // If this is the compass, forward the event to let it handle rotate/paint
+        if (CompassToolItem *compass = dynamic_cast<CompassToolItem*>(mapTool))
+        {
+            QPointF localPos = compass->mapFromScene(toolScenePos);
+            QGraphicsSceneMouseEvent sceneEvent(QEvent::GraphicsSceneMousePress);
+            sceneEvent.setPos(localPos);
+            sceneEvent.setScenePos(toolScenePos);
+            sceneEvent.setScreenPos(event->globalPosition().toPoint());
+            sceneEvent.setButton(event->button());
+            sceneEvent.setButtons(event->buttons());
+            sceneEvent.setModifiers(event->modifiers());
+
+            // Store reference for move/release events
+            m_draggedToolItem = compass;
+            m_activeCompass = compass;
+
+            // Forward to compass via public wrapper
+            compass->handleMousePress(&sceneEvent);
+            event->accept();
+            return;
+        }
+
+        // Other tools use default dragging
+        m_draggedToolItem = mapTool;
+        m_toolDragOffset = toolScenePos - mapTool->pos();
+        event->accept();
+        return;
+    }
+
+    if (event->button() == Qt::LeftButton && m_mapItem)
+    {
+        if (m_crosshairPlacementMode)
+        {
+            const QPointF scenePos = mapToScene(event->pos());
+            placeCrosshairAt(scenePos);
+            event->accept();
             return;
         }
 
@@ -1627,7 +2407,9 @@ void Carta::mousePressEvent(QMouseEvent *event)
                 return;
             case InteractionMode::Erase:
                 m_erasing = true;
-                eraseAt(scenePos);
+                ++m_eraseGesture;
+                m_lastErasePos = scenePos;
+                eraseAlong(scenePos, scenePos);
                 event->accept();
                 return;
             case InteractionMode::Point:
@@ -1642,6 +2424,10 @@ void Carta::mousePressEvent(QMouseEvent *event)
                 handleLineClick(scenePos);
                 event->accept();
                 return;
+            case InteractionMode::Select:
+                startSelectionGesture(scenePos, event->modifiers());
+                event->accept();
+                return;
             case InteractionMode::Drag:
                 m_panning = true;
                 m_lastMousePos = event->pos();
@@ -1657,6 +2443,72 @@ void Carta::mousePressEvent(QMouseEvent *event)
 
 void Carta::mouseMoveEvent(QMouseEvent *event)
 {
+    ++m_inputStats.moveEvents;
+    if (!coalescesMouseMoves(event->buttons()))
+    {
+        flushPendingMove();
+        dispatchMouseMove(event);
+        return;
+    }
+
+    // Keep only the latest position; after a quiet frame it is handled on the next event loop pass
+    m_pendingMove = {event->position(), event->globalPosition(), event->buttons(), event->modifiers()};
+    m_hasPendingMove = true;
+    event->accept();
+    if (!m_moveFlushTimer->isActive())
+    {
+        const qint64 interval = displayFrameIntervalMs();
+        const qint64 sinceDispatch = m_moveDispatchClock.isValid() ? m_moveDispatchClock.elapsed() : interval;
+        m_moveFlushTimer->start(static_cast<int>(std::max<qint64>(0, interval - sinceDispatch)));
+    }
+}
+
+bool Carta::coalescesMouseMoves(Qt::MouseButtons buttons) const
+{
+    // The path itself is the result here, so every sample counts
+    if (m_currentStroke || m_erasing || m_selectionGesture == SelectionGesture::Lasso)
+    {
+        return false;
+    }
+    // Tool rotation and drags, panning, previews and bands follow the pointer to where it is now.
+    // The compass arc preview is rebuilt from its start and current angles, so it loses nothing either.
+    if (m_activeRuler || m_activeCompass || m_draggedToolItem || m_panning || m_selectionGesture != SelectionGesture::None)
+    {
+        return true;
+    }
+    if (m_lineDrawing && m_interactionMode == InteractionMode::Line)
+    {
+        return true;
+    }
+    return buttons == Qt::NoButton;
+}
+
+int Carta::displayFrameIntervalMs() const
+{
+    const QScreen *display = screen();
+    const qreal refreshRate = display && display->refreshRate() > 0.0 ? display->refreshRate() : kFallbackRefreshRate;
+    return std::max(1, qFloor(1000.0 / refreshRate));
+}
+
+void Carta::flushPendingMove()
+{
+    m_moveFlushTimer->stop();
+    if (!m_hasPendingMove)
+    {
+        return;
+    }
+
+    m_hasPendingMove = false;
+    QMouseEvent event(QEvent::MouseMove, m_pendingMove.position, m_pendingMove.globalPosition, Qt::NoButton,
+                      m_pendingMove.buttons, m_pendingMove.modifiers);
+    dispatchMouseMove(&event);
+}
+
+void Carta::dispatchMouseMove(QMouseEvent *event)
+{
+    ++m_inputStats.dispatchedMoves;
+    m_moveDispatchClock.start();
+
     // Forward to RulerToolItem if we have an active ruler
     if (m_activeRuler)
     {
@@ -1672,7 +2524,7 @@ void Carta::mouseMoveEvent(QMouseEvent *event)
         sceneEvent.setModifiers(event->modifiers());
         
         m_activeRuler->handleMouseMove(&sceneEvent);
-        viewport()->update();
+        markToolLayerDirty();
         event->accept();
         return;
     }
@@ -1692,7 +2544,7 @@ void Carta::mouseMoveEvent(QMouseEvent *event)
         sceneEvent.setModifiers(event->modifiers());
 
         m_activeCompass->handleMouseMove(&sceneEvent);
-        viewport()->update();
+        markToolLayerDirty();
         event->accept();
         return;
     }
@@ -1704,7 +2556,7 @@ void Carta::mouseMoveEvent(QMouseEvent *event)
         // Move the tool directly
         m_draggedToolItem->setPos(toolScenePos - m_toolDragOffset);
         setCursor(Qt::ClosedHandCursor);
-        viewport()->update();
+        markToolLayerDirty();
         event->accept();
         return;
     }
@@ -1718,20 +2570,31 @@ void Carta::mouseMoveEvent(QMouseEvent *event)
 
     if (m_erasing && (event->buttons() & Qt::LeftButton))
     {
-        eraseAt(mapToScene(event->pos()));
+        // The whole segment since the previous event, so fast drags do not skip annotations
+        const QPointF scenePos = mapToScene(event->pos());
+        eraseAlong(m_lastErasePos, scenePos);
+        m_lastErasePos = scenePos;
         event->accept();
         return;
     }
 
     if (m_lineDrawing && m_interactionMode == InteractionMode::Line)
     {
-        updateLinePreview(mapToScene(event->pos()));
+        updateLinePreview(trackSnap(mapToScene(event->pos())));
+        event->accept();
+        return;
+    }
+
+    if (m_selectionGesture != SelectionGesture::None && (event->buttons() & Qt::LeftButton))
+    {
+        updateSelectionGesture(mapToScene(event->pos()));
         event->accept();
         return;
     }
 
     if (m_panning)
     {
+        noteInteraction();
         const QPoint delta = event->pos() - m_lastMousePos;
         m_lastMousePos = event->pos();
         horizontalScrollBar()->setValue(horizontalScrollBar()->value() - delta.x());
@@ -1740,11 +2603,21 @@ void Carta::mouseMoveEvent(QMouseEvent *event)
         return;
     }
 
+    if (event->buttons() == Qt::NoButton
+        && (m_interactionMode == InteractionMode::Line || m_interactionMode == InteractionMode::Point))
+    {
+        // Show where a click would land before it is made
+        trackSnap(mapToScene(event->pos()));
+    }
+
     QGraphicsView::mouseMoveEvent(event);
 }
 
 void Carta::mouseReleaseEvent(QMouseEvent *event)
 {
+    // Drags end where the last move left them, not one frame behind
+    flushPendingMove();
+
     // Forward to RulerToolItem if we have an active ruler
     if (m_activeRuler)
     {
@@ -1772,12 +2645,12 @@ void Carta::mouseReleaseEvent(QMouseEvent *event)
         
         if (overlayContainsViewportPoint(centerPoint))
         {
-            removeTool(m_activeRuler->toolId());
+            removeTool(m_activeRuler);
         }
         
         m_activeRuler = nullptr;
         m_draggedToolItem = nullptr;
-        viewport()->update();
+        markToolLayerDirty();
         event->accept();
         return;
     }
@@ -1797,6 +2670,7 @@ void Carta::mouseReleaseEvent(QMouseEvent *event)
         sceneEvent.setModifiers(event->modifiers());
 
         m_activeCompass->handleMouseRelease(&sceneEvent);
+        clearSnapIndicator();
 
         // Store final position
         storeToolViewportPos(m_activeCompass);
@@ -1809,12 +2683,12 @@ void Carta::mouseReleaseEvent(QMouseEvent *event)
 
         if (overlayContainsViewportPoint(centerPoint))
         {
-            removeTool(m_activeCompass->toolId());
+            removeTool(m_activeCompass);
         }
 
         m_activeCompass = nullptr;
         m_draggedToolItem = nullptr;
-        viewport()->update();
+        markToolLayerDirty();
         event->accept();
         return;
     }
@@ -1832,11 +2706,11 @@ void Carta::mouseReleaseEvent(QMouseEvent *event)
         
         if (overlayContainsViewportPoint(centerPoint))
         {
-            removeTool(m_draggedToolItem->toolId());
+            removeTool(m_draggedToolItem);
         }
         
         m_draggedToolItem = nullptr;
-        viewport()->update();
+        markToolLayerDirty();
         event->accept();
         return;
     }
@@ -1857,6 +2731,14 @@ void Carta::mouseReleaseEvent(QMouseEvent *event)
             return;
         }
 
+        if (m_selectionGesture != SelectionGesture::None)
+        {
+            updateSelectionGesture(mapToScene(event->pos()));
+            finishSelectionGesture();
+            event->accept();
+            return;
+        }
+
         if (m_panning)
         {
             m_panning = false;
@@ -1893,6 +2775,8 @@ void Carta::scrollContentsBy(int dx, int dy)
 {
     QGraphicsView::scrollContentsBy(dx, dy);
     syncOverlayToScene();
+    // Tools are pinned to the viewport, so a scrolled blit would drag them along
+    viewport()->update();
 }
 
 void Carta::enterEvent(QEnterEvent *event)
@@ -1903,6 +2787,8 @@ void Carta::enterEvent(QEnterEvent *event)
 
 void Carta::leaveEvent(QEvent *event)
 {
+    flushPendingMove();
+    clearSnapIndicator();
     QGraphicsView::leaveEvent(event);
 }
 
@@ -1945,15 +2831,12 @@ void Carta::dropEvent(QDropEvent *event)
 #endif
     const QPointF toolScenePos = QPointF(widgetPos);
 
-    if (addToolItem(toolId, resourcePath, toolScenePos))
+    if (MapToolItem *addedTool = addToolItem(toolId, resourcePath, toolScenePos))
     {
-        // Select the newly added tool so it can be moved immediately
-        if (MapToolItem *addedTool = m_activeToolItems.value(toolId))
-        {
-            addedTool->setSelected(true);
-        }
+        // Select the newly added tool so it can be moved immediately
+        addedTool->setSelected(true);
         // Force viewport update so tool appears immediately
-        viewport()->update();
+        markToolLayerDirty();
         event->acceptProposedAction();
     }
     else
@@ -2003,6 +2886,86 @@ void Carta::applyScale(qreal factor)
     m_pendingFitToHeight = false;
 }
 
+void Carta::animateZoom(qreal factor)
+{
+    if (!m_mapItem || qFuzzyIsNull(factor))
+    {
+        return;
+    }
+
+    noteInteraction();
+    if (!m_smoothZoom)
+    {
+        applyScale(factor);
+        return;
+    }
+
+    // Steps arriving mid-animation compound on the pending target rather than the current scale
+    const bool running = m_zoomAnimation->state() == QAbstractAnimation::Running;
+    const qreal fromScale = running ? m_zoomTargetScale : m_currentScale;
+    const qreal targetScale = std::clamp(fromScale * factor, minAllowedScale(), maxAllowedScale());
+    if (qFuzzyCompare(targetScale, m_currentScale))
+    {
+        return;
+    }
+
+    m_zoomAnimation->stop();
+    m_zoomTargetScale = targetScale;
+    m_zoomAnimation->setStartValue(m_currentScale);
+    m_zoomAnimation->setEndValue(targetScale);
+    m_zoomAnimation->start();
+}
+
+void Carta::setSmoothZoomEnabled(bool enabled)
+{
+    m_smoothZoom = enabled;
+    if (!enabled)
+    {
+        m_zoomAnimation->stop();
+    }
+}
+
+void Carta::noteInteraction()
+{
+    if (m_renderQuality == RenderQuality::Full)
+    {
+        setRenderQuality(RenderQuality::Interactive);
+    }
+    m_refineTimer->start();
+}
+
+void Carta::setRenderQuality(RenderQuality quality)
+{
+    if (m_renderQuality == quality)
+    {
+        return;
+    }
+
+    m_renderQuality = quality;
+    m_frameTimeAverageMs = 0.0;
+    setRenderHint(QPainter::SmoothPixmapTransform, quality == RenderQuality::Full);
+    if (m_mapItem)
+    {
+        m_mapItem->setLevelBias(quality == RenderQuality::Draft ? 1 : 0);
+    }
+    m_strokeLayer->setInteractive(quality != RenderQuality::Full);
+    m_annotationLayer->setInteractive(quality != RenderQuality::Full);
+
+    if (quality == RenderQuality::Full)
+    {
+        // Strips exposed while moving were drawn at reduced quality
+        invalidateSceneLayer();
+    }
+}
+
+void Carta::setFrameTimeBudget(qreal milliseconds)
+{
+    if (milliseconds > 0.0)
+    {
+        m_frameTimeBudgetMs = milliseconds;
+    }
+}
+
 void Carta::anchorMapToSide()
 {
     if (!m_mapItem)
@@ -2046,6 +3009,7 @@ void Carta::fitMapToViewportHeight()
         return;
     }
 
+    m_zoomAnimation->stop();
     resetTransform();
     scale(factor, factor);
     m_baseScale = factor;
@@ -2117,22 +3081,14 @@ bool Carta::acceptsToolMime(const QMimeData *mime) const
     return mime && mime->hasFormat(MapToolMime::ToolSource) && mime->hasFormat(MapToolMime::ToolId);
 }
 
-bool Carta::addToolItem(const QString &toolId, const QString &resourcePath, const QPointF &scenePos)
+MapToolItem *Carta::addToolItem(const QString &toolId, const QString &resourcePath, const QPointF &scenePos)
 {
     if (toolId.isEmpty() || resourcePath.isEmpty())
     {
-        return false;
-    }
-
-    if (MapToolItem *existing = m_activeToolItems.value(toolId, nullptr))
-    {
-        const QRectF bounds = existing->boundingRect();
-        existing->setPos(scenePos - bounds.center());
-        existing->update();
-        storeToolViewportPos(existing);
-        return true;
+        return nullptr;
     }
 
+    // Every call places a new instance; the SVG document is shared, so this costs no parse
     MapToolItem *item = nullptr;
     if (toolId == QLatin1String("tool_compass"))
     {
@@ -2149,7 +3105,7 @@ bool Carta::addToolItem(const QString &toolId, const QString &resourcePath, cons
     if (!item->renderer() || !item->renderer()->isValid())
     {
         delete item;
-        return false;
+        return nullptr;
     }
 
     const QRectF bounds = item->boundingRect();
@@ -2159,12 +3115,47 @@ bool Carta::addToolItem(const QString &toolId, const QString &resourcePath, cons
     }
     // scenePos is already in viewport coordinates for tool scene
     // Center new tool at the drop point so it appears where the user dropped it
-    item->setPos(scenePos - bounds.center());
+    QPointF pos = scenePos - bounds.center();
+    // Repeated placements at the same spot cascade, so each instance stays reachable
+    const auto occupied = [this, toolId](const QPointF &candidate)
+    {
+        return std::any_of(m_toolItems.cbegin(), m_toolItems.cend(), [&](const MapToolItem *other)
+                           { return other->toolId() == toolId && QLineF(other->pos(), candidate).length() < 1.0; });
+    };
+    for (int attempt = 0; attempt < 16 && occupied(pos); ++attempt)
+    {
+        pos += QPointF(kToolCascadeStep, kToolCascadeStep);
+    }
+    item->setPos(pos);
 
     m_toolScene.addItem(item);
-    m_activeToolItems.insert(toolId, item);
+    m_toolItems.append(item);
+    m_toolIndex.update(item);
     storeToolViewportPos(item);
-    return true;
+    return item;
+}
+
+MapToolItem *Carta::toolAt(const QPointF &toolScenePos) const
+{
+    const QList<QGraphicsItem *> candidates = m_toolIndex.candidatesAt(toolScenePos);
+    for (QGraphicsItem *candidate : candidates)
+    {
+        // Exact test of each tool (analytic for the ruler and compass), on the few tools near the point only
+        auto *tool = static_cast<MapToolItem *>(candidate);
+        if (tool->isVisible() && tool->containsToolScenePoint(toolScenePos))
+        {
+            return tool;
+        }
+    }
+    return nullptr;
+}
+
+void Carta::toolGeometryChanged(MapToolItem *item)
+{
+    if (m_toolIndex.contains(item))
+    {
+        m_toolIndex.update(item);
+    }
 }
 
 bool Carta::isToolItem(const QGraphicsItem *item) const
@@ -2185,16 +3176,14 @@ void Carta::placeToolAtViewportCenter(const QString &toolId, const QString &reso
 
 void Carta::clearToolInstances()
 {
-    for (auto it = m_activeToolItems.begin(); it != m_activeToolItems.end(); ++it)
+    const QList<MapToolItem *> items = std::exchange(m_toolItems, {});
+    m_toolIndex.clear();
+    for (MapToolItem *item : items)
     {
-        if (MapToolItem *item = it.value())
-        {
-            m_toolScene.removeItem(item);
-            delete item;
-        }
+        m_toolScene.removeItem(item);
+        delete item;
     }
 
-    m_activeToolItems.clear();
     m_toolViewportPos.clear();
 }
 
@@ -2238,7 +3227,7 @@ void Carta::handleToolDragFinished(MapToolItem *item)
     const QPointF itemViewportPos = item->pos();
     if (overlayContainsViewportPoint(itemViewportPos.toPoint()))
     {
-        removeTool(item->toolId());
+        removeTool(item);
         return;
     }
 
@@ -2252,27 +3241,31 @@ void Carta::handleToolItemDestroyed(MapToolItem *item)
         return;
     }
 
-    const QString key = m_activeToolItems.key(item);
-    if (!key.isEmpty())
+    m_toolItems.removeOne(item);
+    m_toolIndex.remove(item);
+    m_toolViewportPos.remove(item);
+    if (m_draggedToolItem == item)
     {
-        m_activeToolItems.remove(key);
+        m_draggedToolItem = nullptr;
     }
-    m_toolViewportPos.remove(item);
-}
-
-void Carta::removeTool(const QString &toolId)
-{
-    if (toolId.isEmpty())
+    if (m_activeRuler == item)
     {
-        return;
+        m_activeRuler = nullptr;
+    }
+    if (m_activeCompass == item)
+    {
+        m_activeCompass = nullptr;
     }
+}
 
-    MapToolItem *item = m_activeToolItems.take(toolId);
-    if (!item)
+void Carta::removeTool(MapToolItem *item)
+{
+    if (!item || !m_toolItems.removeOne(item))
     {
         return;
     }
 
+    m_toolIndex.remove(item);
     m_toolViewportPos.remove(item);
 
     m_toolScene.removeItem(item);
@@ -2303,14 +3296,14 @@ void Carta::storeToolViewportPos(MapToolItem *item)
 
 void Carta::repositionToolsToViewport()
 {
-    if (m_toolDragInProgress || m_activeToolItems.isEmpty() || !viewport())
+    if (m_toolDragInProgress || m_toolItems.isEmpty() || !viewport())
     {
         return;
     }
 
     const QRectF viewRect = viewport()->rect();
 
-    for (MapToolItem *item : m_activeToolItems)
+    for (MapToolItem *item : std::as_const(m_toolItems))
     {
         if (!item)
         {
@@ -2325,76 +3318,560 @@ void Carta::repositionToolsToViewport()
     }
 }
 
-void Carta::drawForeground(QPainter *painter, const QRectF &rect)
+void Carta::paintEvent(QPaintEvent *event)
+{
+    QElapsedTimer frameTimer;
+    frameTimer.start();
+    ++m_paintStats.frames;
+    m_currentFrame = FrameSample();
+    quint64 hitsBefore = 0;
+    quint64 missesBefore = 0;
+    tileCounters(&hitsBefore, &missesBefore);
+
+    updateSceneLayer();
+
+    {
+        QPainter painter(viewport());
+        painter.setClipRegion(event->region());
+        painter.drawPixmap(0, 0, m_sceneLayer);
+        // Same foreground pass a direct render gets: tools, then the diagnostics HUD
+        m_compositingViewport = true;
+        painter.setTransform(viewportTransform());
+        drawForeground(&painter, mapToScene(event->rect()).boundingRect());
+        m_compositingViewport = false;
+    }
+
+    m_paintStats.lastFrameMs = frameTimer.nsecsElapsed() / 1.0e6;
+    quint64 hitsAfter = 0;
+    quint64 missesAfter = 0;
+    tileCounters(&hitsAfter, &missesAfter);
+    m_currentFrame.frameMs = m_paintStats.lastFrameMs;
+    m_currentFrame.tileHits = hitsAfter - hitsBefore;
+    m_currentFrame.tileMisses = missesAfter - missesBefore;
+    m_currentFrame.mouseMoves = static_cast<int>(m_inputStats.moveEvents - m_inputStatsAtLastFrame.moveEvents);
+    m_currentFrame.mouseDispatches = static_cast<int>(m_inputStats.dispatchedMoves - m_inputStatsAtLastFrame.dispatchedMoves);
+    m_inputStatsAtLastFrame = m_inputStats;
+    // Only recorded with the HUD on, so every exported sample has all of its columns filled in
+    if (m_showDiagnostics)
+    {
+        m_frameStats.addSample(m_currentFrame);
+    }
+
+    if (m_renderQuality == RenderQuality::Interactive)
+    {
+        // Frame governor: a smoothed frame time over budget drops to coarser tiles until idle
+        m_frameTimeAverageMs = qFuzzyIsNull(m_frameTimeAverageMs)
+                                   ? m_paintStats.lastFrameMs
+                                   : 0.75 * m_frameTimeAverageMs + 0.25 * m_paintStats.lastFrameMs;
+        if (m_frameTimeAverageMs > m_frameTimeBudgetMs)
+        {
+            setRenderQuality(RenderQuality::Draft);
+        }
+    }
+}
+
+void Carta::updateSceneLayer()
+{
+    const qreal dpr = viewport()->devicePixelRatioF();
+    const QRect viewRect = viewport()->rect();
+    const QSize pixelSize = (QSizeF(viewRect.size()) * dpr).toSize();
+    const QTransform transform = viewportTransform();
+
+    QRegion dirty;
+    if (!m_sceneLayerValid || m_sceneLayer.size() != pixelSize || !qFuzzyCompare(m_sceneLayer.devicePixelRatio(), dpr))
+    {
+        if (m_sceneLayer.size() != pixelSize)
+        {
+            m_sceneLayer = QPixmap(pixelSize);
+        }
+        m_sceneLayer.setDevicePixelRatio(dpr);
+        dirty = viewRect;
+    }
+    else if (transform != m_sceneLayerTransform)
+    {
+        // A pure pan shifts the cached pixels; only the uncovered strips need rendering
+        const QPointF delta(transform.dx() - m_sceneLayerTransform.dx(), transform.dy() - m_sceneLayerTransform.dy());
+        const QPoint shift = delta.toPoint();
+        const QPointF deviceShift = QPointF(shift) * dpr;
+        const QPoint deviceShiftPx = deviceShift.toPoint();
+        const bool sameLinearPart = qFuzzyCompare(transform.m11(), m_sceneLayerTransform.m11()) &&
+                                    qFuzzyCompare(transform.m22(), m_sceneLayerTransform.m22()) &&
+                                    qFuzzyIsNull(transform.m12() - m_sceneLayerTransform.m12()) &&
+                                    qFuzzyIsNull(transform.m21() - m_sceneLayerTransform.m21());
+        const bool wholePixels = qFuzzyIsNull(delta.x() - shift.x()) && qFuzzyIsNull(delta.y() - shift.y()) &&
+                                 qFuzzyIsNull(deviceShift.x() - deviceShiftPx.x()) &&
+                                 qFuzzyIsNull(deviceShift.y() - deviceShiftPx.y());
+        if (sameLinearPart && wholePixels && std::abs(shift.x()) < viewRect.width() && std::abs(shift.y()) < viewRect.height())
+        {
+            m_sceneLayer.scroll(deviceShiftPx.x(), deviceShiftPx.y(), m_sceneLayer.rect());
+            dirty = QRegion(viewRect) - QRegion(viewRect.translated(shift));
+        }
+        else
+        {
+            dirty = viewRect;
+        }
+    }
+
+    // Scene updates are collected in scene coordinates and mapped with the transform in use now
+    for (const QRectF &sceneRect : std::as_const(m_pendingSceneDirty))
+    {
+        dirty += transform.mapRect(sceneRect).toAlignedRect().adjusted(-2, -2, 2, 2);
+    }
+    m_pendingSceneDirty.clear();
+    m_sceneLayerTransform = transform;
+    m_sceneLayerValid = true;
+
+    dirty &= viewRect;
+    if (dirty.isEmpty())
+    {
+        return;
+    }
+
+    // Many scattered rects cost more in item lookups than one bounding render
+    if (dirty.rectCount() > 8)
+    {
+        dirty = dirty.boundingRect();
+    }
+
+    ++m_paintStats.sceneRenders;
+    const QRect dirtyBounds = dirty.boundingRect();
+    m_currentFrame.exposedRect = dirtyBounds;
+    // A scene lookup of its own, so only paid for while the HUD shows it and kept out of sceneMs
+    if (m_showDiagnostics)
+    {
+        m_currentFrame.itemsDrawn = m_scene.items(mapToScene(dirtyBounds).boundingRect(), Qt::IntersectsItemBoundingRect).size();
+    }
+
+    QElapsedTimer renderTimer;
+    renderTimer.start();
+
+    QPainter layerPainter(&m_sceneLayer);
+    layerPainter.setRenderHints(renderHints());
+    m_renderingSceneLayer = true;
+    for (const QRect &rect : dirty)
+    {
+        layerPainter.fillRect(rect, Qt::black);
+        render(&layerPainter, QRectF(rect), rect, Qt::IgnoreAspectRatio);
+    }
+    m_renderingSceneLayer = false;
+    m_currentFrame.sceneMs = renderTimer.nsecsElapsed() / 1.0e6;
+}
+
+void Carta::invalidateSceneLayer()
+{
+    m_sceneLayerValid = false;
+    viewport()->update();
+}
+
+void Carta::markToolLayerDirty()
+{
+    m_toolLayerDirty = true;
+    viewport()->update();
+}
+
+void Carta::drawToolLayer(QPainter *painter)
+{
+    if (m_toolItems.isEmpty())
+    {
+        return;
+    }
+
+    const qreal dpr = viewport()->devicePixelRatioF();
+    const QRect viewRect = viewport()->rect();
+    const QSize pixelSize = (QSizeF(viewRect.size()) * dpr).toSize();
+    if (m_toolLayer.size() != pixelSize || !qFuzzyCompare(m_toolLayer.devicePixelRatio(), dpr))
+    {
+        m_toolLayer = QPixmap(pixelSize);
+        m_toolLayer.setDevicePixelRatio(dpr);
+        m_toolLayerDirty = true;
+    }
+
+    // Tools are only re-rasterized when one of them changed; otherwise the cached layer is blitted
+    if (m_toolLayerDirty)
+    {
+        QElapsedTimer renderTimer;
+        renderTimer.start();
+        m_toolLayer.fill(Qt::transparent);
+        QPainter toolPainter(&m_toolLayer);
+        toolPainter.setRenderHints(renderHints());
+        m_toolScene.render(&toolPainter, QRectF(viewRect), QRectF(viewRect));
+        m_toolLayerDirty = false;
+        ++m_paintStats.toolLayerRenders;
+        m_currentFrame.toolMs = renderTimer.nsecsElapsed() / 1.0e6;
+    }
+
+    painter->save();
+    // Clip to exclude overlay area so tools don't render on top of toolbox
+    if (m_overlayWidget && m_overlayWidget->isVisible())
+    {
+        QRegion clipRegion(viewRect);
+        clipRegion -= m_overlayWidget->geometry();
+        painter->setClipRegion(clipRegion, Qt::IntersectClip);
+    }
+    painter->drawPixmap(0, 0, m_toolLayer);
+    painter->restore();
+}
+
+void Carta::drawForeground(QPainter *painter, const QRectF &rect)
+{
+    // The scene foreground is already part of the cached scene layer when compositing the viewport
+    if (!m_compositingViewport)
+    {
+        QGraphicsView::drawForeground(painter, rect);
+    }
+
+    // Tools and the HUD go on top of the finished scene layer, not into it; guides are part of it
+    if (m_renderingSceneLayer)
+    {
+        return;
+    }
+
+    // They live in viewport coordinates, without any view transform
+    painter->save();
+    painter->resetTransform();
+    drawSelection(painter);
+    drawToolLayer(painter);
+    drawSnapIndicator(painter);
+    if (m_showDiagnostics)
+    {
+        drawDiagnosticsHud(painter);
+    }
+    painter->restore();
+}
+
+void Carta::tileCounters(quint64 *hits, quint64 *misses) const
+{
+    *hits = m_strokeLayer->tileHits() + m_annotationLayer->tileHits();
+    *misses = m_strokeLayer->tileMisses() + m_annotationLayer->tileMisses();
+    if (m_mapItem)
+    {
+        *hits += m_mapItem->tileHits();
+        *misses += m_mapItem->tileMisses();
+    }
+}
+
+void Carta::setDiagnosticsVisible(bool visible)
+{
+    if (m_showDiagnostics == visible)
+    {
+        return;
+    }
+
+    m_showDiagnostics = visible;
+    if (visible)
+    {
+        // Each time the HUD is shown starts a fresh, unbroken recording
+        m_frameStats.clear();
+        m_diagnosticsTimer->start();
+    }
+    else
+    {
+        m_diagnosticsTimer->stop();
+    }
+    viewport()->update();
+}
+
+bool Carta::exportFrameStats(const QString &filePath) const
+{
+    return m_frameStats.writeCsv(filePath);
+}
+
+void Carta::drawDiagnosticsHud(QPainter *painter)
+{
+    constexpr int kMargin = 12;
+    constexpr int kPadding = 8;
+    constexpr int kHistogramBuckets = 17;
+    constexpr qreal kBucketMs = 2.0;
+    constexpr int kHistogramHeight = 40;
+
+    // The HUD shows the last finished frame; the one being painted is recorded afterwards
+    const FrameSample last = m_frameStats.latest();
+    const QRect exposed = last.exposedRect;
+    const QStringList lines = {
+        tr("Fotograma: %1 ms  (p50 %2 · p95 %3 · p99 %4)")
+            .arg(last.frameMs, 0, 'f', 2)
+            .arg(m_frameStats.percentile(50), 0, 'f', 2)
+            .arg(m_frameStats.percentile(95), 0, 'f', 2)
+            .arg(m_frameStats.percentile(99), 0, 'f', 2),
+        tr("Escena: %1 ms  región %2×%3 en (%4, %5)  elementos %6")
+            .arg(last.sceneMs, 0, 'f', 2)
+            .arg(exposed.width())
+            .arg(exposed.height())
+            .arg(exposed.x())
+            .arg(exposed.y())
+            .arg(last.itemsDrawn),
+        tr("Herramientas: %1 ms").arg(last.toolMs, 0, 'f', 2),
+        tr("Caché de teselas: %1 % aciertos").arg(m_frameStats.tileHitRate() * 100.0, 0, 'f', 1),
+        tr("Anotaciones: %1 trazos · %2 arcos · %3 líneas · %4 puntos · %5 textos")
+            .arg(m_annotations.count(AnnotationKind::Stroke))
+            .arg(m_annotations.count(AnnotationKind::Arc))
+            .arg(m_annotations.count(AnnotationKind::Line))
+            .arg(m_annotations.count(AnnotationKind::Point))
+            .arg(m_annotations.count(AnnotationKind::Text)),
+        tr("Trazos a mano: %1 muestras → %2 vértices (%3 % menos)")
+            .arg(m_strokeStats.samples)
+            .arg(m_strokeStats.storedVertices)
+            .arg(m_strokeStats.samples > 0 ? 100.0 * (1.0 - static_cast<qreal>(m_strokeStats.storedVertices) / m_strokeStats.samples) : 0.0, 0, 'f', 1),
+        tr("Geometría: %1 vértices en %2 KiB")
+            .arg(m_annotationGeometry.totalVertexCount())
+            .arg(m_annotationGeometry.memoryUsage() / 1024.0, 0, 'f', 1),
+        tr("Ajuste: %1 objetivos en %2 celdas")
+            .arg(m_snapIndex.featureCount())
+            .arg(m_snapIndex.cellCount()),
+        tr("Ratón: %1 movimientos → %2 atendidos (%3:1)  último frame %4 → %5")
+            .arg(m_inputStats.moveEvents)
+            .arg(m_inputStats.dispatchedMoves)
+            .arg(m_inputStats.dispatchedMoves > 0 ? static_cast<qreal>(m_inputStats.moveEvents) / m_inputStats.dispatchedMoves : 1.0, 0, 'f', 2)
+            .arg(last.mouseMoves)
+            .arg(last.mouseDispatches),
+    };
+
+    QFont font = painter->font();
+    font.setFamily(QStringLiteral("monospace"));
+    font.setStyleHint(QFont::Monospace);
+    font.setPointSize(9);
+    painter->setFont(font);
+    const QFontMetrics metrics(font);
+
+    int textWidth = 0;
+    for (const QString &line : lines)
+    {
+        textWidth = std::max(textWidth, metrics.horizontalAdvance(line));
+    }
+    const int lineHeight = metrics.height();
+    const int width = textWidth + 2 * kPadding;
+    const int height = lines.size() * lineHeight + kHistogramHeight + 3 * kPadding;
+    const QRect panel(kMargin, viewport()->height() - height - kMargin, width, height);
+
+    painter->setRenderHint(QPainter::Antialiasing, false);
+    painter->setPen(Qt::NoPen);
+    painter->setBrush(QColor(0, 0, 0, 190));
+    painter->drawRect(panel);
+
+    painter->setPen(Qt::white);
+    int y = panel.top() + kPadding + metrics.ascent();
+    for (const QString &line : lines)
+    {
+        painter->drawText(panel.left() + kPadding, y, line);
+        y += lineHeight;
+    }
+
+    // Rolling histogram of frame times, 2 ms per bar; the last bar collects everything slower
+    const QVector<int> buckets = m_frameStats.histogram(kHistogramBuckets, kBucketMs);
+    const int peak = std::max(1, *std::max_element(buckets.cbegin(), buckets.cend()));
+    const QRect chart(panel.left() + kPadding, panel.bottom() - kPadding - kHistogramHeight,
+                      width - 2 * kPadding, kHistogramHeight);
+    const qreal barWidth = static_cast<qreal>(chart.width()) / buckets.size();
+    painter->setPen(Qt::NoPen);
+    for (int i = 0; i < buckets.size(); ++i)
+    {
+        const qreal barHeight = static_cast<qreal>(buckets.at(i)) / peak * chart.height();
+        const qreal bucketEndMs = (i + 1) * kBucketMs;
+        painter->setBrush(bucketEndMs <= m_frameTimeBudgetMs ? QColor(80, 200, 120) : QColor(230, 90, 70));
+        painter->drawRect(QRectF(chart.left() + i * barWidth, chart.bottom() - barHeight, barWidth - 1.0, barHeight));
+    }
+}
+
+bool Carta::overlayContainsViewportPoint(const QPoint &point) const
+{
+    if (!m_overlayWidget)
+    {
+        return false;
+    }
+
+    return m_overlayWidget->geometry().contains(point);
+}
+
+MapToolItem *Carta::rulerAt(const QPointF &scenePos) const
+{
+    // Convert map scene pos to viewport pos, then to tool scene pos
+    const QPoint viewportPos = mapFromScene(scenePos);
+    const QPointF toolScenePos = QPointF(viewportPos);
+    for (QGraphicsItem *candidate : m_toolIndex.candidatesAt(toolScenePos))
+    {
+        auto *tool = static_cast<MapToolItem *>(candidate);
+        if (tool->toolId() == QLatin1String("tool_ruler") && tool->containsToolScenePoint(toolScenePos))
+        {
+            return tool;
+        }
+    }
+    return nullptr;
+}
+
+QPointF Carta::rulerDirection(MapToolItem *ruler) const
+{
+    if (!ruler)
+    {
+        return QPointF(1.0, 0.0);
+    }
+
+    // Ruler rotation is in tool scene, direction follows Qt's clockwise rotation
+    // In screen coordinates (Y down), rotation angle follows standard trigonometry
+    const qreal angleDeg = ruler->rotation();
+    const qreal angleRad = qDegreesToRadians(angleDeg);
+    return QPointF(std::cos(angleRad), std::sin(angleRad));
+}
+
+void Carta::setGeometrySnapEnabled(bool enabled)
+{
+    m_geometrySnap = enabled;
+    if (!enabled)
+    {
+        clearSnapIndicator();
+    }
+}
+
+QPointF Carta::snapScenePoint(const QPointF &scenePos, AnnotationSnapIndex::Match *match) const
+{
+    AnnotationSnapIndex::Match found;
+    const bool suppressed = !m_geometrySnap || (QApplication::keyboardModifiers() & Qt::AltModifier);
+    const qreal radius = kSnapRadiusPx / m_currentScale;
+    // Stroke vertices rank below every indexed target, so they are only looked up when none is in reach
+    if (!suppressed && (m_snapIndex.snap(scenePos, radius, &found) || snapToStrokeVertex(scenePos, radius, &found)))
+    {
+        if (match)
+        {
+            *match = found;
+        }
+        return found.pos;
+    }
+
+    if (match)
+    {
+        *match = AnnotationSnapIndex::Match();
+    }
+    return scenePos;
+}
+
+bool Carta::snapToStrokeVertex(const QPointF &scenePos, qreal radius, AnnotationSnapIndex::Match *match) const
+{
+    // A vertex within reach belongs to a segment within reach, and the spatial index already files those
+    const QList<AnnotationSpatialIndex::Hit> hits = m_spatialIndex.sweep(scenePos, scenePos, radius);
+    qreal bestDistance = radius * radius;
+    bool found = false;
+    for (const AnnotationSpatialIndex::Hit &hit : hits)
+    {
+        const auto *pathItem = qgraphicsitem_cast<const CompactPathItem *>(hit.item);
+        if (!pathItem || m_annotations.kind(hit.item) != AnnotationKind::Stroke)
+        {
+            continue;
+        }
+
+        const QPointF offset = hit.item->scenePos();
+        const int segmentCount = pathItem->segmentCount();
+        for (int segment : hit.segments)
+        {
+            // Both ends of the segment; the ends of the whole stroke are endpoints in the snap index
+            for (int index : {segment, segment + 1})
+            {
+                if (index <= 0 || index >= segmentCount)
+                {
+                    continue;
+                }
+                const QPointF vertex = pathItem->segmentStart(index) + offset;
+                const QPointF delta = vertex - scenePos;
+                const qreal distance = delta.x() * delta.x() + delta.y() * delta.y();
+                if (distance <= bestDistance)
+                {
+                    bestDistance = distance;
+                    match->pos = vertex;
+                    match->feature = AnnotationSnapIndex::Feature::Vertex;
+                    match->item = hit.item;
+                    found = true;
+                }
+            }
+        }
+    }
+    return found;
+}
+
+QPointF Carta::trackSnap(const QPointF &scenePos)
 {
-    Q_UNUSED(rect);
-    
-    // Render tool scene on top without any view transform
-    painter->save();
-    painter->resetTransform();
-    const QRect viewRect = viewport()->rect();
-    
-    // Clip to exclude overlay area so tools don't render on top of toolbox
-    if (m_overlayWidget && m_overlayWidget->isVisible())
-    {
-        QRegion clipRegion(viewRect);
-        clipRegion -= m_overlayWidget->geometry();
-        painter->setClipRegion(clipRegion);
+    AnnotationSnapIndex::Match match;
+    const QPointF snapped = snapScenePoint(scenePos, &match);
+    const bool found = match.item != nullptr;
+    if (found != m_hasSnapIndicator
+        || (found && (match.pos != m_snapIndicator.pos || match.feature != m_snapIndicator.feature)))
+    {
+        m_snapIndicator = match;
+        m_hasSnapIndicator = found;
+        viewport()->update();
     }
-    
-    m_toolScene.render(painter, viewRect, QRectF(viewRect));
-    painter->restore();
-    
-    QGraphicsView::drawForeground(painter, rect);
+    return snapped;
 }
 
-bool Carta::overlayContainsViewportPoint(const QPoint &point) const
+bool Carta::snapToolScenePoint(const QPointF &toolScenePos, QPointF *snapped)
 {
-    if (!m_overlayWidget)
+    // Tools live in viewport coordinates, annotations in the chart scene
+    const QTransform toViewport = viewportTransform();
+    const QPointF target = trackSnap(toViewport.inverted().map(toolScenePos));
+    if (!m_hasSnapIndicator)
     {
         return false;
     }
-
-    return m_overlayWidget->geometry().contains(point);
-}
-
-MapToolItem *Carta::rulerItem() const
-{
-    return m_activeToolItems.value(QStringLiteral("tool_ruler"), nullptr);
+    *snapped = toViewport.map(target);
+    return true;
 }
 
-bool Carta::pointHitsRuler(const QPointF &scenePos, MapToolItem *ruler) const
+void Carta::clearSnapIndicator()
 {
-    if (!ruler)
+    if (!m_hasSnapIndicator)
     {
-        return false;
+        return;
     }
-
-    // Convert map scene pos to viewport pos, then to tool scene pos
-    const QPoint viewportPos = mapFromScene(scenePos);
-    const QPointF toolScenePos = QPointF(viewportPos);
-    const QPointF localPos = ruler->mapFromScene(toolScenePos);
-    return ruler->shape().contains(localPos);
+    m_hasSnapIndicator = false;
+    viewport()->update();
 }
 
-QPointF Carta::rulerDirection(MapToolItem *ruler) const
+void Carta::drawSnapIndicator(QPainter *painter)
 {
-    if (!ruler)
+    if (!m_hasSnapIndicator)
     {
-        return QPointF(1.0, 0.0);
+        return;
     }
 
-    // Ruler rotation is in tool scene, direction follows Qt's clockwise rotation
-    // In screen coordinates (Y down), rotation angle follows standard trigonometry
-    const qreal angleDeg = ruler->rotation();
-    const qreal angleRad = qDegreesToRadians(angleDeg);
-    return QPointF(std::cos(angleRad), std::sin(angleRad));
+    constexpr qreal kMarkerRadius = 6.0;
+    const QPointF at = viewportTransform().map(m_snapIndicator.pos);
+    const QRectF box(at.x() - kMarkerRadius, at.y() - kMarkerRadius, kMarkerRadius * 2, kMarkerRadius * 2);
+
+    painter->save();
+    painter->setRenderHint(QPainter::Antialiasing, true);
+    painter->setBrush(Qt::NoBrush);
+    // Dark outline first so the marker reads on any chart colour
+    const QPen pens[] = {QPen(QColor(0, 0, 0, 160), 4.0), QPen(QColor(0, 170, 255), 2.0)};
+    for (const QPen &pen : pens)
+    {
+        painter->setPen(pen);
+        switch (m_snapIndicator.feature)
+        {
+        case AnnotationSnapIndex::Feature::Intersection:
+            painter->drawLine(box.topLeft(), box.bottomRight());
+            painter->drawLine(box.topRight(), box.bottomLeft());
+            break;
+        case AnnotationSnapIndex::Feature::Endpoint:
+            painter->drawRect(box);
+            break;
+        case AnnotationSnapIndex::Feature::Point:
+            painter->drawEllipse(box);
+            break;
+        case AnnotationSnapIndex::Feature::Center:
+            painter->drawEllipse(box);
+            painter->drawLine(QPointF(box.left(), at.y()), QPointF(box.right(), at.y()));
+            painter->drawLine(QPointF(at.x(), box.top()), QPointF(at.x(), box.bottom()));
+            break;
+        case AnnotationSnapIndex::Feature::Vertex:
+            painter->drawPolygon(QPolygonF({QPointF(at.x(), box.top()), QPointF(box.right(), at.y()),
+                                            QPointF(at.x(), box.bottom()), QPointF(box.left(), at.y())}));
+            break;
+        }
+    }
+    painter->restore();
 }
 
 QPointF Carta::applyRulerSnap(const QPointF &prevPoint, const QPointF &candidate) const
 {
-    MapToolItem *ruler = rulerItem();
-    if (!pointHitsRuler(candidate, ruler))
+    MapToolItem *ruler = rulerAt(candidate);
+    if (!ruler)
     {
         return candidate;
     }
@@ -2453,7 +3930,17 @@ void Carta::handleTextClick(const QPointF &scenePos)
         return;
     }
 
-    auto *textItem = new QGraphicsSimpleTextItem(text);
+    addTextAnnotation(scenePos, text);
+}
+
+QGraphicsSimpleTextItem *Carta::addTextAnnotation(const QPointF &scenePos, const QString &text)
+{
+    if (text.isEmpty())
+    {
+        return nullptr;
+    }
+
+    auto *textItem = new RasterizedAnnotationItem<QGraphicsSimpleTextItem>(text);
     QFont font = textItem->font();
     font.setPointSize(36);
     font.setWeight(QFont::DemiBold);
@@ -2463,14 +3950,19 @@ void Carta::handleTextClick(const QPointF &scenePos)
     textItem->setPos(scenePos - bounds.center());
     textItem->setZValue(95.0);
     m_scene.addItem(textItem);
-    m_textItems.append(textItem);
-    registerAnnotation(textItem);
+    registerAnnotation(textItem, AnnotationKind::Text);
+    return textItem;
 }
 
 void Carta::handlePointClick(const QPointF &scenePos)
+{
+    addPointAnnotation(snapScenePoint(scenePos));
+}
+
+QGraphicsEllipseItem *Carta::addPointAnnotation(const QPointF &scenePos)
 {
     const qreal radius = std::max<qreal>(4.0, m_strokeWidth * 1.2);
-    auto *pointItem = new QGraphicsEllipseItem(-radius, -radius, radius * 2, radius * 2);
+    auto *pointItem = new RasterizedAnnotationItem<QGraphicsEllipseItem>(-radius, -radius, radius * 2, radius * 2);
     QColor fill = m_drawingColor;
     fill.setAlphaF(std::clamp(m_strokeOpacity / 100.0, 0.0, 1.0));
     pointItem->setBrush(QBrush(fill));
@@ -2482,132 +3974,51 @@ void Carta::handlePointClick(const QPointF &scenePos)
     pointItem->setFlag(QGraphicsItem::ItemIsSelectable, true);
     pointItem->setZValue(93.0);
     m_scene.addItem(pointItem);
-    m_pointItems.append(pointItem);
-    registerAnnotation(pointItem);
+    registerAnnotation(pointItem, AnnotationKind::Point);
+    return pointItem;
 }
 
 void Carta::handleGridClick(const QPointF &scenePos)
 {
-    // Eliminar líneas anteriores si existen
-    if (m_currentHLine) {
-        m_scene.removeItem(m_currentHLine);
-        delete m_currentHLine;
-        m_currentHLine = nullptr;
-    }
-    if (m_currentVLine) {
-        m_scene.removeItem(m_currentVLine);
-        delete m_currentVLine;
-        m_currentVLine = nullptr;
-    }
-    
-    const QRectF sceneRect = m_scene.sceneRect();
-    if (!sceneRect.isValid()) {
-        return;
-    }
-    
-    // Crear línea horizontal
-    m_currentHLine = new QGraphicsLineItem(sceneRect.left(), scenePos.y(), sceneRect.right(), scenePos.y());
-    QPen pen(Qt::black);
-    pen.setWidth(2);
-    pen.setStyle(Qt::DashLine);
-    QColor color = Qt::black;
-    color.setAlpha(180);
-    pen.setColor(color);
-    m_currentHLine->setPen(pen);
-    m_currentHLine->setZValue(85.0);
-    m_scene.addItem(m_currentHLine);
-    
-    // Crear línea vertical
-    m_currentVLine = new QGraphicsLineItem(scenePos.x(), sceneRect.top(), scenePos.x(), sceneRect.bottom());
-    m_currentVLine->setPen(pen);
-    m_currentVLine->setZValue(85.0);
-    m_scene.addItem(m_currentVLine);
+    // Sustituye la cruz anterior; se dibuja en drawGuides
+    m_gridGuide = scenePos;
+    m_hasGridGuide = true;
+    m_guideItem->update();
 }
 
 void Carta::handleLineClick(const QPointF &scenePos)
 {
+    const QPointF target = snapScenePoint(scenePos);
     if (!m_lineDrawing)
     {
-        startLineSegment(scenePos);
+        startLineSegment(target);
         return;
     }
 
-    finishLineSegment(scenePos);
-}
-
-void Carta::removeTextItems()
-{
-    for (QGraphicsSimpleTextItem *item : m_textItems)
-    {
-        if (!item)
-        {
-            continue;
-        }
-        unregisterAnnotation(item);
-        m_scene.removeItem(item);
-        delete item;
-    }
-    m_textItems.clear();
-}
-
-void Carta::removeStrokeItems()
-{
-    for (QGraphicsPathItem *item : m_strokeItems)
-    {
-        if (!item)
-        {
-            continue;
-        }
-        unregisterAnnotation(item);
-        m_scene.removeItem(item);
-        delete item;
-    }
-    m_strokeItems.clear();
-}
-
-void Carta::removePointItems()
-{
-    for (QGraphicsEllipseItem *item : m_pointItems)
-    {
-        if (!item)
-        {
-            continue;
-        }
-        unregisterAnnotation(item);
-        m_scene.removeItem(item);
-        delete item;
-    }
-    m_pointItems.clear();
-}
-
-void Carta::removeLineItems()
-{
-    for (QGraphicsLineItem *item : m_lineItems)
-    {
-        if (!item)
-        {
-            continue;
-        }
-        unregisterAnnotation(item);
-        m_scene.removeItem(item);
-        delete item;
-    }
-    m_lineItems.clear();
+    finishLineSegment(target);
 }
 
-void Carta::removeArcItems()
+void Carta::removeAllAnnotations()
 {
-    for (QGraphicsPathItem *item : m_arcItems)
+    // Parked strokes and arcs must release their geometry before the store is reset
+    m_history.clear();
+    cancelSelectionGesture();
+    clearSelection();
+    m_strokeLayer->clear();
+    m_annotationLayer->clear();
+    m_strokeSmoothingJobs.clear();
+    const QList<QGraphicsItem *> items = m_annotations.items();
+    m_annotations.clear();
+    m_spatialIndex.clear();
+    m_snapIndex.clear();
+    clearSnapIndicator();
+    projectionPointsChanged();
+    for (QGraphicsItem *item : items)
     {
-        if (!item)
-        {
-            continue;
-        }
-        unregisterAnnotation(item);
         m_scene.removeItem(item);
         delete item;
     }
-    m_arcItems.clear();
+    m_annotationGeometry.clear();
 }
 
 void Carta::startLineSegment(const QPointF &scenePos)
@@ -2653,7 +4064,13 @@ void Carta::finishLineSegment(const QPointF &scenePos)
         return;
     }
 
-    auto *lineItem = new QGraphicsLineItem(finalLine);
+    addLineAnnotation(finalLine);
+    cancelLinePreview();
+}
+
+QGraphicsLineItem *Carta::addLineAnnotation(const QLineF &line)
+{
+    auto *lineItem = new RasterizedAnnotationItem<QGraphicsLineItem>(line);
     QPen pen(m_drawingColor);
     QColor color = m_drawingColor;
     color.setAlphaF(std::clamp(m_strokeOpacity / 100.0, 0.0, 1.0));
@@ -2663,9 +4080,8 @@ void Carta::finishLineSegment(const QPointF &scenePos)
     lineItem->setPen(pen);
     lineItem->setZValue(93.0);
     m_scene.addItem(lineItem);
-    m_lineItems.append(lineItem);
-    registerAnnotation(lineItem);
-    cancelLinePreview();
+    registerAnnotation(lineItem, AnnotationKind::Line);
+    return lineItem;
 }
 
 void Carta::cancelLinePreview()
@@ -2682,7 +4098,7 @@ void Carta::cancelLinePreview()
     m_lineDrawing = false;
 }
 
-QGraphicsPathItem *Carta::addArcAnnotation(const QPointF &center, qreal radius, qreal startAngleDeg, qreal spanAngleDeg, qreal rotationOffsetDeg)
+CompactPathItem *Carta::addArcAnnotation(const QPointF &center, qreal radius, qreal startAngleDeg, qreal spanAngleDeg, qreal rotationOffsetDeg)
 {
     if (radius <= 0.0 || qFuzzyIsNull(spanAngleDeg))
     {
@@ -2710,27 +4126,17 @@ QGraphicsPathItem *Carta::addArcAnnotation(const QPointF &center, qreal radius,
         path = rot.map(path);
     }
 
-    auto *arcItem = new QGraphicsPathItem(path);
-    QPen pen(m_drawingColor);
+    QPen pen = strokePen();
     pen.setWidth(std::max(1, m_strokeWidth));
-    pen.setCapStyle(Qt::RoundCap);
-    pen.setJoinStyle(Qt::RoundJoin);
-    QColor color = m_drawingColor;
-    color.setAlphaF(std::clamp(m_strokeOpacity / 100.0, 0.0, 1.0));
-    pen.setColor(color);
-    arcItem->setPen(pen);
+    auto *arcItem = new RasterizedAnnotationItem<CompactPathItem>(&m_annotationGeometry, path, pen);
     arcItem->setZValue(91.0);
     m_scene.addItem(arcItem);
-    m_arcItems.append(arcItem);
-    registerAnnotation(arcItem);
+    registerAnnotation(arcItem, AnnotationKind::Arc);
     return arcItem;
 }
 
-void Carta::startStroke(const QPointF &scenePos)
+QPen Carta::strokePen() const
 {
-    abortCurrentStroke();
-
-    auto *pathItem = new QGraphicsPathItem();
     QPen pen(m_drawingColor);
     pen.setWidth(m_strokeWidth);
     pen.setCapStyle(Qt::RoundCap);
@@ -2738,14 +4144,42 @@ void Carta::startStroke(const QPointF &scenePos)
     QColor color = m_drawingColor;
     color.setAlphaF(std::clamp(m_strokeOpacity / 100.0, 0.0, 1.0));
     pen.setColor(color);
-    pathItem->setPen(pen);
-    pathItem->setZValue(90.0);
+    return pen;
+}
+
+CompactPathItem *Carta::createStrokeItem(const QPainterPath &path)
+{
+    // Geometry goes to the packed store; pixels are baked into the annotation layer once registered
+    auto *pathItem = new RasterizedAnnotationItem<CompactPathItem>(&m_annotationGeometry, path, strokePen());
+    pathItem->setZValue(kStrokeZValue);
+    return pathItem;
+}
+
+CompactPathItem *Carta::addStrokeAnnotation(const QPainterPath &path)
+{
+    if (path.isEmpty())
+    {
+        return nullptr;
+    }
 
-    m_currentStrokePath = QPainterPath(scenePos);
-    m_currentStrokePath.lineTo(scenePos);
-    pathItem->setPath(m_currentStrokePath);
+    CompactPathItem *pathItem = createStrokeItem(path);
     m_scene.addItem(pathItem);
-    m_currentStroke = pathItem;
+    registerAnnotation(pathItem, AnnotationKind::Stroke);
+    return pathItem;
+}
+
+void Carta::startStroke(const QPointF &scenePos)
+{
+    abortCurrentStroke();
+
+    auto *liveItem = new LiveStrokeItem(scenePos);
+    liveItem->setPen(strokePen());
+    liveItem->setZValue(kStrokeZValue);
+
+    m_scene.addItem(liveItem);
+    m_currentStroke = liveItem;
+    m_currentStrokeSamples = 1;
+    m_currentStrokeHasEnd = false;
     m_painting = true;
 }
 
@@ -2756,15 +4190,24 @@ void Carta::extendStroke(const QPointF &scenePos)
         return;
     }
 
-    const QPointF adjusted = applyRulerSnap(m_currentStrokePath.currentPosition(), scenePos);
+    const QPointF adjusted = applyRulerSnap(m_currentStroke->lastPoint(), scenePos);
 
-    if (adjusted == m_currentStrokePath.currentPosition())
+    if (adjusted == m_currentStroke->lastPoint())
     {
         return;
     }
 
-    m_currentStrokePath.lineTo(adjusted);
-    m_currentStroke->setPath(m_currentStrokePath);
+    ++m_currentStrokeSamples;
+    // Samples closer than the tolerance add vertices without visible detail
+    if (!StrokeProcessing::acceptsSample(m_currentStroke->lastPoint(), adjusted, kStrokeSampleTolerancePx / m_currentScale))
+    {
+        m_currentStrokeEnd = adjusted;
+        m_currentStrokeHasEnd = true;
+        return;
+    }
+
+    m_currentStrokeHasEnd = false;
+    m_currentStroke->appendPoint(adjusted);
 }
 
 void Carta::finishStroke()
@@ -2775,18 +4218,83 @@ void Carta::finishStroke()
         return;
     }
 
-    m_strokeItems.append(m_currentStroke);
-    registerAnnotation(m_currentStroke);
+    QPolygonF points = m_currentStroke->points();
+    if (m_currentStrokeHasEnd)
+    {
+        points.append(m_currentStrokeEnd);
+    }
+    points = StrokeProcessing::simplify(points, kStrokeSimplifyTolerancePx / m_currentScale);
+
+    ++m_strokeStats.strokes;
+    m_strokeStats.samples += m_currentStrokeSamples;
+    m_strokeStats.storedVertices += points.size();
+
+    // Swap the live item for a regular committed annotation that the raster layer can bake
+    CompactPathItem *pathItem = createStrokeItem(StrokeProcessing::polylinePath(points));
+    pathItem->setPen(m_currentStroke->pen());
+    m_scene.removeItem(m_currentStroke);
+    delete m_currentStroke;
     m_currentStroke = nullptr;
-    m_currentStrokePath = QPainterPath();
+    m_currentStrokeHasEnd = false;
+
+    m_scene.addItem(pathItem);
+    registerAnnotation(pathItem, AnnotationKind::Stroke);
     m_painting = false;
+
+    if (m_strokeSmoothing)
+    {
+        smoothStroke(pathItem, points);
+    }
+}
+
+void Carta::smoothStroke(CompactPathItem *pathItem, const QPolygonF &points)
+{
+    if (points.size() < 3)
+    {
+        return;
+    }
+
+    if (points.size() <= kSyncSmoothingVertices)
+    {
+        replaceStrokePath(pathItem, StrokeProcessing::smoothPath(points));
+        return;
+    }
+
+    // The polyline stays visible until the fitted curve is ready
+    auto *watcher = new QFutureWatcher<QPainterPath>(this);
+    m_strokeSmoothingJobs.insert(pathItem, watcher);
+    connect(watcher, &QFutureWatcher<QPainterPath>::finished, this, [this, pathItem, watcher]()
+            {
+        watcher->deleteLater();
+        // Undone, erased or cleared while the curve was being fitted
+        if (m_strokeSmoothingJobs.value(pathItem) != watcher)
+        {
+            return;
+        }
+        m_strokeSmoothingJobs.remove(pathItem);
+        replaceStrokePath(pathItem, watcher->result()); });
+    watcher->setFuture(QtConcurrent::run(&StrokeProcessing::smoothPath, points));
+}
+
+void Carta::replaceStrokePath(CompactPathItem *pathItem, const QPainterPath &path)
+{
+    rasterLayerFor(pathItem)->invalidate(pathItem->sceneBoundingRect());
+    m_spatialIndex.remove(pathItem);
+    m_snapIndex.remove(pathItem);
+    pathItem->setPath(path);
+    m_spatialIndex.insert(pathItem);
+    if (m_annotations.contains(pathItem))
+    {
+        m_snapIndex.insert(pathItem, m_annotations.kind(pathItem));
+    }
+    rasterLayerFor(pathItem)->invalidate(pathItem->sceneBoundingRect());
+    emit annotationChanged(pathItem);
 }
 
 void Carta::abortCurrentStroke()
 {
     if (!m_currentStroke)
     {
-        m_currentStrokePath = QPainterPath();
         m_painting = false;
         return;
     }
@@ -2794,102 +4302,176 @@ void Carta::abortCurrentStroke()
     m_scene.removeItem(m_currentStroke);
     delete m_currentStroke;
     m_currentStroke = nullptr;
-    m_currentStrokePath = QPainterPath();
     m_painting = false;
 }
 
-void Carta::eraseAt(const QPointF &scenePos)
+void Carta::eraseAlong(const QPointF &from, const QPointF &to)
 {
-    const QList<QGraphicsItem *> items = m_scene.items(scenePos, Qt::IntersectsItemShape, Qt::DescendingOrder);
-    for (QGraphicsItem *item : items)
+    const QList<AnnotationSpatialIndex::Hit> hits = m_spatialIndex.sweep(from, to, kEraserRadiusPx / m_currentScale);
+    if (hits.isEmpty())
+    {
+        return;
+    }
+
+    // Every item erased during one drag becomes a single undo step
+    AnnotationHistory::Command command;
+    command.type = AnnotationHistory::CommandType::Remove;
+    command.mergeId = m_eraseGesture;
+    for (const AnnotationSpatialIndex::Hit &hit : hits)
     {
-        if (removeAnnotationItem(item))
+        const AnnotationKind kind = m_annotations.kind(hit.item);
+        auto *pathItem = qgraphicsitem_cast<CompactPathItem *>(hit.item);
+        if (m_eraserSplitsStrokes && kind == AnnotationKind::Stroke && pathItem && pathItem->isPolyline())
         {
-            break;
+            const QList<CompactPathItem *> pieces = splitStroke(pathItem, hit.segments);
+            for (CompactPathItem *piece : pieces)
+            {
+                command.added.append(piece);
+                command.addedKinds.append(kind);
+            }
         }
+
+        command.items.append(hit.item);
+        command.kinds.append(kind);
+        parkAnnotation(hit.item);
     }
+    m_history.push(std::move(command));
 }
 
-bool Carta::removeAnnotationItem(QGraphicsItem *item)
+QList<CompactPathItem *> Carta::splitStroke(CompactPathItem *pathItem, const QList<int> &erasedSegments)
 {
-    if (!item)
-    {
-        return false;
-    }
+    const QPainterPath path = pathItem->path();
+    const int vertexCount = path.elementCount();
+    const QPen pen = pathItem->pen();
 
-    if (auto *textItem = qgraphicsitem_cast<QGraphicsSimpleTextItem *>(item))
+    QList<CompactPathItem *> pieces;
+    const auto addPiece = [&](int first, int last)
     {
-        if (!m_textItems.contains(textItem))
+        // A lone vertex would be left as a dot
+        if (last <= first)
         {
-            return false;
+            return;
         }
-        unregisterAnnotation(textItem);
-        m_textItems.removeAll(textItem);
-        m_scene.removeItem(textItem);
-        delete textItem;
-        return true;
-    }
-
-    if (auto *ellipseItem = qgraphicsitem_cast<QGraphicsEllipseItem *>(item))
-    {
-        if (!m_pointItems.contains(ellipseItem))
+        QPolygonF points;
+        points.reserve(last - first + 1);
+        for (int i = first; i <= last; ++i)
         {
-            return false;
+            points.append(path.elementAt(i));
         }
-        unregisterAnnotation(ellipseItem);
-        m_pointItems.removeAll(ellipseItem);
-        m_scene.removeItem(ellipseItem);
-        delete ellipseItem;
-        return true;
+        auto *piece = new RasterizedAnnotationItem<CompactPathItem>(&m_annotationGeometry, StrokeProcessing::polylinePath(points), pen);
+        piece->setZValue(pathItem->zValue());
+        piece->setPos(pathItem->pos());
+        m_scene.addItem(piece);
+        attachAnnotation(piece, AnnotationKind::Stroke);
+        pieces.append(piece);
+    };
+
+    // Segment i joins vertices i and i + 1; the runs between erased segments survive
+    int runStart = 0;
+    for (int segment : erasedSegments)
+    {
+        addPiece(runStart, segment);
+        runStart = segment + 1;
+    }
+    addPiece(runStart, vertexCount - 1);
+    return pieces;
+}
+
+bool Carta::parkAnnotation(QGraphicsItem *item)
+{
+    if (!item || !m_annotations.contains(item))
+    {
+        return false;
     }
 
-    if (auto *lineItem = qgraphicsitem_cast<QGraphicsLineItem *>(item))
+    m_strokeSmoothingJobs.remove(item);
+    emit annotationRemoved(item);
+    unregisterAnnotation(item);
+    m_scene.removeItem(item);
+    return true;
+}
+
+void Carta::unparkAnnotation(QGraphicsItem *item, AnnotationKind kind)
+{
+    if (!item || m_annotations.contains(item))
     {
-        if (!m_lineItems.contains(lineItem))
-        {
-            return false;
-        }
-        unregisterAnnotation(lineItem);
-        m_lineItems.removeAll(lineItem);
-        m_scene.removeItem(lineItem);
-        delete lineItem;
-        return true;
+        return;
     }
 
-    if (auto *pathItem = qgraphicsitem_cast<QGraphicsPathItem *>(item))
+    m_scene.addItem(item);
+    attachAnnotation(item, kind);
+}
+
+void Carta::parkAnnotations(const QList<QGraphicsItem *> &items)
+{
+    // Detached up front, so parking each item no longer touches the tiles
+    m_strokeLayer->removeAnnotations(items);
+    m_annotationLayer->removeAnnotations(items);
+    for (QGraphicsItem *item : items)
     {
-        if (m_strokeItems.contains(pathItem))
-        {
-            unregisterAnnotation(pathItem);
-            m_strokeItems.removeAll(pathItem);
-            m_scene.removeItem(pathItem);
-            delete pathItem;
-            return true;
-        }
+        parkAnnotation(item);
+    }
+}
 
-        if (m_arcItems.contains(pathItem))
+void Carta::unparkAnnotations(const QList<QGraphicsItem *> &items, const QList<AnnotationKind> &kinds)
+{
+    QList<QGraphicsItem *> restored;
+    QList<AnnotationKind> restoredKinds;
+    restored.reserve(items.size());
+    restoredKinds.reserve(items.size());
+    for (qsizetype i = 0; i < items.size(); ++i)
+    {
+        QGraphicsItem *item = items.at(i);
+        if (!item || m_annotations.contains(item))
         {
-            unregisterAnnotation(pathItem);
-            m_arcItems.removeAll(pathItem);
-            m_scene.removeItem(pathItem);
-            delete pathItem;
-            return true;
+            continue;
         }
-
-        return false;
+        m_scene.addItem(item);
+        restored.append(item);
+        restoredKinds.append(kinds.at(i));
     }
 
-    return false;
+    // Attached in one batch per layer; attachAnnotation then finds them already in their layer
+    QList<QGraphicsItem *> restoredStrokes;
+    QList<QGraphicsItem *> restoredOthers;
+    for (QGraphicsItem *item : std::as_const(restored))
+    {
+        (rasterLayerFor(item) == m_strokeLayer ? restoredStrokes : restoredOthers).append(item);
+    }
+    m_strokeLayer->addAnnotations(restoredStrokes);
+    m_annotationLayer->addAnnotations(restoredOthers);
+    for (qsizetype i = 0; i < restored.size(); ++i)
+    {
+        attachAnnotation(restored.at(i), restoredKinds.at(i));
+    }
 }
 
-void Carta::registerAnnotation(QGraphicsItem *item)
+void Carta::registerAnnotation(QGraphicsItem *item, AnnotationKind kind)
 {
     if (!item)
     {
         return;
     }
-    m_annotationStack.removeAll(item);
-    m_annotationStack.append(item);
+    attachAnnotation(item, kind);
+
+    AnnotationHistory::Command command;
+    command.type = AnnotationHistory::CommandType::Add;
+    command.items.append(item);
+    command.kinds.append(kind);
+    m_history.push(std::move(command));
+}
+
+void Carta::attachAnnotation(QGraphicsItem *item, AnnotationKind kind)
+{
+    m_annotations.add(item, kind);
+    m_spatialIndex.insert(item);
+    m_snapIndex.insert(item, kind);
+    if (kind == AnnotationKind::Point)
+    {
+        projectionPointsChanged();
+    }
+    rasterLayerFor(item)->addAnnotation(item);
+    emit annotationAdded(item);
 }
 
 void Carta::unregisterAnnotation(QGraphicsItem *item)
@@ -2898,7 +4480,19 @@ void Carta::unregisterAnnotation(QGraphicsItem *item)
     {
         return;
     }
-    m_annotationStack.removeAll(item);
+    if (m_annotations.contains(item, AnnotationKind::Point))
+    {
+        projectionPointsChanged();
+    }
+    m_annotations.remove(item);
+    m_spatialIndex.remove(item);
+    m_snapIndex.remove(item);
+    rasterLayerFor(item)->removeAnnotation(item);
+    if (m_selection.remove(item))
+    {
+        ++m_selectionId;
+        viewport()->update();
+    }
 }
 
 void Carta::contextMenuEvent(QContextMenuEvent *event)
@@ -2924,7 +4518,22 @@ void Carta::keyPressEvent(QKeyEvent *event)
 {
     if (!event)
     {
-        QGraphicsView::keyPressEvent(event);
+        QGraphicsView::keyPressEvent(event);
+        return;
+    }
+
+    if (event->key() == Qt::Key_Escape && m_interactionMode == InteractionMode::Select)
+    {
+        // A gesture in progress is abandoned first, the selection on a second press
+        if (m_selectionGesture != SelectionGesture::None)
+        {
+            cancelSelectionGesture();
+        }
+        else
+        {
+            clearSelection();
+        }
+        event->accept();
         return;
     }
 
@@ -2959,122 +4568,421 @@ void Carta::showAnnotationContextMenu(QGraphicsItem *item, const QPoint &globalP
         return;
     }
 
+    // Right-clicking a member of a multi-selection edits the whole selection
+    const bool onSelection = m_selection.size() > 1 && m_selection.contains(item);
+
     QMenu menu(this);
-    QAction *changeColorAction = menu.addAction(tr("Cambiar color..."));
+    QAction *changeColorAction = menu.addAction(onSelection ? tr("Cambiar color de la selección...") : tr("Cambiar color..."));
+    QAction *deleteSelectionAction = onSelection ? menu.addAction(tr("Eliminar selección")) : nullptr;
 
     QAction *selected = menu.exec(globalPos);
-    if (selected == changeColorAction)
+    if (selected && selected == deleteSelectionAction)
+    {
+        deleteSelectedAnnotations();
+    }
+    else if (selected == changeColorAction)
+    {
+        const QColor currentColor = annotationColor(item);
+        const QColor newColor = QColorDialog::getColor(currentColor, this, tr("Seleccionar color"),
+                                                       QColorDialog::ShowAlphaChannel);
+        if (!newColor.isValid())
+        {
+            return;
+        }
+
+        if (onSelection)
+        {
+            const auto recolor = [newColor](QGraphicsItem *, AnnotationHistory::Style style)
+            {
+                style.color = newColor;
+                return style;
+            };
+            restyleSelection(recolor, 0);
+        }
+        else
+        {
+            changeAnnotationColor(item, newColor);
+        }
+    }
+}
+
+void Carta::changeAnnotationColor(QGraphicsItem *item, const QColor &newColor)
+{
+    if (!item || !newColor.isValid() || !m_annotations.contains(item))
+    {
+        return;
+    }
+
+    const AnnotationHistory::Style oldStyle = annotationStyle(item);
+    if (oldStyle.color == newColor)
+    {
+        return;
+    }
+
+    AnnotationHistory::Style newStyle = oldStyle;
+    newStyle.color = newColor;
+    AnnotationHistory::Command command;
+    command.type = AnnotationHistory::CommandType::Restyle;
+    command.items.append(item);
+    command.oldStyles.append(oldStyle);
+    command.newStyles.append(newStyle);
+    applyAnnotationStyles(command.items, command.newStyles);
+    m_history.push(std::move(command));
+}
+
+QColor Carta::annotationColor(QGraphicsItem *item) const
+{
+    if (auto *textItem = qgraphicsitem_cast<QGraphicsSimpleTextItem *>(item))
+    {
+        return textItem->brush().color();
+    }
+    if (auto *ellipseItem = qgraphicsitem_cast<QGraphicsEllipseItem *>(item))
+    {
+        return ellipseItem->brush().color();
+    }
+    if (auto *lineItem = qgraphicsitem_cast<QGraphicsLineItem *>(item))
     {
-        QColor currentColor = m_drawingColor;
+        return lineItem->pen().color();
+    }
+    if (auto *pathItem = qgraphicsitem_cast<CompactPathItem *>(item))
+    {
+        return pathItem->pen().color();
+    }
+    return m_drawingColor;
+}
+
+AnnotationHistory::Style Carta::annotationStyle(QGraphicsItem *item) const
+{
+    AnnotationHistory::Style style;
+    style.color = annotationColor(item);
+    if (auto *textItem = qgraphicsitem_cast<QGraphicsSimpleTextItem *>(item))
+    {
+        style.width = textItem->font().pointSizeF();
+    }
+    else if (auto *ellipseItem = qgraphicsitem_cast<QGraphicsEllipseItem *>(item))
+    {
+        style.width = ellipseItem->rect().width() / 2.0;
+    }
+    else if (auto *lineItem = qgraphicsitem_cast<QGraphicsLineItem *>(item))
+    {
+        style.width = lineItem->pen().widthF();
+    }
+    else if (auto *pathItem = qgraphicsitem_cast<CompactPathItem *>(item))
+    {
+        style.width = pathItem->penWidth();
+    }
+    return style;
+}
+
+void Carta::applyAnnotationStyles(const QList<QGraphicsItem *> &items, const QList<AnnotationHistory::Style> &styles)
+{
+    // Old and new bounds of every item reach its raster layer as one batch
+    QHash<AnnotationRasterLayer *, QList<QRectF>> dirty;
+    for (qsizetype i = 0; i < items.size() && i < styles.size(); ++i)
+    {
+        QGraphicsItem *item = items.at(i);
+        const AnnotationHistory::Style &style = styles.at(i);
+        const bool resized = !qFuzzyCompare(annotationStyle(item).width, style.width);
+        dirty[rasterLayerFor(item)].append(item->sceneBoundingRect());
+        if (resized)
+        {
+            // The index reaches as far as the pen
+            m_spatialIndex.remove(item);
+        }
 
         if (auto *textItem = qgraphicsitem_cast<QGraphicsSimpleTextItem *>(item))
         {
-            currentColor = textItem->brush().color();
+            textItem->setBrush(QBrush(style.color));
+            if (resized)
+            {
+                QFont font = textItem->font();
+                font.setPointSizeF(style.width);
+                textItem->setFont(font);
+            }
         }
         else if (auto *ellipseItem = qgraphicsitem_cast<QGraphicsEllipseItem *>(item))
         {
-            currentColor = ellipseItem->brush().color();
+            ellipseItem->setBrush(QBrush(style.color));
+            QPen pen = ellipseItem->pen();
+            pen.setColor(style.color.darker(150));
+            if (resized)
+            {
+                const qreal radius = style.width;
+                ellipseItem->setRect(-radius, -radius, radius * 2, radius * 2);
+                pen.setWidth(std::max(1, qRound(radius / 2.4)));
+            }
+            ellipseItem->setPen(pen);
         }
         else if (auto *lineItem = qgraphicsitem_cast<QGraphicsLineItem *>(item))
         {
-            currentColor = lineItem->pen().color();
+            QPen pen = lineItem->pen();
+            pen.setColor(style.color);
+            pen.setWidthF(style.width);
+            lineItem->setPen(pen);
         }
-        else if (auto *pathItem = qgraphicsitem_cast<QGraphicsPathItem *>(item))
+        else if (auto *pathItem = qgraphicsitem_cast<CompactPathItem *>(item))
         {
-            currentColor = pathItem->pen().color();
+            QPen pen = pathItem->pen();
+            pen.setColor(style.color);
+            pen.setWidthF(style.width);
+            pathItem->setPen(pen);
         }
 
-        const QColor newColor = QColorDialog::getColor(currentColor, this, tr("Seleccionar color"),
-                                                       QColorDialog::ShowAlphaChannel);
-        if (newColor.isValid())
+        if (resized)
         {
-            changeAnnotationColor(item, newColor);
+            m_spatialIndex.insert(item);
         }
+        dirty[rasterLayerFor(item)].append(item->sceneBoundingRect());
+        emit annotationChanged(item);
+    }
+    for (auto it = dirty.cbegin(); it != dirty.cend(); ++it)
+    {
+        it.key()->invalidate(it.value());
     }
 }
 
-void Carta::changeAnnotationColor(QGraphicsItem *item, const QColor &newColor)
+void Carta::restyleSelection(const Restyle &restyle, quint64 mergeId)
 {
-    if (!item || !newColor.isValid())
+    const QList<QGraphicsItem *> items = selectedAnnotations();
+    if (items.isEmpty())
     {
         return;
     }
 
-    if (auto *textItem = qgraphicsitem_cast<QGraphicsSimpleTextItem *>(item))
+    AnnotationHistory::Command command;
+    command.type = AnnotationHistory::CommandType::Restyle;
+    command.mergeId = mergeId;
+    command.items = items;
+    command.oldStyles.reserve(items.size());
+    command.newStyles.reserve(items.size());
+    bool changed = false;
+    for (QGraphicsItem *item : items)
     {
-        textItem->setBrush(QBrush(newColor));
-        return;
+        const AnnotationHistory::Style oldStyle = annotationStyle(item);
+        const AnnotationHistory::Style newStyle = restyle(item, oldStyle);
+        changed = changed || newStyle.color != oldStyle.color || !qFuzzyCompare(newStyle.width, oldStyle.width);
+        command.oldStyles.append(oldStyle);
+        command.newStyles.append(newStyle);
     }
-
-    if (auto *ellipseItem = qgraphicsitem_cast<QGraphicsEllipseItem *>(item))
+    if (!changed)
     {
-        QColor fillColor = newColor;
-        ellipseItem->setBrush(QBrush(fillColor));
-        QPen pen = ellipseItem->pen();
-        pen.setColor(fillColor.darker(150));
-        ellipseItem->setPen(pen);
         return;
     }
 
-    if (auto *lineItem = qgraphicsitem_cast<QGraphicsLineItem *>(item))
+    applyAnnotationStyles(command.items, command.newStyles);
+    m_history.push(std::move(command));
+    // The outlines follow the new bounds
+    viewport()->update();
+}
+
+void Carta::translateAnnotations(const QList<QGraphicsItem *> &items, const QPointF &offset)
+{
+    // Old and new bounds of every item reach its raster layer as one batch
+    QHash<AnnotationRasterLayer *, QList<QRectF>> dirty;
+    for (QGraphicsItem *item : items)
     {
-        QPen pen = lineItem->pen();
-        pen.setColor(newColor);
-        lineItem->setPen(pen);
-        return;
+        QList<QRectF> &layerDirty = dirty[rasterLayerFor(item)];
+        layerDirty.append(item->sceneBoundingRect());
+        m_spatialIndex.remove(item);
+        m_snapIndex.remove(item);
+        item->moveBy(offset.x(), offset.y());
+        m_spatialIndex.insert(item);
+        m_snapIndex.insert(item, m_annotations.kind(item));
+        layerDirty.append(item->sceneBoundingRect());
+        emit annotationChanged(item);
     }
-
-    if (auto *pathItem = qgraphicsitem_cast<QGraphicsPathItem *>(item))
+    for (auto it = dirty.cbegin(); it != dirty.cend(); ++it)
     {
-        QPen pen = pathItem->pen();
-        pen.setColor(newColor);
-        pathItem->setPen(pen);
-        return;
+        it.key()->invalidate(it.value());
     }
+    projectionPointsChanged();
+}
+
+AnnotationRasterLayer *Carta::rasterLayerFor(const QGraphicsItem *item) const
+{
+    return item->zValue() < AnnotationRasterLayer::kZValue ? m_strokeLayer : m_annotationLayer;
 }
 
 bool Carta::isAnnotationItem(QGraphicsItem *item) const
 {
-    if (!item)
+    return item && m_annotations.contains(item);
+}
+
+bool Carta::annotationData(QGraphicsItem *item, AnnotationData *data) const
+{
+    if (!item || !data || !m_annotations.contains(item))
+    {
+        return false;
+    }
+
+    AnnotationData result;
+    result.kind = m_annotations.kind(item);
+    if (auto *textItem = qgraphicsitem_cast<QGraphicsSimpleTextItem *>(item))
+    {
+        result.color = textItem->brush().color().rgba();
+        result.width = textItem->font().pointSizeF();
+        result.points.append(textItem->pos());
+        result.text = textItem->text();
+    }
+    else if (auto *ellipseItem = qgraphicsitem_cast<QGraphicsEllipseItem *>(item))
+    {
+        result.color = ellipseItem->brush().color().rgba();
+        result.width = ellipseItem->rect().width() / 2.0;
+        result.points.append(ellipseItem->pos());
+    }
+    else if (auto *lineItem = qgraphicsitem_cast<QGraphicsLineItem *>(item))
+    {
+        result.color = lineItem->pen().color().rgba();
+        result.width = lineItem->pen().widthF();
+        result.points << lineItem->mapToScene(lineItem->line().p1()) << lineItem->mapToScene(lineItem->line().p2());
+    }
+    else if (auto *pathItem = qgraphicsitem_cast<CompactPathItem *>(item))
+    {
+        result.color = pathItem->pen().color().rgba();
+        result.width = pathItem->pen().widthF();
+        AnnotationCodec::setPath(&result, pathItem->mapToScene(pathItem->path()));
+    }
+    else
     {
         return false;
     }
 
-    if (qgraphicsitem_cast<QGraphicsSimpleTextItem *>(item))
+    *data = result;
+    return true;
+}
+
+QGraphicsItem *Carta::restoreAnnotation(const AnnotationData &data)
+{
+    if (data.points.isEmpty())
     {
-        return m_textItems.contains(static_cast<QGraphicsSimpleTextItem *>(item));
+        return nullptr;
     }
 
-    if (qgraphicsitem_cast<QGraphicsEllipseItem *>(item))
+    const QColor color = QColor::fromRgba(data.color);
+    switch (data.kind)
     {
-        return m_pointItems.contains(static_cast<QGraphicsEllipseItem *>(item));
+    case AnnotationKind::Stroke:
+    case AnnotationKind::Arc:
+    {
+        QPen pen = strokePen();
+        pen.setColor(color);
+        pen.setWidthF(data.width);
+        auto *pathItem = new RasterizedAnnotationItem<CompactPathItem>(&m_annotationGeometry, AnnotationCodec::path(data), pen);
+        pathItem->setZValue(data.kind == AnnotationKind::Arc ? 91.0 : kStrokeZValue);
+        m_scene.addItem(pathItem);
+        attachAnnotation(pathItem, data.kind);
+        return pathItem;
     }
+    case AnnotationKind::Line:
+    {
+        if (data.points.size() < 2)
+        {
+            return nullptr;
+        }
+        auto *lineItem = new RasterizedAnnotationItem<QGraphicsLineItem>(QLineF(data.points.at(0), data.points.at(1)));
+        QPen pen(color);
+        pen.setWidthF(data.width);
+        pen.setCapStyle(Qt::RoundCap);
+        lineItem->setPen(pen);
+        lineItem->setZValue(93.0);
+        m_scene.addItem(lineItem);
+        attachAnnotation(lineItem, AnnotationKind::Line);
+        return lineItem;
+    }
+    case AnnotationKind::Point:
+    {
+        // Same proportions as addPointAnnotation: radius = 1.2 × stroke width, outline = half the stroke width
+        const qreal radius = std::max<qreal>(1.0, data.width);
+        auto *pointItem = new RasterizedAnnotationItem<QGraphicsEllipseItem>(-radius, -radius, radius * 2, radius * 2);
+        pointItem->setBrush(QBrush(color));
+        QPen pen(color.darker(150));
+        pen.setWidth(std::max(1, qRound(radius / 2.4)));
+        pointItem->setPen(pen);
+        pointItem->setPos(data.points.constFirst());
+        pointItem->setFlag(QGraphicsItem::ItemIsSelectable, true);
+        pointItem->setZValue(93.0);
+        m_scene.addItem(pointItem);
+        attachAnnotation(pointItem, AnnotationKind::Point);
+        return pointItem;
+    }
+    case AnnotationKind::Text:
+    {
+        if (data.text.isEmpty())
+        {
+            return nullptr;
+        }
+        auto *textItem = new RasterizedAnnotationItem<QGraphicsSimpleTextItem>(data.text);
+        QFont font = textItem->font();
+        font.setPointSizeF(data.width > 0.0 ? data.width : 36.0);
+        font.setWeight(QFont::DemiBold);
+        textItem->setFont(font);
+        textItem->setBrush(QBrush(color));
+        textItem->setPos(data.points.constFirst());
+        textItem->setZValue(95.0);
+        m_scene.addItem(textItem);
+        attachAnnotation(textItem, AnnotationKind::Text);
+        return textItem;
+    }
+    }
+    return nullptr;
+}
 
-    if (qgraphicsitem_cast<QGraphicsLineItem *>(item))
+ChartExporter::Snapshot Carta::exportSnapshot(bool includeTools)
+{
+    ChartExporter::Snapshot snapshot;
+    if (!m_mapItem)
     {
-        return m_lineItems.contains(static_cast<QGraphicsLineItem *>(item));
+        return snapshot;
     }
 
-    if (qgraphicsitem_cast<QGraphicsPathItem *>(item))
+    snapshot.chart = m_mapItem->source();
+    snapshot.chartRect = m_mapItem->sceneBoundingRect();
+
+    // Registry order is creation order; painting follows the scene's stacking by z value
+    QList<QGraphicsItem *> items = m_annotations.items();
+    std::stable_sort(items.begin(), items.end(), [](const QGraphicsItem *a, const QGraphicsItem *b)
+                     { return a->zValue() < b->zValue(); });
+    snapshot.annotations.reserve(items.size());
+    for (QGraphicsItem *item : std::as_const(items))
     {
-        QGraphicsPathItem *pathItem = static_cast<QGraphicsPathItem *>(item);
-        return m_strokeItems.contains(pathItem) || m_arcItems.contains(pathItem);
+        AnnotationData data;
+        if (item->isVisible() && annotationData(item, &data))
+        {
+            snapshot.annotations.append(data);
+        }
     }
 
-    return false;
+    // Tools live in viewport coordinates; recorded back into scene coordinates they scale with the export
+    if (includeTools && !m_toolItems.isEmpty())
+    {
+        const QRectF toolRect = m_toolScene.itemsBoundingRect();
+        QPainter picturePainter(&snapshot.tools);
+        picturePainter.setRenderHints(QPainter::Antialiasing | QPainter::SmoothPixmapTransform);
+        picturePainter.setTransform(viewportTransform().inverted());
+        m_toolScene.render(&picturePainter, toolRect, toolRect);
+        picturePainter.end();
+        snapshot.hasTools = true;
+    }
+    return snapshot;
 }
 
-void Carta::setProjectionLinesVisible(bool visible)
+QRectF Carta::visibleChartRect() const
 {
-    m_showProjectionLines = visible;
-    if (visible)
+    if (!m_mapItem)
     {
-        updateProjectionLines();
+        return QRectF();
     }
-    else
+    return mapToScene(viewport()->rect()).boundingRect().intersected(m_mapItem->sceneBoundingRect());
+}
+
+void Carta::setProjectionLinesVisible(bool visible)
+{
+    if (m_showProjectionLines == visible)
     {
-        clearProjectionLines();
+        return;
     }
+    m_showProjectionLines = visible;
+    m_guideItem->update();
 }
 
 void Carta::setCrosshairPlacementEnabled(bool enabled)
@@ -3083,111 +4991,347 @@ void Carta::setCrosshairPlacementEnabled(bool enabled)
     // Keep the drawn crosshair even when disabling the mode; placement is what toggles off
 }
 
-void Carta::updateProjectionLines()
+void Carta::projectionPointsChanged()
 {
-    clearProjectionLines();
+    m_projectionGuidesDirty = true;
+    if (m_showProjectionLines)
+    {
+        // The guides span the whole chart, not just the dirty rect of the point
+        m_guideItem->update();
+    }
+}
 
-    if (!m_showProjectionLines)
+void Carta::rebuildProjectionGuides()
+{
+    m_projectionGuideXs.clear();
+    m_projectionGuideYs.clear();
+    const QList<QGraphicsItem *> pointItems = m_annotations.items(AnnotationKind::Point);
+    m_projectionGuideXs.reserve(pointItems.size());
+    m_projectionGuideYs.reserve(pointItems.size());
+    for (QGraphicsItem *pointItem : pointItems)
     {
-        return;
+        const QPointF center = pointItem->scenePos();
+        m_projectionGuideXs.append(center.x());
+        m_projectionGuideYs.append(center.y());
     }
+    // Sorted so each frame only walks the coordinates inside the viewport
+    std::sort(m_projectionGuideXs.begin(), m_projectionGuideXs.end());
+    std::sort(m_projectionGuideYs.begin(), m_projectionGuideYs.end());
+    m_projectionGuidesDirty = false;
+}
 
-    if (!m_mapItem || !scene())
+void Carta::drawGuides(QPainter *painter, Guides guides)
+{
+    const bool chartLines = guides == Guides::ChartLines;
+    const bool projection = chartLines && m_showProjectionLines && m_annotations.count(AnnotationKind::Point) > 0;
+    const bool gridGuide = chartLines && m_hasGridGuide;
+    const bool crosshair = !chartLines && m_hasCrosshair;
+    if (!m_mapItem || (!projection && !gridGuide && !crosshair))
     {
         return;
     }
 
-    const QRectF sceneRect = scene()->sceneRect();
-    if (!sceneRect.isValid())
+    // Guides cover the chart only, clipped to what the viewport shows
+    const QRectF visible = mapToScene(viewport()->rect()).boundingRect().intersected(m_scene.sceneRect());
+    if (visible.isEmpty())
     {
         return;
     }
 
-    for (QGraphicsEllipseItem *pointItem : m_pointItems)
+    // Scale and translation only, so scene x and y map independently
+    const QTransform toViewport = viewportTransform();
+    const QRectF extent = toViewport.mapRect(visible);
+    const auto verticalAt = [&](qreal sceneX)
+    {
+        const qreal x = toViewport.m11() * sceneX + toViewport.dx();
+        return QLineF(x, extent.top(), x, extent.bottom());
+    };
+    const auto horizontalAt = [&](qreal sceneY)
+    {
+        const qreal y = toViewport.m22() * sceneY + toViewport.dy();
+        return QLineF(extent.left(), y, extent.right(), y);
+    };
+    // Pen widths were given in scene units when these guides were scene items
+    const auto scaledWidth = [this](qreal width)
+    {
+        return std::max<qreal>(1.0, width * m_currentScale);
+    };
+
+    painter->save();
+    // Called from the guide items during the scene-layer render, whose source and target rects
+    // match, so dropping the scene transform leaves viewport coordinates
+    painter->resetTransform();
+    painter->setRenderHint(QPainter::Antialiasing, false);
+
+    if (projection)
     {
-        if (!pointItem)
+        if (m_projectionGuidesDirty)
         {
-            continue;
+            rebuildProjectionGuides();
         }
 
-        const QPointF center = pointItem->scenePos();
+        QVarLengthArray<QLineF, 256> lines;
+        const auto firstX = std::lower_bound(m_projectionGuideXs.cbegin(), m_projectionGuideXs.cend(), visible.left());
+        const auto lastX = std::upper_bound(firstX, m_projectionGuideXs.cend(), visible.right());
+        for (auto it = firstX; it != lastX; ++it)
+        {
+            lines.append(verticalAt(*it));
+        }
+        const auto firstY = std::lower_bound(m_projectionGuideYs.cbegin(), m_projectionGuideYs.cend(), visible.top());
+        const auto lastY = std::upper_bound(firstY, m_projectionGuideYs.cend(), visible.bottom());
+        for (auto it = firstY; it != lastY; ++it)
+        {
+            lines.append(horizontalAt(*it));
+        }
 
-        auto *hLine = new QGraphicsLineItem(sceneRect.left(), center.y(), sceneRect.right(), center.y());
-        QPen pen(Qt::white);
-        pen.setWidth(1);
-        pen.setStyle(Qt::DashLine);
         QColor color = Qt::white;
         color.setAlpha(120);
-        pen.setColor(color);
-        hLine->setPen(pen);
-        hLine->setZValue(85.0);
-        m_scene.addItem(hLine);
-        m_projectionLines.append(hLine);
+        QPen pen(color);
+        pen.setWidthF(scaledWidth(1.0));
+        pen.setStyle(Qt::DashLine);
+        painter->setPen(pen);
+        painter->drawLines(lines.constData(), static_cast<int>(lines.size()));
+    }
+
+    if (gridGuide)
+    {
+        QColor color = Qt::black;
+        color.setAlpha(180);
+        QPen pen(color);
+        pen.setWidthF(scaledWidth(2.0));
+        pen.setStyle(Qt::DashLine);
+        painter->setPen(pen);
+        const QLineF lines[] = {horizontalAt(m_gridGuide.y()), verticalAt(m_gridGuide.x())};
+        painter->drawLines(lines, 2);
+    }
 
-        auto *vLine = new QGraphicsLineItem(center.x(), sceneRect.top(), center.x(), sceneRect.bottom());
-        vLine->setPen(pen);
-        vLine->setZValue(85.0);
-        m_scene.addItem(vLine);
-        m_projectionLines.append(vLine);
+    if (crosshair)
+    {
+        QPen pen(Qt::black);
+        pen.setWidth(2);
+        painter->setPen(pen);
+        const QLineF lines[] = {horizontalAt(m_crosshair.y()), verticalAt(m_crosshair.x())};
+        painter->drawLines(lines, 2);
     }
+
+    painter->restore();
+}
+
+void Carta::clearGuides()
+{
+    m_hasGridGuide = false;
+    m_hasCrosshair = false;
+    m_projectionGuidesDirty = true;
+    updateGuides();
+}
+
+void Carta::placeCrosshairAt(const QPointF &scenePos)
+{
+    m_crosshair = scenePos;
+    m_hasCrosshair = true;
+    m_crosshairItem->update();
+}
+
+void Carta::updateGuideBounds()
+{
+    m_guideItem->setBounds(m_scene.sceneRect());
+    m_crosshairItem->setBounds(m_scene.sceneRect());
+}
+
+void Carta::updateGuides()
+{
+    m_guideItem->update();
+    m_crosshairItem->update();
+}
+
+void Carta::setSelection(const QSet<QGraphicsItem *> &items)
+{
+    m_selection = items;
+    ++m_selectionId;
+    viewport()->update();
 }
 
-void Carta::clearProjectionLines()
+QGraphicsItem *Carta::annotationAt(const QPointF &scenePos) const
 {
-    for (QGraphicsLineItem *line : m_projectionLines)
+    const QList<AnnotationSpatialIndex::Hit> hits = m_spatialIndex.sweep(scenePos, scenePos, kSelectionPickRadiusPx / m_currentScale);
+    QGraphicsItem *topmost = nullptr;
+    for (const AnnotationSpatialIndex::Hit &hit : hits)
     {
-        if (!line)
+        if (!topmost || hit.item->zValue() > topmost->zValue())
         {
-            continue;
+            topmost = hit.item;
         }
-        m_scene.removeItem(line);
-        delete line;
     }
-    m_projectionLines.clear();
+    return topmost;
 }
 
-void Carta::placeCrosshairAt(const QPointF &scenePos)
+void Carta::startSelectionGesture(const QPointF &scenePos, Qt::KeyboardModifiers modifiers)
 {
-    if (!scene())
+    const bool additive = modifiers & (Qt::ShiftModifier | Qt::ControlModifier);
+    QGraphicsItem *item = annotationAt(scenePos);
+    if (item && additive)
     {
+        QSet<QGraphicsItem *> selection = m_selection;
+        if (!selection.remove(item))
+        {
+            selection.insert(item);
+        }
+        setSelection(selection);
         return;
     }
 
-    clearCrosshair();
+    if (item)
+    {
+        if (!m_selection.contains(item))
+        {
+            setSelection({item});
+        }
+        m_selectionGesture = SelectionGesture::Move;
+    }
+    else
+    {
+        if (!additive)
+        {
+            clearSelection();
+        }
+        m_selectionGesture = (modifiers & Qt::AltModifier) ? SelectionGesture::Lasso : SelectionGesture::Band;
+        m_selectionAdditive = additive;
+        m_lassoPoints = QPolygonF({scenePos});
+    }
+    m_selectionAnchor = scenePos;
+    m_selectionCurrent = scenePos;
+}
+
+void Carta::updateSelectionGesture(const QPointF &scenePos)
+{
+    if (m_selectionGesture == SelectionGesture::Lasso)
+    {
+        if (QLineF(m_lassoPoints.constLast(), scenePos).length() * m_currentScale < kLassoSpacingPx)
+        {
+            return;
+        }
+        m_lassoPoints.append(scenePos);
+    }
+    m_selectionCurrent = scenePos;
+    viewport()->update();
+}
+
+void Carta::finishSelectionGesture()
+{
+    const SelectionGesture gesture = m_selectionGesture;
+    cancelSelectionGesture();
 
-    const QRectF sceneRect = scene()->sceneRect();
-    if (!sceneRect.isValid())
+    QPolygonF region;
+    switch (gesture)
     {
+    case SelectionGesture::None:
         return;
+    case SelectionGesture::Move:
+        // One step for the whole drag, applied once instead of on every mouse move
+        moveSelection(m_selectionCurrent - m_selectionAnchor);
+        return;
+    case SelectionGesture::Band:
+    {
+        const QRectF band = QRectF(m_selectionAnchor, m_selectionCurrent).normalized();
+        if (std::max(band.width(), band.height()) * m_currentScale < kMinimumBandPx)
+        {
+            return;
+        }
+        region = QPolygonF(band);
+        break;
     }
+    case SelectionGesture::Lasso:
+        region = m_lassoPoints;
+        break;
+    }
+    m_lassoPoints.clear();
 
-    QPen pen(Qt::black);
-    pen.setWidth(2);
-    pen.setCosmetic(true);
-
-    m_crosshairHLine = new QGraphicsLineItem(sceneRect.left(), scenePos.y(), sceneRect.right(), scenePos.y());
-    m_crosshairHLine->setPen(pen);
-    m_crosshairHLine->setZValue(90.0);
-    m_scene.addItem(m_crosshairHLine);
+    QSet<QGraphicsItem *> selection;
+    if (m_selectionAdditive)
+    {
+        selection = m_selection;
+    }
+    const QList<QGraphicsItem *> found = m_spatialIndex.intersecting(region);
+    selection.reserve(selection.size() + found.size());
+    for (QGraphicsItem *item : found)
+    {
+        selection.insert(item);
+    }
+    setSelection(selection);
+}
 
-    m_crosshairVLine = new QGraphicsLineItem(scenePos.x(), sceneRect.top(), scenePos.x(), sceneRect.bottom());
-    m_crosshairVLine->setPen(pen);
-    m_crosshairVLine->setZValue(90.0);
-    m_scene.addItem(m_crosshairVLine);
+void Carta::cancelSelectionGesture()
+{
+    if (m_selectionGesture == SelectionGesture::None)
+    {
+        return;
+    }
+    m_selectionGesture = SelectionGesture::None;
+    viewport()->update();
 }
 
-void Carta::clearCrosshair()
+void Carta::drawSelection(QPainter *painter)
 {
-    if (m_crosshairHLine)
+    if (m_selection.isEmpty() && m_selectionGesture == SelectionGesture::None)
+    {
+        return;
+    }
+
+    const QTransform toViewport = viewportTransform();
+    const QRectF visible = mapToScene(viewport()->rect()).boundingRect();
+    const QPointF preview = m_selectionGesture == SelectionGesture::Move ? m_selectionCurrent - m_selectionAnchor : QPointF();
+    const QColor accent(0, 170, 255);
+
+    painter->save();
+    painter->setRenderHint(QPainter::Antialiasing, false);
+
+    // Only the visible outlines, in one call; selected items keep painting from the raster layer
+    QList<QRectF> outlines;
+    QList<QGraphicsItem *> moved;
+    for (QGraphicsItem *item : std::as_const(m_selection))
+    {
+        const QRectF bounds = item->sceneBoundingRect().translated(preview);
+        if (bounds.intersects(visible))
+        {
+            outlines.append(toViewport.mapRect(bounds));
+            moved.append(item);
+        }
+    }
+
+    // While dragging, the visible part of the selection is drawn at its new place as well; the
+    // move itself is still applied once, on release, as a single undo step
+    if (m_selectionGesture == SelectionGesture::Move && !preview.isNull())
+    {
+        std::sort(moved.begin(), moved.end(), [](const QGraphicsItem *a, const QGraphicsItem *b)
+                  { return a->zValue() < b->zValue(); });
+        const QTransform movedToViewport = QTransform::fromTranslate(preview.x(), preview.y()) * toViewport;
+        painter->save();
+        painter->setRenderHints(renderHints());
+        for (QGraphicsItem *item : std::as_const(moved))
+        {
+            painter->setWorldTransform(item->sceneTransform() * movedToViewport);
+            painter->setOpacity(item->effectiveOpacity());
+            rasterLayerFor(item)->paintAnnotation(item, painter);
+        }
+        painter->restore();
+    }
+    painter->setPen(QPen(accent, 1.0));
+    painter->setBrush(Qt::NoBrush);
+    painter->drawRects(outlines.constData(), static_cast<int>(outlines.size()));
+
+    QColor fill = accent;
+    fill.setAlpha(40);
+    painter->setBrush(fill);
+    painter->setPen(QPen(accent, 1.0, Qt::DashLine));
+    if (m_selectionGesture == SelectionGesture::Band)
     {
-        m_scene.removeItem(m_crosshairHLine);
-        delete m_crosshairHLine;
-        m_crosshairHLine = nullptr;
+        painter->drawRect(toViewport.mapRect(QRectF(m_selectionAnchor, m_selectionCurrent).normalized()));
     }
-    if (m_crosshairVLine)
+    else if (m_selectionGesture == SelectionGesture::Lasso && m_lassoPoints.size() > 1)
     {
-        m_scene.removeItem(m_crosshairVLine);
-        delete m_crosshairVLine;
-        m_crosshairVLine = nullptr;
+        painter->setRenderHint(QPainter::Antialiasing, true);
+        painter->drawPolygon(toViewport.map(m_lassoPoints));
     }
+
+    painter->restore();
 }
@@ -1,37 +1,65 @@
 #ifndef CARTA_H
 #define CARTA_H
 
+#include "annotationgeometrystore.h"
+#include "annotationhistory.h"
+#include "annotationregistry.h"
+#include "annotationsnapindex.h"
+#include "annotationspatialindex.h"
+#include "chartexporter.h"
+#include "toolspatialindex.h"
+#include "framestats.h"
+
+#include <QByteArray>
+#include <QCache>
 #include <QColor>
+#include <QElapsedTimer>
 #include <QGraphicsScene>
 #include <QGraphicsView>
 #include <QHash>
 #include <QList>
 #include <QPainterPath>
+#include <QPen>
+#include <QPixmap>
 #include <QPoint>
 #include <QPointF>
+#include <QPolygonF>
+#include <QSet>
+#include <QSize>
+#include <QTransform>
+#include <functional>
 
 class QString;
 class QWheelEvent;
 class QMouseEvent;
 class QResizeEvent;
-class QPixmap;
-class QGraphicsPixmapItem;
+class ChartPyramidItem;
+class AnnotationRasterLayer;
+class QImage;
+template <typename T>
+class QFutureWatcher;
 class QWidget;
 class QDragEnterEvent;
 class QDragMoveEvent;
 class QDropEvent;
 class QMimeData;
 class QGraphicsItem;
+class GuideLayerItem;
 class MapToolItem;
 class CompassToolItem;
 class RulerToolItem;
 class QGraphicsSimpleTextItem;
-class QGraphicsPathItem;
+class LiveStrokeItem;
 class QGraphicsEllipseItem;
 class QGraphicsLineItem;
+class QLineF;
 class QContextMenuEvent;
 class QKeyEvent;
 class QFocusEvent;
+class QPaintEvent;
+class QTimer;
+class QVariantAnimation;
+struct AnnotationData;
 
 class Carta : public QGraphicsView
 {
@@ -51,13 +79,20 @@ public:
         Text,
         Point,
         Line,
-        Grid
+        Grid,
+        Select
     };
 
     bool loadMap(const QString &filePath);
     bool setMapPixmap(const QPixmap &pixmap);
+    bool setMapImage(const QImage &image);
     void clearMap();
     void setZoomRange(qreal minFactor, qreal maxFactor);
+    void setTileCacheBudget(qint64 bytes);
+    // Memory budget for recently viewed charts kept decoded, so switching back is instant
+    void setChartCacheBudget(qint64 bytes);
+    bool isChartCached(const QString &filePath) const;
+    QString mapPath() const { return m_mapPath; }
     void setOverlayWidget(QWidget *widget);
     void moveOverlayBy(const QPoint &delta);
     void resetOverlayPosition();
@@ -66,16 +101,119 @@ public:
     void setDrawingColor(const QColor &color);
     void setStrokeWidth(int width);
     void setStrokeOpacity(int opacityPercent);
+    // Undoable: the removed annotations stay parked in the history
     void clearUserAnnotations();
+    // Removes every annotation and forgets the history, e.g. when another user takes over the chart
+    void discardAnnotations();
     void undoLastAnnotation();
+    void redoLastAnnotation();
+    bool canUndo() const { return m_history.canUndo(); }
+    bool canRedo() const { return m_history.canRedo(); }
+    // Memory the undo history may hold, parked annotations included
+    void setHistoryBudget(qint64 bytes);
+    // One undo step; calls sharing a non-zero mergeId (e.g. one drag) merge into a single step
+    void moveAnnotations(const QList<QGraphicsItem *> &items, const QPointF &offset, quint64 mergeId = 0);
+    // Annotations picked in Select mode, oldest first. Every bulk edit below is one batched
+    // scene update and one undo step; consecutive width or opacity changes of the same
+    // selection (a slider drag) merge into one step.
+    QList<QGraphicsItem *> selectedAnnotations() const;
+    bool hasSelection() const { return !m_selection.isEmpty(); }
+    int selectionSize() const { return m_selection.size(); }
+    void clearSelection();
+    void deleteSelectedAnnotations();
+    // Keeps the opacity of each annotation
+    void recolorSelection(const QColor &color);
+    void setSelectionStrokeWidth(int width);
+    void setSelectionOpacity(int opacityPercent);
+    void moveSelection(const QPointF &offset);
     // Add a tool at the center of the viewport (public wrapper for click-to-add)
     void placeToolAtViewportCenter(const QString &toolId, const QString &resourcePath);
     void setProjectionLinesVisible(bool visible);
     void setCrosshairPlacementEnabled(bool enabled);
-    QGraphicsPathItem *addArcAnnotation(const QPointF &center, qreal radius, qreal startAngleDeg, qreal spanAngleDeg, qreal rotationOffsetDeg = 0.0);
+    CompactPathItem *addArcAnnotation(const QPointF &center, qreal radius, qreal startAngleDeg, qreal spanAngleDeg, qreal rotationOffsetDeg = 0.0);
+    // Programmatic counterparts of the interactive modes, drawn with the current color, width and opacity
+    CompactPathItem *addStrokeAnnotation(const QPainterPath &path);
+    QGraphicsEllipseItem *addPointAnnotation(const QPointF &scenePos);
+    QGraphicsLineItem *addLineAnnotation(const QLineF &line);
+    QGraphicsSimpleTextItem *addTextAnnotation(const QPointF &scenePos, const QString &text);
+    // Fits a smooth curve through freehand strokes once they are finished
+    void setStrokeSmoothingEnabled(bool enabled) { m_strokeSmoothing = enabled; }
+    bool strokeSmoothingEnabled() const { return m_strokeSmoothing; }
+    // The eraser cuts freehand strokes where it passes instead of deleting them whole
+    void setEraserSplitsStrokes(bool enabled) { m_eraserSplitsStrokes = enabled; }
+    bool eraserSplitsStrokes() const { return m_eraserSplitsStrokes; }
+    // Line ends, points and the compass pivot land on nearby annotation geometry
+    void setGeometrySnapEnabled(bool enabled);
+    bool geometrySnapEnabled() const { return m_geometrySnap; }
+    // Nearest snap target within a few screen pixels of scenePos, or scenePos itself when there is
+    // none, snapping is off or Alt is held
+    QPointF snapScenePoint(const QPointF &scenePos, AnnotationSnapIndex::Match *match = nullptr) const;
     QColor drawingColor() const { return m_drawingColor; }
     int strokeWidth() const { return m_strokeWidth; }
     int strokeOpacity() const { return m_strokeOpacity; }
+    struct PaintStats
+    {
+        quint64 frames = 0;           // viewport paint events
+        quint64 sceneRenders = 0;     // chart/annotation layer re-rasterizations
+        quint64 toolLayerRenders = 0; // tool layer re-rasterizations
+        qreal lastFrameMs = 0.0;      // duration of the latest paint event
+    };
+    // Full: smooth sampling at the exact pyramid level. Interactive: nearest sampling while
+    // zoom or pan events arrive. Draft: also one pyramid level coarser, picked by the frame governor.
+    enum class RenderQuality
+    {
+        Full,
+        Interactive,
+        Draft
+    };
+    RenderQuality renderQuality() const { return m_renderQuality; }
+    // Paint time above which an interactive frame drops to draft quality
+    void setFrameTimeBudget(qreal milliseconds);
+    void setSmoothZoomEnabled(bool enabled);
+    // Frame time, tile cache and annotation HUD in the bottom-left corner
+    void setDiagnosticsVisible(bool visible);
+    bool diagnosticsVisible() const { return m_showDiagnostics; }
+    // Writes the frame samples buffered since the HUD was last shown as CSV
+    bool exportFrameStats(const QString &filePath) const;
+    struct StrokeStats
+    {
+        quint64 strokes = 0;        // finished freehand strokes
+        quint64 samples = 0;        // mouse samples received while drawing them
+        quint64 storedVertices = 0; // vertices left after decimation and simplification
+    };
+    StrokeStats strokeStats() const { return m_strokeStats; }
+    struct InputStats
+    {
+        quint64 moveEvents = 0;      // mouse move events received from Qt
+        quint64 dispatchedMoves = 0; // moves handled after merging those of the same display frame
+    };
+    InputStats inputStats() const { return m_inputStats; }
+    // Bytes held by the packed stroke and arc geometry
+    qint64 annotationGeometryBytes() const { return m_annotationGeometry.memoryUsage(); }
+    PaintStats paintStats() const { return m_paintStats; }
+    void resetPaintStats() { m_paintStats = PaintStats(); }
+    bool isMapLoading() const { return m_mapLoadWatcher != nullptr; }
+    // Content hash of the current chart file, empty until the background load has hashed it
+    QByteArray chartHash() const { return m_chartHash; }
+    // Committed annotations, oldest first
+    QList<QGraphicsItem *> annotationItems() const { return m_annotations.items(); }
+    bool annotationData(QGraphicsItem *item, AnnotationData *data) const;
+    // Recreates a saved annotation with its own style; emits annotationAdded but is not an undo step
+    QGraphicsItem *restoreAnnotation(const AnnotationData &data);
+    // Copy of the chart, annotations and (optionally) tools that ChartExporter renders off the GUI thread
+    ChartExporter::Snapshot exportSnapshot(bool includeTools);
+    // Part of the chart shown in the viewport, in scene coordinates; empty without a chart
+    QRectF visibleChartRect() const;
+
+signals:
+    // Emitted once the full resolution chart replaced the preview (or failed to decode)
+    void mapLoadFinished(bool ok);
+    void chartHashChanged(const QByteArray &hash);
+    // Edits of committed annotations. Switching charts discards the annotations without these signals.
+    void annotationAdded(QGraphicsItem *item);
+    void annotationChanged(QGraphicsItem *item);
+    void annotationRemoved(QGraphicsItem *item);
+    void annotationsCleared();
 
 protected:
     void wheelEvent(QWheelEvent *event) override;
@@ -94,13 +232,50 @@ protected:
     void focusOutEvent(QFocusEvent *event) override;
     void enterEvent(QEnterEvent *event) override;
     void leaveEvent(QEvent *event) override;
+    void paintEvent(QPaintEvent *event) override;
 
 private:
+    // Declared before the scenes: stroke and arc items release their geometry when the scene deletes them
+    AnnotationGeometryStore m_annotationGeometry;
     QGraphicsScene m_scene;
     QGraphicsScene m_toolScene;
-    QGraphicsPixmapItem *m_mapItem = nullptr;
+    ChartPyramidItem *m_mapItem = nullptr;
+    // Baked strokes below the live stroke, every other annotation above it
+    AnnotationRasterLayer *m_strokeLayer = nullptr;
+    AnnotationRasterLayer *m_annotationLayer = nullptr;
+    // A chart that was switched away from, with the viewport it was left at
+    struct CachedChart
+    {
+        ~CachedChart();
+        ChartPyramidItem *item = nullptr;
+        QByteArray hash;
+        qreal scale = 1.0;
+        QPointF center;
+        bool userHasZoomed = false;
+    };
+    QCache<QString, CachedChart> m_chartCache; // keyed by chartCacheKey(), cost in KiB
+    QString m_mapPath;
+    qint64 m_tileCacheBudget = 0; // 0 keeps the pyramid's default budget
+    struct MapLoadResult;
+    QFutureWatcher<MapLoadResult> *m_mapLoadWatcher = nullptr;
+    quint64 m_mapLoadGeneration = 0;
+    QByteArray m_chartHash;
     bool m_panning = false;
     QPoint m_lastMousePos;
+    // Latest mouse move not yet handled; drags and hover are dispatched once per display frame
+    struct PendingMove
+    {
+        QPointF position;
+        QPointF globalPosition;
+        Qt::MouseButtons buttons;
+        Qt::KeyboardModifiers modifiers;
+    };
+    PendingMove m_pendingMove;
+    bool m_hasPendingMove = false;
+    QTimer *m_moveFlushTimer = nullptr;
+    QElapsedTimer m_moveDispatchClock;
+    InputStats m_inputStats;
+    InputStats m_inputStatsAtLastFrame;
     qreal m_minZoomRatio = 0.3;
     qreal m_maxZoomRatio = 6.0;
     qreal m_baseScale = 1.0;
@@ -111,17 +286,46 @@ private:
     QPoint m_overlayViewportPos;
     bool m_overlayUserMoved = false;
     int m_overlayMargin = 18;
-    QHash<QString, MapToolItem *> m_activeToolItems;
+    // Placed tools in stacking order; any tool may be placed several times
+    QList<MapToolItem *> m_toolItems;
+    ToolSpatialIndex m_toolIndex;
     bool m_overlayMouseTransparent = false;
     static constexpr int ToolItemDataKey = 1;
-    QList<QGraphicsSimpleTextItem *> m_textItems;
-    QList<QGraphicsPathItem *> m_strokeItems;
-    QList<QGraphicsEllipseItem *> m_pointItems;
-    QList<QGraphicsLineItem *> m_lineItems;
-    QList<QGraphicsPathItem *> m_arcItems;
-    QList<QGraphicsItem *> m_annotationStack;
-    QGraphicsPathItem *m_currentStroke = nullptr;
-    QPainterPath m_currentStrokePath;
+    AnnotationRegistry m_annotations;
+    // After the geometry store: parked strokes release their geometry when the history goes
+    AnnotationHistory m_history;
+    quint64 m_eraseGesture = 0; // merge id of the current eraser drag
+    QPointF m_lastErasePos;
+    bool m_eraserSplitsStrokes = false;
+    AnnotationSpatialIndex m_spatialIndex;
+    AnnotationSnapIndex m_snapIndex;
+    bool m_geometrySnap = true;
+    // Target under the cursor while placing a line end, a point or the compass pivot
+    AnnotationSnapIndex::Match m_snapIndicator;
+    bool m_hasSnapIndicator = false;
+    // Kept apart from QGraphicsItem selection, so selected annotations stay baked in the raster layer
+    QSet<QGraphicsItem *> m_selection;
+    quint64 m_selectionId = 0; // bumped on every selection change
+    enum class SelectionGesture
+    {
+        None,
+        Band,
+        Lasso,
+        Move // previewed as an offset, applied on release
+    };
+    SelectionGesture m_selectionGesture = SelectionGesture::None;
+    bool m_selectionAdditive = false;
+    QPointF m_selectionAnchor;
+    QPointF m_selectionCurrent;
+    QPolygonF m_lassoPoints;
+    LiveStrokeItem *m_currentStroke = nullptr;
+    int m_currentStrokeSamples = 0;
+    // Latest sample dropped by decimation, kept so the stroke still ends under the cursor
+    QPointF m_currentStrokeEnd;
+    bool m_currentStrokeHasEnd = false;
+    bool m_strokeSmoothing = false;
+    StrokeStats m_strokeStats;
+    QHash<QGraphicsItem *, QFutureWatcher<QPainterPath> *> m_strokeSmoothingJobs;
     QGraphicsLineItem *m_linePreview = nullptr;
     QPointF m_lineStartScenePos;
     InteractionMode m_interactionMode = InteractionMode::Drag;
@@ -131,13 +335,20 @@ private:
     bool m_painting = false;
     bool m_erasing = false;
     bool m_lineDrawing = false;
+    // Guide lines are painted in drawGuides from two scene items at the z values of the line items
+    // they replaced: projection lines and the grid guide (85) under every annotation, the crosshair
+    // (90) between the stroke and annotation raster layers
+    GuideLayerItem *m_guideItem = nullptr;
+    GuideLayerItem *m_crosshairItem = nullptr;
     bool m_showProjectionLines = false;
-    QList<QGraphicsLineItem *> m_projectionLines;
-    QGraphicsLineItem *m_currentHLine = nullptr;
-    QGraphicsLineItem *m_currentVLine = nullptr;
+    QList<qreal> m_projectionGuideXs; // sorted point coordinates, rebuilt lazily
+    QList<qreal> m_projectionGuideYs;
+    bool m_projectionGuidesDirty = true;
+    QPointF m_gridGuide;
+    bool m_hasGridGuide = false;
     bool m_crosshairPlacementMode = false;
-    QGraphicsLineItem *m_crosshairHLine = nullptr;
-    QGraphicsLineItem *m_crosshairVLine = nullptr;
+    QPointF m_crosshair;
+    bool m_hasCrosshair = false;
     QHash<MapToolItem *, QPointF> m_toolViewportPos;
     bool m_toolDragInProgress = false;
     MapToolItem *m_draggedToolItem = nullptr;
@@ -145,8 +356,37 @@ private:
     CompassToolItem *m_activeCompass = nullptr;
     QPointF m_toolDragOffset;
     bool m_repositioningInForeground = false;
+    QPixmap m_sceneLayer;
+    QTransform m_sceneLayerTransform;
+    QList<QRectF> m_pendingSceneDirty;
+    bool m_sceneLayerValid = false;
+    bool m_renderingSceneLayer = false;
+    QPixmap m_toolLayer;
+    bool m_toolLayerDirty = true;
+    PaintStats m_paintStats;
+    RenderQuality m_renderQuality = RenderQuality::Full;
+    QTimer *m_refineTimer = nullptr;
+    qreal m_frameTimeBudgetMs = 16.0;
+    qreal m_frameTimeAverageMs = 0.0;
+    QVariantAnimation *m_zoomAnimation = nullptr;
+    qreal m_zoomTargetScale = 0.0;
+    bool m_smoothZoom = true;
+    bool m_compositingViewport = false;
+    FrameStatsRecorder m_frameStats;
+    FrameSample m_currentFrame;
+    bool m_showDiagnostics = false;
+    QTimer *m_diagnosticsTimer = nullptr;
 
+    bool installMapItem(ChartPyramidItem *item);
+    void parkMapItem();
+    static QString chartCacheKey(const QString &filePath);
+    void startFullResolutionLoad(const QString &filePath);
+    void startTileCacheBuild(const QByteArray &hash, const QImage &image);
+    void cancelPendingMapLoad();
     void applyScale(qreal factor);
+    void animateZoom(qreal factor);
+    void noteInteraction();
+    void setRenderQuality(RenderQuality quality);
     void anchorMapToSide();
     void fitMapToViewportHeight();
     qreal minAllowedScale() const;
@@ -155,52 +395,110 @@ private:
     QPoint clampOverlayToViewport(const QPoint &candidate) const;
     void setOverlayDefaultScenePos();
     bool acceptsToolMime(const QMimeData *mime) const;
-    bool addToolItem(const QString &toolId, const QString &resourcePath, const QPointF &scenePos);
+    MapToolItem *addToolItem(const QString &toolId, const QString &resourcePath, const QPointF &scenePos);
+    // Topmost tool under a tool scene (viewport) point
+    MapToolItem *toolAt(const QPointF &toolScenePos) const;
     bool isToolItem(const QGraphicsItem *item) const;
     void clearToolInstances();
     void setOverlayMouseTransparent(bool enabled);
     void handleToolDragStarted();
     void handleToolDragFinished(MapToolItem *item);
     void handleToolItemDestroyed(MapToolItem *item);
-    void removeTool(const QString &toolId);
+    void toolGeometryChanged(MapToolItem *item);
+    void removeTool(MapToolItem *item);
     bool overlayContainsSceneRect(const QRectF &rect) const;
     bool overlayContainsViewportPoint(const QPoint &point) const;
     void handleTextClick(const QPointF &scenePos);
     void handlePointClick(const QPointF &scenePos);
     void handleGridClick(const QPointF &scenePos);
     void handleLineClick(const QPointF &scenePos);
-    void removeTextItems();
-    void removeStrokeItems();
+    void removeAllAnnotations();
+    void setChartHash(const QByteArray &hash);
+    QPen strokePen() const;
+    CompactPathItem *createStrokeItem(const QPainterPath &path);
+    void smoothStroke(CompactPathItem *pathItem, const QPolygonF &points);
+    void replaceStrokePath(CompactPathItem *pathItem, const QPainterPath &path);
     void startStroke(const QPointF &scenePos);
     void extendStroke(const QPointF &scenePos);
     void finishStroke();
     void abortCurrentStroke();
-    void eraseAt(const QPointF &scenePos);
-    bool removeAnnotationItem(QGraphicsItem *item);
-    void registerAnnotation(QGraphicsItem *item);
+    void eraseAlong(const QPointF &from, const QPointF &to);
+    // Replaces the erased segments of a straight-segment stroke with the runs around them
+    QList<CompactPathItem *> splitStroke(CompactPathItem *pathItem, const QList<int> &erasedSegments);
+    // Takes the item off the chart without deleting it
+    bool parkAnnotation(QGraphicsItem *item);
+    void unparkAnnotation(QGraphicsItem *item, AnnotationKind kind);
+    // Same for many items, with one raster layer update
+    void parkAnnotations(const QList<QGraphicsItem *> &items);
+    void unparkAnnotations(const QList<QGraphicsItem *> &items, const QList<AnnotationKind> &kinds);
+    // Adds a new annotation as an undo step
+    void registerAnnotation(QGraphicsItem *item, AnnotationKind kind);
+    void attachAnnotation(QGraphicsItem *item, AnnotationKind kind);
     void unregisterAnnotation(QGraphicsItem *item);
     bool dispatchWheelEventToTool(QWheelEvent *event);
+    // Moves whose result only depends on the latest pointer position; strokes, erasing and lasso need every sample
+    bool coalescesMouseMoves(Qt::MouseButtons buttons) const;
+    void dispatchMouseMove(QMouseEvent *event);
+    // Handles the move held back for the current display frame, if any
+    void flushPendingMove();
+    int displayFrameIntervalMs() const;
     QPoint wheelEventViewportPos(const QWheelEvent *event) const;
     void startLineSegment(const QPointF &scenePos);
     void updateLinePreview(const QPointF &scenePos);
     void finishLineSegment(const QPointF &scenePos);
     void cancelLinePreview();
-    void removePointItems();
-    void removeLineItems();
-    void removeArcItems();
     void showAnnotationContextMenu(QGraphicsItem *item, const QPoint &globalPos);
     void changeAnnotationColor(QGraphicsItem *item, const QColor &newColor);
+    QColor annotationColor(QGraphicsItem *item) const;
+    AnnotationHistory::Style annotationStyle(QGraphicsItem *item) const;
+    void applyAnnotationStyles(const QList<QGraphicsItem *> &items, const QList<AnnotationHistory::Style> &styles);
+    using Restyle = std::function<AnnotationHistory::Style(QGraphicsItem *, AnnotationHistory::Style)>;
+    void restyleSelection(const Restyle &restyle, quint64 mergeId);
+    void translateAnnotations(const QList<QGraphicsItem *> &items, const QPointF &offset);
+    // Raster layer an annotation is baked into, picked by its z value
+    AnnotationRasterLayer *rasterLayerFor(const QGraphicsItem *item) const;
     bool isAnnotationItem(QGraphicsItem *item) const;
-    void updateProjectionLines();
-    void clearProjectionLines();
+    void projectionPointsChanged();
+    void rebuildProjectionGuides();
+    enum class Guides
+    {
+        ChartLines, // projection lines and the grid guide
+        Crosshair
+    };
+    void drawGuides(QPainter *painter, Guides guides);
+    // Guide items follow the scene rect; repainting them re-renders the scene layer under them
+    void updateGuideBounds();
+    void updateGuides();
+    void clearGuides();
     void placeCrosshairAt(const QPointF &scenePos);
-    void clearCrosshair();
-    MapToolItem *rulerItem() const;
-    bool pointHitsRuler(const QPointF &scenePos, MapToolItem *ruler) const;
+    void setSelection(const QSet<QGraphicsItem *> &items);
+    // Topmost annotation under a scene point, with a few pixels of tolerance
+    QGraphicsItem *annotationAt(const QPointF &scenePos) const;
+    void startSelectionGesture(const QPointF &scenePos, Qt::KeyboardModifiers modifiers);
+    void updateSelectionGesture(const QPointF &scenePos);
+    void finishSelectionGesture();
+    void cancelSelectionGesture();
+    void drawSelection(QPainter *painter);
+    // Topmost ruler under a chart scene point
+    MapToolItem *rulerAt(const QPointF &scenePos) const;
     QPointF rulerDirection(MapToolItem *ruler) const;
     QPointF applyRulerSnap(const QPointF &prevPoint, const QPointF &candidate) const;
+    // Nearest inner vertex of a freehand stroke within radius, read from the geometry store
+    bool snapToStrokeVertex(const QPointF &scenePos, qreal radius, AnnotationSnapIndex::Match *match) const;
+    // snapScenePoint that also shows the target it picked
+    QPointF trackSnap(const QPointF &scenePos);
+    // Same for a point of the tool scene (viewport); false when nothing is in reach
+    bool snapToolScenePoint(const QPointF &toolScenePos, QPointF *snapped);
+    void clearSnapIndicator();
+    void drawSnapIndicator(QPainter *painter);
     void storeToolViewportPos(MapToolItem *item);
     void repositionToolsToViewport();
+    void updateSceneLayer();
+    void invalidateSceneLayer();
+    void markToolLayerDirty();
+    void drawToolLayer(QPainter *painter);
+    void drawDiagnosticsHud(QPainter *painter);
+    void tileCounters(quint64 *hits, quint64 *misses) const;
     void drawForeground(QPainter *painter, const QRectF &rect) override;
 };
 
@@ -0,0 +1,244 @@
+#include "chartcatalogpanel.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QHBoxLayout>
+#include <QIcon>
+#include <QImageReader>
+#include <QLabel>
+#include <QListWidget>
+#include <QPixmap>
+#include <QPushButton>
+#include <QStandardPaths>
+#include <QThread>
+#include <QVBoxLayout>
+#include <QtConcurrent/QtConcurrentMap>
+#include <algorithm>
+
+namespace
+{
+    constexpr int kThumbnailSide = 160;
+    constexpr int kPathRole = Qt::UserRole + 1;
+
+    const QStringList &chartNameFilters()
+    {
+        static const QStringList filters = {
+            QStringLiteral("*.png"), QStringLiteral("*.jpg"), QStringLiteral("*.jpeg"),
+            QStringLiteral("*.bmp"), QStringLiteral("*.tif"), QStringLiteral("*.tiff"),
+            QStringLiteral("*.svg"), QStringLiteral("*.webp")};
+        return filters;
+    }
+}
+
+ChartCatalogPanel::ChartCatalogPanel(QWidget *parent)
+    : QDialog(parent)
+{
+    setWindowTitle(tr("Catálogo de cartas"));
+    setModal(false);
+    resize(720, 520);
+
+    m_thumbnailPool.setMaxThreadCount(std::max(1, QThread::idealThreadCount() - 1));
+
+    m_folderLabel = new QLabel(this);
+    m_folderLabel->setTextInteractionFlags(Qt::TextSelectableByMouse);
+
+    m_list = new QListWidget(this);
+    m_list->setViewMode(QListView::IconMode);
+    m_list->setIconSize(QSize(kThumbnailSide, kThumbnailSide));
+    m_list->setGridSize(QSize(kThumbnailSide + 40, kThumbnailSide + 48));
+    m_list->setResizeMode(QListView::Adjust);
+    m_list->setMovement(QListView::Static);
+    m_list->setWordWrap(true);
+    m_list->setUniformItemSizes(true);
+
+    auto *folderButton = new QPushButton(tr("Cambiar carpeta..."), this);
+    auto *browseButton = new QPushButton(tr("Abrir archivo..."), this);
+    auto *rescanButton = new QPushButton(tr("Actualizar"), this);
+
+    auto *buttons = new QHBoxLayout();
+    buttons->addWidget(folderButton);
+    buttons->addWidget(rescanButton);
+    buttons->addStretch(1);
+    buttons->addWidget(browseButton);
+
+    auto *layout = new QVBoxLayout(this);
+    layout->addWidget(m_folderLabel);
+    layout->addWidget(m_list, 1);
+    layout->addLayout(buttons);
+
+    m_thumbnailWatcher = new QFutureWatcher<QImage>(this);
+    connect(m_thumbnailWatcher, &QFutureWatcher<QImage>::resultReadyAt, this, &ChartCatalogPanel::applyThumbnail);
+
+    connect(m_list, &QListWidget::itemActivated, this, [this](QListWidgetItem *item)
+            {
+        if (!item)
+        {
+            return;
+        }
+        emit chartSelected(item->data(kPathRole).toString(), item->text());
+        hide(); });
+    connect(folderButton, &QPushButton::clicked, this, &ChartCatalogPanel::chooseDirectory);
+    connect(rescanButton, &QPushButton::clicked, this, &ChartCatalogPanel::rescan);
+    connect(browseButton, &QPushButton::clicked, this, [this]()
+            {
+        hide();
+        emit browseRequested(); });
+
+    m_directory = defaultChartsDirectory();
+}
+
+ChartCatalogPanel::~ChartCatalogPanel()
+{
+    m_thumbnailWatcher->cancel();
+    m_thumbnailWatcher->waitForFinished();
+}
+
+QString ChartCatalogPanel::defaultChartsDirectory()
+{
+    const QString overrideDir = qEnvironmentVariable("NAVTRAINER_CHARTS_DIR");
+    if (!overrideDir.isEmpty())
+    {
+        return overrideDir;
+    }
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + QStringLiteral("/charts");
+}
+
+void ChartCatalogPanel::addBuiltInChart(const QString &resourcePath, const QString &title)
+{
+    m_builtIn.append({resourcePath, title});
+}
+
+void ChartCatalogPanel::setChartsDirectory(const QString &directory)
+{
+    if (directory == m_directory)
+    {
+        return;
+    }
+    m_directory = directory;
+    rescan();
+}
+
+void ChartCatalogPanel::setCurrentChart(const QString &filePath)
+{
+    m_currentChart = filePath;
+    if (QListWidgetItem *item = itemForPath(filePath))
+    {
+        m_list->setCurrentItem(item);
+    }
+}
+
+void ChartCatalogPanel::rescan()
+{
+    m_thumbnailWatcher->cancel();
+    m_list->clear();
+
+    QList<Entry> entries = m_builtIn;
+    const QDir directory(m_directory);
+    m_folderLabel->setText(directory.exists() ? tr("Carpeta: %1").arg(QDir::toNativeSeparators(m_directory))
+                                              : tr("Carpeta: %1 (no existe)").arg(QDir::toNativeSeparators(m_directory)));
+    const QFileInfoList files = directory.entryInfoList(chartNameFilters(), QDir::Files | QDir::Readable, QDir::Name | QDir::IgnoreCase);
+    for (const QFileInfo &file : files)
+    {
+        entries.append({file.absoluteFilePath(), file.completeBaseName()});
+    }
+
+    QStringList pending;
+    for (const Entry &entry : std::as_const(entries))
+    {
+        auto *item = new QListWidgetItem(entry.title, m_list);
+        item->setData(kPathRole, entry.filePath);
+        item->setToolTip(QDir::toNativeSeparators(entry.filePath));
+        item->setTextAlignment(Qt::AlignHCenter | Qt::AlignTop);
+
+        const auto cached = m_thumbnails.constFind(thumbnailKey(entry.filePath));
+        if (cached != m_thumbnails.constEnd())
+        {
+            item->setIcon(QIcon(QPixmap::fromImage(*cached)));
+        }
+        else
+        {
+            pending.append(entry.filePath);
+        }
+    }
+
+    setCurrentChart(m_currentChart);
+    startThumbnails(pending);
+}
+
+void ChartCatalogPanel::startThumbnails(const QStringList &filePaths)
+{
+    m_thumbnailPaths = filePaths;
+    if (filePaths.isEmpty())
+    {
+        return;
+    }
+    m_thumbnailWatcher->setFuture(QtConcurrent::mapped(&m_thumbnailPool, filePaths, &ChartCatalogPanel::makeThumbnail));
+}
+
+void ChartCatalogPanel::applyThumbnail(int index)
+{
+    if (index < 0 || index >= m_thumbnailPaths.size())
+    {
+        return;
+    }
+
+    const QImage thumbnail = m_thumbnailWatcher->resultAt(index);
+    if (thumbnail.isNull())
+    {
+        return;
+    }
+
+    const QString &filePath = m_thumbnailPaths.at(index);
+    m_thumbnails.insert(thumbnailKey(filePath), thumbnail);
+    if (QListWidgetItem *item = itemForPath(filePath))
+    {
+        item->setIcon(QIcon(QPixmap::fromImage(thumbnail)));
+    }
+}
+
+QImage ChartCatalogPanel::makeThumbnail(const QString &filePath)
+{
+    // Runs on the thumbnail pool; scaled reads keep large charts cheap to preview
+    QImageReader reader(filePath);
+    reader.setAutoTransform(true);
+    const QSize size = reader.size();
+    if (size.isValid())
+    {
+        reader.setScaledSize(size.scaled(kThumbnailSide, kThumbnailSide, Qt::KeepAspectRatio));
+        return reader.read();
+    }
+
+    const QImage image = reader.read();
+    return image.isNull() ? image : image.scaled(kThumbnailSide, kThumbnailSide, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+}
+
+QString ChartCatalogPanel::thumbnailKey(const QString &filePath)
+{
+    const QFileInfo info(filePath);
+    return filePath + QLatin1Char('@') + QString::number(info.lastModified().toMSecsSinceEpoch());
+}
+
+QListWidgetItem *ChartCatalogPanel::itemForPath(const QString &filePath) const
+{
+    for (int row = 0; row < m_list->count(); ++row)
+    {
+        QListWidgetItem *item = m_list->item(row);
+        if (item->data(kPathRole).toString() == filePath)
+        {
+            return item;
+        }
+    }
+    return nullptr;
+}
+
+void ChartCatalogPanel::chooseDirectory()
+{
+    const QString directory = QFileDialog::getExistingDirectory(this, tr("Seleccionar carpeta de cartas"), m_directory);
+    if (!directory.isEmpty())
+    {
+        setChartsDirectory(directory);
+    }
+}
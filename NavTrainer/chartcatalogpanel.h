@@ -0,0 +1,67 @@
+#ifndef CHARTCATALOGPANEL_H
+#define CHARTCATALOGPANEL_H
+
+#include <QDialog>
+#include <QHash>
+#include <QImage>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+
+class QLabel;
+class QListWidget;
+class QListWidgetItem;
+template <typename T>
+class QFutureWatcher;
+
+// Catálogo de cartas: lista las imágenes de una carpeta de cartas junto a las
+// cartas embebidas, con miniaturas generadas en segundo plano.
+class ChartCatalogPanel : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit ChartCatalogPanel(QWidget *parent = nullptr);
+    ~ChartCatalogPanel() override;
+
+    // NAVTRAINER_CHARTS_DIR si está definida; si no, la carpeta "charts" de los datos de la aplicación
+    static QString defaultChartsDirectory();
+
+    void addBuiltInChart(const QString &resourcePath, const QString &title);
+    void setChartsDirectory(const QString &directory);
+    QString chartsDirectory() const { return m_directory; }
+    void setCurrentChart(const QString &filePath);
+    void rescan();
+
+signals:
+    void chartSelected(const QString &filePath, const QString &title);
+    void browseRequested();
+
+private:
+    struct Entry
+    {
+        QString filePath;
+        QString title;
+    };
+
+    static QImage makeThumbnail(const QString &filePath);
+    static QString thumbnailKey(const QString &filePath);
+    void startThumbnails(const QStringList &filePaths);
+    void applyThumbnail(int index);
+    QListWidgetItem *itemForPath(const QString &filePath) const;
+    void chooseDirectory();
+
+    QListWidget *m_list = nullptr;
+    QLabel *m_folderLabel = nullptr;
+    QString m_directory;
+    QString m_currentChart;
+    QList<Entry> m_builtIn;
+    // Dedicated pool so thumbnails never queue ahead of the chart decode on the global pool
+    QThreadPool m_thumbnailPool;
+    QFutureWatcher<QImage> *m_thumbnailWatcher = nullptr;
+    QStringList m_thumbnailPaths;
+    QHash<QString, QImage> m_thumbnails; // by path and modification time
+};
+
+#endif // CHARTCATALOGPANEL_H
@@ -0,0 +1,349 @@
+#include "chartexporter.h"
+#include "pngstreamwriter.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QFileInfo>
+#include <QFont>
+#include <QFontMetricsF>
+#include <QPageSize>
+#include <QPainter>
+#include <QPainterPath>
+#include <QPdfWriter>
+#include <QSaveFile>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    // Upper bound for one PNG band; the band is as wide as the whole output
+    constexpr qint64 kBandBytes = 32ll * 1024 * 1024;
+    constexpr int kMinimumBandRows = 16;
+    // Font size of texts saved without one, as in Carta::addTextAnnotation
+    constexpr qreal kDefaultTextPointSize = 36.0;
+
+    qreal exportScale(int dotsPerInch)
+    {
+        return static_cast<qreal>(dotsPerInch) / ChartExporter::kSceneDotsPerInch;
+    }
+
+    // Maps scene coordinates to output pixels, with the output pixel origin at outputOrigin
+    void setSceneTransform(QPainter *painter, const QRectF &sceneRect, qreal scale, const QPointF &outputOrigin)
+    {
+        painter->translate(-outputOrigin);
+        painter->scale(scale, scale);
+        painter->translate(-sceneRect.topLeft());
+    }
+
+    // The pyramid paints in item coordinates, the exporter's painter works in scene coordinates
+    void paintChart(QPainter *painter, const ChartExporter::Snapshot &snapshot, const QRectF &sceneRect, qreal scale)
+    {
+        painter->save();
+        painter->translate(snapshot.chartRect.topLeft());
+        ChartPyramidItem::paintSource(painter, snapshot.chart, sceneRect.translated(-snapshot.chartRect.topLeft()), scale);
+        painter->restore();
+    }
+
+    // Texts are sized in scene pixels, as on screen, whatever the resolution of the output device
+    QFont textFont(const AnnotationData &data)
+    {
+        QFont font;
+        const qreal points = data.width > 0.0 ? data.width : kDefaultTextPointSize;
+        font.setPixelSize(std::max(1, qRound(points * ChartExporter::kSceneDotsPerInch / 72.0)));
+        font.setWeight(QFont::DemiBold);
+        return font;
+    }
+}
+
+// An annotation ready to paint: its data, the path of strokes and arcs, and bounds for culling
+struct ChartExporter::Shape
+{
+    AnnotationData data;
+    QPainterPath path;
+    QRectF bounds;
+};
+
+QSize ChartExporter::outputSize(const QRectF &sceneRect, int dotsPerInch)
+{
+    const qreal scale = exportScale(dotsPerInch);
+    return QSize(std::max(1, static_cast<int>(std::ceil(sceneRect.width() * scale))),
+                 std::max(1, static_cast<int>(std::ceil(sceneRect.height() * scale))));
+}
+
+void ChartExporter::run(QPromise<Result> &promise, const Snapshot &snapshot, const Options &options)
+{
+    Options clipped = options;
+    clipped.sceneRect = options.sceneRect.intersected(snapshot.chartRect);
+    if (clipped.sceneRect.isEmpty() || clipped.dotsPerInch <= 0)
+    {
+        promise.addResult(Result{false, false, QCoreApplication::translate("ChartExporter", "No hay nada que exportar")});
+        return;
+    }
+
+    const QList<Shape> shapes = prepareShapes(snapshot.annotations);
+    const Result result = clipped.format == Format::Pdf ? exportPdf(promise, snapshot, shapes, clipped)
+                                                        : exportPng(promise, snapshot, shapes, clipped);
+    promise.addResult(result);
+}
+
+ChartExporter::Result ChartExporter::exportPng(QPromise<Result> &promise, const Snapshot &snapshot,
+                                               const QList<Shape> &shapes, const Options &options)
+{
+    const QSize size = outputSize(options.sceneRect, options.dotsPerInch);
+    const qreal scale = exportScale(options.dotsPerInch);
+    const int bandRows = static_cast<int>(std::clamp<qint64>(kBandBytes / (static_cast<qint64>(size.width()) * 4),
+                                                             kMinimumBandRows, kTileSize));
+    const int bandCount = (size.height() + bandRows - 1) / bandRows;
+    promise.setProgressRange(0, bandCount);
+
+    // Written to a temporary file that only replaces the target once complete
+    QSaveFile file(options.filePath);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        return Result{false, false, file.errorString()};
+    }
+    PngStreamWriter writer(&file);
+    if (!writer.begin(size, options.dotsPerInch))
+    {
+        file.cancelWriting();
+        return Result{false, false, writer.errorString()};
+    }
+
+    QImage band(size.width(), bandRows, QImage::Format_RGB32);
+    if (band.isNull())
+    {
+        file.cancelWriting();
+        return Result{false, false, QCoreApplication::translate("ChartExporter", "No hay memoria suficiente para una franja de %1 píxeles de ancho").arg(size.width())};
+    }
+
+    for (int index = 0; index < bandCount; ++index)
+    {
+        if (promise.isCanceled())
+        {
+            file.cancelWriting();
+            return Result{false, true, QString()};
+        }
+
+        const int top = index * bandRows;
+        const QRectF bandRect(options.sceneRect.left(), options.sceneRect.top() + top / scale,
+                              options.sceneRect.width(), bandRows / scale);
+        band.fill(Qt::white);
+        QPainter painter(&band);
+        painter.setRenderHints(QPainter::Antialiasing | QPainter::SmoothPixmapTransform);
+        setSceneTransform(&painter, options.sceneRect, scale, QPointF(0, top));
+        painter.setClipRect(options.sceneRect);
+        paintChart(&painter, snapshot, bandRect, scale);
+        paintOverlay(&painter, snapshot, shapes, bandRect);
+        painter.end();
+
+        if (!writer.writeRows(band))
+        {
+            file.cancelWriting();
+            return Result{false, false, writer.errorString()};
+        }
+        promise.setProgressValue(index + 1);
+    }
+
+    if (!writer.finish())
+    {
+        file.cancelWriting();
+        return Result{false, false, writer.errorString()};
+    }
+    if (!file.commit())
+    {
+        return Result{false, false, file.errorString()};
+    }
+    return Result{true, false, QString()};
+}
+
+ChartExporter::Result ChartExporter::exportPdf(QPromise<Result> &promise, const Snapshot &snapshot,
+                                               const QList<Shape> &shapes, const Options &options)
+{
+    const QSize size = outputSize(options.sceneRect, options.dotsPerInch);
+    const qreal scale = exportScale(options.dotsPerInch);
+    const int columns = (size.width() + kTileSize - 1) / kTileSize;
+    const int rows = (size.height() + kTileSize - 1) / kTileSize;
+    // One step per chart tile and a last one for the vector overlay
+    promise.setProgressRange(0, columns * rows + 1);
+
+    QPdfWriter writer(options.filePath);
+    writer.setResolution(options.dotsPerInch);
+    writer.setPageSize(QPageSize(QSizeF(size) / options.dotsPerInch, QPageSize::Inch));
+    writer.setPageMargins(QMarginsF(0, 0, 0, 0));
+    writer.setCreator(QStringLiteral("NavTrainer"));
+    writer.setTitle(QFileInfo(options.filePath).completeBaseName());
+
+    QPainter painter;
+    if (!painter.begin(&writer))
+    {
+        return Result{false, false, QCoreApplication::translate("ChartExporter", "No se pudo escribir %1").arg(options.filePath)};
+    }
+
+    const auto abandon = [&painter, &options](Result result)
+    {
+        painter.end();
+        QFile::remove(options.filePath);
+        return result;
+    };
+
+    // The PDF engine writes each image out as soon as it is drawn, so only one tile is alive at a time
+    QImage tile(kTileSize, kTileSize, QImage::Format_RGB32);
+    for (int row = 0; row < rows; ++row)
+    {
+        for (int column = 0; column < columns; ++column)
+        {
+            if (promise.isCanceled())
+            {
+                return abandon(Result{false, true, QString()});
+            }
+
+            const QPoint origin(column * kTileSize, row * kTileSize);
+            const QSize tileSize(std::min(kTileSize, size.width() - origin.x()),
+                                 std::min(kTileSize, size.height() - origin.y()));
+            const QRectF tileRect(options.sceneRect.topLeft() + QPointF(origin) / scale, QSizeF(tileSize) / scale);
+
+            tile.fill(Qt::white);
+            QPainter tilePainter(&tile);
+            tilePainter.setRenderHint(QPainter::SmoothPixmapTransform);
+            setSceneTransform(&tilePainter, options.sceneRect, scale, origin);
+            paintChart(&tilePainter, snapshot, tileRect, scale);
+            tilePainter.end();
+
+            painter.drawImage(QRect(origin, tileSize), tile, QRect(QPoint(0, 0), tileSize));
+            promise.setProgressValue(row * columns + column + 1);
+        }
+    }
+
+    if (promise.isCanceled())
+    {
+        return abandon(Result{false, true, QString()});
+    }
+    painter.setRenderHint(QPainter::Antialiasing);
+    setSceneTransform(&painter, options.sceneRect, scale, QPointF());
+    painter.setClipRect(options.sceneRect);
+    paintOverlay(&painter, snapshot, shapes, options.sceneRect);
+    if (!painter.end())
+    {
+        QFile::remove(options.filePath);
+        return Result{false, false, QCoreApplication::translate("ChartExporter", "No se pudo escribir %1").arg(options.filePath)};
+    }
+    promise.setProgressValue(columns * rows + 1);
+    return Result{true, false, QString()};
+}
+
+QList<ChartExporter::Shape> ChartExporter::prepareShapes(const QList<AnnotationData> &annotations)
+{
+    QList<Shape> shapes;
+    shapes.reserve(annotations.size());
+    for (const AnnotationData &data : annotations)
+    {
+        if (data.points.isEmpty())
+        {
+            continue;
+        }
+
+        Shape shape;
+        shape.data = data;
+        switch (data.kind)
+        {
+        case AnnotationKind::Stroke:
+        case AnnotationKind::Arc:
+        {
+            shape.path = AnnotationCodec::path(data);
+            const qreal margin = data.width / 2.0 + 1.0;
+            shape.bounds = shape.path.controlPointRect().adjusted(-margin, -margin, margin, margin);
+            break;
+        }
+        case AnnotationKind::Line:
+        {
+            if (data.points.size() < 2)
+            {
+                continue;
+            }
+            const qreal margin = data.width / 2.0 + 1.0;
+            shape.bounds = QRectF(data.points.at(0), data.points.at(1)).normalized().adjusted(-margin, -margin, margin, margin);
+            break;
+        }
+        case AnnotationKind::Point:
+        {
+            const qreal reach = std::max<qreal>(1.0, data.width) * 1.5;
+            const QPointF center = data.points.constFirst();
+            shape.bounds = QRectF(center - QPointF(reach, reach), center + QPointF(reach, reach));
+            break;
+        }
+        case AnnotationKind::Text:
+        {
+            if (data.text.isEmpty())
+            {
+                continue;
+            }
+            const QFontMetricsF metrics(textFont(data));
+            shape.bounds = metrics.boundingRect(QRectF(data.points.constFirst(), QSizeF(1e6, 1e6)),
+                                                Qt::AlignLeft | Qt::AlignTop, data.text);
+            break;
+        }
+        }
+        shapes.append(shape);
+    }
+    return shapes;
+}
+
+void ChartExporter::paintOverlay(QPainter *painter, const Snapshot &snapshot, const QList<Shape> &shapes,
+                                 const QRectF &sceneRect)
+{
+    // Same styles as the items Carta::restoreAnnotation builds from the data
+    for (const Shape &shape : shapes)
+    {
+        if (!shape.bounds.intersects(sceneRect))
+        {
+            continue;
+        }
+
+        const AnnotationData &data = shape.data;
+        const QColor color = QColor::fromRgba(data.color);
+        switch (data.kind)
+        {
+        case AnnotationKind::Stroke:
+        case AnnotationKind::Arc:
+        {
+            QPen pen(color);
+            pen.setWidthF(data.width);
+            pen.setCapStyle(Qt::RoundCap);
+            pen.setJoinStyle(Qt::RoundJoin);
+            painter->setPen(pen);
+            painter->setBrush(Qt::NoBrush);
+            painter->drawPath(shape.path);
+            break;
+        }
+        case AnnotationKind::Line:
+        {
+            QPen pen(color);
+            pen.setWidthF(data.width);
+            pen.setCapStyle(Qt::RoundCap);
+            painter->setPen(pen);
+            painter->drawLine(data.points.at(0), data.points.at(1));
+            break;
+        }
+        case AnnotationKind::Point:
+        {
+            const qreal radius = std::max<qreal>(1.0, data.width);
+            QPen pen(color.darker(150));
+            pen.setWidth(std::max(1, qRound(radius / 2.4)));
+            painter->setPen(pen);
+            painter->setBrush(color);
+            painter->drawEllipse(data.points.constFirst(), radius, radius);
+            break;
+        }
+        case AnnotationKind::Text:
+            painter->setPen(color);
+            painter->setFont(textFont(data));
+            painter->drawText(shape.bounds, Qt::AlignLeft | Qt::AlignTop, data.text);
+            break;
+        }
+    }
+
+    if (snapshot.hasTools)
+    {
+        painter->drawPicture(QPointF(0, 0), snapshot.tools);
+    }
+}
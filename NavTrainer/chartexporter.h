@@ -0,0 +1,82 @@
+#ifndef CHARTEXPORTER_H
+#define CHARTEXPORTER_H
+
+#include "annotationcodec.h"
+#include "chartpyramiditem.h"
+
+#include <QList>
+#include <QPicture>
+#include <QPromise>
+#include <QRectF>
+#include <QSize>
+#include <QString>
+
+class QPainter;
+
+// Renders the chart with its annotations (and optionally the tools) to a PNG
+// or PDF file on a worker thread. Everything it draws comes from a Snapshot
+// taken on the GUI thread: the chart pixels are shared, annotations are
+// plain AnnotationData and the tools are a vector recording, so the live
+// scene is never touched while an export runs.
+//
+// Output is rendered offscreen one tile at a time and streamed out. PNG
+// bands go straight into PngStreamWriter; in a PDF every chart tile becomes
+// its own image, with annotations and tools drawn on top as vectors. Memory
+// stays bounded by one band whatever the output size.
+class ChartExporter
+{
+public:
+    // Chart pixels count as screen pixels at this density when converting the requested DPI to a scale
+    static constexpr int kSceneDotsPerInch = 96;
+    // Output pixels per side of a rendered tile
+    static constexpr int kTileSize = 1024;
+
+    enum class Format
+    {
+        Png,
+        Pdf
+    };
+
+    struct Options
+    {
+        QString filePath;
+        Format format = Format::Png;
+        QRectF sceneRect; // exported part of the scene, clipped to the chart
+        int dotsPerInch = 150;
+    };
+
+    struct Snapshot
+    {
+        ChartPyramidItem::Source chart;
+        QRectF chartRect;                  // scene rect of the chart item
+        QList<AnnotationData> annotations; // in paint order
+        QPicture tools;                    // recorded in scene coordinates; empty when not exported
+        bool hasTools = false;
+    };
+
+    struct Result
+    {
+        bool ok = false;
+        bool canceled = false;
+        QString error;
+    };
+
+    static QSize outputSize(const QRectF &sceneRect, int dotsPerInch);
+    // Meant for QtConcurrent::run; reports progress in tiles and stops between tiles once canceled.
+    // A canceled or failed export leaves no file behind.
+    static void run(QPromise<Result> &promise, const Snapshot &snapshot, const Options &options);
+
+private:
+    struct Shape;
+
+    static Result exportPng(QPromise<Result> &promise, const Snapshot &snapshot, const QList<Shape> &shapes,
+                            const Options &options);
+    static Result exportPdf(QPromise<Result> &promise, const Snapshot &snapshot, const QList<Shape> &shapes,
+                            const Options &options);
+    static QList<Shape> prepareShapes(const QList<AnnotationData> &annotations);
+    // Annotations and tools within sceneRect, with the painter already in scene coordinates
+    static void paintOverlay(QPainter *painter, const Snapshot &snapshot, const QList<Shape> &shapes,
+                             const QRectF &sceneRect);
+};
+
+#endif // CHARTEXPORTER_H
@@ -0,0 +1,303 @@
+#include "chartpyramiditem.h"
+#include "charttilecache.h"
+
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <algorithm>
+#include <cmath>
+
+ChartPyramidItem::ChartPyramidItem(const QImage &image, const QSize &chartSize, QGraphicsItem *parent)
+    : QGraphicsItem(parent), m_chartSize(chartSize.isValid() ? chartSize : image.size())
+{
+    int longestSide = std::max(m_chartSize.width(), m_chartSize.height());
+    m_levelCount = 1;
+    while (longestSide > kTileSize)
+    {
+        longestSide = (longestSide + 1) / 2;
+        ++m_levelCount;
+    }
+
+    setCacheBudget(kDefaultCacheBudget);
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption, true);
+    setCacheMode(QGraphicsItem::NoCache);
+    setImage(image);
+}
+
+QImage ChartPyramidItem::prepareImage(const QImage &image)
+{
+    // Keep the chart in a format the raster engine can blit without converting
+    const QImage::Format format = image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied
+                                                           : QImage::Format_RGB32;
+    return image.convertToFormat(format);
+}
+
+QImage ChartPyramidItem::halveImage(const QImage &image)
+{
+    const QSize halfSize((image.width() + 1) / 2, (image.height() + 1) / 2);
+    return image.scaled(halfSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+}
+
+void ChartPyramidItem::setImage(const QImage &image)
+{
+    m_tileCache.reset();
+    m_source = prepareImage(image);
+
+    m_baseLevel = 0;
+    if (!m_source.isNull() && m_source.width() > 0)
+    {
+        const qreal ratio = static_cast<qreal>(m_chartSize.width()) / m_source.width();
+        if (ratio > 1.0)
+        {
+            m_baseLevel = std::clamp(static_cast<int>(std::lround(std::log2(ratio))), 0, m_levelCount - 1);
+        }
+    }
+
+    m_levels.clear();
+    m_levels.resize(m_levelCount);
+    m_tiles.clear();
+    update();
+}
+
+bool ChartPyramidItem::setTileCache(const std::shared_ptr<ChartTileCache> &cache)
+{
+    if (!cache || cache->chartSize() != m_chartSize || cache->levelCount() != m_levelCount)
+    {
+        return false;
+    }
+
+    // The mapped pyramid covers every level, so the decoded images are no longer needed
+    m_tileCache = cache;
+    m_source = QImage();
+    m_baseLevel = 0;
+    m_levels.clear();
+    m_levels.resize(m_levelCount);
+    m_tiles.clear();
+    update();
+    return true;
+}
+
+QRectF ChartPyramidItem::boundingRect() const
+{
+    return QRectF(QPointF(0, 0), QSizeF(m_chartSize));
+}
+
+int ChartPyramidItem::levelForScale(qreal scale) const
+{
+    if (scale <= 0.0 || scale >= 1.0)
+    {
+        return 0;
+    }
+
+    // Coarsest level that still has at least one texel per device pixel
+    const int level = static_cast<int>(std::floor(std::log2(1.0 / scale)));
+    return std::clamp(level, 0, m_levelCount - 1);
+}
+
+void ChartPyramidItem::setLevelBias(int bias)
+{
+    bias = std::max(0, bias);
+    if (bias == m_levelBias)
+    {
+        return;
+    }
+    m_levelBias = bias;
+    update();
+}
+
+void ChartPyramidItem::releaseCaches()
+{
+    m_levels.clear();
+    m_levels.resize(m_levelCount);
+    m_tiles.clear();
+}
+
+qint64 ChartPyramidItem::memoryFootprint() const
+{
+    qint64 bytes = m_source.sizeInBytes() + static_cast<qint64>(m_tiles.totalCost()) * 1024;
+    for (const QImage &level : m_levels)
+    {
+        bytes += level.sizeInBytes();
+    }
+    return bytes;
+}
+
+void ChartPyramidItem::setCacheBudget(qint64 bytes)
+{
+    m_tiles.setMaxCost(std::max<qint64>(1, bytes / 1024));
+}
+
+qint64 ChartPyramidItem::cacheBudget() const
+{
+    return static_cast<qint64>(m_tiles.maxCost()) * 1024;
+}
+
+void ChartPyramidItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    Q_UNUSED(widget);
+
+    if (m_source.isNull() && !m_tileCache)
+    {
+        return;
+    }
+
+    const QRectF exposed = option->exposedRect.intersected(boundingRect());
+    if (exposed.isEmpty())
+    {
+        return;
+    }
+
+    const qreal scale = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+    const int level = std::clamp(std::max(levelForScale(scale) + m_levelBias, m_baseLevel), 0, m_levelCount - 1);
+    const int span = kTileSize << level; // chart pixels covered by one tile at this level
+
+    const int firstColumn = static_cast<int>(std::floor(exposed.left() / span));
+    const int lastColumn = static_cast<int>(std::ceil(exposed.right() / span)) - 1;
+    const int firstRow = static_cast<int>(std::floor(exposed.top() / span));
+    const int lastRow = static_cast<int>(std::ceil(exposed.bottom() / span)) - 1;
+
+    for (int row = firstRow; row <= lastRow; ++row)
+    {
+        for (int column = firstColumn; column <= lastColumn; ++column)
+        {
+            const qreal x = static_cast<qreal>(column) * span;
+            const qreal y = static_cast<qreal>(row) * span;
+            const QRectF target(x, y,
+                                std::min<qreal>(span, m_chartSize.width() - x),
+                                std::min<qreal>(span, m_chartSize.height() - y));
+
+            if (m_tileCache)
+            {
+                // Drawn straight from the mapped file, no decode and no copy
+                const QImage tile = m_tileCache->tile(level, column, row);
+                if (!tile.isNull())
+                {
+                    ++m_tileHits;
+                    painter->drawImage(target, tile, QRectF(tile.rect()));
+                }
+                continue;
+            }
+
+            const QPixmap tile = tilePixmap(level, column, row);
+            if (tile.isNull())
+            {
+                continue;
+            }
+            painter->drawPixmap(target, tile, QRectF(tile.rect()));
+        }
+    }
+}
+
+ChartPyramidItem::Source ChartPyramidItem::source() const
+{
+    Source result;
+    result.image = m_source;
+    result.baseLevel = m_baseLevel;
+    result.tileCache = m_tileCache;
+    result.chartSize = m_chartSize;
+    result.levelCount = m_levelCount;
+    return result;
+}
+
+void ChartPyramidItem::paintSource(QPainter *painter, const Source &source, const QRectF &sceneRect, qreal scale)
+{
+    const QRectF exposed = sceneRect.intersected(QRectF(QPointF(0, 0), QSizeF(source.chartSize)));
+    if (exposed.isEmpty())
+    {
+        return;
+    }
+
+    if (!source.tileCache)
+    {
+        if (source.image.isNull())
+        {
+            return;
+        }
+        // A single scaled blit; the source may be a preview a few levels coarser than the chart
+        const qreal texelsPerUnit = static_cast<qreal>(source.image.width()) / source.chartSize.width();
+        const QRectF texels(exposed.topLeft() * texelsPerUnit, exposed.size() * texelsPerUnit);
+        painter->drawImage(exposed, source.image, texels);
+        return;
+    }
+
+    int level = 0;
+    if (scale > 0.0 && scale < 1.0)
+    {
+        level = std::clamp(static_cast<int>(std::floor(std::log2(1.0 / scale))), 0, source.levelCount - 1);
+    }
+    const int span = kTileSize << level;
+
+    const int firstColumn = static_cast<int>(std::floor(exposed.left() / span));
+    const int lastColumn = static_cast<int>(std::ceil(exposed.right() / span)) - 1;
+    const int firstRow = static_cast<int>(std::floor(exposed.top() / span));
+    const int lastRow = static_cast<int>(std::ceil(exposed.bottom() / span)) - 1;
+    for (int row = firstRow; row <= lastRow; ++row)
+    {
+        for (int column = firstColumn; column <= lastColumn; ++column)
+        {
+            const QImage tile = source.tileCache->tile(level, column, row);
+            if (tile.isNull())
+            {
+                continue;
+            }
+            const qreal x = static_cast<qreal>(column) * span;
+            const qreal y = static_cast<qreal>(row) * span;
+            const QRectF target(x, y,
+                                std::min<qreal>(span, source.chartSize.width() - x),
+                                std::min<qreal>(span, source.chartSize.height() - y));
+            painter->drawImage(target, tile, QRectF(tile.rect()));
+        }
+    }
+}
+
+const QImage &ChartPyramidItem::levelImage(int level)
+{
+    if (level <= m_baseLevel)
+    {
+        return m_source;
+    }
+
+    QImage &cached = m_levels[level];
+    if (cached.isNull())
+    {
+        // Each level is built from the previous one so every halving is a cheap 2x2 reduction
+        cached = halveImage(levelImage(level - 1));
+    }
+    return cached;
+}
+
+QPixmap ChartPyramidItem::tilePixmap(int level, int column, int row)
+{
+    if (column < 0 || row < 0)
+    {
+        return QPixmap();
+    }
+
+    const quint64 key = tileKey(level, column, row);
+    if (QPixmap *cached = m_tiles.object(key))
+    {
+        ++m_tileHits;
+        return *cached;
+    }
+
+    const QImage &source = levelImage(level);
+    const QRect tileRect = QRect(column * kTileSize, row * kTileSize, kTileSize, kTileSize)
+                               .intersected(source.rect());
+    if (tileRect.isEmpty())
+    {
+        return QPixmap();
+    }
+
+    ++m_tileMisses;
+    const QPixmap tile = QPixmap::fromImage(source.copy(tileRect));
+    const qint64 cost = std::max<qint64>(1, static_cast<qint64>(tileRect.width()) * tileRect.height() * 4 / 1024);
+    // QCache may drop the new entry right away when it exceeds the budget, so hand it a copy
+    m_tiles.insert(key, new QPixmap(tile), cost);
+    return tile;
+}
+
+quint64 ChartPyramidItem::tileKey(int level, int column, int row)
+{
+    return (static_cast<quint64>(level) << 56) |
+           (static_cast<quint64>(static_cast<quint32>(column) & 0x0FFFFFFF) << 28) |
+           static_cast<quint64>(static_cast<quint32>(row) & 0x0FFFFFFF);
+}
@@ -0,0 +1,97 @@
+#ifndef CHARTPYRAMIDITEM_H
+#define CHARTPYRAMIDITEM_H
+
+#include <QCache>
+#include <QGraphicsItem>
+#include <QImage>
+#include <QList>
+#include <QPixmap>
+#include <QSize>
+
+#include <memory>
+
+class ChartTileCache;
+
+// Chart image split into fixed-size tiles at power-of-two zoom levels.
+// Level 0 is the full resolution chart, each following level halves it.
+// Paint picks the level matching the current view scale and only draws the
+// tiles that intersect the exposed rect; decoded tiles live in an LRU cache
+// bounded by a memory budget.
+//
+// The source image may be a downscaled preview of the chart: its level is
+// derived from chartSize and finer levels fall back to it until setImage()
+// swaps in a sharper decode. The item geometry never changes on a swap.
+// Once a memory-mapped ChartTileCache is attached, tiles are drawn straight
+// from the mapped pages and the decoded images are released.
+// The view may ask for coarser tiles with setLevelBias() while it is being
+// zoomed or panned, trading sharpness for fill rate until it settles.
+class ChartPyramidItem : public QGraphicsItem
+{
+public:
+    static constexpr int kTileSize = 512;
+    static constexpr qint64 kDefaultCacheBudget = 96ll * 1024 * 1024;
+
+    explicit ChartPyramidItem(const QImage &image, const QSize &chartSize = QSize(),
+                              QGraphicsItem *parent = nullptr);
+
+    QRectF boundingRect() const override;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override;
+
+    // Converts to the pixel format the pyramid draws from; safe to call from worker threads
+    static QImage prepareImage(const QImage &image);
+    // One pyramid step: halves both dimensions, rounding up
+    static QImage halveImage(const QImage &image);
+
+    void setImage(const QImage &image);
+    bool setTileCache(const std::shared_ptr<ChartTileCache> &cache);
+    bool hasTileCache() const { return m_tileCache != nullptr; }
+    bool isPreview() const { return m_baseLevel > 0 && !m_tileCache; }
+    QSize chartSize() const { return m_chartSize; }
+    int levelCount() const { return m_levelCount; }
+    int levelForScale(qreal scale) const;
+    // Draws this many levels coarser than the view scale needs; used while the view is moving
+    void setLevelBias(int bias);
+    int levelBias() const { return m_levelBias; }
+    void setCacheBudget(qint64 bytes);
+    qint64 cacheBudget() const;
+    // Drops derived levels and uploaded tiles, keeping only what is needed to rebuild them
+    void releaseCaches();
+    // Bytes of decoded pixels held by the item (mapped tile caches are not counted)
+    qint64 memoryFootprint() const;
+    // Running counters for diagnostics; mapped tiles always count as hits
+    quint64 tileHits() const { return m_tileHits; }
+    quint64 tileMisses() const { return m_tileMisses; }
+
+    // What the pyramid draws from, shared rather than copied, for painting off the GUI thread
+    struct Source
+    {
+        QImage image;   // null once a tile cache is attached
+        int baseLevel = 0;
+        std::shared_ptr<ChartTileCache> tileCache;
+        QSize chartSize;
+        int levelCount = 1;
+    };
+    Source source() const;
+    // Paints the part of a source inside sceneRect (item coordinates) with the painter's current
+    // transform, whose scale is given; touches no item state, so it is safe on worker threads
+    static void paintSource(QPainter *painter, const Source &source, const QRectF &sceneRect, qreal scale);
+
+private:
+    const QImage &levelImage(int level);
+    QPixmap tilePixmap(int level, int column, int row);
+    static quint64 tileKey(int level, int column, int row);
+
+    QImage m_source;
+    QSize m_chartSize;
+    int m_levelCount = 1;
+    int m_baseLevel = 0; // pyramid level m_source corresponds to
+    int m_levelBias = 0;
+    QList<QImage> m_levels;
+    std::shared_ptr<ChartTileCache> m_tileCache;
+    // Cost unit is KiB so the budget fits comfortably in the cache counter
+    QCache<quint64, QPixmap> m_tiles;
+    quint64 m_tileHits = 0;
+    quint64 m_tileMisses = 0;
+};
+
+#endif // CHARTPYRAMIDITEM_H
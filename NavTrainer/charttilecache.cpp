@@ -0,0 +1,316 @@
+#include "charttilecache.h"
+#include "chartpyramiditem.h"
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThread>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    constexpr quint32 kMagic = 0x3143544E; // "NTC1"
+    constexpr qint64 kTileAlignment = 64;
+    constexpr int kHashBytes = 32;
+
+    struct CacheHeader
+    {
+        quint32 magic;
+        quint32 version;
+        quint32 tileSize;
+        quint32 levelCount;
+        quint32 chartWidth;
+        quint32 chartHeight;
+        quint32 format;
+        quint32 tileCount;
+        quint64 fileSize;
+        char hash[kHashBytes];
+    };
+    static_assert(sizeof(CacheHeader) == 72, "cache header layout must stay stable");
+
+    struct TileEntry
+    {
+        quint64 offset;
+        quint32 width;
+        quint32 height;
+    };
+    static_assert(sizeof(TileEntry) == 16, "cache index layout must stay stable");
+
+    qint64 alignedOffset(qint64 offset)
+    {
+        return (offset + kTileAlignment - 1) / kTileAlignment * kTileAlignment;
+    }
+
+    int tilesAcross(int length, int tileSize)
+    {
+        return (length + tileSize - 1) / tileSize;
+    }
+}
+
+ChartTileCache::~ChartTileCache()
+{
+    if (m_data)
+    {
+        m_file.unmap(const_cast<uchar *>(m_data));
+    }
+}
+
+QByteArray ChartTileCache::hashFile(const QString &filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return QByteArray();
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    if (!hash.addData(&file))
+    {
+        return QByteArray();
+    }
+    return hash.result();
+}
+
+QString ChartTileCache::cacheDirectory()
+{
+    const QString overrideDir = qEnvironmentVariable("NAVTRAINER_CHART_CACHE");
+    if (!overrideDir.isEmpty())
+    {
+        return overrideDir;
+    }
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/charts");
+}
+
+QString ChartTileCache::cachePathFor(const QByteArray &hash)
+{
+    return cacheDirectory() + QLatin1Char('/') + QString::fromLatin1(hash.toHex()) + QStringLiteral(".ntc");
+}
+
+QVector<QSize> ChartTileCache::levelSizesFor(const QSize &chartSize, int tileSize)
+{
+    // Same halving rule as ChartPyramidItem so level indices line up
+    QVector<QSize> sizes;
+    QSize size = chartSize;
+    sizes.append(size);
+    while (std::max(size.width(), size.height()) > tileSize)
+    {
+        size = QSize((size.width() + 1) / 2, (size.height() + 1) / 2);
+        sizes.append(size);
+    }
+    return sizes;
+}
+
+std::shared_ptr<ChartTileCache> ChartTileCache::open(const QByteArray &hash, int tileSize)
+{
+    if (hash.size() != kHashBytes || tileSize <= 0)
+    {
+        return nullptr;
+    }
+
+    std::shared_ptr<ChartTileCache> cache(new ChartTileCache());
+    cache->m_file.setFileName(cachePathFor(hash));
+    if (!cache->m_file.open(QIODevice::ReadOnly))
+    {
+        return nullptr;
+    }
+
+    const qint64 size = cache->m_file.size();
+    if (size < static_cast<qint64>(sizeof(CacheHeader)))
+    {
+        return nullptr;
+    }
+
+    // Read-only shared mapping: other instances opening the same chart reuse these pages
+    const uchar *data = cache->m_file.map(0, size);
+    if (!data)
+    {
+        return nullptr;
+    }
+    cache->m_data = data;
+    cache->m_size = size;
+
+    CacheHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    const auto format = static_cast<QImage::Format>(header.format);
+    if (header.magic != kMagic || header.version != kVersion ||
+        header.tileSize != static_cast<quint32>(tileSize) ||
+        header.fileSize != static_cast<quint64>(size) ||
+        std::memcmp(header.hash, hash.constData(), kHashBytes) != 0 ||
+        header.chartWidth == 0 || header.chartHeight == 0 ||
+        (format != QImage::Format_RGB32 && format != QImage::Format_ARGB32_Premultiplied))
+    {
+        return nullptr;
+    }
+
+    cache->m_tileSize = tileSize;
+    cache->m_format = format;
+    cache->m_chartSize = QSize(static_cast<int>(header.chartWidth), static_cast<int>(header.chartHeight));
+    cache->m_levelSizes = levelSizesFor(cache->m_chartSize, tileSize);
+    if (cache->m_levelSizes.size() != static_cast<int>(header.levelCount))
+    {
+        return nullptr;
+    }
+
+    int tileCount = 0;
+    for (const QSize &levelSize : std::as_const(cache->m_levelSizes))
+    {
+        cache->m_levelFirstTile.append(tileCount);
+        tileCount += tilesAcross(levelSize.width(), tileSize) * tilesAcross(levelSize.height(), tileSize);
+    }
+
+    const qint64 indexEnd = static_cast<qint64>(sizeof(CacheHeader)) + static_cast<qint64>(tileCount) * sizeof(TileEntry);
+    if (tileCount != static_cast<int>(header.tileCount) || indexEnd > size)
+    {
+        return nullptr;
+    }
+    cache->m_index = data + sizeof(CacheHeader);
+
+    // Opened from the loader thread; hand the file over to the GUI thread that will own the cache
+    if (QCoreApplication *app = QCoreApplication::instance())
+    {
+        if (cache->m_file.thread() != app->thread())
+        {
+            cache->m_file.moveToThread(app->thread());
+        }
+    }
+    return cache;
+}
+
+bool ChartTileCache::build(const QByteArray &hash, const QImage &image, int tileSize)
+{
+    if (hash.size() != kHashBytes || image.isNull() || tileSize <= 0)
+    {
+        return false;
+    }
+
+    QImage level = ChartPyramidItem::prepareImage(image);
+    const QImage::Format format = level.format();
+    const QVector<QSize> levelSizes = levelSizesFor(level.size(), tileSize);
+
+    // Lay out every tile up front so the header can carry the final file size
+    QVector<TileEntry> entries;
+    qint64 offset = static_cast<qint64>(sizeof(CacheHeader));
+    for (const QSize &levelSize : levelSizes)
+    {
+        const int columns = tilesAcross(levelSize.width(), tileSize);
+        const int rows = tilesAcross(levelSize.height(), tileSize);
+        offset += static_cast<qint64>(columns) * rows * sizeof(TileEntry);
+    }
+    for (const QSize &levelSize : levelSizes)
+    {
+        const int columns = tilesAcross(levelSize.width(), tileSize);
+        const int rows = tilesAcross(levelSize.height(), tileSize);
+        for (int row = 0; row < rows; ++row)
+        {
+            for (int column = 0; column < columns; ++column)
+            {
+                TileEntry entry;
+                entry.width = static_cast<quint32>(std::min(tileSize, levelSize.width() - column * tileSize));
+                entry.height = static_cast<quint32>(std::min(tileSize, levelSize.height() - row * tileSize));
+                offset = alignedOffset(offset);
+                entry.offset = static_cast<quint64>(offset);
+                offset += static_cast<qint64>(entry.width) * entry.height * 4;
+                entries.append(entry);
+            }
+        }
+    }
+
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = kMagic;
+    header.version = kVersion;
+    header.tileSize = static_cast<quint32>(tileSize);
+    header.levelCount = static_cast<quint32>(levelSizes.size());
+    header.chartWidth = static_cast<quint32>(level.width());
+    header.chartHeight = static_cast<quint32>(level.height());
+    header.format = static_cast<quint32>(format);
+    header.tileCount = static_cast<quint32>(entries.size());
+    header.fileSize = static_cast<quint64>(offset);
+    std::memcpy(header.hash, hash.constData(), kHashBytes);
+
+    if (!QDir().mkpath(cacheDirectory()))
+    {
+        return false;
+    }
+
+    // QSaveFile renames into place, so readers never map a half-written cache
+    QSaveFile file(cachePathFor(hash));
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        return false;
+    }
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(entries.constData()), entries.size() * static_cast<qint64>(sizeof(TileEntry)));
+    qint64 position = static_cast<qint64>(sizeof(CacheHeader)) + entries.size() * static_cast<qint64>(sizeof(TileEntry));
+
+    const QByteArray padding(kTileAlignment, '\0');
+    int entryIndex = 0;
+    for (int levelIndex = 0; levelIndex < levelSizes.size(); ++levelIndex)
+    {
+        if (levelIndex > 0)
+        {
+            level = ChartPyramidItem::halveImage(level).convertToFormat(format);
+        }
+
+        const QSize levelSize = levelSizes.at(levelIndex);
+        const int columns = tilesAcross(levelSize.width(), tileSize);
+        const int rows = tilesAcross(levelSize.height(), tileSize);
+        for (int row = 0; row < rows; ++row)
+        {
+            for (int column = 0; column < columns; ++column)
+            {
+                const TileEntry &entry = entries.at(entryIndex++);
+                const qint64 gap = static_cast<qint64>(entry.offset) - position;
+                if (gap > 0)
+                {
+                    file.write(padding.constData(), gap);
+                }
+
+                const int x = column * tileSize;
+                const int y = row * tileSize;
+                const qint64 rowBytes = static_cast<qint64>(entry.width) * 4;
+                for (quint32 line = 0; line < entry.height; ++line)
+                {
+                    const uchar *scan = level.constScanLine(y + static_cast<int>(line)) + x * 4;
+                    file.write(reinterpret_cast<const char *>(scan), rowBytes);
+                }
+                position = static_cast<qint64>(entry.offset) + rowBytes * entry.height;
+            }
+        }
+    }
+
+    return file.commit();
+}
+
+QImage ChartTileCache::tile(int level, int column, int row) const
+{
+    if (!m_data || level < 0 || level >= m_levelSizes.size())
+    {
+        return QImage();
+    }
+
+    const QSize levelSize = m_levelSizes.at(level);
+    const int columns = tilesAcross(levelSize.width(), m_tileSize);
+    const int rows = tilesAcross(levelSize.height(), m_tileSize);
+    if (column < 0 || row < 0 || column >= columns || row >= rows)
+    {
+        return QImage();
+    }
+
+    TileEntry entry;
+    const int index = m_levelFirstTile.at(level) + row * columns + column;
+    std::memcpy(&entry, m_index + static_cast<qint64>(index) * sizeof(TileEntry), sizeof(entry));
+
+    const qint64 bytes = static_cast<qint64>(entry.width) * entry.height * 4;
+    if (static_cast<qint64>(entry.offset) + bytes > m_size)
+    {
+        return QImage();
+    }
+
+    return QImage(m_data + entry.offset, static_cast<int>(entry.width), static_cast<int>(entry.height),
+                  static_cast<qsizetype>(entry.width) * 4, m_format);
+}
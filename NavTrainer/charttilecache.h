@@ -0,0 +1,58 @@
+#ifndef CHARTTILECACHE_H
+#define CHARTTILECACHE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QImage>
+#include <QSize>
+#include <QString>
+#include <QVector>
+
+#include <memory>
+
+// On-disk pyramid of pre-resampled chart tiles, keyed by the content hash of
+// the chart file. Tiles are stored uncompressed in the pyramid's pixel format
+// and the whole file is memory-mapped read-only, so reopening a chart only
+// costs page faults and every NavTrainer instance on the machine shares the
+// same physical pages. The header carries a version, the chart geometry and
+// the expected file size so stale or truncated caches are rejected.
+class ChartTileCache
+{
+public:
+    static constexpr quint32 kVersion = 1;
+
+    ~ChartTileCache();
+
+    // Content hash of a chart file (or Qt resource); empty when unreadable
+    static QByteArray hashFile(const QString &filePath);
+    // Cache directory, overridable with NAVTRAINER_CHART_CACHE for a machine-wide location
+    static QString cacheDirectory();
+    static QString cachePathFor(const QByteArray &hash);
+
+    // Maps an existing cache; returns nullptr when it is missing, stale or corrupt
+    static std::shared_ptr<ChartTileCache> open(const QByteArray &hash, int tileSize);
+    // Writes the full pyramid of a decoded chart; meant to run on a worker thread
+    static bool build(const QByteArray &hash, const QImage &image, int tileSize);
+
+    QSize chartSize() const { return m_chartSize; }
+    int levelCount() const { return m_levelSizes.size(); }
+    // Zero-copy view over the mapped tile; valid while the cache is alive
+    QImage tile(int level, int column, int row) const;
+
+private:
+    ChartTileCache() = default;
+
+    static QVector<QSize> levelSizesFor(const QSize &chartSize, int tileSize);
+
+    QFile m_file;
+    const uchar *m_data = nullptr;
+    qint64 m_size = 0;
+    int m_tileSize = 0;
+    QImage::Format m_format = QImage::Format_Invalid;
+    QSize m_chartSize;
+    QVector<QSize> m_levelSizes;
+    QVector<int> m_levelFirstTile;
+    const uchar *m_index = nullptr;
+};
+
+#endif // CHARTTILECACHE_H
@@ -0,0 +1,122 @@
+#include "framestats.h"
+
+#include <QDateTime>
+#include <QSaveFile>
+#include <QTextStream>
+#include <algorithm>
+#include <cmath>
+
+FrameStatsRecorder::FrameStatsRecorder()
+    : m_samples(kCapacity), m_startMs(QDateTime::currentMSecsSinceEpoch())
+{
+}
+
+void FrameStatsRecorder::addSample(FrameSample sample)
+{
+    sample.timestampMs = QDateTime::currentMSecsSinceEpoch() - m_startMs;
+    m_samples[m_next] = sample;
+    m_next = (m_next + 1) % kCapacity;
+    m_count = std::min(m_count + 1, kCapacity);
+}
+
+void FrameStatsRecorder::clear()
+{
+    m_next = 0;
+    m_count = 0;
+}
+
+FrameSample FrameStatsRecorder::latest() const
+{
+    if (m_count == 0)
+    {
+        return FrameSample();
+    }
+    return m_samples.at((m_next + kCapacity - 1) % kCapacity);
+}
+
+QVector<FrameSample> FrameStatsRecorder::orderedSamples() const
+{
+    QVector<FrameSample> ordered;
+    ordered.reserve(m_count);
+    const int first = (m_next + kCapacity - m_count) % kCapacity;
+    for (int i = 0; i < m_count; ++i)
+    {
+        ordered.append(m_samples.at((first + i) % kCapacity));
+    }
+    return ordered;
+}
+
+qreal FrameStatsRecorder::percentile(qreal p) const
+{
+    if (m_count == 0)
+    {
+        return 0.0;
+    }
+
+    QVector<qreal> times;
+    times.reserve(m_count);
+    for (int i = 0; i < m_count; ++i)
+    {
+        times.append(m_samples.at(i).frameMs);
+    }
+
+    // Nearest-rank percentile; nth_element keeps it linear for the HUD refresh
+    const int rank = std::clamp(static_cast<int>(std::ceil(p / 100.0 * m_count)) - 1, 0, m_count - 1);
+    std::nth_element(times.begin(), times.begin() + rank, times.end());
+    return times.at(rank);
+}
+
+QVector<int> FrameStatsRecorder::histogram(int bucketCount, qreal bucketMs) const
+{
+    QVector<int> buckets(std::max(1, bucketCount), 0);
+    if (bucketMs <= 0.0)
+    {
+        return buckets;
+    }
+
+    for (int i = 0; i < m_count; ++i)
+    {
+        const int bucket = static_cast<int>(m_samples.at(i).frameMs / bucketMs);
+        ++buckets[std::clamp(bucket, 0, buckets.size() - 1)];
+    }
+    return buckets;
+}
+
+qreal FrameStatsRecorder::tileHitRate() const
+{
+    quint64 hits = 0;
+    quint64 total = 0;
+    for (int i = 0; i < m_count; ++i)
+    {
+        hits += m_samples.at(i).tileHits;
+        total += m_samples.at(i).tileHits + m_samples.at(i).tileMisses;
+    }
+    return total == 0 ? 1.0 : static_cast<qreal>(hits) / total;
+}
+
+bool FrameStatsRecorder::writeCsv(const QString &filePath) const
+{
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        return false;
+    }
+
+    QTextStream out(&file);
+    out << "timestamp_ms,frame_ms,scene_ms,tool_ms,exposed_x,exposed_y,exposed_w,exposed_h,"
+           "items_drawn,tile_hits,tile_misses,mouse_moves,mouse_dispatches\n";
+    const QVector<FrameSample> samples = orderedSamples();
+    for (const FrameSample &sample : samples)
+    {
+        out << sample.timestampMs << ','
+            << QString::number(sample.frameMs, 'f', 3) << ','
+            << QString::number(sample.sceneMs, 'f', 3) << ','
+            << QString::number(sample.toolMs, 'f', 3) << ','
+            << sample.exposedRect.x() << ',' << sample.exposedRect.y() << ','
+            << sample.exposedRect.width() << ',' << sample.exposedRect.height() << ','
+            << sample.itemsDrawn << ',' << sample.tileHits << ',' << sample.tileMisses << ','
+            << sample.mouseMoves << ',' << sample.mouseDispatches << '\n';
+    }
+    out.flush();
+    return file.commit();
+}
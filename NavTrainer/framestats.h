@@ -0,0 +1,55 @@
+#ifndef FRAMESTATS_H
+#define FRAMESTATS_H
+
+#include <QRect>
+#include <QString>
+#include <QVector>
+
+// One viewport paint of the chart view
+struct FrameSample
+{
+    qint64 timestampMs = 0; // since the recorder was created
+    qreal frameMs = 0.0;    // whole paint event
+    qreal sceneMs = 0.0;    // chart/annotation layer re-rendering, 0 when only blitted
+    qreal toolMs = 0.0;     // tool layer re-rendering, 0 when only blitted
+    QRect exposedRect;      // viewport area re-rendered into the scene layer
+    int itemsDrawn = 0;     // scene items intersecting the re-rendered area
+    quint64 tileHits = 0;   // chart and annotation tiles served from cache
+    quint64 tileMisses = 0; // tiles that had to be built
+    int mouseMoves = 0;      // mouse move events received since the previous frame
+    int mouseDispatches = 0; // moves actually handled after coalescing
+};
+
+// Fixed-size ring buffer of frame samples with percentile and histogram
+// queries for the diagnostics HUD, and CSV export so runs of different
+// builds can be compared offline.
+class FrameStatsRecorder
+{
+public:
+    static constexpr int kCapacity = 600;
+
+    FrameStatsRecorder();
+
+    void addSample(FrameSample sample);
+    void clear();
+    int sampleCount() const { return m_count; }
+    FrameSample latest() const;
+
+    // Frame time percentile over the buffered samples, p in [0, 100]
+    qreal percentile(qreal p) const;
+    // Frame time counts in buckets of bucketMs; the last bucket collects everything slower
+    QVector<int> histogram(int bucketCount, qreal bucketMs) const;
+    qreal tileHitRate() const;
+
+    bool writeCsv(const QString &filePath) const;
+
+private:
+    QVector<FrameSample> orderedSamples() const;
+
+    QVector<FrameSample> m_samples;
+    int m_next = 0;
+    int m_count = 0;
+    qint64 m_startMs = 0;
+};
+
+#endif // FRAMESTATS_H
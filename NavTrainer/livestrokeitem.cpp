@@ -0,0 +1,271 @@
+#include "livestrokeitem.h"
+#include "strokeprocessing.h"
+
+#include <QPaintEngine>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    // Minimum growth of the reported bounds, in scene units
+    constexpr qreal kBoundsSlack = 256.0;
+    // Side of the translucent stroke layer's tiles, in device pixels
+    constexpr int kLayerTileSize = 256;
+}
+
+LiveStrokeItem::LiveStrokeItem(const QPointF &start, QGraphicsItem *parent)
+    : QGraphicsItem(parent)
+{
+    // exposedRect lets paint() skip the parts of a long stroke outside the dirty area
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption, true);
+    m_points.reserve(256);
+    m_points.append(start);
+    const qreal margin = penMargin();
+    m_pointBounds = QRectF(start, start).adjusted(-margin, -margin, margin, margin);
+    m_reportedBounds = m_pointBounds.adjusted(-kBoundsSlack, -kBoundsSlack, kBoundsSlack, kBoundsSlack);
+}
+
+void LiveStrokeItem::setPen(const QPen &pen)
+{
+    if (pen == m_pen)
+    {
+        return;
+    }
+
+    const bool widthChanged = pen.widthF() != m_pen.widthF();
+    m_pen = pen;
+    m_layerScale = 0.0;
+    if (widthChanged)
+    {
+        prepareGeometryChange();
+        const qreal margin = penMargin();
+        m_pointBounds = m_points.boundingRect().adjusted(-margin, -margin, margin, margin);
+        m_reportedBounds = m_reportedBounds.united(m_pointBounds);
+    }
+    update();
+}
+
+void LiveStrokeItem::appendPoint(const QPointF &point)
+{
+    const QPointF previous = m_points.constLast();
+    m_points.append(point);
+
+    const qreal margin = penMargin();
+    const QRectF segmentRect = QRectF(previous, point).normalized().adjusted(-margin, -margin, margin, margin);
+    m_pointBounds = m_pointBounds.united(segmentRect);
+
+    if (!m_reportedBounds.contains(segmentRect))
+    {
+        // Grow geometrically so the scene re-indexes the item O(log n) times per stroke
+        const qreal slackX = std::max(kBoundsSlack, m_pointBounds.width() * 0.5);
+        const qreal slackY = std::max(kBoundsSlack, m_pointBounds.height() * 0.5);
+        prepareGeometryChange();
+        m_reportedBounds = m_reportedBounds.united(m_pointBounds.adjusted(-slackX, -slackY, slackX, slackY));
+    }
+
+    update(segmentRect);
+}
+
+QPainterPath LiveStrokeItem::path() const
+{
+    return StrokeProcessing::polylinePath(m_points);
+}
+
+QRectF LiveStrokeItem::boundingRect() const
+{
+    return m_reportedBounds;
+}
+
+void LiveStrokeItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    Q_UNUSED(widget);
+
+    painter->setPen(m_pen);
+    painter->setBrush(Qt::NoBrush);
+
+    if (m_points.size() == 1)
+    {
+        painter->drawPoint(m_points.constFirst());
+        return;
+    }
+
+    const QRectF exposed = option ? option->exposedRect : QRectF();
+    if (m_pen.color().alpha() < 255)
+    {
+        // Without the layer a translucent stroke must be stroked in one call, or overlapping runs darken
+        if (!paintThroughLayer(painter, exposed))
+        {
+            drawRange(painter, 0, m_points.size() - 1);
+        }
+        return;
+    }
+
+    if (exposed.isEmpty() || exposed.contains(m_pointBounds))
+    {
+        drawRange(painter, 0, m_points.size() - 1);
+        return;
+    }
+
+    const qreal margin = penMargin();
+    int runStart = -1;
+    for (int i = 1; i < m_points.size(); ++i)
+    {
+        const QRectF segment = QRectF(m_points.at(i - 1), m_points.at(i)).normalized().adjusted(-margin, -margin, margin, margin);
+        const bool visible = exposed.intersects(segment);
+        if (visible && runStart < 0)
+        {
+            runStart = i - 1;
+        }
+        else if (!visible && runStart >= 0)
+        {
+            drawRange(painter, runStart, i - 1);
+            runStart = -1;
+        }
+    }
+    if (runStart >= 0)
+    {
+        drawRange(painter, runStart, m_points.size() - 1);
+    }
+}
+
+qreal LiveStrokeItem::penMargin() const
+{
+    return std::max<qreal>(1.0, m_pen.widthF() / 2.0 + 1.0);
+}
+
+void LiveStrokeItem::drawRange(QPainter *painter, int first, int last) const
+{
+    painter->drawPolyline(m_points.constData() + first, last - first + 1);
+}
+
+quint64 LiveStrokeItem::tileKey(int column, int row)
+{
+    return (static_cast<quint64>(static_cast<quint32>(column)) << 32) | static_cast<quint32>(row);
+}
+
+bool LiveStrokeItem::paintThroughLayer(QPainter *painter, const QRectF &exposed)
+{
+    const QPaintEngine *engine = painter->paintEngine();
+    const QTransform world = painter->worldTransform();
+    if (!engine || engine->type() != QPaintEngine::Raster || world.type() > QTransform::TxScale
+        || !qFuzzyCompare(std::abs(world.m11()), std::abs(world.m22())))
+    {
+        return false;
+    }
+    const qreal devicePixelRatio = painter->device() ? painter->device()->devicePixelRatioF() : 1.0;
+    const qreal scale = std::abs(world.m11()) * devicePixelRatio;
+    if (scale <= 0.0)
+    {
+        return false;
+    }
+
+    // A new zoom redraws the stroke once; otherwise only the segments added since the last paint
+    if (!qFuzzyCompare(scale, m_layerScale))
+    {
+        m_layerTiles.clear();
+        m_layerScale = scale;
+        m_layerPoints = 0;
+    }
+    if (m_layerPoints < m_points.size())
+    {
+        drawIntoLayer(m_layerPoints, painter->renderHints());
+        m_layerPoints = m_points.size();
+    }
+
+    // Only the exposed part of the tiles is blended, so a new segment costs its own area
+    const QRectF target = exposed.isEmpty() ? m_pointBounds : exposed.intersected(m_pointBounds);
+    if (target.isEmpty())
+    {
+        return true;
+    }
+    const qreal tileSpan = kLayerTileSize / scale;
+    const int firstColumn = static_cast<int>(std::floor(target.left() / tileSpan));
+    const int lastColumn = static_cast<int>(std::floor(target.right() / tileSpan));
+    const int firstRow = static_cast<int>(std::floor(target.top() / tileSpan));
+    const int lastRow = static_cast<int>(std::floor(target.bottom() / tileSpan));
+
+    painter->save();
+    painter->setOpacity(painter->opacity() * m_pen.color().alphaF());
+    for (int row = firstRow; row <= lastRow; ++row)
+    {
+        for (int column = firstColumn; column <= lastColumn; ++column)
+        {
+            const auto tile = m_layerTiles.constFind(tileKey(column, row));
+            if (tile == m_layerTiles.constEnd())
+            {
+                continue;
+            }
+            const QRectF tileRect(column * tileSpan, row * tileSpan, tileSpan, tileSpan);
+            const QRectF part = target.intersected(tileRect);
+            const QRectF source((part.topLeft() - tileRect.topLeft()) * scale, part.size() * scale);
+            painter->drawImage(part, tile.value(), source);
+        }
+    }
+    painter->restore();
+    return true;
+}
+
+void LiveStrokeItem::drawIntoLayer(int first, const QPainter::RenderHints &hints)
+{
+    const qreal scale = m_layerScale;
+    const qreal tileSpan = kLayerTileSize / scale;
+    const qreal margin = penMargin();
+
+    // Consecutive segments touching the same tile form one run there, so joins are stroked
+    // properly. The segment before the new ones is redrawn to join them to what is there
+    QHash<quint64, QList<QPair<int, int>>> runs;
+    for (int i = std::max(1, first - 1); i < m_points.size(); ++i)
+    {
+        const QRectF segment = QRectF(m_points.at(i - 1), m_points.at(i)).normalized().adjusted(-margin, -margin, margin, margin);
+        const int firstColumn = static_cast<int>(std::floor(segment.left() / tileSpan));
+        const int lastColumn = static_cast<int>(std::floor(segment.right() / tileSpan));
+        const int firstRow = static_cast<int>(std::floor(segment.top() / tileSpan));
+        const int lastRow = static_cast<int>(std::floor(segment.bottom() / tileSpan));
+        for (int row = firstRow; row <= lastRow; ++row)
+        {
+            for (int column = firstColumn; column <= lastColumn; ++column)
+            {
+                QList<QPair<int, int>> &tileRuns = runs[tileKey(column, row)];
+                if (!tileRuns.isEmpty() && tileRuns.last().second == i - 1)
+                {
+                    tileRuns.last().second = i;
+                }
+                else
+                {
+                    tileRuns.append({i - 1, i});
+                }
+            }
+        }
+    }
+
+    QPen opaquePen = m_pen;
+    QColor color = opaquePen.color();
+    color.setAlpha(255);
+    opaquePen.setColor(color);
+
+    for (auto it = runs.cbegin(); it != runs.cend(); ++it)
+    {
+        auto tile = m_layerTiles.find(it.key());
+        if (tile == m_layerTiles.end())
+        {
+            QImage image(kLayerTileSize, kLayerTileSize, QImage::Format_ARGB32_Premultiplied);
+            image.fill(Qt::transparent);
+            tile = m_layerTiles.insert(it.key(), image);
+        }
+        const int column = static_cast<int>(static_cast<qint32>(it.key() >> 32));
+        const int row = static_cast<int>(static_cast<qint32>(it.key() & 0xFFFFFFFF));
+
+        QPainter layerPainter(&tile.value());
+        layerPainter.setRenderHints(hints);
+        layerPainter.translate(-column * kLayerTileSize, -row * kLayerTileSize);
+        layerPainter.scale(scale, scale);
+        layerPainter.setPen(opaquePen);
+        layerPainter.setBrush(Qt::NoBrush);
+        for (const QPair<int, int> &run : it.value())
+        {
+            drawRange(&layerPainter, run.first, run.second);
+        }
+    }
+}
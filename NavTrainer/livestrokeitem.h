@@ -0,0 +1,59 @@
+#ifndef LIVESTROKEITEM_H
+#define LIVESTROKEITEM_H
+
+#include <QGraphicsItem>
+#include <QHash>
+#include <QImage>
+#include <QPainter>
+#include <QPainterPath>
+#include <QPen>
+#include <QPolygonF>
+#include <QRectF>
+
+// Freehand stroke while the trainee is still drawing it. Points are appended
+// in amortized O(1): the item only repaints the bounding box of the newest
+// segment, and its reported bounding rect grows in coarse steps so the scene
+// index is not updated on every mouse move. Translucent pens cannot stroke the
+// newest segment on its own (overlaps would darken), so the stroke is drawn
+// opaque into tiles of an offscreen layer one new run at a time and
+// composited with the pen's alpha. Only tiles the stroke passes through are
+// allocated, so the layer has no size limit. Once the stroke is finished the
+// points are handed over to a regular committed annotation item.
+class LiveStrokeItem : public QGraphicsItem
+{
+public:
+    explicit LiveStrokeItem(const QPointF &start, QGraphicsItem *parent = nullptr);
+
+    QPen pen() const { return m_pen; }
+    void setPen(const QPen &pen);
+
+    void appendPoint(const QPointF &point);
+    QPointF lastPoint() const { return m_points.constLast(); }
+    int pointCount() const { return m_points.size(); }
+    const QPolygonF &points() const { return m_points; }
+    QPainterPath path() const;
+
+    QRectF boundingRect() const override;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override;
+
+private:
+    qreal penMargin() const;
+    void drawRange(QPainter *painter, int first, int last) const;
+    // False when the painter cannot use the layer (not raster, or rotated)
+    bool paintThroughLayer(QPainter *painter, const QRectF &exposed);
+    // Draws segments from the one ending at point first onwards into the tiles they cross
+    void drawIntoLayer(int first, const QPainter::RenderHints &hints);
+    static quint64 tileKey(int column, int row);
+
+    QPolygonF m_points;
+    QPen m_pen;
+    QRectF m_pointBounds;
+    // Bounding rect reported to the scene; grows ahead of m_pointBounds by a slack margin
+    QRectF m_reportedBounds;
+    // Opaque rendering of the stroke for translucent pens, in device-pixel tiles
+    QHash<quint64, QImage> m_layerTiles;
+    qreal m_layerScale = 0.0;  // device pixels per item unit it was drawn at; 0 when invalid
+    int m_layerPoints = 0;     // points already drawn into it
+};
+
+#endif // LIVESTROKEITEM_H
@@ -1,7 +1,10 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 
+#include "annotationpersistence.h"
 #include "carta.h"
+#include "chartexporter.h"
+#include "chartcatalogpanel.h"
 #include "mapoverlaypanel.h"
 #include "problem.h"
 #include "selecpro.h"
@@ -14,13 +17,23 @@
 #include "navlib/navigationdao.h"
 
 #include <QDebug>
+#include <QCheckBox>
 #include <QColor>
+#include <QComboBox>
+#include <QDialog>
+#include <QDialogButtonBox>
 #include <QFile>
 #include <QFileDialog>
 #include <QFileInfo>
+#include <QFormLayout>
+#include <QFutureWatcher>
 #include <QIODevice>
+#include <QLabel>
 #include <QMessageBox>
+#include <QProgressDialog>
 #include <QShortcut>
+#include <QSpinBox>
+#include <QtConcurrent/QtConcurrentRun>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QPainter>
@@ -42,7 +55,10 @@ MainWindow::MainWindow(QWidget *parent)
     m_dao = new NavigationDAO(QStringLiteral("data/navdb.sqlite"));
 
     setupMapView();
+    // Anotaciones guardadas por usuario y carta
+    m_annotationPersistence = new AnnotationPersistence(m_carta, m_dao, this);
     setupOverlayPanel();
+    setupChartCatalog();
 
     // Inicializar notificación toast
     m_toastNotification = new ToastNotification(this);
@@ -65,6 +81,7 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow()
 {
+    m_annotationPersistence->flush();
     delete ui;
 }
 
@@ -78,6 +95,14 @@ void MainWindow::setupMapView()
     mapLayout->setSpacing(0);
     mapLayout->addWidget(m_carta);
     mapLayout->setStretch(0, 1);
+
+    // Charts open with a preview; the full resolution decode finishes in the background
+    connect(m_carta, &Carta::mapLoadFinished, this, [this](bool ok)
+            {
+        if (!ok)
+        {
+            showToast(tr("No se pudo cargar la carta a resolución completa"), ToastNotification::Warning);
+        } });
 }
 
 void MainWindow::setupOverlayPanel()
@@ -133,36 +158,60 @@ void MainWindow::setupOverlayPanel()
         {
             m_carta->setInteractionMode(Carta::InteractionMode::Grid);
         } });
+    connect(m_overlayPanel, &MapOverlayPanel::selectModeSelected, this, [this]()
+            {
+        if (m_carta)
+        {
+            m_carta->setInteractionMode(Carta::InteractionMode::Select);
+        } });
+    // Con anotaciones seleccionadas, color, grosor y opacidad también se aplican a ellas
     connect(m_overlayPanel, &MapOverlayPanel::colorPicked, this, [this](const QColor &color)
             {
         if (m_carta)
         {
             m_carta->setDrawingColor(color);
+            m_carta->recolorSelection(color);
         } });
     connect(m_overlayPanel, &MapOverlayPanel::strokeWidthChanged, this, [this](int value)
             {
         if (m_carta)
         {
             m_carta->setStrokeWidth(value);
+            m_carta->setSelectionStrokeWidth(value);
         } });
     connect(m_overlayPanel, &MapOverlayPanel::strokeOpacityChanged, this, [this](int value)
             {
         if (m_carta)
         {
             m_carta->setStrokeOpacity(value);
+            m_carta->setSelectionOpacity(value);
         } });
-    connect(m_overlayPanel, &MapOverlayPanel::undoRequested, this, [this]()
+    connect(m_overlayPanel, &MapOverlayPanel::strokeSmoothingToggled, this, [this](bool enabled)
             {
         if (m_carta)
         {
-            m_carta->undoLastAnnotation();
+            m_carta->setStrokeSmoothingEnabled(enabled);
         } });
-    connect(m_overlayPanel, &MapOverlayPanel::clearEditsRequested, this, [this]()
+    connect(m_overlayPanel, &MapOverlayPanel::eraserSplitToggled, this, [this](bool enabled)
+            {
+        if (m_carta)
+        {
+            m_carta->setEraserSplitsStrokes(enabled);
+        } });
+    connect(m_overlayPanel, &MapOverlayPanel::geometrySnapToggled, this, [this](bool enabled)
             {
         if (m_carta)
         {
-            m_carta->clearUserAnnotations();
+            m_carta->setGeometrySnapEnabled(enabled);
+        } });
+    connect(m_overlayPanel, &MapOverlayPanel::undoRequested, this, [this]()
+            {
+        if (m_carta)
+        {
+            m_carta->undoLastAnnotation();
         } });
+    connect(m_overlayPanel, &MapOverlayPanel::clearEditsRequested, this, [this]()
+            { deleteAnnotations(); });
     connect(m_overlayPanel, &MapOverlayPanel::gridToggled, this, [this](bool enabled)
             {
         if (m_carta)
@@ -251,7 +300,173 @@ bool MainWindow::loadMapFromFile(const QString &filePath)
     return true;
 }
 
+void MainWindow::setupChartCatalog()
+{
+    m_chartCatalog = new ChartCatalogPanel(this);
+    m_chartCatalog->addBuiltInChart(QStringLiteral(":/assets/carta_nautica.jpg"), tr("Estrecho de Gibraltar"));
+
+    connect(m_chartCatalog, &ChartCatalogPanel::chartSelected, this, [this](const QString &filePath, const QString &title)
+            {
+        const bool loaded = filePath.startsWith(QLatin1Char(':')) ? loadMapResource(filePath, title)
+                                                                  : loadMapFromFile(filePath);
+        if (!loaded)
+        {
+            QMessageBox::warning(this, tr("Error"),
+                                 tr("No se pudo cargar el mapa seleccionado."));
+        } });
+    connect(m_chartCatalog, &ChartCatalogPanel::browseRequested, this, &MainWindow::browseForMapFile);
+}
+
+void MainWindow::deleteAnnotations()
+{
+    if (!m_carta)
+    {
+        return;
+    }
+
+    // Con una selección activa solo se eliminan esas anotaciones; si no, todas
+    if (m_carta->hasSelection())
+    {
+        m_carta->deleteSelectedAnnotations();
+    }
+    else
+    {
+        m_carta->clearUserAnnotations();
+    }
+}
+
+void MainWindow::exportChart()
+{
+    if (!m_carta || m_carta->mapPath().isEmpty() || m_exportInProgress)
+    {
+        return;
+    }
+
+    const QString baseName = m_currentMapTitle.isEmpty() ? QStringLiteral("carta") : m_currentMapTitle;
+    QString selectedFilter;
+    QString filePath = QFileDialog::getSaveFileName(this, tr("Exportar carta"), baseName + QStringLiteral(".png"),
+                                                    tr("PNG (*.png);;PDF (*.pdf)"), &selectedFilter);
+    if (filePath.isEmpty())
+    {
+        return;
+    }
+    // El formato lo decide la extensión; si falta, se añade la del filtro elegido
+    QString suffix = QFileInfo(filePath).suffix().toLower();
+    if (suffix != QLatin1String("png") && suffix != QLatin1String("pdf"))
+    {
+        suffix = selectedFilter.startsWith(QLatin1String("PDF")) ? QStringLiteral("pdf") : QStringLiteral("png");
+        filePath += QLatin1Char('.') + suffix;
+    }
+
+    // Opciones: resolución, zona exportada y herramientas
+    QDialog optionsDialog(this);
+    optionsDialog.setWindowTitle(tr("Opciones de exportación"));
+    auto *form = new QFormLayout(&optionsDialog);
+    auto *dpiSpin = new QSpinBox(&optionsDialog);
+    dpiSpin->setRange(72, 1200);
+    dpiSpin->setSingleStep(50);
+    dpiSpin->setValue(300);
+    dpiSpin->setSuffix(tr(" ppp"));
+    form->addRow(tr("Resolución:"), dpiSpin);
+    auto *areaCombo = new QComboBox(&optionsDialog);
+    areaCombo->addItem(tr("Carta completa"));
+    areaCombo->addItem(tr("Vista actual"));
+    form->addRow(tr("Zona:"), areaCombo);
+    auto *toolsCheck = new QCheckBox(tr("Incluir herramientas"), &optionsDialog);
+    toolsCheck->setChecked(true);
+    form->addRow(QString(), toolsCheck);
+    auto *sizeLabel = new QLabel(&optionsDialog);
+    form->addRow(tr("Tamaño:"), sizeLabel);
+    auto *buttons = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel, &optionsDialog);
+    form->addRow(buttons);
+    connect(buttons, &QDialogButtonBox::accepted, &optionsDialog, &QDialog::accept);
+    connect(buttons, &QDialogButtonBox::rejected, &optionsDialog, &QDialog::reject);
+
+    const QRectF chartRect = m_carta->sceneRect();
+    const QRectF visibleRect = m_carta->visibleChartRect();
+    auto exportRect = [&]()
+    {
+        return areaCombo->currentIndex() == 1 ? visibleRect : chartRect;
+    };
+    auto updateSizeLabel = [&]()
+    {
+        const QSize size = ChartExporter::outputSize(exportRect(), dpiSpin->value());
+        sizeLabel->setText(tr("%1 × %2 píxeles").arg(size.width()).arg(size.height()));
+    };
+    connect(dpiSpin, &QSpinBox::valueChanged, &optionsDialog, updateSizeLabel);
+    connect(areaCombo, &QComboBox::currentIndexChanged, &optionsDialog, updateSizeLabel);
+    updateSizeLabel();
+
+    if (optionsDialog.exec() != QDialog::Accepted)
+    {
+        return;
+    }
+
+    ChartExporter::Options options;
+    options.filePath = filePath;
+    options.format = suffix == QLatin1String("pdf") ? ChartExporter::Format::Pdf : ChartExporter::Format::Png;
+    options.sceneRect = exportRect();
+    options.dotsPerInch = dpiSpin->value();
+    // La instantánea se toma aquí, en el hilo de la interfaz; el resto se dibuja en segundo plano
+    const ChartExporter::Snapshot snapshot = m_carta->exportSnapshot(toolsCheck->isChecked());
+
+    auto *progress = new QProgressDialog(tr("Exportando carta..."), tr("Cancelar"), 0, 0, this);
+    progress->setWindowModality(Qt::WindowModal);
+    progress->setMinimumDuration(300);
+    progress->setAutoClose(false);
+    progress->setAutoReset(false);
+
+    auto *watcher = new QFutureWatcher<ChartExporter::Result>(this);
+    connect(watcher, &QFutureWatcherBase::progressRangeChanged, progress, &QProgressDialog::setRange);
+    connect(watcher, &QFutureWatcherBase::progressValueChanged, progress, &QProgressDialog::setValue);
+    connect(progress, &QProgressDialog::canceled, watcher, &QFutureWatcherBase::cancel);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, progress, filePath]()
+            {
+        m_exportInProgress = false;
+        progress->deleteLater();
+        watcher->deleteLater();
+
+        const ChartExporter::Result result = watcher->future().resultCount() > 0 ? watcher->future().resultAt(0)
+                                                                                  : ChartExporter::Result{false, true, QString()};
+        if (result.ok)
+        {
+            showToast(tr("Carta exportada a %1").arg(QFileInfo(filePath).fileName()), ToastNotification::Success);
+        }
+        else if (result.canceled)
+        {
+            showToast(tr("Exportación cancelada"), ToastNotification::Info);
+        }
+        else
+        {
+            QMessageBox::warning(this, tr("Error"),
+                                 tr("No se pudo exportar la carta:\n%1").arg(result.error));
+        } });
+
+    m_exportInProgress = true;
+    watcher->setFuture(QtConcurrent::run([snapshot, options](QPromise<ChartExporter::Result> &promise)
+                                         { ChartExporter::run(promise, snapshot, options); }));
+}
+
 void MainWindow::promptForMapChange()
+{
+    if (!m_chartCatalog)
+    {
+        browseForMapFile();
+        return;
+    }
+
+    // Las cartas recientes siguen decodificadas en Carta, así que volver a ellas es inmediato
+    m_chartCatalog->rescan();
+    if (m_carta)
+    {
+        m_chartCatalog->setCurrentChart(m_carta->mapPath());
+    }
+    m_chartCatalog->show();
+    m_chartCatalog->raise();
+    m_chartCatalog->activateWindow();
+}
+
+void MainWindow::browseForMapFile()
 {
     const QString filePath = QFileDialog::getOpenFileName(
         this, tr("Seleccionar mapa"), QString(),
@@ -320,6 +535,13 @@ void MainWindow::setupShortcuts()
             m_overlayPanel->setActiveMode(MapOverlayPanel::Mode::Point);
         } });
 
+    bind(QKeySequence(Qt::Key_S), [this]()
+         {
+        if (m_overlayPanel)
+        {
+            m_overlayPanel->setActiveMode(MapOverlayPanel::Mode::Select);
+        } });
+
     bind(QKeySequence::Undo, [this]()
          {
         if (m_carta)
@@ -327,15 +549,51 @@ void MainWindow::setupShortcuts()
             m_carta->undoLastAnnotation();
         } });
 
-    bind(QKeySequence::Delete, [this]()
+    bind(QKeySequence::Redo, [this]()
          {
         if (m_carta)
         {
-            m_carta->clearUserAnnotations();
+            m_carta->redoLastAnnotation();
         } });
 
+    bind(QKeySequence::Delete, [this]()
+         { deleteAnnotations(); });
+
     bind(QKeySequence(Qt::CTRL | Qt::Key_O), [this]()
          { promptForMapChange(); });
+
+    bind(QKeySequence(Qt::CTRL | Qt::Key_E), [this]()
+         { exportChart(); });
+
+    // Diagnóstico de rendimiento de la carta
+    bind(QKeySequence(Qt::Key_F3), [this]()
+         {
+        if (m_carta)
+        {
+            m_carta->setDiagnosticsVisible(!m_carta->diagnosticsVisible());
+        } });
+
+    bind(QKeySequence(Qt::SHIFT | Qt::Key_F3), [this]()
+         {
+        if (!m_carta)
+        {
+            return;
+        }
+        const QString filePath = QFileDialog::getSaveFileName(this, tr("Exportar estadísticas de dibujado"),
+                                                              QStringLiteral("carta-frames.csv"),
+                                                              tr("CSV (*.csv)"));
+        if (filePath.isEmpty())
+        {
+            return;
+        }
+        if (m_carta->exportFrameStats(filePath))
+        {
+            showToast(tr("Estadísticas exportadas"), ToastNotification::Success);
+        }
+        else
+        {
+            showToast(tr("No se pudieron exportar las estadísticas"), ToastNotification::Warning);
+        } });
 }
 
 void MainWindow::onProblemButtonClicked()
@@ -383,6 +641,7 @@ void MainWindow::onLogoutButtonClicked()
     {
         // Limpiar usuario actual
         m_currentUserNickname.clear();
+        m_annotationPersistence->setUser(QString());
 
         // Restablecer icono del botón a default
         ui->user_button->setIcon(QIcon(QStringLiteral(":/assets/icons/avatar-default.svg")));
@@ -431,6 +690,7 @@ void MainWindow::onUserButtonClicked()
         connect(m_userManagement, &UserManagement::usuarioDesconectado, this, [this]()
                 {
             m_currentUserNickname.clear();
+            m_annotationPersistence->setUser(QString());
             // Restablecer icono del botón a default
             ui->user_button->setIcon(QIcon(QStringLiteral(":/assets/icons/avatar-default.svg")));
             // Hide logout button since user disconnected
@@ -443,6 +703,7 @@ void MainWindow::onUserButtonClicked()
                     if (m_currentUserNickname == anterior)
                     {
                         m_currentUserNickname = nuevo;
+                        m_annotationPersistence->renameUser(nuevo);
                     }
                     updateUserAvatar(nuevo);
                     showToast(tr("Nombre actualizado a %1").arg(nuevo), ToastNotification::Success);
@@ -473,6 +734,7 @@ void MainWindow::onUserButtonClicked()
     connect(m_loginWidget, &LoginWidget::sesionIniciada, this, [this](const QString &nickName)
             {
         m_currentUserNickname = nickName;
+        m_annotationPersistence->setUser(nickName);
         updateUserAvatar(nickName);
         showToast(tr("¡Bienvenido %1!").arg(nickName), ToastNotification::Success);
         m_loginWidget->close(); });
@@ -499,6 +761,7 @@ void MainWindow::onUserButtonClicked()
     connect(m_registerWidget, &RegisterWidget::cuentaCreada, this, [this](const QString &nickName)
             {
         m_currentUserNickname = nickName;
+        m_annotationPersistence->setUser(nickName);
         updateUserAvatar(nickName);
         showToast(tr("¡Bienvenido %1!").arg(nickName), ToastNotification::Success);
         m_registerWidget->close();
@@ -8,12 +8,14 @@
 #include <QPushButton>
 
 class MapOverlayPanel;
+class ChartCatalogPanel;
 class NavigationDAO;
 class LoginWidget;
 class RegisterWidget;
 class UserManagement;
 class ToastNotification;
 class ProblemWidget;
+class AnnotationPersistence;
 
 class Carta;
 class SelecPro;
@@ -41,14 +43,17 @@ private:
     Ui::MainWindow *ui;
     Carta *m_carta = nullptr;
     MapOverlayPanel *m_overlayPanel = nullptr;
+    ChartCatalogPanel *m_chartCatalog = nullptr;
     QString m_currentMapTitle;
     bool m_userFirstLaunch = true;
     NavigationDAO *m_dao = nullptr;
+    AnnotationPersistence *m_annotationPersistence = nullptr;
     LoginWidget *m_loginWidget = nullptr;
     RegisterWidget *m_registerWidget = nullptr;
     UserManagement *m_userManagement = nullptr;
     ToastNotification *m_toastNotification = nullptr;
     QString m_currentUserNickname;
+    bool m_exportInProgress = false;
     
     QList<ProblemWidget*> m_minimizedProblems;
     QList<QPushButton*> m_minimizedButtons;
@@ -59,11 +64,15 @@ private:
     void setupOverlayPanel();
     bool applyOverlayStyle();
     void updateMapTitle(const QString &title);
+    void setupChartCatalog();
     void promptForMapChange();
+    void browseForMapFile();
     bool loadMapResource(const QString &resourcePath, const QString &title);
     bool loadMapFromFile(const QString &filePath);
     void handleOverlayDrag(const QPoint &delta);
     void setupShortcuts();
+    void deleteAnnotations();
+    void exportChart();
     void updateUserAvatar(const QString &nickName);
     void showToast(const QString &message, int type = 0, int durationMs = 5000);
     void updateMinimizedButtonsPosition();
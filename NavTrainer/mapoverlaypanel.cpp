@@ -2,6 +2,7 @@
 
 #include <QApplication>
 #include <QButtonGroup>
+#include <QCheckBox>
 #include <QColorDialog>
 #include <QDrag>
 #include <QEvent>
@@ -262,7 +263,7 @@ void MapOverlayPanel::buildUi()
 
     m_actionGridWidget = new QWidget(m_toolPane);
     m_actionGridWidget->setObjectName(QStringLiteral("overlayActionGrid"));
-    m_actionGridWidget->setMaximumWidth(360);
+    m_actionGridWidget->setMaximumWidth(424);
     m_actionGridLayout = new QGridLayout(m_actionGridWidget);
     m_actionGridLayout->setContentsMargins(0, 0, 0, 0);
     m_actionGridLayout->setHorizontalSpacing(8);
@@ -313,6 +314,8 @@ void MapOverlayPanel::buildActionGrid()
                                         QIcon(QStringLiteral(":/assets/icons/grid.svg")), Mode::Grid);
     m_textModeButton = createModeButton(QStringLiteral("actionTextMode"), tr("Añadir texto (T)"),
                                         QIcon(QStringLiteral(":/assets/icons/text.svg")), Mode::Text);
+    m_selectModeButton = createModeButton(QStringLiteral("actionSelectMode"), tr("Seleccionar anotaciones (S)"),
+                                          QIcon(QStringLiteral(":/assets/icons/select.svg")), Mode::Select);
     m_undoButton = makeActionButton(QStringLiteral("actionUndo"),
                                     QIcon(QStringLiteral(":/assets/icons/undo.svg")), tr("Deshacer (Ctrl+Z)"));
     m_colorButton = makeActionButton(QStringLiteral("actionColor"),
@@ -356,6 +359,7 @@ void MapOverlayPanel::buildActionGrid()
     placeButton(m_textModeButton, 0, 3);
     placeButton(m_pointModeButton, 0, 4);
     placeButton(m_gridModeButton, 0, 4);
+    placeButton(m_selectModeButton, 0, 5);
 
     placeButton(m_undoButton, 1, 0);
     placeButton(m_colorButton, 1, 1);
@@ -394,6 +398,20 @@ void MapOverlayPanel::createSettingsMenu()
     layout->addWidget(opacityLabel);
     layout->addWidget(m_opacitySlider);
 
+    m_smoothingCheck = new QCheckBox(tr("Suavizar trazos"), container);
+    m_smoothingCheck->setToolTip(tr("Ajusta una curva suave a los trazos a mano alzada al terminarlos"));
+    layout->addWidget(m_smoothingCheck);
+
+    m_eraserSplitCheck = new QCheckBox(tr("Borrar solo la parte tocada"), container);
+    m_eraserSplitCheck->setToolTip(tr("La goma corta los trazos a mano alzada en lugar de borrarlos enteros"));
+    layout->addWidget(m_eraserSplitCheck);
+
+    m_geometrySnapCheck = new QCheckBox(tr("Ajustar a la geometría"), container);
+    m_geometrySnapCheck->setToolTip(tr("Las líneas, los puntos y la punta del compás se ajustan a extremos, puntos, "
+                                       "centros de arco y cruces cercanos (mantén Alt para desactivarlo)"));
+    m_geometrySnapCheck->setChecked(true);
+    layout->addWidget(m_geometrySnapCheck);
+
     auto *action = new QWidgetAction(m_settingsMenu);
     action->setDefaultWidget(container);
     m_settingsMenu->addAction(action);
@@ -413,6 +431,10 @@ void MapOverlayPanel::createSettingsMenu()
             return;
         }
         emit strokeOpacityChanged(value); });
+
+    connect(m_smoothingCheck, &QCheckBox::toggled, this, &MapOverlayPanel::strokeSmoothingToggled);
+    connect(m_eraserSplitCheck, &QCheckBox::toggled, this, &MapOverlayPanel::eraserSplitToggled);
+    connect(m_geometrySnapCheck, &QCheckBox::toggled, this, &MapOverlayPanel::geometrySnapToggled);
 }
 
 QToolButton *MapOverlayPanel::makeActionButton(const QString &objectName, const QIcon &icon,
@@ -529,6 +551,9 @@ void MapOverlayPanel::setActiveMode(Mode mode)
     case Mode::Grid:
         emit gridModeSelected();
         break;
+    case Mode::Select:
+        emit selectModeSelected();
+        break;
     case Mode::Line:
         // Line mode removed; no action
         break;
@@ -713,6 +738,8 @@ MapOverlayPanel::Mode MapOverlayPanel::idToMode(int id)
         return Mode::Point;
     case Mode::Grid:
         return Mode::Grid;
+    case Mode::Select:
+        return Mode::Select;
     case Mode::Drag:
     default:
         return Mode::Drag;
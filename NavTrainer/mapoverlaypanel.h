@@ -19,6 +19,7 @@ class QSpacerItem;
 class QButtonGroup;
 class QMenu;
 class QSlider;
+class QCheckBox;
 class ToolPaletteButton;
 
 class MapOverlayPanel : public QWidget
@@ -39,7 +40,8 @@ public:
         Text,
         Point,
         Line,
-        Grid
+        Grid,
+        Select
     };
 
     void setActiveMode(Mode mode);
@@ -58,12 +60,16 @@ signals:
     void textModeSelected();
     void pointModeSelected();
     void gridModeSelected();
+    void selectModeSelected();
     void undoRequested();
     void clearEditsRequested();
     void colorPicked(const QColor &color);
     void gridToggled(bool enabled);
     void strokeWidthChanged(int width);
     void strokeOpacityChanged(int percent);
+    void strokeSmoothingToggled(bool enabled);
+    void eraserSplitToggled(bool enabled);
+    void geometrySnapToggled(bool enabled);
     void toolRequested(const QString &toolId, const QString &resourcePath);
 
 protected:
@@ -96,6 +102,7 @@ private:
     QToolButton *m_textModeButton = nullptr;
     QToolButton *m_pointModeButton = nullptr;
     QToolButton *m_gridModeButton = nullptr;
+    QToolButton *m_selectModeButton = nullptr;
     QToolButton *m_undoButton = nullptr;
     QToolButton *m_colorButton = nullptr;
     QToolButton *m_clearButton = nullptr;
@@ -103,6 +110,9 @@ private:
     QMenu *m_settingsMenu = nullptr;
     QSlider *m_thicknessSlider = nullptr;
     QSlider *m_opacitySlider = nullptr;
+    QCheckBox *m_smoothingCheck = nullptr;
+    QCheckBox *m_eraserSplitCheck = nullptr;
+    QCheckBox *m_geometrySnapCheck = nullptr;
     bool m_updatingSettingsUi = false;
     QColor m_currentColor = QColor(255, 204, 51);
     Mode m_activeMode = Mode::Drag;
@@ -66,6 +66,7 @@ void NavigationDAO::createTablesIfNeeded()
     createUserTable();
     createSessionTable();
     createProblemTable();
+    createAnnotationTable();
 }
 
 void NavigationDAO::createUserTable()
@@ -127,6 +128,28 @@ void NavigationDAO::createProblemTable()
     }
 }
 
+void NavigationDAO::createAnnotationTable()
+{
+    // Una fila por anotación: guardar un cambio nunca reescribe el resto de la carta
+    const char *sql =
+        "CREATE TABLE IF NOT EXISTS chartAnnotation ("
+        "userNickName TEXT,"
+        "chartHash    TEXT,"
+        "seq          INTEGER,"
+        "record       BLOB NOT NULL,"
+        "PRIMARY KEY(userNickName, chartHash, seq),"
+        "FOREIGN KEY(userNickName)"
+        "  REFERENCES user(nickName)"
+        "  ON UPDATE CASCADE"
+        "  ON DELETE CASCADE"
+        ") WITHOUT ROWID;";
+
+    QSqlQuery q(m_db);
+    if (!q.exec(QString::fromUtf8(sql))) {
+        throwSqlError("createAnnotationTable", q.lastError());
+    }
+}
+
 QMap<QString, User> NavigationDAO::loadUsers()
 {
     QMap<QString, User> result;
@@ -337,6 +360,96 @@ void NavigationDAO::replaceAllProblems(const QVector<Problem> &problems)
     }
 }
 
+QVector<AnnotationRecord> NavigationDAO::loadAnnotations(const QString &nickName, const QString &chartHash)
+{
+    QVector<AnnotationRecord> res;
+
+    const char *sql =
+        "SELECT seq, record FROM chartAnnotation "
+        "WHERE userNickName=? AND chartHash=? ORDER BY seq;";
+
+    QSqlQuery q(m_db);
+    q.setForwardOnly(true);
+    if (!q.prepare(QString::fromUtf8(sql))) {
+        throwSqlError("loadAnnotations.prepare", q.lastError());
+    }
+    q.bindValue(0, nickName);
+    q.bindValue(1, chartHash);
+
+    if (!q.exec()) {
+        throwSqlError("loadAnnotations.exec", q.lastError());
+    }
+
+    while (q.next()) {
+        AnnotationRecord record;
+        record.seq  = q.value(0).toLongLong();
+        record.data = q.value(1).toByteArray();
+        res.push_back(record);
+    }
+    return res;
+}
+
+void NavigationDAO::storeAnnotations(const QString &nickName, const QString &chartHash,
+                                     const QVector<AnnotationRecord> &records, const QVector<qint64> &removedSeqs,
+                                     bool clearFirst)
+{
+    if (!clearFirst && records.isEmpty() && removedSeqs.isEmpty())
+        return;
+
+    if (!m_db.transaction()) {
+        throwSqlError("storeAnnotations.transaction", m_db.lastError());
+    }
+
+    try {
+        if (clearFirst) {
+            QSqlQuery clear(m_db);
+            clear.prepare(QStringLiteral("DELETE FROM chartAnnotation WHERE userNickName=? AND chartHash=?;"));
+            clear.bindValue(0, nickName);
+            clear.bindValue(1, chartHash);
+            if (!clear.exec()) {
+                throwSqlError("storeAnnotations.clear", clear.lastError());
+            }
+        }
+
+        QSqlQuery del(m_db);
+        if (!del.prepare(QStringLiteral(
+                "DELETE FROM chartAnnotation WHERE userNickName=? AND chartHash=? AND seq=?;"))) {
+            throwSqlError("storeAnnotations.prepareDelete", del.lastError());
+        }
+        for (qint64 seq : removedSeqs) {
+            del.bindValue(0, nickName);
+            del.bindValue(1, chartHash);
+            del.bindValue(2, seq);
+            if (!del.exec()) {
+                throwSqlError("storeAnnotations.delete", del.lastError());
+            }
+        }
+
+        QSqlQuery ins(m_db);
+        if (!ins.prepare(QStringLiteral(
+                "INSERT OR REPLACE INTO chartAnnotation(userNickName, chartHash, seq, record) "
+                "VALUES(?,?,?,?);"))) {
+            throwSqlError("storeAnnotations.prepareInsert", ins.lastError());
+        }
+        for (const AnnotationRecord &record : records) {
+            ins.bindValue(0, nickName);
+            ins.bindValue(1, chartHash);
+            ins.bindValue(2, record.seq);
+            ins.bindValue(3, record.data);
+            if (!ins.exec()) {
+                throwSqlError("storeAnnotations.insert", ins.lastError());
+            }
+        }
+    } catch (...) {
+        m_db.rollback();
+        throw;
+    }
+
+    if (!m_db.commit()) {
+        throwSqlError("storeAnnotations.commit", m_db.lastError());
+    }
+}
+
 User NavigationDAO::buildUserFromQuery(QSqlQuery &q)
 {
     const QString nick  = q.value(QStringLiteral("nickName")).toString();
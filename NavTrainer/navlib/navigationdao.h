@@ -10,6 +10,13 @@
 #include <QBuffer>
 #include <QMap>
 
+// One saved chart annotation; data is an opaque encoded record
+struct AnnotationRecord
+{
+    qint64     seq = 0;
+    QByteArray data;
+};
+
 class NavigationDAO
 {
 public:
@@ -29,6 +36,16 @@ public:
 
     void replaceAllProblems(const QVector<Problem> &problems);
 
+    // Annotations of one user on one chart, identified by the chart content hash
+    QVector<AnnotationRecord> loadAnnotations(const QString &nickName, const QString &chartHash);
+    // Inserts or replaces the given records and deletes the removed ones in a single transaction.
+    // With clearFirst every stored annotation of the user on the chart is deleted in that same transaction
+    void storeAnnotations(const QString &nickName, const QString &chartHash,
+                          const QVector<AnnotationRecord> &records, const QVector<qint64> &removedSeqs,
+                          bool clearFirst = false);
+
+    const QString &databasePath() const { return m_dbFilePath; }
+
 private:
     QString      m_dbFilePath;
     QString      m_connectionName;
@@ -41,6 +58,7 @@ private:
     void createUserTable();
     void createSessionTable();
     void createProblemTable();
+    void createAnnotationTable();
 
     User    buildUserFromQuery(QSqlQuery &q);
     Session buildSessionFromQuery(QSqlQuery &q);
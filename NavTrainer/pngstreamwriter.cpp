@@ -0,0 +1,240 @@
+#include "pngstreamwriter.h"
+
+#include <QCoreApplication>
+#include <QIODevice>
+#include <QtEndian>
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+
+// Qt builds for Windows ship their own zlib; elsewhere the system one is linked
+#if defined(Q_OS_WIN)
+#include <QtZlib/zlib.h>
+#else
+#include <zlib.h>
+#endif
+
+namespace
+{
+    // Compressed bytes collected before an IDAT chunk is written
+    constexpr qsizetype kChunkSize = 256 * 1024;
+    constexpr int kBytesPerPixel = 3;
+    constexpr uchar kPaethFilter = 4;
+
+    inline int paethPredictor(int left, int up, int upLeft)
+    {
+        const int estimate = left + up - upLeft;
+        const int toLeft = std::abs(estimate - left);
+        const int toUp = std::abs(estimate - up);
+        const int toUpLeft = std::abs(estimate - upLeft);
+        if (toLeft <= toUp && toLeft <= toUpLeft)
+        {
+            return left;
+        }
+        return toUp <= toUpLeft ? up : upLeft;
+    }
+}
+
+struct PngStreamWriter::Deflater
+{
+    z_stream stream = {};
+    bool initialized = false;
+
+    ~Deflater()
+    {
+        if (initialized)
+        {
+            deflateEnd(&stream);
+        }
+    }
+};
+
+PngStreamWriter::PngStreamWriter(QIODevice *device)
+    : m_device(device)
+{
+}
+
+PngStreamWriter::~PngStreamWriter() = default;
+
+bool PngStreamWriter::begin(const QSize &size, int dotsPerInch)
+{
+    if (m_started)
+    {
+        return fail(QCoreApplication::translate("PngStreamWriter", "La cabecera PNG ya estaba escrita"));
+    }
+    if (!m_device || !m_device->isWritable())
+    {
+        return fail(QCoreApplication::translate("PngStreamWriter", "No se puede escribir en la salida"));
+    }
+    if (size.isEmpty())
+    {
+        return fail(QCoreApplication::translate("PngStreamWriter", "La imagen está vacía"));
+    }
+
+    m_deflater = std::make_unique<Deflater>();
+    if (deflateInit(&m_deflater->stream, Z_DEFAULT_COMPRESSION) != Z_OK)
+    {
+        return fail(QCoreApplication::translate("PngStreamWriter", "No se pudo iniciar el compresor"));
+    }
+    m_deflater->initialized = true;
+
+    static const char signature[] = {'\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n'};
+    if (m_device->write(signature, sizeof(signature)) != qint64(sizeof(signature)))
+    {
+        return fail(m_device->errorString());
+    }
+
+    QByteArray header(13, '\0');
+    qToBigEndian<quint32>(size.width(), header.data());
+    qToBigEndian<quint32>(size.height(), header.data() + 4);
+    header[8] = 8;  // bits per sample
+    header[9] = 2;  // truecolor
+    header[10] = 0; // deflate
+    header[11] = 0; // adaptive filtering
+    header[12] = 0; // no interlace
+    if (!writeChunk("IHDR", header))
+    {
+        return false;
+    }
+
+    if (dotsPerInch > 0)
+    {
+        QByteArray physical(9, '\0');
+        const quint32 dotsPerMeter = static_cast<quint32>(qRound(dotsPerInch / 0.0254));
+        qToBigEndian<quint32>(dotsPerMeter, physical.data());
+        qToBigEndian<quint32>(dotsPerMeter, physical.data() + 4);
+        physical[8] = 1; // unit is the meter
+        if (!writeChunk("pHYs", physical))
+        {
+            return false;
+        }
+    }
+
+    const qsizetype rowBytes = static_cast<qsizetype>(size.width()) * kBytesPerPixel;
+    m_size = size;
+    m_rowsWritten = 0;
+    m_previousRow = QByteArray(rowBytes, '\0');
+    m_filteredRow = QByteArray(rowBytes + 1, '\0');
+    m_started = true;
+    return true;
+}
+
+bool PngStreamWriter::writeRows(const QImage &band)
+{
+    if (!m_started || m_finished)
+    {
+        return fail(QCoreApplication::translate("PngStreamWriter", "Filas escritas fuera de begin() y finish()"));
+    }
+    if (band.width() != m_size.width())
+    {
+        return fail(QCoreApplication::translate("PngStreamWriter", "La franja mide %1 píxeles de ancho y la imagen %2").arg(band.width()).arg(m_size.width()));
+    }
+
+    const QImage rgb = band.format() == QImage::Format_RGB888 ? band : band.convertToFormat(QImage::Format_RGB888);
+    const int rows = std::min(rgb.height(), m_size.height() - m_rowsWritten);
+    const qsizetype rowBytes = m_previousRow.size();
+    for (int y = 0; y < rows; ++y)
+    {
+        const uchar *row = rgb.constScanLine(y);
+        const auto *up = reinterpret_cast<const uchar *>(m_previousRow.constData());
+        auto *filtered = reinterpret_cast<uchar *>(m_filteredRow.data());
+        filtered[0] = kPaethFilter;
+        for (qsizetype i = 0; i < rowBytes; ++i)
+        {
+            const int left = i >= kBytesPerPixel ? row[i - kBytesPerPixel] : 0;
+            const int upLeft = i >= kBytesPerPixel ? up[i - kBytesPerPixel] : 0;
+            filtered[i + 1] = static_cast<uchar>(row[i] - paethPredictor(left, up[i], upLeft));
+        }
+        std::memcpy(m_previousRow.data(), row, static_cast<size_t>(rowBytes));
+
+        if (!compress(filtered, m_filteredRow.size(), false))
+        {
+            return false;
+        }
+        ++m_rowsWritten;
+    }
+    return true;
+}
+
+bool PngStreamWriter::finish()
+{
+    if (!m_started || m_finished)
+    {
+        return fail(QCoreApplication::translate("PngStreamWriter", "finish() sin el begin() correspondiente"));
+    }
+    if (m_rowsWritten < m_size.height())
+    {
+        return fail(QCoreApplication::translate("PngStreamWriter", "Solo se escribieron %1 de %2 filas").arg(m_rowsWritten).arg(m_size.height()));
+    }
+
+    if (!compress(nullptr, 0, true))
+    {
+        return false;
+    }
+    if (!m_pending.isEmpty() && !writeChunk("IDAT", m_pending))
+    {
+        return false;
+    }
+    m_pending.clear();
+    if (!writeChunk("IEND", QByteArray()))
+    {
+        return false;
+    }
+    m_finished = true;
+    return true;
+}
+
+bool PngStreamWriter::writeChunk(const char *type, const QByteArray &data)
+{
+    char length[4];
+    qToBigEndian<quint32>(static_cast<quint32>(data.size()), length);
+    uLong crc = crc32(0L, reinterpret_cast<const Bytef *>(type), 4);
+    crc = crc32(crc, reinterpret_cast<const Bytef *>(data.constData()), static_cast<uInt>(data.size()));
+    char checksum[4];
+    qToBigEndian<quint32>(static_cast<quint32>(crc), checksum);
+
+    if (m_device->write(length, 4) != 4 || m_device->write(type, 4) != 4
+        || m_device->write(data) != data.size() || m_device->write(checksum, 4) != 4)
+    {
+        return fail(m_device->errorString());
+    }
+    return true;
+}
+
+bool PngStreamWriter::compress(const uchar *data, qsizetype size, bool finish)
+{
+    z_stream &stream = m_deflater->stream;
+    stream.next_in = const_cast<Bytef *>(data);
+    stream.avail_in = static_cast<uInt>(size);
+
+    std::array<Bytef, 64 * 1024> buffer;
+    int status = Z_OK;
+    do
+    {
+        stream.next_out = buffer.data();
+        stream.avail_out = static_cast<uInt>(buffer.size());
+        status = ::deflate(&stream, finish ? Z_FINISH : Z_NO_FLUSH);
+        if (status == Z_STREAM_ERROR)
+        {
+            return fail(QCoreApplication::translate("PngStreamWriter", "Ha fallado el compresor"));
+        }
+
+        m_pending.append(reinterpret_cast<const char *>(buffer.data()), static_cast<qsizetype>(buffer.size() - stream.avail_out));
+        if (m_pending.size() >= kChunkSize)
+        {
+            if (!writeChunk("IDAT", m_pending))
+            {
+                return false;
+            }
+            m_pending.clear();
+        }
+    } while (finish ? status != Z_STREAM_END : stream.avail_out == 0);
+    return true;
+}
+
+bool PngStreamWriter::fail(const QString &message)
+{
+    m_error = message;
+    return false;
+}
@@ -0,0 +1,54 @@
+#ifndef PNGSTREAMWRITER_H
+#define PNGSTREAMWRITER_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QSize>
+#include <QString>
+
+#include <memory>
+
+class QIODevice;
+
+// PNG encoder fed with horizontal bands of the image, top to bottom, so an
+// image of any height is written without ever holding it whole. Rows are
+// Paeth-filtered and deflated into one running zlib stream that is cut into
+// IDAT chunks as the compressed bytes come out. Output is 8-bit RGB.
+class PngStreamWriter
+{
+public:
+    explicit PngStreamWriter(QIODevice *device);
+    ~PngStreamWriter();
+    PngStreamWriter(const PngStreamWriter &) = delete;
+    PngStreamWriter &operator=(const PngStreamWriter &) = delete;
+
+    // Writes the signature and header; dotsPerInch goes into the pHYs chunk when positive
+    bool begin(const QSize &size, int dotsPerInch = 0);
+    // The band must be exactly as wide as the image; rows past the image height are ignored
+    bool writeRows(const QImage &band);
+    // Flushes the compressor and closes the file; fails when fewer rows than the height were written
+    bool finish();
+
+    int rowsWritten() const { return m_rowsWritten; }
+    QString errorString() const { return m_error; }
+
+private:
+    struct Deflater;
+
+    bool writeChunk(const char *type, const QByteArray &data);
+    bool compress(const uchar *data, qsizetype size, bool finish);
+    bool fail(const QString &message);
+
+    QIODevice *m_device = nullptr;
+    std::unique_ptr<Deflater> m_deflater;
+    QSize m_size;
+    int m_rowsWritten = 0;
+    QByteArray m_previousRow; // unfiltered, for the Paeth predictor
+    QByteArray m_filteredRow; // filter type byte followed by the filtered row
+    QByteArray m_pending;     // compressed bytes not yet written as an IDAT chunk
+    QString m_error;
+    bool m_started = false;
+    bool m_finished = false;
+};
+
+#endif // PNGSTREAMWRITER_H
@@ -0,0 +1,195 @@
+#include "strokeprocessing.h"
+
+#include <QLineF>
+#include <QList>
+#include <QPair>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    // Knot spacing of the centripetal parameterisation (alpha = 0.5)
+    qreal knotDistance(const QPointF &a, const QPointF &b)
+    {
+        return std::sqrt(QLineF(a, b).length());
+    }
+}
+
+bool StrokeProcessing::acceptsSample(const QPointF &last, const QPointF &candidate, qreal minDistance)
+{
+    const QPointF offset = candidate - last;
+    return QPointF::dotProduct(offset, offset) >= minDistance * minDistance;
+}
+
+qreal StrokeProcessing::squaredDistanceToSegment(const QPointF &point, const QPointF &start, const QPointF &end)
+{
+    const QPointF segment = end - start;
+    const qreal lengthSquared = QPointF::dotProduct(segment, segment);
+    if (qFuzzyIsNull(lengthSquared))
+    {
+        const QPointF offset = point - start;
+        return QPointF::dotProduct(offset, offset);
+    }
+
+    const qreal t = std::clamp(QPointF::dotProduct(point - start, segment) / lengthSquared, 0.0, 1.0);
+    const QPointF offset = point - (start + segment * t);
+    return QPointF::dotProduct(offset, offset);
+}
+
+qreal StrokeProcessing::squaredDistanceBetweenSegments(const QPointF &start1, const QPointF &end1,
+                                                      const QPointF &start2, const QPointF &end2)
+{
+    const auto cross = [](const QPointF &a, const QPointF &b, const QPointF &c)
+    {
+        return (b.x() - a.x()) * (c.y() - a.y()) - (b.y() - a.y()) * (c.x() - a.x());
+    };
+
+    // Proper crossing: each segment has the ends of the other on opposite sides
+    const qreal d1 = cross(start1, end1, start2);
+    const qreal d2 = cross(start1, end1, end2);
+    const qreal d3 = cross(start2, end2, start1);
+    const qreal d4 = cross(start2, end2, end1);
+    if (((d1 > 0.0 && d2 < 0.0) || (d1 < 0.0 && d2 > 0.0)) && ((d3 > 0.0 && d4 < 0.0) || (d3 < 0.0 && d4 > 0.0)))
+    {
+        return 0.0;
+    }
+
+    // Otherwise the closest pair always involves an endpoint
+    return std::min({squaredDistanceToSegment(start1, start2, end2),
+                     squaredDistanceToSegment(end1, start2, end2),
+                     squaredDistanceToSegment(start2, start1, end1),
+                     squaredDistanceToSegment(end2, start1, end1)});
+}
+
+QPolygonF StrokeProcessing::simplify(const QPolygonF &points, qreal tolerance)
+{
+    if (points.size() < 3 || tolerance <= 0.0)
+    {
+        return points;
+    }
+
+    const QList<int> kept = simplifiedIndices(points, tolerance);
+    QPolygonF simplified;
+    simplified.reserve(kept.size());
+    for (int index : kept)
+    {
+        simplified.append(points.at(index));
+    }
+    return simplified;
+}
+
+QList<int> StrokeProcessing::simplifiedIndices(const QPolygonF &points, qreal tolerance)
+{
+    QList<int> kept;
+    if (points.size() < 3 || tolerance <= 0.0)
+    {
+        kept.reserve(points.size());
+        for (int i = 0; i < points.size(); ++i)
+        {
+            kept.append(i);
+        }
+        return kept;
+    }
+
+    // Iterative with an explicit stack so very long strokes cannot overflow the call stack
+    const qreal toleranceSquared = tolerance * tolerance;
+    QList<bool> keep(points.size(), false);
+    keep.first() = true;
+    keep.last() = true;
+
+    QList<QPair<int, int>> pending;
+    pending.append({0, static_cast<int>(points.size()) - 1});
+    while (!pending.isEmpty())
+    {
+        const auto [first, last] = pending.takeLast();
+        qreal farthest = 0.0;
+        int farthestIndex = -1;
+        for (int i = first + 1; i < last; ++i)
+        {
+            const qreal distance = squaredDistanceToSegment(points.at(i), points.at(first), points.at(last));
+            if (distance > farthest)
+            {
+                farthest = distance;
+                farthestIndex = i;
+            }
+        }
+
+        if (farthestIndex >= 0 && farthest > toleranceSquared)
+        {
+            keep[farthestIndex] = true;
+            pending.append({first, farthestIndex});
+            pending.append({farthestIndex, last});
+        }
+    }
+
+    for (int i = 0; i < points.size(); ++i)
+    {
+        if (keep.at(i))
+        {
+            kept.append(i);
+        }
+    }
+    return kept;
+}
+
+QPainterPath StrokeProcessing::polylinePath(const QPolygonF &points)
+{
+    if (points.isEmpty())
+    {
+        return QPainterPath();
+    }
+
+    QPainterPath path(points.constFirst());
+    if (points.size() == 1)
+    {
+        // A click without movement still leaves a dot
+        path.lineTo(points.constFirst());
+        return path;
+    }
+    for (int i = 1; i < points.size(); ++i)
+    {
+        path.lineTo(points.at(i));
+    }
+    return path;
+}
+
+QPainterPath StrokeProcessing::smoothPath(const QPolygonF &points)
+{
+    if (points.size() < 3)
+    {
+        return polylinePath(points);
+    }
+
+    QPainterPath path(points.constFirst());
+    const int count = points.size();
+    for (int i = 0; i + 1 < count; ++i)
+    {
+        // The end segments reuse their endpoint as the missing neighbour
+        const QPointF &p0 = points.at(std::max(0, i - 1));
+        const QPointF &p1 = points.at(i);
+        const QPointF &p2 = points.at(i + 1);
+        const QPointF &p3 = points.at(std::min(count - 1, i + 2));
+
+        const qreal d1 = knotDistance(p0, p1);
+        const qreal d2 = knotDistance(p1, p2);
+        const qreal d3 = knotDistance(p2, p3);
+        if (qFuzzyIsNull(d2))
+        {
+            continue;
+        }
+
+        // Catmull-Rom to Bezier conversion for non-uniform knots (Yuksel et al.)
+        QPointF control1 = p1;
+        if (!qFuzzyIsNull(d1))
+        {
+            control1 = (p2 * (d1 * d1) - p0 * (d2 * d2) + p1 * (2 * d1 * d1 + 3 * d1 * d2 + d2 * d2)) / (3 * d1 * (d1 + d2));
+        }
+        QPointF control2 = p2;
+        if (!qFuzzyIsNull(d3))
+        {
+            control2 = (p1 * (d3 * d3) - p3 * (d2 * d2) + p2 * (2 * d3 * d3 + 3 * d3 * d2 + d2 * d2)) / (3 * d3 * (d3 + d2));
+        }
+        path.cubicTo(control1, control2, p2);
+    }
+    return path;
+}
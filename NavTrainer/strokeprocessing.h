@@ -0,0 +1,35 @@
+#ifndef STROKEPROCESSING_H
+#define STROKEPROCESSING_H
+
+#include <QList>
+#include <QPainterPath>
+#include <QPointF>
+#include <QPolygonF>
+
+// Geometry helpers that turn raw freehand mouse samples into the path that
+// is actually stored. All functions are pure, so curve fitting can run on a
+// worker thread.
+class StrokeProcessing
+{
+public:
+    // True when the candidate is far enough from the last kept sample to be worth storing
+    static bool acceptsSample(const QPointF &last, const QPointF &candidate, qreal minDistance);
+
+    // Ramer-Douglas-Peucker: drops vertices closer than tolerance to the simplified polyline.
+    // Endpoints are always kept.
+    static QPolygonF simplify(const QPolygonF &points, qreal tolerance);
+    // Same, as the ascending indices of the kept vertices
+    static QList<int> simplifiedIndices(const QPolygonF &points, qreal tolerance);
+
+    static QPainterPath polylinePath(const QPolygonF &points);
+
+    static qreal squaredDistanceToSegment(const QPointF &point, const QPointF &start, const QPointF &end);
+    // Zero when the segments cross
+    static qreal squaredDistanceBetweenSegments(const QPointF &start1, const QPointF &end1,
+                                                const QPointF &start2, const QPointF &end2);
+
+    // Centripetal Catmull-Rom spline through every vertex, emitted as cubic Beziers
+    static QPainterPath smoothPath(const QPolygonF &points);
+};
+
+#endif // STROKEPROCESSING_H
@@ -0,0 +1,160 @@
+#include "toolrendercache.h"
+
+#include <QPaintDevice>
+#include <QPaintEngine>
+#include <QPainter>
+#include <QTransform>
+#include <QtMath>
+#include <QtSvg/qsvgrenderer.h>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    // Scales closer than this share a raster; tools only change scale with the device pixel ratio
+    constexpr qreal kScaleQuantum = 1.0 / 4096.0;
+
+    // True for transforms made of translation, uniform scale and rotation only
+    bool isSimilarity(const QTransform &transform, qreal scale)
+    {
+        if (transform.type() > QTransform::TxRotate)
+        {
+            return false;
+        }
+        const qreal tolerance = scale * 1e-6;
+        return std::abs(transform.m11() - transform.m22()) <= tolerance
+               && std::abs(transform.m12() + transform.m21()) <= tolerance;
+    }
+}
+
+ToolRenderCache &ToolRenderCache::instance()
+{
+    static ToolRenderCache cache;
+    return cache;
+}
+
+ToolRenderCache::ToolRenderCache()
+{
+    setRasterBudget(kDefaultRasterBudget);
+}
+
+QSvgRenderer *ToolRenderCache::renderer(const QString &resourcePath)
+{
+    if (resourcePath.isEmpty())
+    {
+        return nullptr;
+    }
+
+    std::shared_ptr<QSvgRenderer> &shared = m_renderers[resourcePath];
+    if (!shared)
+    {
+        // Kept even when invalid, so a broken resource is not parsed again on every attempt
+        shared = std::make_shared<QSvgRenderer>(resourcePath);
+    }
+    return shared.get();
+}
+
+void ToolRenderCache::setRasterBudget(qint64 bytes)
+{
+    m_rasters.setMaxCost(static_cast<qsizetype>(std::max<qint64>(1, bytes / 1024)));
+}
+
+void ToolRenderCache::paint(QPainter *painter, const QString &resourcePath, const QRectF &bounds)
+{
+    QSvgRenderer *svg = renderer(resourcePath);
+    if (!painter || !svg || !svg->isValid() || bounds.isEmpty())
+    {
+        return;
+    }
+
+    // Only raster targets gain from a cached pixmap; pictures and PDF keep the vectors
+    const QPaintEngine *engine = painter->paintEngine();
+    const QTransform world = painter->worldTransform();
+    const qreal scale = std::hypot(world.m11(), world.m12());
+    if (!engine || engine->type() != QPaintEngine::Raster || scale <= 0.0 || !isSimilarity(world, scale))
+    {
+        svg->render(painter, bounds);
+        return;
+    }
+
+    const qreal angle = qRadiansToDegrees(std::atan2(world.m12(), world.m11()));
+    const int rotationSteps = qRound(angle / kRotationStep);
+    const qreal residual = angle - rotationSteps * kRotationStep;
+    const qreal devicePixelRatio = painter->device() ? painter->device()->devicePixelRatioF() : 1.0;
+
+    Raster *cached = raster(svg, resourcePath, bounds, scale, rotationSteps, devicePixelRatio);
+    if (!cached)
+    {
+        svg->render(painter, bounds);
+        return;
+    }
+
+    painter->save();
+    QTransform placement = QTransform::fromTranslate(world.dx(), world.dy());
+    if (!qFuzzyIsNull(residual))
+    {
+        placement.rotate(residual);
+        painter->setRenderHint(QPainter::SmoothPixmapTransform, true);
+    }
+    painter->setWorldTransform(placement);
+    painter->drawPixmap(cached->origin, cached->pixmap);
+    painter->restore();
+}
+
+ToolRenderCache::Raster *ToolRenderCache::raster(QSvgRenderer *svg, const QString &resourcePath, const QRectF &bounds,
+                                                 qreal scale, int rotationSteps, qreal devicePixelRatio)
+{
+    const qint64 scaleKey = qRound64(scale / kScaleQuantum);
+    const QString key = QStringLiteral("%1|%2|%3|%4|%5,%6,%7,%8")
+                            .arg(resourcePath)
+                            .arg(scaleKey)
+                            .arg(rotationSteps)
+                            .arg(qRound(devicePixelRatio * 100.0))
+                            .arg(bounds.x())
+                            .arg(bounds.y())
+                            .arg(bounds.width())
+                            .arg(bounds.height());
+    if (Raster *cached = m_rasters.object(key))
+    {
+        ++m_rasterHits;
+        return cached;
+    }
+    ++m_rasterMisses;
+
+    const qreal quantizedScale = scaleKey * kScaleQuantum;
+    QTransform layout;
+    layout.rotate(rotationSteps * kRotationStep);
+    layout.scale(quantizedScale, quantizedScale);
+    const QRectF mapped = layout.mapRect(bounds);
+
+    // One device pixel of padding keeps antialiased edges inside the pixmap
+    const QPointF origin(std::floor(mapped.left() * devicePixelRatio - 1.0) / devicePixelRatio,
+                         std::floor(mapped.top() * devicePixelRatio - 1.0) / devicePixelRatio);
+    const QSize pixelSize(static_cast<int>(std::ceil((mapped.right() - origin.x()) * devicePixelRatio)) + 1,
+                          static_cast<int>(std::ceil((mapped.bottom() - origin.y()) * devicePixelRatio)) + 1);
+    if (pixelSize.isEmpty() || pixelSize.width() > kMaxRasterSide || pixelSize.height() > kMaxRasterSide)
+    {
+        return nullptr;
+    }
+    const qint64 cost = std::max<qint64>(1, static_cast<qint64>(pixelSize.width()) * pixelSize.height() * 4 / 1024);
+    if (cost > m_rasters.maxCost())
+    {
+        return nullptr;
+    }
+
+    auto *entry = new Raster;
+    entry->origin = origin;
+    entry->pixmap = QPixmap(pixelSize);
+    entry->pixmap.setDevicePixelRatio(devicePixelRatio);
+    entry->pixmap.fill(Qt::transparent);
+    {
+        QPainter rasterPainter(&entry->pixmap);
+        rasterPainter.setRenderHints(QPainter::Antialiasing | QPainter::SmoothPixmapTransform);
+        rasterPainter.translate(-origin);
+        rasterPainter.setTransform(layout, true);
+        svg->render(&rasterPainter, bounds);
+    }
+
+    m_rasters.insert(key, entry, static_cast<qsizetype>(cost));
+    return entry;
+}
@@ -0,0 +1,68 @@
+#ifndef TOOLRENDERCACHE_H
+#define TOOLRENDERCACHE_H
+
+#include <QCache>
+#include <QHash>
+#include <QPixmap>
+#include <QPointF>
+#include <QRectF>
+#include <QString>
+
+#include <memory>
+
+class QPainter;
+class QSvgRenderer;
+
+// Process-wide cache for the SVG drawing tools (ruler, protractor, compass).
+//
+// Each SVG resource is parsed once into a QSvgRenderer that every tool item
+// built from it shares, so a second instance of a tool costs no parse.
+// Painting goes through a raster cache keyed by resource, device scale and
+// rotation rounded to kRotationStep: the vector document is only rendered
+// when the tool is shown at a new size or angle, while dragging and
+// re-painting blit a pixmap. The remaining fraction of a step is applied
+// when the pixmap is drawn. Painters that record vectors (pictures, PDF) or
+// carry shear are always served straight from the renderer.
+//
+// Like the items that use it, the cache lives on the GUI thread.
+class ToolRenderCache
+{
+public:
+    static constexpr qreal kRotationStep = 1.0; // degrees
+    static constexpr qint64 kDefaultRasterBudget = 48ll * 1024 * 1024;
+    static constexpr int kMaxRasterSide = 4096; // device pixels
+
+    static ToolRenderCache &instance();
+
+    ToolRenderCache(const ToolRenderCache &) = delete;
+    ToolRenderCache &operator=(const ToolRenderCache &) = delete;
+
+    // Shared parsed document for resourcePath; owned by the cache, null only if the path is empty
+    QSvgRenderer *renderer(const QString &resourcePath);
+    // Draws the document of resourcePath into bounds (item coordinates) with the painter's transform
+    void paint(QPainter *painter, const QString &resourcePath, const QRectF &bounds);
+
+    void setRasterBudget(qint64 bytes);
+    quint64 rasterHits() const { return m_rasterHits; }
+    quint64 rasterMisses() const { return m_rasterMisses; }
+
+private:
+    struct Raster
+    {
+        QPixmap pixmap;
+        QPointF origin; // position of the pixmap's top-left corner, relative to the item origin, in logical pixels
+    };
+
+    ToolRenderCache();
+
+    // Null when the raster would not fit in the budget or exceeds kMaxRasterSide
+    Raster *raster(QSvgRenderer *svg, const QString &resourcePath, const QRectF &bounds, qreal scale,
+                   int rotationSteps, qreal devicePixelRatio);
+
+    QHash<QString, std::shared_ptr<QSvgRenderer>> m_renderers;
+    QCache<QString, Raster> m_rasters; // cost in KiB
+    quint64 m_rasterHits = 0;
+    quint64 m_rasterMisses = 0;
+};
+
+#endif // TOOLRENDERCACHE_H
@@ -0,0 +1,119 @@
+#include "toolspatialindex.h"
+
+#include <QGraphicsItem>
+#include <QRectF>
+#include <algorithm>
+#include <cmath>
+
+quint64 ToolSpatialIndex::cellKey(int column, int row)
+{
+    return (static_cast<quint64>(static_cast<quint32>(column)) << 32) | static_cast<quint32>(row);
+}
+
+void ToolSpatialIndex::update(QGraphicsItem *item)
+{
+    if (!item)
+    {
+        return;
+    }
+
+    Entry entry;
+    auto existing = m_entries.constFind(item);
+    if (existing != m_entries.constEnd())
+    {
+        entry.stackOrder = existing->stackOrder;
+        unfile(item, *existing);
+    }
+    else
+    {
+        entry.stackOrder = m_nextStackOrder++;
+    }
+
+    entry.outline = item->sceneTransform().map(item->boundingRect());
+    const QRectF bounds = entry.outline.boundingRect();
+    const int firstColumn = static_cast<int>(std::floor(bounds.left() / kCellSize));
+    const int lastColumn = static_cast<int>(std::floor(bounds.right() / kCellSize));
+    const int firstRow = static_cast<int>(std::floor(bounds.top() / kCellSize));
+    const int lastRow = static_cast<int>(std::floor(bounds.bottom() / kCellSize));
+    // An axis-aligned outline covers every cell of its bounds; a rotated one only some
+    const bool rotated = item->sceneTransform().type() > QTransform::TxScale;
+    for (int row = firstRow; row <= lastRow; ++row)
+    {
+        for (int column = firstColumn; column <= lastColumn; ++column)
+        {
+            if (rotated)
+            {
+                const QRectF cell(column * kCellSize, row * kCellSize, kCellSize, kCellSize);
+                if (!entry.outline.intersects(QPolygonF(cell)))
+                {
+                    continue;
+                }
+            }
+            const quint64 key = cellKey(column, row);
+            m_cells[key].append(item);
+            entry.cells.append(key);
+        }
+    }
+    m_entries.insert(item, entry);
+}
+
+void ToolSpatialIndex::remove(QGraphicsItem *item)
+{
+    auto it = m_entries.find(item);
+    if (it == m_entries.end())
+    {
+        return;
+    }
+    unfile(item, *it);
+    m_entries.erase(it);
+}
+
+void ToolSpatialIndex::clear()
+{
+    m_cells.clear();
+    m_entries.clear();
+}
+
+QList<QGraphicsItem *> ToolSpatialIndex::candidatesAt(const QPointF &scenePos) const
+{
+    const auto cell = m_cells.constFind(cellKey(static_cast<int>(std::floor(scenePos.x() / kCellSize)),
+                                                static_cast<int>(std::floor(scenePos.y() / kCellSize))));
+    if (cell == m_cells.constEnd())
+    {
+        return {};
+    }
+
+    QList<QGraphicsItem *> hits;
+    for (QGraphicsItem *item : *cell)
+    {
+        if (m_entries.value(item).outline.containsPoint(scenePos, Qt::OddEvenFill))
+        {
+            hits.append(item);
+        }
+    }
+    std::sort(hits.begin(), hits.end(), [this](QGraphicsItem *a, QGraphicsItem *b)
+              {
+        if (a->zValue() != b->zValue())
+        {
+            return a->zValue() > b->zValue();
+        }
+        return m_entries.value(a).stackOrder > m_entries.value(b).stackOrder; });
+    return hits;
+}
+
+void ToolSpatialIndex::unfile(QGraphicsItem *item, const Entry &entry)
+{
+    for (quint64 key : entry.cells)
+    {
+        auto cell = m_cells.find(key);
+        if (cell == m_cells.end())
+        {
+            continue;
+        }
+        cell->removeOne(item);
+        if (cell->isEmpty())
+        {
+            m_cells.erase(cell);
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef TOOLSPATIALINDEX_H
+#define TOOLSPATIALINDEX_H
+
+#include <QHash>
+#include <QList>
+#include <QPointF>
+#include <QPolygonF>
+
+class QGraphicsItem;
+
+// Uniform-grid index of the plotting tools placed on the chart, in tool scene
+// (viewport) coordinates. Each tool is filed under the cells its rotated
+// outline covers, so a long ruler lying diagonally does not claim its whole
+// bounding box. Lookups return the few tools whose outline contains the point,
+// topmost first; Carta then runs the exact shape test on those alone.
+//
+// Tools move all the time, so entries are refreshed by the owner through
+// update() whenever a tool's position, rotation or scale changes.
+class ToolSpatialIndex
+{
+public:
+    static constexpr qreal kCellSize = 128.0;
+
+    // Inserts the tool or refreshes its cells; later insertions stack above earlier ones
+    void update(QGraphicsItem *item);
+    void remove(QGraphicsItem *item);
+    void clear();
+
+    bool contains(QGraphicsItem *item) const { return m_entries.contains(item); }
+    int size() const { return m_entries.size(); }
+
+    // Tools whose outline contains scenePos, topmost first
+    QList<QGraphicsItem *> candidatesAt(const QPointF &scenePos) const;
+
+private:
+    struct Entry
+    {
+        QPolygonF outline; // bounding rect mapped to the scene
+        QList<quint64> cells;
+        quint64 stackOrder = 0;
+    };
+
+    static quint64 cellKey(int column, int row);
+    void unfile(QGraphicsItem *item, const Entry &entry);
+
+    QHash<quint64, QList<QGraphicsItem *>> m_cells;
+    QHash<QGraphicsItem *, Entry> m_entries;
+    quint64 m_nextStackOrder = 0;
+};
+
+#endif // TOOLSPATIALINDEX_H